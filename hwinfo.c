@@ -5,8 +5,13 @@
 #include <fcntl.h>
 #include <getopt.h>
 #include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 #include "hd.h"
 #include "hd_int.h"
@@ -26,6 +31,17 @@ typedef struct {
   unsigned assigned:1;
 } map_t;
 
+/* daemon: clients whose query is still being read */
+#define DAEMON_CLIENTS		16
+#define DAEMON_TIMEOUT		2
+
+typedef struct {
+  int fd;
+  time_t start;
+  size_t len;
+  char buf[0x4000];
+} daemon_client_t;
+
 static int get_probe_flags(int, char **, hd_data_t *);
 static void progress2(char *, char *);
 
@@ -48,6 +64,11 @@ static char *saveconfig = NULL;
 static hd_hw_item_t hw_item[100] = { };
 static int hw_items = 0;
 
+static char *daemon_socket = NULL;
+static char *server_socket = NULL;
+static str_list_t *queries = NULL;
+static volatile sig_atomic_t daemon_exit = 0;
+
 int braille_install_info(hd_data_t *hd_data);
 int x11_install_info(hd_data_t *hd_data);
 int oem_install_info(hd_data_t *hd_data);
@@ -64,6 +85,17 @@ void do_chroot(hd_data_t *hd_data, char *dir);
 void ask_db(hd_data_t *hd_data, char *query);
 // void get_mapping(hd_data_t *hd_data);
 int get_mapping2(void);
+hd_t *diff_list(hd_data_t *hd_data, char *dir);
+int do_diff(char *dir_old, char *dir_new);
+int do_daemon(hd_data_t *hd_data, char *name);
+void daemon_stop(int sig);
+void daemon_rescan(hd_data_t *hd_data, unsigned char *dirty);
+int daemon_read(daemon_client_t *client);
+void daemon_request(hd_data_t *hd_data, daemon_client_t *client);
+int do_client(char *name, str_list_t *query, int short_fmt);
+void do_query(hd_data_t *hd_data, FILE *f, str_list_t *query, int short_fmt);
+int query_match(hd_t *hd, char *query);
+hd_hw_item_t query_item(char *name);
 void write_udi(hd_data_t *hd_data, char *udi);
 
 void do_saveconfig(hd_data_t *hd_data, hd_t *hd, FILE *f);
@@ -107,6 +139,10 @@ struct option options[] = {
   { "nowpa", 0, NULL, 317 },
   { "map2", 0, NULL, 318 },
   { "hddb-dir-new", 1, NULL, 319 },
+  { "diff", 1, NULL, 320 },
+  { "daemon", 1, NULL, 321 },
+  { "socket", 1, NULL, 322 },
+  { "query", 1, NULL, 323 },
   { "cdrom", 0, NULL, 1000 + hw_cdrom },
   { "floppy", 0, NULL, 1000 + hw_floppy },
   { "disk", 0, NULL, 1000 + hw_disk },
@@ -253,6 +289,8 @@ int main(int argc, char **argv)
 
         case 304:
           is_short = 1;
+          /* the short listing needs no block0, media or link info */
+          hd_data->flags.lazy = 1;
           break;
 
         case 305:
@@ -317,6 +355,44 @@ int main(int argc, char **argv)
           if(*optarg) setenv("LIBHD_HDDB_DIR_NEW", optarg, 1);
           break;
 
+        case 320:
+          if(optind >= argc) {
+            help();
+            return 2;
+          }
+          return do_diff(optarg, argv[optind]);
+          break;
+
+        case 321:
+          daemon_socket = optarg;
+          break;
+
+        case 322:
+          server_socket = optarg;
+          break;
+
+        case 323:
+          {
+            char *s = NULL, *t;
+
+            if(
+              !(t = strchr(optarg, '=')) ||
+              (
+                strncmp(optarg, "item=", 5) &&
+                strncmp(optarg, "bus=", 4) &&
+                strncmp(optarg, "id=", 3) &&
+                strncmp(optarg, "sysfs=", 6)
+              )
+            ) {
+              help();
+              return 1;
+            }
+            str_printf(&s, 0, "%.*s %s", (int) (t - optarg), optarg, t + 1);
+            add_str_list(&queries, s);
+            free_mem(s);
+          }
+          break;
+
         case 400:
           printf("%s\n", hd_version());
 	  break;
@@ -339,8 +415,53 @@ int main(int argc, char **argv)
       }
     }
 
+    if(daemon_socket) return do_daemon(hd_data, daemon_socket);
+
     if(!hw_items && is_short) hw_item[hw_items++] = 2000;	/* all */
 
+#ifndef LIBHD_TINY
+    if(server_socket || queries) {
+      int local_query = queries ? 1 : 0;
+      char *s = NULL;
+
+      /* smp, arch, uml, xen are not handled by the daemon */
+      for(i = 0; i < hw_items && hw_item[i] < 2002; i++);
+
+      if(i == hw_items) {
+        for(i = 0; i < hw_items; i++) {
+          if(hw_item[i] >= 2000) {
+            str_printf(&s, 0, "item all");
+          }
+          else if(hd_hw_item_name(hw_item[i])) {
+            str_printf(&s, 0, "item %s", hd_hw_item_name(hw_item[i]));
+          }
+          else {
+            str_printf(&s, 0, "item %d", hw_item[i]);
+          }
+          add_str_list(&queries, s);
+        }
+        s = free_mem(s);
+
+        if(server_socket && queries && !do_client(server_socket, queries, is_short)) return 0;
+
+        /* no daemon: answer it ourselves */
+        if(local_query) {
+          hd_free_hd_list(hd_list(hd_data, hw_all, 1, NULL));
+          if(hd_data->progress) {
+            printf("\r%64s\r", "");
+            fflush(stdout);
+          }
+          do_query(hd_data, stdout, queries, is_short);
+
+          hd_free_hd_data(hd_data);
+          free(hd_data);
+
+          return 0;
+        }
+      }
+    }
+#endif
+
     if(hw_items >= 0 || showconfig || saveconfig) {
       if(*log_file) {
         if(!strcmp(log_file, "-")) {
@@ -819,6 +940,7 @@ void help()
     "    --only DEVNAME\n"
     "        This option can be given more than once. If you add this option,\n"
     "        only data about devices with DEVNAME will be shown.\n"
+    "        DEVNAME may also be a sysfs path or a network interface name.\n"
     "    --save-config SPEC\n"
     "        Store config  for a particular device below /var/lib/hardware.\n"
     "        SPEC can be a device name, an UDI, or 'all'. This option must be\n"
@@ -829,6 +951,20 @@ void help()
     "        If disk names have  changed (e.g. after a kernel update) this\n"
     "        prints a list of disk name mappings. Note  that  you must have\n"
     "        used --save-config at some point before for this can work.\n"
+    "    --hddb-dir DIR\n"
+    "        Use DIR instead of /var/lib/hardware.\n"
+    "    --diff OLD NEW\n"
+    "        Compare two hardware inventories. OLD and NEW are directories\n"
+    "        holding data saved with --save-config (see --hddb-dir), or '-'\n"
+    "        for the current hardware. Exit status is 1 if they differ.\n"
+    "    --daemon SOCKET\n"
+    "        Keep hardware data in memory, update them on device events, and\n"
+    "        answer queries on UNIX socket SOCKET.\n"
+    "    --socket SOCKET\n"
+    "        Ask the daemon at SOCKET instead of probing.\n"
+    "    --query KEY=VALUE\n"
+    "        This option can be given more than once. Show devices matching\n"
+    "        any query. KEY is one of item, bus, id, sysfs.\n"
     "    --debug N\n"
     "        Set debug level to N. The debug info is shown only in the log\n"
     "        file. If you specify a log file, the debug level is implicitly\n"
@@ -1883,3 +2019,484 @@ int get_mapping2()
 }
 
 
+/*
+ * Read inventory from hddb dir; '-' means: probe.
+ */
+hd_t *diff_list(hd_data_t *hd_data, char *dir)
+{
+  hd_t *hd;
+  char *s;
+
+  if(!strcmp(dir, "-")) return hd_list(hd_data, hw_all, 1, NULL);
+
+  s = getenv("LIBHD_HDDB_DIR");
+  if(s) s = new_str(s);
+
+  setenv("LIBHD_HDDB_DIR", dir, 1);
+
+  hd_data->flags.list_all = 1;
+  hd = hd_list(hd_data, hw_manual, 1, NULL);
+
+  if(s) {
+    setenv("LIBHD_HDDB_DIR", s, 1);
+    free(s);
+  }
+  else {
+    unsetenv("LIBHD_HDDB_DIR");
+  }
+
+  return hd;
+}
+
+
+int do_diff(char *dir_old, char *dir_new)
+{
+#ifndef LIBHD_TINY
+  hd_data_t *hd_data_old, *hd_data_new;
+  hd_t *hd_old, *hd_new, *hd;
+  hd_diff_t *diff, *d;
+  str_list_t *sl;
+  int err;
+
+  hd_data_old = calloc(1, sizeof *hd_data_old);
+  hd_data_new = calloc(1, sizeof *hd_data_new);
+
+  hd_old = diff_list(hd_data_old, dir_old);
+  hd_new = diff_list(hd_data_new, dir_new);
+
+  diff = hd_diff(hd_data_new, hd_old, hd_new);
+
+  for(d = diff; d; d = d->next) {
+    hd = d->hd_new ?: d->hd_old;
+    printf("%c %s: %s\n",
+      d->type == hd_diff_added ? '+' : d->type == hd_diff_removed ? '-' : '*',
+      hd->unique_id ?: hd->sysfs_id ?: hd->unix_dev_name ?: "?",
+      hd->model ?: hd_hw_item_name(hd->hw_class) ?: ""
+    );
+    for(sl = d->info; sl; sl = sl->next) {
+      printf("    %s\n", sl->str);
+    }
+  }
+
+  err = diff ? 1 : 0;
+
+  hd_free_diff(diff);
+
+  hd_free_hd_list(hd_old);
+  hd_free_hd_list(hd_new);
+
+  hd_free_hd_data(hd_data_old);
+  free(hd_data_old);
+
+  hd_free_hd_data(hd_data_new);
+  free(hd_data_new);
+
+  return err;
+#else
+  return 2;
+#endif
+}
+
+
+/*
+ * Run as daemon: keep the hardware data and answer queries on socket 'name'.
+ *
+ * Data are refreshed on kernel uevents: single devices are updated right
+ * away (see hd_update_device()); all other changes that arrived before a
+ * request are handled in a single (partial) rescan.
+ */
+int do_daemon(hd_data_t *hd_data, char *name)
+{
+#ifndef LIBHD_TINY
+  struct sockaddr_un addr = { };
+  struct pollfd pfd[2 + DAEMON_CLIENTS];
+  unsigned char dirty[hw_all + 1] = { };
+  daemon_client_t *client;
+  hd_uevent_t *uevent;
+  const hd_hw_item_t *item;
+  struct stat sbuf;
+  mode_t mask;
+  unsigned u, clients = 0;
+  time_t now;
+  int fd, sock;
+
+  if(strlen(name) >= sizeof addr.sun_path) {
+    fprintf(stderr, "%s: socket name too long\n", name);
+    return 1;
+  }
+
+  /* replace a stale socket, but nothing else */
+  if(!lstat(name, &sbuf)) {
+    if(!S_ISSOCK(sbuf.st_mode)) {
+      fprintf(stderr, "%s: file exists and is not a socket\n", name);
+      return 1;
+    }
+    unlink(name);
+  }
+
+  hd_data->progress = NULL;
+
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, name);
+
+  sock = socket(PF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  mask = umask(077);
+  if(sock < 0 || bind(sock, (struct sockaddr *) &addr, sizeof addr) || listen(sock, 16)) {
+    perror(name);
+    return 1;
+  }
+  umask(mask);
+
+  if((pfd[1].fd = hd_uevent_open()) < 0) {
+    fprintf(stderr, "hwinfo: no uevents, data will not be updated\n");
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+  signal(SIGTERM, daemon_stop);
+  signal(SIGINT, daemon_stop);
+
+  /* initial scan */
+  dirty[hw_all] = 1;
+  daemon_rescan(hd_data, dirty);
+
+  client = new_mem(DAEMON_CLIENTS * sizeof *client);
+
+  for(u = 0; u < 2 + DAEMON_CLIENTS; u++) pfd[u].events = POLLIN;
+
+  /*
+   * Clients are read without blocking: a slow one must not hold up the
+   * others or the uevents.
+   */
+  while(!daemon_exit) {
+    /* negative fds are ignored */
+    pfd[0].fd = clients < DAEMON_CLIENTS ? sock : -1;
+    for(u = 0; u < clients; u++) pfd[2 + u].fd = client[u].fd;
+
+    if(poll(pfd, 2 + clients, clients ? 1000 : -1) < 0) {
+      if(errno == EINTR) continue;
+      perror("poll");
+      break;
+    }
+
+    if(pfd[1].fd >= 0 && (pfd[1].revents & POLLIN)) {
+      while((uevent = hd_uevent_read(pfd[1].fd))) {
+        if(hd_update_device(hd_data, uevent) < 0) {
+          for(item = hd_uevent_hw_items(uevent); *item; item++) {
+            if(*item < hw_all) dirty[*item] = 1;
+          }
+        }
+        uevent = hd_free_uevent(uevent);
+      }
+      /* lost events, we have to check everything */
+      if(errno == ENOBUFS) dirty[hw_all] = 1;
+    }
+
+    now = time(NULL);
+
+    for(u = 0; u < clients; u++) {
+      if(pfd[2 + u].revents && daemon_read(client + u)) {
+        daemon_rescan(hd_data, dirty);
+        daemon_request(hd_data, client + u);
+      }
+      else if(now - client[u].start >= DAEMON_TIMEOUT) {
+        close(client[u].fd);
+        client[u].fd = -1;
+      }
+    }
+
+    /* drop finished clients */
+    for(u = fd = 0; u < clients; u++) {
+      if(client[u].fd >= 0) {
+        if((unsigned) fd != u) client[fd] = client[u];
+        fd++;
+      }
+    }
+    clients = fd;
+
+    if(pfd[0].fd >= 0 && (pfd[0].revents & POLLIN)) {
+      fd = accept(sock, NULL, NULL);
+      if(fd >= 0) {
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        client[clients].fd = fd;
+        client[clients].start = now;
+        client[clients].len = 0;
+        clients++;
+      }
+    }
+  }
+
+  for(u = 0; u < clients; u++) close(client[u].fd);
+  free_mem(client);
+
+  if(pfd[1].fd >= 0) close(pfd[1].fd);
+  close(sock);
+  unlink(name);
+
+  hd_free_hd_data(hd_data);
+  free(hd_data);
+
+  return 0;
+#else
+  return 1;
+#endif
+}
+
+
+void daemon_stop(int sig)
+{
+  daemon_exit = 1;
+}
+
+
+#ifndef LIBHD_TINY
+/*
+ * Rescan hardware items marked in dirty[]; dirty[hw_all] means everything.
+ *
+ * Also frees the entries replaced by hd_update_device() since the last call.
+ */
+void daemon_rescan(hd_data_t *hd_data, unsigned char *dirty)
+{
+  hd_hw_item_t items[hw_all + 1];
+  unsigned u, len = 0;
+
+  if(dirty[hw_all]) {
+    items[len++] = hw_all;
+  }
+  else {
+    for(u = hw_none + 1; u < hw_all; u++) {
+      if(dirty[u]) items[len++] = u;
+    }
+  }
+
+  if(len) {
+    items[len] = 0;
+    memset(dirty, 0, hw_all + 1);
+
+    hd_free_hd_list(hd_list2(hd_data, items, 1));
+  }
+
+  /* there are no references to the old entries left */
+  free_old_hd_entries(hd_data);
+
+  /* don't let the log grow forever */
+  hd_data->log = free_mem(hd_data->log);
+  hd_data->log_size = hd_data->log_max = 0;
+}
+
+
+/*
+ * Read what the client has sent so far.
+ *
+ * Returns 1 if the query is complete: it ends when the client shuts down
+ * its sending side (or on errors or if the buffer is full).
+ */
+int daemon_read(daemon_client_t *client)
+{
+  ssize_t len;
+
+  while(client->len < sizeof client->buf - 1) {
+    len = read(client->fd, client->buf + client->len, sizeof client->buf - 1 - client->len);
+    if(len > 0) {
+      client->len += len;
+      continue;
+    }
+    if(len < 0 && errno == EINTR) continue;
+    if(len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+    break;
+  }
+
+  return 1;
+}
+
+
+/*
+ * Answer the query read from client and close the connection.
+ *
+ * A query consists of lines 'item|bus|id|sysfs VALUE' and an optional
+ * 'short' line.
+ */
+void daemon_request(hd_data_t *hd_data, daemon_client_t *client)
+{
+  struct timeval tv = { .tv_sec = DAEMON_TIMEOUT };
+  str_list_t *sl, *sl0, *query = NULL;
+  int fd = client->fd, short_fmt = 0;
+  FILE *f;
+
+  client->fd = -1;
+
+  /* write the answer blocking, but don't wait forever */
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof tv);
+
+  client->buf[client->len] = 0;
+
+  sl0 = hd_split('\n', client->buf);
+  for(sl = sl0; sl; sl = sl->next) {
+    if(!strcmp(sl->str, "short")) {
+      short_fmt = 1;
+    }
+    else if(*sl->str) {
+      add_str_list(&query, sl->str);
+    }
+  }
+  free_str_list(sl0);
+
+  if((f = fdopen(fd, "w"))) {
+    do_query(hd_data, f, query, short_fmt);
+    fclose(f);
+  }
+  else {
+    close(fd);
+  }
+
+  free_str_list(query);
+}
+#endif
+
+
+/*
+ * Send query to hwinfo daemon at socket 'name' and print the answer.
+ *
+ * Returns 0 on success, 1 if the daemon is not reachable.
+ */
+int do_client(char *name, str_list_t *query, int short_fmt)
+{
+  struct sockaddr_un addr = { };
+  str_list_t *sl;
+  char *s = NULL, buf[0x4000];
+  ssize_t len;
+  size_t pos;
+  int sock;
+
+  if(strlen(name) >= sizeof addr.sun_path) return 1;
+
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, name);
+
+  sock = socket(PF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if(sock < 0) return 1;
+  if(connect(sock, (struct sockaddr *) &addr, sizeof addr)) {
+    close(sock);
+    return 1;
+  }
+
+  for(sl = query; sl; sl = sl->next) str_printf(&s, -1, "%s\n", sl->str);
+  if(short_fmt) str_printf(&s, -1, "short\n");
+
+  for(pos = 0; s && s[pos]; pos += len) {
+    if((len = write(sock, s + pos, strlen(s + pos))) <= 0) break;
+  }
+  free_mem(s);
+
+  shutdown(sock, SHUT_WR);
+
+  while((len = read(sock, buf, sizeof buf)) > 0) {
+    fwrite(buf, len, 1, stdout);
+  }
+
+  close(sock);
+
+  return 0;
+}
+
+
+/*
+ * Print all entries matching one of the queries.
+ */
+void do_query(hd_data_t *hd_data, FILE *f, str_list_t *query, int short_fmt)
+{
+#ifndef LIBHD_TINY
+  hd_t *hd, *hd0, **hd_next;
+  str_list_t *sl;
+
+  hd0 = hd_list(hd_data, hw_all, 0, NULL);
+
+  for(hd_next = &hd0; (hd = *hd_next);) {
+    for(sl = query; sl; sl = sl->next) {
+      if(query_match(hd, sl->str)) break;
+    }
+    if(sl) {
+      hd_next = &hd->next;
+    }
+    else {
+      *hd_next = hd->next;
+      hd->next = NULL;
+      hd_free_hd_list(hd);
+    }
+  }
+
+  if(short_fmt) {
+    do_short(hd_data, hd0, f);
+  }
+  else {
+    for(hd = hd0; hd; hd = hd->next) {
+      hd_dump_entry(hd_data, hd, f);
+    }
+  }
+
+  if(
+    hd0 &&
+    query &&
+    !query->next &&
+    !strncmp(query->str, "item ", sizeof "item " - 1) &&
+    query_item(query->str + sizeof "item " - 1) == hw_display
+  ) {
+    fprintf(f, "\nPrimary display adapter: #%u\n", hd_display_adapter(hd_data));
+  }
+
+  hd_free_hd_list(hd0);
+#endif
+}
+
+
+/*
+ * Check if hd matches query ('item|bus|id|sysfs VALUE').
+ */
+int query_match(hd_t *hd, char *query)
+{
+  char *s;
+
+  if(!(s = strchr(query, ' '))) return 0;
+  s++;
+
+  if(!strncmp(query, "item ", sizeof "item " - 1)) {
+    return hd_is_hw_class(hd, query_item(s));
+  }
+
+  if(!strncmp(query, "bus ", sizeof "bus " - 1)) {
+    return hd->bus.name && !strcasecmp(hd->bus.name, s);
+  }
+
+  if(!strncmp(query, "id ", sizeof "id " - 1)) {
+    return hd->unique_id && !strcmp(hd->unique_id, s);
+  }
+
+  if(!strncmp(query, "sysfs ", sizeof "sysfs " - 1)) {
+    if(!strncmp(s, "/sys/", sizeof "/sys/" - 1)) s += sizeof "/sys" - 1;
+    return hd->sysfs_id && !strcmp(hd->sysfs_id, s);
+  }
+
+  return 0;
+}
+
+
+/*
+ * Hardware item by name ('all', number, or hardware class name).
+ */
+hd_hw_item_t query_item(char *name)
+{
+  char *s;
+  unsigned u;
+
+  if(!strcmp(name, "all")) return hw_all;
+
+  u = strtoul(name, &s, 10);
+  if(!*s && s != name) return u;
+
+#ifndef LIBHD_TINY
+  return hd_hw_item_type(name);
+#else
+  return hw_none;
+#endif
+}
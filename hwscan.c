@@ -209,8 +209,8 @@ int main(int argc, char **argv)
     rc = do_scan(scan_item);
     if(found_items) {
       unlink(HARDWARE_DIR "/.update");		/* the old file */
-      unlink(HARDWARE_UNIQUE_KEYS "/.update");	/* so we trigger a rescan */
-      if((f = fopen(HARDWARE_UNIQUE_KEYS "/.update", "a"))) fclose(f);
+      unlink(hd_get_hddb_path("unique-keys/.update"));	/* so we trigger a rescan */
+      if((f = fopen(hd_get_hddb_path("unique-keys/.update"), "a"))) fclose(f);
     }
     ok = 1;
   }
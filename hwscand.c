@@ -1,43 +1,456 @@
-
 /* hwscan front end
    Copyright 2004 by SUSE (<adrian@suse.de>) */
 
-#include <sys/types.h>
-#include <sys/ipc.h>
-#include <sys/msg.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
 #include <time.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <inttypes.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 
+#include "hd.h"
+#include "hd_int.h"
 #include "init_message.h"
 
-#define TIMEOUT 2
-#define LONG_TIMEOUT 0
-#define BUFFERS 1024
+#define TIMEOUT 2		// quiet time before we scan
+#define MAX_DELAY 10		// but never delay a scan longer than this
+#define POLL_INTERVAL 5		// media check for devices without kernel disk events
+#define EVENTS_POLL_MSECS "2000"	// kernel media check, if nobody else enabled it
+
+typedef struct device_s {
+	struct device_s *next;
+	char *name;		// device as registered
+	char *sysfs;		// /sys/class/block/<dev>
+	int kernel_events;	// kernel reports media changes via uevents
+	int poll_set;		// we enabled the kernel media check
+	int last_state;		// media present; only if !kernel_events
+} device_t;
+
+static str_list_t *command_device[NR_COMMANDS];
+static int command_pending[NR_COMMANDS];
+static str_list_t *commands;
+static device_t *devices;
+static int scan_timer = -1;
+static int poll_timer = -1;
+static int pending;
+static struct timespec pending_since;
+static hd_data_t *hd_data;
+static int scan_disabled;
+
+// same order as command_args
+static hd_hw_item_t command_items[NR_COMMANDS] = {
+	hw_block, hw_partition, hw_usb, hw_ieee1394, hw_pci, hw_pcmcia, hw_bluetooth
+};
+
+// (re)arm scan timer: wait until a burst of requests is over, but not forever
+static void schedule( void )
+{
+	struct itimerspec its;
+	struct timespec now;
+
+	memset(&its, 0, sizeof its);
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if ( !pending ){
+		pending = 1;
+		pending_since = now;
+	}
+	its.it_value = now;
+	its.it_value.tv_sec += TIMEOUT;
+	if ( its.it_value.tv_sec > pending_since.tv_sec + MAX_DELAY ){
+		its.it_value = pending_since;
+		its.it_value.tv_sec += MAX_DELAY;
+	}
+	timerfd_settime(scan_timer, TFD_TIMER_ABSTIME, &its, 0);
+}
+
+// returns 1 if the timer really expired
+static int read_timer( int fd )
+{
+	uint64_t expired;
+
+	return read(fd, &expired, sizeof expired) == sizeof expired && expired;
+}
+
+static int command_index( const char *name )
+{
+	int i;
+
+	for ( i=0; i<NR_COMMANDS; i++ )
+		if ( !strcmp(name, command_args[i]) )
+			return i;
+	return -1;
+}
+
+static void queue_scan( int c, char *device )
+{
+	if ( c < 0 || c >= NR_COMMANDS )
+		return;
+	if ( command_with_device[c] ){
+		if ( !device || !*device )
+			return;
+		if ( !search_str_list(command_device[c], device) )
+			add_str_list(&command_device[c], device);
+	}else
+		command_pending[c] = 1;
+	schedule();
+}
+
+// old style media check; opening the device may spin it up
+static int media_present( device_t *dev )
+{
+	int fd = open( dev->name, O_RDONLY | O_CLOEXEC );
+
+	if ( fd < 0 )
+		return 0;
+	close(fd);
+	return 1;
+}
+
+// run the polling timer only as long as there are devices that need it
+static void update_poll_timer( void )
+{
+	struct itimerspec its;
+	device_t *dev;
+
+	memset(&its, 0, sizeof its);
+	for ( dev = devices; dev; dev = dev->next ){
+		if ( !dev->kernel_events ){
+			its.it_value.tv_sec = its.it_interval.tv_sec = POLL_INTERVAL;
+			break;
+		}
+	}
+	timerfd_settime(poll_timer, 0, &its, 0);
+}
+
+static void poll_devices( void )
+{
+	device_t *dev;
+	int state;
+
+	for ( dev = devices; dev; dev = dev->next ){
+		if ( dev->kernel_events )
+			continue;
+		state = media_present(dev);
+		if ( state != dev->last_state )
+			queue_scan(command_index("partition"), dev->name);
+		dev->last_state = state;
+	}
+}
+
+static int write_attr( char *dir, char *attr, char *val )
+{
+	char *path = 0;
+	int fd, ok = 0;
+
+	str_printf(&path, 0, "%s/%s", dir, attr);
+	if ( (fd = open(path, O_WRONLY | O_CLOEXEC)) >= 0 ){
+		ok = write(fd, val, strlen(val)) == (ssize_t) strlen(val);
+		close(fd);
+	}
+	free_mem(path);
+
+	return ok;
+}
+
+// the kernel checks only if asked to; keep an admin's choice, though
+static void enable_disk_events( device_t *dev )
+{
+	char *s;
+
+	s = get_sysfs_attr_by_path(dev->sysfs, "events_poll_msecs");
+	if ( !s || strtol(s, 0, 10) != -1 )
+		return;
+	s = get_sysfs_attr_by_path("/sys/module/block/parameters", "events_dfl_poll_msecs");
+	if ( s && strtol(s, 0, 10) > 0 )
+		return;
+	dev->poll_set = write_attr(dev->sysfs, "events_poll_msecs", EVENTS_POLL_MSECS);
+}
+
+static void add_device( char *name )
+{
+	device_t *dev;
+	char real[PATH_MAX], *s, *t;
+
+	for ( dev = devices; dev; dev = dev->next )
+		if ( !strcmp(dev->name, name) )
+			return;
+
+	dev = new_mem(sizeof *dev);
+	dev->name = new_str(name);
+
+	// sysfs knows only the real name, not a symlink like /dev/cdrom
+	s = realpath(name, real) ? real : name;
+	if ( (t = strrchr(s, '/')) )
+		s = t + 1;
+	str_printf(&dev->sysfs, 0, "/sys/class/block/%s", s);
+
+	s = get_sysfs_attr_by_path(dev->sysfs, "events");
+	if ( s && strstr(s, "media_change") ){
+		dev->kernel_events = 1;
+		enable_disk_events(dev);
+	}else
+		dev->last_state = media_present(dev);
+
+	dev->next = devices;
+	devices = dev;
+
+	update_poll_timer();
+}
+
+static void remove_device( char *name )
+{
+	device_t **dev, *d;
+
+	for ( dev = &devices; (d = *dev); ){
+		if ( !strcmp(d->name, name) ){
+			*dev = d->next;
+			if ( d->poll_set )
+				write_attr(d->sysfs, "events_poll_msecs", "-1");
+			free_mem(d->name);
+			free_mem(d->sysfs);
+			free_mem(d);
+		}else
+			dev = &d->next;
+	}
+
+	update_poll_timer();
+}
+
+static void read_messages( int fd )
+{
+	char m[MESSAGE_BUFFER+1];
+	ssize_t r;
+
+	while ( (r = recv(fd, m, MESSAGE_BUFFER, 0)) >= 0 ){
+		m[r] = '\0';
+#if DEBUG
+		printf("CALL RECEIVED %s\n", m);
+#endif
+		switch ( m[0] ){
+			case 'S':
+				// scan calls
+				if ( m[1] >= '0' && m[1] <= '9' )
+					queue_scan(m[1] - '0', m + 2);
+				break;
+			case 'C':
+				// config calls
+				if ( m[1] ){
+					add_str_list(&commands, m + 1);
+					schedule();
+				}
+				break;
+			case 'A':
+				// add scan devices
+				if ( m[1] )
+					add_device(m + 1);
+				break;
+			case 'R':
+				remove_device(m + 1);
+				break;
+			default:
+				fprintf( stderr, "hwscand: error, invalid message\n" );
+		}
+	}
+}
+
+static void read_uevents( int fd )
+{
+	static const char *subsystems[][2] = {
+		{ "usb", "usb" },
+		{ "pci", "pci" },
+		{ "firewire", "firewire" },
+		{ "ieee1394", "firewire" },
+		{ "pcmcia", "pcmcia" },
+		{ "bluetooth", "bluetooth" }
+	};
+	hd_uevent_t *uevent;
+	char *dev;
+	int c, i;
+
+	for ( errno = 0; (uevent = hd_uevent_read(fd)); hd_free_uevent(uevent), errno = 0 ){
+		if ( !uevent->subsystem )
+			continue;
+#if DEBUG
+		printf("EVENT %s %s\n", uevent->action, uevent->devpath);
+#endif
+		c = -1;
+		dev = 0;
+		if ( !strcmp(uevent->subsystem, "block") ){
+			if ( !uevent->devname )
+				continue;
+			str_printf(&dev, 0, "/dev/%s", uevent->devname);
+			if ( !strcmp(uevent->action, "change") ){
+				// sent by the kernel's media check
+				if (
+					search_str_list(uevent->env, "DISK_MEDIA_CHANGE=1") ||
+					search_str_list(uevent->env, "DISK_EJECT_REQUEST=1")
+				)
+					c = command_index("partition");
+			}else if ( !strcmp(uevent->action, "add") || !strcmp(uevent->action, "remove") ){
+				if ( uevent->devtype && !strcmp(uevent->devtype, "partition") )
+					c = command_index("partition");
+				else
+					c = command_index("block");
+			}
+		}else if ( !strcmp(uevent->action, "add") || !strcmp(uevent->action, "remove") ){
+			// usb interfaces come with their device
+			if (
+				!strcmp(uevent->subsystem, "usb") &&
+				(!uevent->devtype || strcmp(uevent->devtype, "usb_device"))
+			)
+				continue;
+			for ( i=0; i<(int) (sizeof subsystems / sizeof *subsystems); i++ ){
+				if ( !strcmp(uevent->subsystem, subsystems[i][0]) ){
+					c = command_index(subsystems[i][1]);
+					break;
+				}
+			}
+		}
+		if ( c >= 0 )
+			queue_scan(c, dev);
+		free_mem(dev);
+	}
+
+	// we lost events: look at everything again
+	if ( errno == ENOBUFS ){
+		for ( c=0; c<NR_COMMANDS; c++ )
+			if ( !command_with_device[c] )
+				queue_scan(c, 0);
+	}
+}
+
+// hd_data stays around between scans; we don't want to pay for hddb setup every time
+static void init_hd_data( void )
+{
+	hd_data = new_mem(sizeof *hd_data);
+
+	// look if we have been disabled ('hwprobe=-scan')
+	hd_clear_probe_feature(hd_data, pr_all);
+	hd_scan(hd_data);
+	hd_set_probe_feature(hd_data, pr_scan);
+	scan_disabled = !hd_probe_feature(hd_data, pr_scan);
+
+	hd_data->flags.list_all = 1;
+	hd_data->flags.fast = 1;
+}
+
+// what 'hwscan --fast --boot --silent' used to do
+static void scan_items( hd_hw_item_t *items )
+{
+	hd_t *hd, *hd1;
+	int found = 0;
+	FILE *f;
+
+	// status may have been changed by 'hwscan --cfg' meanwhile
+	for ( hd = hd_data->hd; hd; hd = hd->next )
+		hd->persistent_prop = hd_free_hal_properties(hd->persistent_prop);
+
+	hd = hd_list2(hd_data, items, 1);
+
+	for ( hd1 = hd; hd1; hd1 = hd1->next ){
+		found = 1;
+		// write the real entry, not the list copy
+		if ( hd_write_config(hd_data, hd1->ref ? hd1->ref : hd1) ){
+			fprintf( stderr, "hwscand: error writing configuration for %s (%s)\n", hd1->unique_id, hd1->model );
+			break;
+		}
+	}
+
+	hd_free_hd_list(hd);
+
+	if ( found ){
+		unlink(HARDWARE_DIR "/.update");	// the old file
+		unlink(hd_get_hddb_path("unique-keys/.update"));	// so we trigger a rescan
+		if ( (f = fopen(hd_get_hddb_path("unique-keys/.update"), "a")) )
+			fclose(f);
+	}
+
+	// nobody references the replaced entries anymore
+	free_old_hd_entries(hd_data);
+
+	// don't let the log grow forever
+	hd_data->log = free_mem(hd_data->log);
+	hd_data->log_size = hd_data->log_max = 0;
+}
+
+static void run_scans( void )
+{
+	hd_hw_item_t items[NR_COMMANDS + 1];
+	str_list_t *sl;
+	int i, len = 0;
+
+	pending = 0;
+
+	// one scan for the whole batch; all devices go into a single 'only' list
+	for ( i=0; i<NR_COMMANDS; i++ ){
+		if ( command_with_device[i] ){
+			if ( !command_device[i] )
+				continue;
+			for ( sl = command_device[i]; sl; sl = sl->next )
+				if ( !search_str_list(hd_data->only, sl->str) )
+					add_str_list(&hd_data->only, sl->str);
+			command_device[i] = free_str_list(command_device[i]);
+		}else if ( command_pending[i] )
+			command_pending[i] = 0;
+		else
+			continue;
+		items[len++] = command_items[i];
+	}
+	items[len] = 0;
+
+	if ( len && !scan_disabled ){
+#if DEBUG
+		char *s = hd_join(" ", hd_data->only);
+
+		printf("SCAN %d items, only %s\n", len, s ?: "-");
+		free_mem(s);
+#endif
+		scan_items(items);
+	}
+
+	hd_data->only = free_str_list(hd_data->only);
+
+	for ( sl = commands; sl; sl = sl->next ){
+#if DEBUG
+		printf("CALL DIRECT %s\n", sl->str);
+#endif
+		system(sl->str);
+#if DEBUG
+		printf("CALL quit %s\n", sl->str);
+#endif
+	}
+	commands = free_str_list(commands);
+}
+
+static void watch( int ep, int fd )
+{
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof ev);
+	ev.events = EPOLLIN;
+	ev.data.fd = fd;
+	if ( epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev) ){
+		perror("hwscand: epoll_ctl");
+		exit(1);
+	}
+}
 
 int main( int argc, char **argv )
 {
-        int ret, i;
-	key_t key = KEY;
-	int msgid;
-	int mode = 0;
-	int dev_nr = 0;
-	int lines = 0;
-	int block, usb, firewire, pci;
-	int dev_last_state[BUFFERS];
-	int dev_counter[BUFFERS];
-	char * command_device[NR_COMMANDS][BUFFERS];
-	time_t command_device_last[NR_COMMANDS][BUFFERS];
-	time_t last;
-	char **commands;
-	char **devices;
+	int ret, i, n;
+	int sock, uevent_fd, ep;
+	struct sockaddr_un addr;
+	struct epoll_event events[8];
 	char buffer[32];
-	message m;
 
 	// are we running already, maybe ?
 	{
@@ -71,184 +484,58 @@ int main( int argc, char **argv )
 		close(ret);
 	}
 
-	// initialize ...
-	for ( i=0; i<NR_COMMANDS; i++ ){
-		command_device[i][0] = 0;
-		command_device_last[i][0] = 1;
+	init_hd_data();
+
+	// requests from hwscanqueue
+	memset(&addr, 0, sizeof addr);
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, SOCKET_NAME, sizeof addr.sun_path - 1);
+	unlink(SOCKET_NAME);
+	sock = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+	if ( sock < 0 || bind(sock, (struct sockaddr *) &addr, sizeof addr) || chmod(SOCKET_NAME, 0600) ){
+		perror("hwscand: unable to open socket "SOCKET_NAME);
+		unlink(PID_FILE);
+		exit(1);
 	}
 
-	last=block=usb=firewire=pci=0;
-	commands = (char**) malloc( BUFFERS * sizeof(char*) );
-	devices  = (char**) malloc( BUFFERS * sizeof(char*) );
+	// we still serve hwscanqueue without kernel events
+	if ( (uevent_fd = hd_uevent_open()) < 0 )
+		perror("hwscand: no kernel device events");
 
-	msgid = msgget(key, IPC_CREAT | 0600);
-        if (msgid < 0) {
-		perror("msgget");
+	scan_timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+	poll_timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+	ep = epoll_create1(EPOLL_CLOEXEC);
+	if ( scan_timer < 0 || poll_timer < 0 || ep < 0 ){
+		perror("hwscand");
 		exit(1);
-        }
+	}
 
+	watch(ep, sock);
+	if ( uevent_fd >= 0 )
+		watch(ep, uevent_fd);
+	watch(ep, scan_timer);
+	watch(ep, poll_timer);
+
+	// timers run only while there is something to do
 	while (1) {
-		if ( last || dev_nr )
-			mode = IPC_NOWAIT;
-		else
-			mode = 0;
-
-		if( msgrcv(msgid, &m, MESSAGE_BUFFER, 1, mode) >= 0 ){
-			char *p = m.mtext;
-
-			if ( p == 0 ){
-				fprintf( stderr, "hwscand: error, zero sized message\n" );
-			}else{
-				if ( p[0] == 'S' && strlen(p) > 1 ){
-					// scan calls
-					char z[2];
-					int c;
-					z[0] = *(p+1);
-					z[1] = '\0';
-					c = atoi(z);
-					if ( c < NR_COMMANDS ){
-						if ( ! command_with_device[c] ){
-							last = time(0L);
-							if ( LONG_TIMEOUT+command_device_last[c][0] < time(0L) )
-								command_device_last[c][0] = 0;
-						}else
-						for ( i=0; i<BUFFERS; i++ ){
-							if ( !command_device[c][i] ){
-								last = time(0L);
-								command_device[c][i] = strdup(p+2);
-								command_device[c][i+1] = 0;
-								command_device_last[c][i] = 0;
-								break;
-							}else if ( !strcmp(command_device[c][i], p+2) ){
-								last = time(0L);
-								if ( LONG_TIMEOUT+command_device_last[c][i] < time(0L) )
-									command_device_last[c][i] = 0;
-								break;
-							}
-						}
-					}
-				}
-				if ( p[0] == 'C' && lines < BUFFERS ){
-					last = time(0L);
-					// config calls
-					commands[lines] = strdup(p+1);
-					lines++;	
-				}
-				if ( p[0] == 'A' && dev_nr < BUFFERS ){	
-					// add scan devices
-					devices[dev_nr]        = strdup(p+1);
-					dev_last_state[dev_nr] = 0;
-					dev_counter[dev_nr]    = 0;
-					dev_nr++;
-				}
-				if ( p[0] == 'R' && dev_nr < BUFFERS ){	
-					for ( i=0; i<dev_nr; i++ ){
-						if ( !strcmp(p+1, devices[i]) ){
-							int j;
-							free(devices[i]);
-							for ( j=i; j+1<dev_nr; j++ ){
-								devices[j]        = devices[j+1];
-								dev_last_state[j] = dev_last_state[j+1];
-								dev_counter[j]    = dev_counter[j+1];
-							}
-							dev_nr--;
-						}
-					}
-				}
-			}
-#if DEBUG
-				printf("CALL RECEIVED %s\n", p);
-#endif
-		}else{
-			// we do this only in scanning mode ...
-
-			sleep(1);
-			for ( i=0; i<dev_nr; i++ ){
-				if (dev_counter[i]<0) continue;
-				dev_counter[i]++;
-				if ( dev_counter[i] > 5 ){
-					int fd;
-					char buf[MESSAGE_BUFFER];
-					dev_counter[i] = 0;
-					fd = open( devices[i], O_RDONLY );
-					strcpy( buf, "/sbin/hwscan --fast --partition --only=");
-					strcat( buf, devices[i] );
-					if ( fd < 0 ){
-						if ( dev_last_state[i] )
-							system(buf);
-						dev_last_state[i] = 0;
-					}else{
-						if ( dev_last_state[i] == 0)
-							system(buf);
-						dev_last_state[i] = 1;
-						close(fd);
-					}
-				}
-			}
+		n = epoll_wait(ep, events, sizeof events / sizeof *events, -1);
+		if ( n < 0 ){
+			if ( errno == EINTR )
+				continue;
+			perror("hwscand: epoll_wait");
+			exit(1);
 		}
-		
-		if ( last && (last+TIMEOUT <= time(0L)) ){
-			char buf[MESSAGE_BUFFER * NR_COMMANDS];
-			int run_really = 0;
-
-			last=0;
-			strcpy( buf, "/sbin/hwscan --fast --boot --silent" );
-			for ( i=0; i<NR_COMMANDS; i++ ){
-				if ( command_with_device[i] == 0 &&
-				     command_device_last[i][0] == 0 ){
-					command_device_last[i][0] = time(0L);
-					strcat( buf, " --");
-					strcat( buf, command_args[i] );
-				 	run_really = 1;
-				} else {
-					int j;
-					int commappended = 0;
-
-					for ( j=0; j<BUFFERS; j++ ){
-						if ( !command_device[i][j] )
-							break;
-						if ( command_device_last[i][j] == 0 ){
-							if (!commappended) {
-								strcat( buf, " --");
-								strcat( buf, command_args[i] );
-								commappended = 1;
-						        }
-							strcat( buf, " --only=" );
-							strcat( buf, command_device[i][j] );
-							command_device_last[i][j] = time(0L);
-							run_really = 1;
-							if (strlen(buf) > sizeof(buf) - MESSAGE_BUFFER)
-								break;
-						}
-					}
-				}
-				if (strlen(buf) > sizeof(buf) - MESSAGE_BUFFER) {
-					last = time(0L);	/* call me again */
-					break;
-				}
-			}
-
-			if ( run_really ){
-#if DEBUG
-				printf("RUN %s\n", buf);
-#endif
-				system(buf);
-#if DEBUG				
-				printf("RUN quit %s\n", buf);
-#endif
-			}
-			if ( lines ){
-				for (i=0; i<lines; i++){
-#if DEBUG
-				printf("CALL DIRECT %s\n", commands[i]);
-#endif
-					system(commands[i]);
-#if DEBUG
-				printf("CALL quit %s\n", commands[i]);
-#endif
-					free(commands[i]);
-				}
-				lines=0;
+		for ( i=0; i<n; i++ ){
+			if ( events[i].data.fd == sock )
+				read_messages(sock);
+			else if ( events[i].data.fd == uevent_fd )
+				read_uevents(uevent_fd);
+			else if ( events[i].data.fd == scan_timer ){
+				if ( read_timer(scan_timer) )
+					run_scans();
+			}else if ( events[i].data.fd == poll_timer ){
+				if ( read_timer(poll_timer) )
+					poll_devices();
 			}
 		}
 	}
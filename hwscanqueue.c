@@ -4,9 +4,10 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
-#include <sys/ipc.h>
-#include <sys/msg.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <signal.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdlib.h>
@@ -15,13 +16,24 @@
 
 #include "init_message.h"
 
+#define RETRIES 50		// wait up to 5 s for hwscand to come up
+
+static int send_message( int fd, const char *m )
+{
+	struct sockaddr_un addr;
+
+	memset(&addr, 0, sizeof addr);
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, SOCKET_NAME, sizeof addr.sun_path - 1);
+
+	return sendto(fd, m, strlen(m), 0, (struct sockaddr *) &addr, sizeof addr);
+}
+
 int main( int argc, char **argv )
 {
-	int ret;
+	int ret, fd;
 	unsigned short i;
-        key_t key = KEY;
-        int msgid;
-	message m;
+	char m[MESSAGE_BUFFER+1];
 	char *device = argv[2];
 
 	if ( argc < 2 ){
@@ -40,26 +52,26 @@ int main( int argc, char **argv )
 	}
 
 	if ( !strncmp("--cfg=", argv[1], 6) && argc>2 )
-		snprintf( m.mtext, MESSAGE_BUFFER, "C/sbin/hwscan %s %s", argv[1], argv[2]  );
+		snprintf( m, MESSAGE_BUFFER, "C/sbin/hwscan %s %s", argv[1], argv[2]  );
 	else if ( !strncmp("--avail=", argv[1], 8) && argc>2 )
-		snprintf( m.mtext, MESSAGE_BUFFER, "C/sbin/hwscan %s %s", argv[1], argv[2]  );
+		snprintf( m, MESSAGE_BUFFER, "C/sbin/hwscan %s %s", argv[1], argv[2]  );
 	else if ( !strncmp("--scan=", argv[1], 7) )
-		snprintf( m.mtext, MESSAGE_BUFFER, "A%s", argv[1]+7 );
+		snprintf( m, MESSAGE_BUFFER, "A%s", argv[1]+7 );
 	else if ( !strncmp("--stop=", argv[1], 7) )
-		snprintf( m.mtext, MESSAGE_BUFFER, "R%s", argv[1]+7 );
+		snprintf( m, MESSAGE_BUFFER, "R%s", argv[1]+7 );
 	else if ( !strncmp("--", argv[1], 2) ){
 		for ( i=0; i<NR_COMMANDS; i++ ){
 			if ( !strcmp(argv[1]+2,command_args[i]) ){
 #if DEBUG
 				printf("COMMAND %s\n", command_args[i] );
 #endif
-				snprintf( m.mtext, MESSAGE_BUFFER, "S%d", i );
+				snprintf( m, MESSAGE_BUFFER, "S%d", i );
 				if (command_with_device[i]){
 					if ( !device ){
 						fprintf(stderr, "need a device for this command\n");
 						exit(1);
 					}
-					strncat( m.mtext, device, MESSAGE_BUFFER-3 );
+					strncat( m, device, MESSAGE_BUFFER-3 );
 				}
 				break;
 			}
@@ -71,20 +83,17 @@ int main( int argc, char **argv )
 	}else
 		exit(1);
 
-        if ( (msgid = msgget(key, IPC_CREAT | 0600)) < 0 ){
+	if ( (fd = socket(AF_UNIX, SOCK_DGRAM, 0)) < 0 ){
 		perror("unable to init.");
-                exit(1);
-        }
-	m.mtype = 1;
-	ret = msgsnd( msgid, &m, MESSAGE_BUFFER, IPC_NOWAIT);
+		exit(1);
+	}
+	ret = send_message( fd, m );
 #if DEBUG
-	printf("SEND %s, return %d\n", m.mtext, ret );
+	printf("SEND %s, return %d\n", m, ret );
 #endif
 
-	if ( ret < 0 )
-		perror("message send failed");
-	else{
-		// success ... start hwscand, if it is not yet running
+	if ( ret < 0 && (errno == ENOENT || errno == ECONNREFUSED) ){
+		// start hwscand, if it is not yet running
 		ssize_t r;
 		char buffer[1024];
 		char link[1024];
@@ -117,10 +126,22 @@ int main( int argc, char **argv )
 				close(2);
 				/* Start hwscand */
 				execve("/sbin/hwscand", 0, 0);
+				_exit(1);
 			}
 		}
+
+		// ... and give it a moment to open its socket
+		for ( i=0; i<RETRIES && ret < 0; i++ ){
+			usleep(100000);
+			ret = send_message( fd, m );
+		}
+	}
+
+	if ( ret < 0 ){
+		perror("message send failed");
+		exit(1);
 	}
 
-	exit(ret);
+	exit(0);
 }
 
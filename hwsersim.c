@@ -0,0 +1,673 @@
+/*
+ * Simulate serial devices on pseudo terminals.
+ *
+ * Every device gets a pty; a PROC_DRIVER_SERIAL style file and /dev/ttyS<n>
+ * style links to the ptys are put into a directory. Point libhd at them
+ * with LIBHD_SERIAL and LIBHD_SERIAL_DEV to run the serial probes
+ * (modem, mouse, braille) against well known devices, e.g. to time them:
+ *
+ *   hwsersim --latency 20 --runs 5 modem pnp-modem mouse silent -- hwinfo --modem
+ *
+ * 'make check' runs the scripts in tests/ with it.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <inttypes.h>
+#include <termios.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define MAX_PORTS	32
+
+/* a mouse answers that long after the last speed magic (cf. mouse_step()) */
+#define MOUSE_DELAY	150
+
+typedef enum {
+  dev_silent, dev_modem, dev_pnp_modem, dev_ati0_modem, dev_mouse, dev_logitech,
+  dev_pnp_mouse, dev_ht_braille
+} dev_type_t;
+
+typedef struct {
+  dev_type_t type;
+  int master, slave;
+  char *pts, *link;
+  char line[256];		/* current AT command */
+  unsigned line_len;
+  char out[1024];		/* pending response */
+  unsigned out_len;
+  uint64_t due;			/* send response then (ms); 0: nothing pending */
+} port_t;
+
+static struct {
+  char *name;
+  dev_type_t type;
+} dev_names[] = {
+  { "silent", dev_silent },
+  { "modem", dev_modem },
+  { "pnp-modem", dev_pnp_modem },
+  { "ati0-modem", dev_ati0_modem },
+  { "mouse", dev_mouse },
+  { "logitech", dev_logitech },
+  { "pnp-mouse", dev_pnp_mouse },
+  { "ht-braille", dev_ht_braille }
+};
+
+struct option options[] = {
+  { "help", 0, NULL, 'h' },
+  { "dir", 1, NULL, 'D' },
+  { "latency", 1, NULL, 'l' },
+  { "jitter", 1, NULL, 'j' },
+  { "errors", 1, NULL, 'e' },
+  { "seed", 1, NULL, 's' },
+  { "split", 0, NULL, 'S' },
+  { "runs", 1, NULL, 'r' },
+  { "verbose", 0, NULL, 'v' },
+  { }
+};
+
+static struct {
+  char *dir;
+  unsigned latency;
+  unsigned jitter;
+  unsigned errors;
+  unsigned seed;
+  unsigned runs;
+  unsigned split:1;
+  unsigned verbose:1;
+  unsigned tmp_dir:1;
+} opt = { .runs = 1, .seed = 1 };
+
+static port_t ports[MAX_PORTS];
+static unsigned port_cnt;
+static char *serial_file;
+static int sig_pipe[2] = { -1, -1 };
+static volatile sig_atomic_t stop;
+
+static void help(void);
+static int add_port(dev_type_t type);
+static int setup(void);
+static void cleanup(void);
+static int serve(pid_t child);
+static int run(char **argv, double *secs);
+static void reset_ports(void);
+static void port_input(port_t *port, uint64_t now);
+static void at_input(port_t *port, char *cmd);
+static void queue(port_t *port, char *buf, unsigned len, unsigned delay, uint64_t now);
+static void flush_port(port_t *port);
+static uint64_t now_ms(void);
+static void sig_handler(int sig);
+
+
+int main(int argc, char **argv)
+{
+  int i, err = 0;
+  unsigned u;
+  double secs, sum = 0, min = 0;
+  char **cmd = NULL;
+
+  opterr = 0;
+
+  while((i = getopt_long(argc, argv, "+hD:l:j:e:s:Sr:v", options, NULL)) != -1) {
+    switch(i) {
+      case 'D':
+        opt.dir = optarg;
+        break;
+
+      case 'l':
+        opt.latency = strtoul(optarg, NULL, 0);
+        break;
+
+      case 'j':
+        opt.jitter = strtoul(optarg, NULL, 0);
+        break;
+
+      case 'e':
+        opt.errors = strtoul(optarg, NULL, 0);
+        if(opt.errors > 100) opt.errors = 100;
+        break;
+
+      case 's':
+        opt.seed = strtoul(optarg, NULL, 0);
+        break;
+
+      case 'S':
+        opt.split = 1;
+        break;
+
+      case 'r':
+        opt.runs = strtoul(optarg, NULL, 0);
+        if(!opt.runs) opt.runs = 1;
+        break;
+
+      case 'v':
+        opt.verbose = 1;
+        break;
+
+      default:
+        help();
+        return 1;
+    }
+  }
+
+  for(; optind < argc; optind++) {
+    if(!strcmp(argv[optind], "--")) {
+      if(optind + 1 < argc) cmd = argv + optind + 1;
+      break;
+    }
+    for(u = 0; u < sizeof dev_names / sizeof *dev_names; u++) {
+      if(!strcmp(argv[optind], dev_names[u].name)) break;
+    }
+    if(u == sizeof dev_names / sizeof *dev_names) {
+      fprintf(stderr, "%s: unknown device type\n", argv[optind]);
+      return 1;
+    }
+    if(add_port(dev_names[u].type)) return 1;
+  }
+
+  if(!port_cnt) {
+    help();
+    return 1;
+  }
+
+  srand(opt.seed);
+
+  if(setup()) {
+    cleanup();
+    return 1;
+  }
+
+  if(!cmd) {
+    printf("LIBHD_SERIAL=%s LIBHD_SERIAL_DEV=%s/ttyS\n", serial_file, opt.dir);
+    fflush(stdout);
+    err = serve(0);
+  }
+  else {
+    for(u = 0; u < opt.runs && !stop; u++) {
+      reset_ports();
+      if((err = run(cmd, &secs))) break;
+      fprintf(stderr, "run %u: %.3f s\n", u + 1, secs);
+      sum += secs;
+      if(!u || secs < min) min = secs;
+    }
+    if(!err && u > 1) fprintf(stderr, "%u runs: min %.3f s, avg %.3f s\n", u, min, sum / u);
+  }
+
+  cleanup();
+
+  return err;
+}
+
+
+void help()
+{
+  fprintf(stderr,
+    "Usage: hwsersim [OPTIONS] DEVICE... [-- COMMAND [ARGS]]\n"
+    "Simulate serial devices on ptys for the libhd serial probes.\n"
+    "Devices (one serial line each, starting at 0):\n"
+    "  silent, modem, pnp-modem, ati0-modem, mouse, logitech, pnp-mouse,\n"
+    "  ht-braille\n"
+    "Options:\n"
+    "  -D, --dir DIR       put serial info & device links into DIR (default: temp dir)\n"
+    "  -l, --latency MS    answer after MS milliseconds\n"
+    "  -j, --jitter MS     add up to MS random milliseconds\n"
+    "  -e, --errors PCT    drop or garble PCT percent of all answers\n"
+    "  -s, --seed N        random seed (default: 1)\n"
+    "  -S, --split         send answers line by line, each after the latency\n"
+    "  -r, --runs N        run COMMAND N times and report its wall time\n"
+    "  -v, --verbose       log traffic\n"
+    "  -h, --help          show this text\n"
+    "Without COMMAND the environment for libhd is printed and the devices are\n"
+    "served until interrupted.\n"
+  );
+}
+
+
+int add_port(dev_type_t type)
+{
+  port_t *port;
+
+  if(port_cnt >= MAX_PORTS) {
+    fprintf(stderr, "too many devices (max. %u)\n", MAX_PORTS);
+    return 1;
+  }
+
+  port = ports + port_cnt++;
+  port->type = type;
+  port->master = port->slave = -1;
+
+  return 0;
+}
+
+
+/*
+ * Create ptys, device links and serial info file.
+ */
+int setup()
+{
+  static unsigned io[] = { 0x3f8, 0x2f8, 0x3e8, 0x2e8 };
+  port_t *port;
+  struct termios tio;
+  struct sigaction sa = { .sa_handler = sig_handler };
+  unsigned u;
+  char *s;
+  FILE *f;
+
+  if(!opt.dir) {
+    s = strdup("/tmp/hwsersim.XXXXXX");
+    if(!mkdtemp(s)) {
+      perror("mkdtemp");
+      free(s);
+      return 1;
+    }
+    opt.dir = s;
+    opt.tmp_dir = 1;
+  }
+  else if(mkdir(opt.dir, 0755) && errno != EEXIST) {
+    perror(opt.dir);
+    return 1;
+  }
+
+  for(u = 0; u < port_cnt; u++) {
+    port = ports + u;
+
+    port->master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if(
+      port->master == -1 ||
+      grantpt(port->master) ||
+      unlockpt(port->master) ||
+      !(s = ptsname(port->master))
+    ) {
+      perror("pty");
+      return 1;
+    }
+    port->pts = strdup(s);
+
+    /* keep the slave open: no hangup when the probe closes it */
+    port->slave = open(port->pts, O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if(port->slave == -1) {
+      perror(port->pts);
+      return 1;
+    }
+    if(!tcgetattr(port->slave, &tio)) {
+      cfmakeraw(&tio);
+      tcsetattr(port->slave, TCSANOW, &tio);
+    }
+
+    if(asprintf(&port->link, "%s/ttyS%u", opt.dir, u) == -1) return 1;
+    unlink(port->link);
+    if(symlink(port->pts, port->link)) {
+      perror(port->link);
+      free(port->link);
+      port->link = NULL;
+      return 1;
+    }
+
+    if(opt.verbose) fprintf(stderr, "%s -> %s: %s\n", port->link, port->pts, dev_names[port->type].name);
+  }
+
+  if(asprintf(&serial_file, "%s/serial", opt.dir) == -1) return 1;
+
+  if(!(f = fopen(serial_file, "w"))) {
+    perror(serial_file);
+    return 1;
+  }
+  fprintf(f, "serinfo:1.0 driver revision:\n");
+  for(u = 0; u < port_cnt; u++) {
+    fprintf(f, "%u: uart:16550A port:%08X irq:%u tx:0 rx:0\n",
+      u, u < sizeof io / sizeof *io ? io[u] : 0x1000 + 8 * u, u & 1 ? 3 : 4
+    );
+  }
+  fclose(f);
+
+  if(pipe2(sig_pipe, O_NONBLOCK | O_CLOEXEC)) {
+    perror("pipe");
+    return 1;
+  }
+
+  sigaction(SIGCHLD, &sa, NULL);
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+
+  return 0;
+}
+
+
+void cleanup()
+{
+  unsigned u;
+
+  for(u = 0; u < port_cnt; u++) {
+    if(ports[u].link) unlink(ports[u].link);
+    if(ports[u].slave != -1) close(ports[u].slave);
+    if(ports[u].master != -1) close(ports[u].master);
+    free(ports[u].link);
+    free(ports[u].pts);
+  }
+
+  if(serial_file) unlink(serial_file);
+  free(serial_file);
+
+  if(opt.tmp_dir) {
+    rmdir(opt.dir);
+    free(opt.dir);
+  }
+}
+
+
+/*
+ * Answer the probes until child (or, if 0, we) got terminated.
+ */
+int serve(pid_t child)
+{
+  struct pollfd pfd[MAX_PORTS + 1];
+  port_t *port;
+  uint64_t now, next;
+  unsigned u;
+  int i, timeout, status;
+  char c;
+
+  for(;;) {
+    if(child) {
+      while(read(sig_pipe[0], &c, 1) == 1);
+      if(waitpid(child, &status, WNOHANG) == child) {
+        return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+      }
+    }
+    else if(stop) {
+      return 0;
+    }
+
+    now = now_ms();
+    next = 0;
+
+    for(u = 0; u < port_cnt; u++) {
+      port = ports + u;
+      if(port->due && port->due <= now) flush_port(port);
+      if(port->due && (!next || port->due < next)) next = port->due;
+      pfd[u].fd = port->master;
+      pfd[u].events = POLLIN;
+    }
+    pfd[u].fd = sig_pipe[0];
+    pfd[u].events = POLLIN;
+
+    timeout = next ? next > now ? next - now : 0 : -1;
+
+    i = poll(pfd, port_cnt + 1, timeout);
+
+    if(i == -1) {
+      if(errno == EINTR) continue;
+      perror("poll");
+      return 1;
+    }
+
+    now = now_ms();
+
+    for(u = 0; u < port_cnt; u++) {
+      if((pfd[u].revents & POLLIN)) port_input(ports + u, now);
+    }
+  }
+}
+
+
+/*
+ * Run command once with libhd pointed at our devices.
+ */
+int run(char **argv, double *secs)
+{
+  pid_t pid;
+  int err;
+  uint64_t start;
+  char *s;
+
+  if(asprintf(&s, "%s/ttyS", opt.dir) == -1) return 1;
+  setenv("LIBHD_SERIAL_DEV", s, 1);
+  setenv("LIBHD_SERIAL", serial_file, 1);
+  free(s);
+
+  start = now_ms();
+
+  pid = fork();
+
+  if(pid == -1) {
+    perror("fork");
+    return 1;
+  }
+
+  if(!pid) {
+    execvp(*argv, argv);
+    perror(*argv);
+    _exit(127);
+  }
+
+  err = serve(pid);
+
+  *secs = (now_ms() - start) / 1000.0;
+
+  if(err) fprintf(stderr, "%s: exit code %d\n", *argv, err);
+
+  return err;
+}
+
+
+/*
+ * Forget everything from the last run.
+ */
+void reset_ports()
+{
+  unsigned u;
+
+  for(u = 0; u < port_cnt; u++) {
+    ports[u].line_len = 0;
+    ports[u].out_len = 0;
+    ports[u].due = 0;
+    tcflush(ports[u].master, TCIOFLUSH);
+  }
+}
+
+
+void port_input(port_t *port, uint64_t now)
+{
+  static char *mouse_id[] = {
+    [dev_mouse] = "M",
+    [dev_logitech] = "M3",
+    [dev_pnp_mouse] = "M(\x01$PNP0F0C\\\\MOUSE\\\\Simulated Mouse)"
+  };
+  char buf[256];
+  int i, j;
+
+  i = read(port->master, buf, sizeof buf);
+
+  if(i <= 0) return;
+
+  if(opt.verbose) fprintf(stderr, "%s < %d bytes\n", port->link, i);
+
+  switch(port->type) {
+    case dev_silent:
+      break;
+
+    case dev_modem:
+    case dev_pnp_modem:
+    case dev_ati0_modem:
+      for(j = 0; j < i; j++) {
+        if(buf[j] == '\r') {
+          port->line[port->line_len] = 0;
+          port->line_len = 0;
+          at_input(port, port->line);
+        }
+        else if(buf[j] != '\n' && port->line_len < sizeof port->line - 1) {
+          port->line[port->line_len++] = buf[j];
+        }
+      }
+      break;
+
+    case dev_mouse:
+    case dev_logitech:
+    case dev_pnp_mouse:
+      /* answer once the speed magic is over; pretend DTR was toggled */
+      if(memchr(buf, '*', i)) {
+        port->out_len = 0;
+        port->due = 0;
+        queue(port, mouse_id[port->type], strlen(mouse_id[port->type]), MOUSE_DELAY, now);
+      }
+      break;
+
+    case dev_ht_braille:
+      /* reset: answer with reset ok and the model id (Braille Wave) */
+      if(memchr(buf, 0xff, i)) queue(port, "\xfe\x09", 2, 0, now);
+      break;
+  }
+}
+
+
+/*
+ * Answer AT command.
+ */
+void at_input(port_t *port, char *cmd)
+{
+  static struct {
+    char *cmd, *resp;
+  } resp[] = {
+    { "", "" },
+    { "I", "56000" },
+    { "I0", "56000" },
+    { "I1", "255" },
+    { "I3", "Simulated 56K Modem Rev. 1.0" },
+    { "I4", "hwsersim" },
+    { "+FCLASS=?", "0,1,1.0,2" },
+    { "+GMI", "Simulated Modems Inc." },
+    { "+GMM", "SIM56K" },
+    { "+GMR", "1.0" }
+  };
+  char *s, *at = NULL, buf[512];
+  unsigned u;
+  int len;
+
+  /* there might be garbage before the command (e.g. from the mouse probe) */
+  for(s = cmd; (s = strcasestr(s, "AT")); s += 2) at = s;
+
+  if(!at) return;
+
+  cmd = at + 2;
+  while(*cmd == ' ') cmd++;
+
+  /* echo */
+  len = snprintf(buf, sizeof buf, "%s\r", at);
+
+  if(!strcasecmp(cmd, "I9")) {
+    len += snprintf(buf + len, sizeof buf - len, "%s\r\nOK\r\n",
+      port->type == dev_pnp_modem ? "(\x01$USR3090\\\\MODEM\\USR1234\\Sportster 56K)" : ""
+    );
+  }
+  else {
+    for(u = 0; u < sizeof resp / sizeof *resp; u++) {
+      if(!strcasecmp(cmd, resp[u].cmd)) break;
+    }
+    if(port->type == dev_ati0_modem && (!strcasecmp(cmd, "I") || !strcasecmp(cmd, "I0"))) {
+      /* product code only: looks like a numeric result code */
+      len += snprintf(buf + len, sizeof buf - len, "\r\n0\r\n\r\nOK\r\n");
+    }
+    else if(u < sizeof resp / sizeof *resp && *resp[u].resp) {
+      len += snprintf(buf + len, sizeof buf - len, "\r\n%s\r\n\r\nOK\r\n", resp[u].resp);
+    }
+    else {
+      len += snprintf(buf + len, sizeof buf - len, "\r\nOK\r\n");
+    }
+  }
+
+  if(len > (int) sizeof buf - 1) len = sizeof buf - 1;
+
+  queue(port, buf, len, 0, now_ms());
+}
+
+
+/*
+ * Add to pending response; it's sent delay + latency ms from now.
+ */
+void queue(port_t *port, char *buf, unsigned len, unsigned delay, uint64_t now)
+{
+  if(len > sizeof port->out - port->out_len) len = sizeof port->out - port->out_len;
+
+  memcpy(port->out + port->out_len, buf, len);
+  port->out_len += len;
+
+  if(!port->due) {
+    port->due = now + delay + opt.latency;
+    if(opt.jitter) port->due += rand() % (opt.jitter + 1);
+  }
+}
+
+
+/*
+ * Send pending response; maybe drop it or garble it.
+ *
+ * With --split only the first line is sent; the rest follows later.
+ */
+void flush_port(port_t *port)
+{
+  unsigned err = 0, len = port->out_len;
+  int i;
+
+  if(opt.split) {
+    for(len = 0; len < port->out_len; ) {
+      i = port->out[len++];
+      if((i == '\r' || i == '\n') && (len == port->out_len || port->out[len] != '\n')) break;
+    }
+  }
+
+  if(opt.errors && (unsigned) (rand() % 100) < opt.errors) {
+    err = 1 + (rand() & 1);
+    if(err == 2 && len) port->out[rand() % len] ^= 0x55;
+  }
+
+  if(opt.verbose) {
+    fprintf(stderr, "%s > %u bytes%s\n",
+      port->link, len, err == 1 ? " (dropped)" : err == 2 ? " (garbled)" : ""
+    );
+  }
+
+  if(err != 1 && len) {
+    i = write(port->master, port->out, len);
+    if(i != (int) len && opt.verbose) fprintf(stderr, "%s: write oops: %d/%u\n", port->link, i, len);
+  }
+
+  port->out_len -= len;
+  port->due = 0;
+
+  if(port->out_len) {
+    memmove(port->out, port->out + len, port->out_len);
+    port->due = now_ms() + (opt.latency ?: 1);
+  }
+}
+
+
+uint64_t now_ms()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec * 1000ull + ts.tv_nsec / 1000000;
+}
+
+
+void sig_handler(int sig)
+{
+  int err = errno;
+
+  if(sig != SIGCHLD) stop = 1;
+  if(write(sig_pipe[1], "", 1)) {}
+
+  errno = err;
+}
@@ -1,6 +1,6 @@
 #define MESSAGE_BUFFER 1024
-#define KEY 8024;
 #define PID_FILE "/var/run/hwscand.pid"
+#define SOCKET_NAME "/var/run/hwscand.sock"
 
 // WARNING NEEDS TO BE <= 9
 #define NR_COMMANDS 7
@@ -8,10 +8,11 @@
 static const char *command_args[] = { "block", "partition", "usb", "firewire", "pci", "pcmcia", "bluetooth" };
 static const int command_with_device[] = { 1, 1, 0, 0, 0, 0, 0 };
 
-typedef struct msgbuf {
-        long mtype;
-        char mtext[MESSAGE_BUFFER+1];
-} message;
+// messages are single datagrams:
+//   S<command><device>  queue hwscan command (index into command_args)
+//   C<command line>     run config command
+//   A<device>           watch device for media changes
+//   R<device>           stop watching device
 
 #define DEBUG 0
 
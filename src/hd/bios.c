@@ -118,6 +118,7 @@ int detect_smp_bios(hd_data_t *hd_data)
   hd_smbios_t *sm;
   hd_t *hd;
   int cpus;
+  unsigned u;
 
   if(!hd_data->bios_ram.data) return -1;	/* hd_scan_bios() not called */
 
@@ -139,9 +140,8 @@ int detect_smp_bios(hd_data_t *hd_data)
 
   /* look at smbios data in case there's no mp table */
   if(hd_data->smbios) {
-    for(sm = hd_data->smbios; sm; sm = sm->next) {
+    for(u = 0; (sm = smbios_get(hd_data, sm_processor, u)); u++) {
       if(
-        sm->any.type == sm_processor &&
         sm->processor.pr_type.id == 3 &&	/* cpu */
         sm->processor.cpu_status.id == 1	/* enabled */
       ) {
@@ -166,10 +166,12 @@ void hd_scan_bios(hd_data_t *hd_data)
   unsigned u, u1;
   memory_range_t mem;
   unsigned smp_ok;
+  int smbios_sysfs;
   vbe_info_t *vbe;
   vbe_mode_info_t *mi;
   hd_res_t *res;
   str_list_t *sl, *sl0;
+  unsigned pos;
 
   if(!hd_probe_feature(hd_data, pr_bios)) return;
 
@@ -359,15 +361,19 @@ void hd_scan_bios(hd_data_t *hd_data)
    */
   PROGRESS(2, 0, "rom");
 
+  /* the kernel knows better, and there's no /dev/mem needed */
+  smbios_sysfs = smbios_read_sysfs(hd_data, &bt->smbios_ver);
+
   if(hd_data->bios_rom.data) {
     get_pnp_support_status(&hd_data->bios_rom, bt);
-    smbios_get_info(hd_data, &hd_data->bios_rom, bt);
+    if(!smbios_sysfs) smbios_get_info(hd_data, &hd_data->bios_rom, bt);
     get_fsc_info(hd_data, &hd_data->bios_rom, bt);
-    add_panel_info(hd_data, bt);
-    add_mouse_info(hd_data, bt);
-    chk_vbox(hd_data);
   }
 
+  add_panel_info(hd_data, bt);
+  add_mouse_info(hd_data, bt);
+  chk_vbox(hd_data);
+
   PROGRESS(3, 0, "smp");
 
   smp_ok = 0;
@@ -440,7 +446,7 @@ void hd_scan_bios(hd_data_t *hd_data)
     vbe->ok = 0;
 
     if(!hd_data->klog) read_klog(hd_data);
-    for(sl = hd_data->klog; sl; sl = sl->next) {
+    for(pos = 0; (sl = klog_find(hd_data, "PCI", &pos)); ) {
       if(sscanf(sl->str, "<6>PCI: Using configuration type %u", &u) == 1) {
         hd_data->pci_config_type = u;
         ADD2LOG("  klog: pci config type %u\n", hd_data->pci_config_type);
@@ -609,12 +615,10 @@ unsigned char crc(unsigned char *mem, unsigned len)
 
 void smbios_get_info(hd_data_t *hd_data, memory_range_t *mem, bios_info_t *bt)
 {
-  unsigned u, u1, u2, ok, hlen = 0, ofs;
-  unsigned addr = 0, len = 0, scnt;
-  unsigned structs = 0, type, slen;
-  char *s;
+  unsigned u, ok, hlen = 0;
+  uint64_t addr = 0;
+  unsigned len = 0, structs = 0;
   memory_range_t memory;
-  hd_smbios_t *sm;
 
   if(!mem->data || mem->size < 0x10) return;
 
@@ -631,6 +635,20 @@ void smbios_get_info(hd_data_t *hd_data, memory_range_t *mem, bios_info_t *bt)
         break;
       }
     }
+    /* SMBIOS 3: 64 bit table address, no struct count */
+    if(memcmp(mem->data + u, "_SM3_", 5) == 0) {
+      hlen = mem->data[u + 6];
+      if(hlen < 0x18 || u + hlen > mem->size) continue;
+      addr = *(uint64_t *) (mem->data + u + 0x10);
+      len = *(unsigned *) (mem->data + u + 0x0c);
+      structs = 0;
+      /* we can only map the low 4 GB */
+      ok = crc(mem->data + u, hlen) == 0 && len && len < (1 << 24) && !(addr >> 32);
+      if(ok) {
+        bt->smbios_ver = (mem->data[u + 7] << 8) + mem->data[u + 8];
+        break;
+      }
+    }
     /* Also look for legacy DMI entry point */
     if(memcmp(mem->data + u, "_DMI_", 5) == 0) {
       hlen = 0x0f;
@@ -648,6 +666,7 @@ void smbios_get_info(hd_data_t *hd_data, memory_range_t *mem, bios_info_t *bt)
   if(!ok) return;
 
   hd_data->smbios = smbios_free(hd_data->smbios);
+  smbios_free_index(hd_data);
 
   memory.start = mem->start + u;
   memory.size = hlen;
@@ -661,59 +680,14 @@ void smbios_get_info(hd_data_t *hd_data, memory_range_t *mem, bios_info_t *bt)
   if(len >= 0x4000) {
     ADD2LOG(
       "  SMBIOS Structure Table at 0x%05x (size 0x%x)\n",
-      addr, len
+      memory.start, len
     );
   }
   else {
     dump_memory(hd_data, &memory, 0, "SMBIOS Structure Table");
   }
 
-  for(type = 0, u = 0, ofs = 0; u < structs && ofs + 3 < len; u++) {
-    type = memory.data[ofs];
-    slen = memory.data[ofs + 1];
-    if(ofs + slen > len || slen < 4) break;
-    sm = smbios_add_entry(&hd_data->smbios, new_mem(sizeof *sm));
-    sm->any.type = type;
-    sm->any.data_len = slen;
-    sm->any.data = new_mem(slen);
-    memcpy(sm->any.data, memory.data + ofs, slen);
-    sm->any.handle = memory.data[ofs + 2] + (memory.data[ofs + 3] << 8);
-    ADD2LOG("  type 0x%02x [0x%04x]: ", type, sm->any.handle);
-    if(slen) hd_log_hex(hd_data, 0, slen, sm->any.data);
-    ADD2LOG("\n");
-    if(type == sm_end) break;
-    ofs += slen;
-    u1 = ofs;
-    u2 = 1;
-    scnt = 0;
-    while(ofs + 1 < len) {
-      if(!memory.data[ofs]) {
-        if(ofs > u1) {
-          s = canon_str(memory.data + u1, strlen(memory.data + u1));
-          add_str_list(&sm->any.strings, s);
-          scnt++;
-          if(*s) ADD2LOG("       str%d: \"%s\"\n", scnt, s);
-          free_mem(s);
-          u1 = ofs + 1;
-          u2++;
-        }
-        if(!memory.data[ofs + 1]) {
-          ofs += 2;
-          break;
-        }
-      }
-      ofs++;
-    }
-  }
-
-  if(u != structs) {
-    if(type == sm_end) {
-      ADD2LOG("  smbios: stopped at end tag\n");
-    }
-    else {
-      ADD2LOG("  smbios oops: only %d of %d structs found\n", u, structs);
-    }
-  }
+  smbios_add_table(hd_data, memory.data, len, structs);
 
   memory.data = free_mem(memory.data);
 
@@ -730,12 +704,7 @@ void get_fsc_info(hd_data_t *hd_data, memory_range_t *mem, bios_info_t *bt)
 
   if(!mem->data || mem->size < 0x20) return;
 
-  for(sm = hd_data->smbios; sm; sm = sm->next) {
-    if(sm->any.type == sm_sysinfo) {
-      vendor = sm->sysinfo.manuf;
-      break;
-    }
-  }
+  if((sm = smbios_get(hd_data, sm_sysinfo, 0))) vendor = sm->sysinfo.manuf;
 
   vendor = vendor && !strcasecmp(vendor, "Fujitsu") ? "Fujitsu" : "Fujitsu Siemens";
 
@@ -812,13 +781,10 @@ void add_panel_info(hd_data_t *hd_data, bios_info_t *bt)
   vendor = name = version = NULL;
   width = height = 0;
 
-  for(sm = hd_data->smbios; sm; sm = sm->next) {
-    if(sm->any.type == sm_sysinfo) {
-      vendor = sm->sysinfo.manuf;
-      name = sm->sysinfo.product;
-      version = sm->sysinfo.version;
-      break;
-    }
+  if((sm = smbios_get(hd_data, sm_sysinfo, 0))) {
+    vendor = sm->sysinfo.manuf;
+    name = sm->sysinfo.product;
+    version = sm->sysinfo.version;
   }
 
   if(!vendor || !name) return;
@@ -867,30 +833,24 @@ void add_mouse_info(hd_data_t *hd_data, bios_info_t *bt)
   vendor = name = type = NULL;
   compat_vend = compat_dev = bus = 0;
 
-  for(sm = hd_data->smbios; sm; sm = sm->next) {
-    if(sm->any.type == sm_sysinfo) {
-      vendor = sm->sysinfo.manuf;
-      name = sm->sysinfo.product;
-    }
-    if(
-      sm->any.type == sm_mouse &&
-      !compat_vend	/* take the first entry */
-    ) {
-      compat_vend = compat_dev = bus = 0;
-      type = NULL;
-      
-      switch(sm->mouse.interface.id) {
-        case 4:	/* ps/2 */
-        case 7:	/* bus mouse (dell notebooks report this) */
-          bus = bus_ps2;
-          compat_vend = MAKE_ID(TAG_SPECIAL, 0x0200);
-          compat_dev = MAKE_ID(TAG_SPECIAL, sm->mouse.buttons == 3 ? 0x0007 : 0x0006);
-          break;
-      }
-      type = sm->mouse.mtype.name;
-      if(sm->mouse.mtype.id == 1) type = "Touch Pad";	/* Why??? */
-      if(sm->mouse.mtype.id == 2) type = NULL;		/* "Other" */
+  if((sm = smbios_get(hd_data, sm_sysinfo, 0))) {
+    vendor = sm->sysinfo.manuf;
+    name = sm->sysinfo.product;
+  }
+
+  /* take the first entry */
+  if((sm = smbios_get(hd_data, sm_mouse, 0))) {
+    switch(sm->mouse.interface.id) {
+      case 4:	/* ps/2 */
+      case 7:	/* bus mouse (dell notebooks report this) */
+        bus = bus_ps2;
+        compat_vend = MAKE_ID(TAG_SPECIAL, 0x0200);
+        compat_dev = MAKE_ID(TAG_SPECIAL, sm->mouse.buttons == 3 ? 0x0007 : 0x0006);
+        break;
     }
+    type = sm->mouse.mtype.name;
+    if(sm->mouse.mtype.id == 1) type = "Touch Pad";	/* Why??? */
+    if(sm->mouse.mtype.id == 2) type = NULL;		/* "Other" */
   }
 
   if(!vendor || !name) return;
@@ -917,10 +877,10 @@ void add_mouse_info(hd_data_t *hd_data, bios_info_t *bt)
 void chk_vbox(hd_data_t *hd_data)
 {
   hd_smbios_t *sm;
+  unsigned u;
 
-  for(sm = hd_data->smbios; sm; sm = sm->next) {
+  for(u = 0; (sm = smbios_get(hd_data, sm_sysinfo, u)); u++) {
     if(
-      sm->any.type == sm_sysinfo &&
       sm->sysinfo.product &&
       !strcmp(sm->sysinfo.product, "VirtualBox")
     ) {
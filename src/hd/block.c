@@ -16,6 +16,7 @@
 #include "hd_int.h"
 #include "hddb.h"
 #include "block.h"
+#include "index.h"
 #include "dvd.h"
 
 /**
@@ -32,13 +33,13 @@ static void add_cdrom_info(hd_data_t *hd_data, hd_t *hd);
 static void add_other_sysfs_info(hd_data_t *hd_data, hd_t *hd);
 static void add_ide_sysfs_info(hd_data_t *hd_data, hd_t *hd);
 static void add_scsi_sysfs_info(hd_data_t *hd_data, hd_t *hd, char *sf_dev);
-static void read_partitions(hd_data_t *hd_data);
+static int is_disk(hd_data_t *hd_data, char *sf_cdev, char *name);
+static int cmp_part_name(const void *p0, const void *p1);
 static void read_cdroms(hd_data_t *hd_data);
 static cdrom_info_t *new_cdrom_entry(cdrom_info_t **ci);
 static cdrom_info_t *get_cdrom_entry(cdrom_info_t *ci, int n);
 static void get_scsi_tape(hd_data_t *hd_data);
 static void get_generic_scsi_devs(hd_data_t *hd_data);
-static void add_disk_size(hd_data_t *hd_data, hd_t *hd);
 
 
 void hd_scan_sysfs_block(hd_data_t *hd_data)
@@ -50,8 +51,6 @@ void hd_scan_sysfs_block(hd_data_t *hd_data)
   /* some clean-up */
   remove_hd_entries(hd_data);
 
-  hd_data->disks = free_str_list(hd_data->disks);
-  hd_data->partitions = free_str_list(hd_data->partitions);
   hd_data->cdroms = free_str_list(hd_data->cdroms);
 
   if(hd_probe_feature(hd_data, pr_block_mods)) {
@@ -74,11 +73,7 @@ void hd_scan_sysfs_block(hd_data_t *hd_data)
 
   read_cdroms(hd_data);
 
-  PROGRESS(4, 0, "partition");
-
-  read_partitions(hd_data);
-
-  PROGRESS(5, 0, "get sysfs block dev data");
+  PROGRESS(4, 0, "get sysfs block dev data");
 
   get_block_devs(hd_data);
 
@@ -145,6 +140,10 @@ void get_block_devs(hd_data_t *hd_data)
 
   for(sf_class_e = sf_class; sf_class_e; sf_class_e = sf_class_e->next) {
     str_printf(&sf_cdev, 0, "%s/%s", sf_block_dir, sf_class_e->str);
+
+    /* not related to hd_data->only */
+    if(!hd_index_only_sysfs(hd_data, sf_cdev)) continue;
+
     ADD2LOG(
       "  block: name = %s, path = %s\n",
       sf_class_e->str,
@@ -241,7 +240,7 @@ void get_block_devs(hd_data_t *hd_data)
     else
 #endif
 
-    if((sl = search_str_list(hd_data->disks, hd_sysfs_name2_dev(sf_class_e->str)))) {
+    if(is_disk(hd_data, sf_cdev, hd_sysfs_name2_dev(sf_class_e->str))) {
       hd = add_hd_entry(hd_data, __LINE__, 0);
       hd->sub_class.id = sc_sdev_disk;
     }
@@ -400,25 +399,84 @@ char *hd_sysfs_find_driver(hd_data_t *hd_data, char *sysfs_id, int exact)
 }
 
 
+/*
+ * Partitions are the sysfs children of a disk that have a 'partition'
+ * attribute. Partitions of dm devices (kpartx) are holders with a 'part*'
+ * dm uuid instead.
+ */
 void add_partitions(hd_data_t *hd_data, hd_t *hd, char *path)
 {
   hd_t *hd1;
-  str_list_t *sl;
-  char *s;
-  size_t len;
-
-  s = hd->unix_dev_name + sizeof "/dev/" - 1;
-  len = strlen(s);
-  for(sl = hd_data->partitions; sl; sl = sl->next) {
-    if(!strncmp(sl->str, s, len)) {
-      hd1 = add_hd_entry(hd_data, __LINE__, 0);
-      hd1->base_class.id = bc_partition;
-      str_printf(&hd1->unix_dev_name, 0, "/dev/%s", sl->str);
-      hd1->attached_to = hd->idx;
-
-      str_printf(&hd1->sysfs_id, 0, "%s/%s", hd->sysfs_id, hd_sysfs_dev2_name(sl->str));
-    }
+  str_list_t *sf_part, *sf_part_e, *sf_holder, *sf_holder_e;
+  char *sf_dir = NULL, *s;
+
+  sf_part = read_dir(path, 'd');
+
+  for(sf_part_e = sf_part; sf_part_e; sf_part_e = sf_part_e->next) {
+    str_printf(&sf_dir, 0, "%s/%s", path, sf_part_e->str);
+    if(!get_sysfs_attr_by_path(sf_dir, "partition")) *sf_part_e->str = 0;
   }
+
+  str_printf(&sf_dir, 0, "%s/holders", path);
+  sf_holder = read_dir(sf_dir, 'l');
+
+  for(sf_holder_e = sf_holder; sf_holder_e; sf_holder_e = sf_holder_e->next) {
+    str_printf(&sf_dir, 0, "%s/holders/%s/dm", path, sf_holder_e->str);
+    s = get_sysfs_attr_by_path(sf_dir, "uuid");
+    if(!s || strncmp(s, "part", sizeof "part" - 1)) *sf_holder_e->str = 0;
+  }
+
+  sf_part = sort_str_list(sf_part, cmp_part_name);
+  sf_holder = sort_str_list(sf_holder, cmp_part_name);
+
+  for(sf_part_e = sf_part; sf_part_e; sf_part_e = sf_part_e->next) {
+    if(!*sf_part_e->str) continue;
+
+    hd1 = add_hd_entry(hd_data, __LINE__, 0);
+    hd1->base_class.id = bc_partition;
+    str_printf(&hd1->unix_dev_name, 0, "/dev/%s", hd_sysfs_name2_dev(sf_part_e->str));
+    hd1->attached_to = hd->idx;
+
+    str_printf(&hd1->sysfs_id, 0, "%s/%s", hd->sysfs_id, sf_part_e->str);
+  }
+
+  /* holders are block devices of their own, usually in /devices/virtual/block */
+  str_printf(&sf_dir, 0, "%s/holders", path);
+
+  for(sf_holder_e = sf_holder; sf_holder_e; sf_holder_e = sf_holder_e->next) {
+    if(!*sf_holder_e->str) continue;
+    if(!(s = hd_sysfs_id(hd_read_sysfs_link(sf_dir, sf_holder_e->str)))) continue;
+
+    hd1 = add_hd_entry(hd_data, __LINE__, 0);
+    hd1->base_class.id = bc_partition;
+    str_printf(&hd1->unix_dev_name, 0, "/dev/%s", hd_sysfs_name2_dev(sf_holder_e->str));
+    hd1->attached_to = hd->idx;
+
+    hd1->sysfs_id = new_str(s);
+  }
+
+  free_str_list(sf_part);
+  free_str_list(sf_holder);
+  free_mem(sf_dir);
+}
+
+
+/*
+ * Sort partitions by number, not alphabetically (sda2 before sda10).
+ */
+int cmp_part_name(const void *p0, const void *p1)
+{
+  char *s0 = (*(str_list_t **) p0)->str;
+  char *s1 = (*(str_list_t **) p1)->str;
+  size_t l0, l1;
+
+  for(l0 = strlen(s0); l0 && isdigit(s0[l0 - 1]); l0--);
+  for(l1 = strlen(s1); l1 && isdigit(s1[l1 - 1]); l1--);
+
+  if(l0 != l1 || strncmp(s0, s1, l0)) return strcmp(s0, s1);
+
+  return strtoul(s0 + l0, NULL, 10) < strtoul(s1 + l1, NULL, 10) ? -1 :
+    strtoul(s0 + l0, NULL, 10) > strtoul(s1 + l1, NULL, 10);
 }
 
 
@@ -493,7 +551,12 @@ void add_cdrom_info(hd_data_t *hd_data, hd_t *hd)
     hd_probe_feature(hd_data, pr_block_cdrom) &&
     hd_report_this(hd_data, hd)
   ) {
-    hd_read_cdrom_info(hd_data, hd);
+    if(hd_data->flags.lazy) {
+      hd->lazy.cdrom = 1;
+    }
+    else {
+      hd_read_cdrom_info(hd_data, hd);
+    }
   }
 }
 
@@ -538,7 +601,12 @@ void add_other_sysfs_info(hd_data_t *hd_data, hd_t *hd)
     }
   }
 
-  add_disk_size(hd_data, hd);
+  if(hd_data->flags.lazy) {
+    hd->lazy.size = 1;
+  }
+  else {
+    add_disk_size(hd_data, hd);
+  }
 }
 
 
@@ -682,7 +750,14 @@ void add_ide_sysfs_info(hd_data_t *hd_data, hd_t *hd)
     free_mem(fname);
   }
 
-  if(!size) add_disk_size(hd_data, hd);
+  if(!size) {
+    if(hd_data->flags.lazy) {
+      hd->lazy.size = 1;
+    }
+    else {
+      add_disk_size(hd_data, hd);
+    }
+  }
 }
 
 
@@ -935,16 +1010,21 @@ void add_scsi_sysfs_info(hd_data_t *hd_data, hd_t *hd, char *sf_dev)
     fd = open(hd->unix_dev_name, O_RDONLY | O_NONBLOCK);
     if(fd >= 0) {
 
-      str_printf(&pr_str, 0, "%s geo", hd->unix_dev_name);
-      PROGRESS(5, 1, pr_str);
-
-      if(hd_getdisksize(hd_data, hd->unix_dev_name, fd, &geo, &size) == 1) {
-        /* (low-level) unformatted disk */
-        hd->is.notready = 1;
+      if(hd_data->flags.lazy) {
+        hd->lazy.size = 1;
       }
+      else {
+        str_printf(&pr_str, 0, "%s geo", hd->unix_dev_name);
+        PROGRESS(5, 1, pr_str);
 
-      if(geo) add_res_entry(&hd->res, geo);
-      if(size) add_res_entry(&hd->res, size);
+        if(hd_getdisksize(hd_data, hd->unix_dev_name, fd, &geo, &size) == 1) {
+          /* (low-level) unformatted disk */
+          hd->is.notready = 1;
+        }
+
+        if(geo) add_res_entry(&hd->res, geo);
+        if(size) add_res_entry(&hd->res, size);
+      }
 
       str_printf(&pr_str, 0, "%s serial", hd->unix_dev_name);
       PROGRESS(5, 2, pr_str);
@@ -997,84 +1077,43 @@ void add_scsi_sysfs_info(hd_data_t *hd_data, hd_t *hd, char *sf_dev)
 }
 
 
-void read_partitions(hd_data_t *hd_data)
+/*
+ * Check whether a sysfs block device is a disk.
+ *
+ * Partitions have a 'partition' attribute, partitions of dm devices
+ * (kpartx) a 'part*' dm uuid. As in /proc/partitions, empty and hidden
+ * devices are left out.
+ */
+int is_disk(hd_data_t *hd_data, char *sf_cdev, char *name)
 {
-  str_list_t *sl, *sl0, *pl0 = NULL;
-  char buf[256], *s1, *name, *base;
-  char *last_base = new_str(" ");
-  char *last_name = new_str(" ");
-  int l, is_disk;
-
-  if(!(sl0 = read_file(PROC_PARTITIONS, 2, 0))) return;
+  char *sf_dm = NULL, *s;
+  uint64_t ul0, ul1;
+  int part;
 
-  if(hd_data->debug) {
-    ADD2LOG("----- "PROC_PARTITIONS" -----\n");
-    for(sl = sl0; sl; sl = sl->next) {
-      ADD2LOG("  %s", sl->str);
-    }
-    ADD2LOG("----- "PROC_PARTITIONS" end -----\n");
-  }
-
-  for(sl = sl0; sl; sl = sl->next) {
-    *buf = 0;
-    if(sscanf(sl->str, "%*s %*s %*s %255s", buf) > 0) {
-      if(*buf) add_str_list(&pl0, buf);
-    }
-  }
-
-  free_str_list(sl0);
-
-  for(is_disk = 1, sl = pl0; sl; sl = sl->next) {
-    base = sl->str;
-    l = strlen(base);
-    if(!l) continue;
-
-    s1 = base + l - 1;
-    while(isdigit(*s1) && s1 > base) s1--;
-    if(s1 == base) continue;
-
-    name = new_str(base);
-    s1[1] = 0;
-
-    if(!strcmp(last_base, base)) {
-      if(!strcmp(last_name, base)) is_disk = 0;
-    }
-    else {
-      is_disk = strncmp(last_name, base, strlen(last_name)) ? 1 : 0;
-    }
-
-    if(!search_str_list(hd_data->cdroms, name)) {
-      if(
-        strncmp(name, "loop", sizeof "loop" - 1) &&
-        (
-          hd_data->flags.list_md ||
-          (
-            strncmp(name, "md", sizeof "md" - 1) &&
-            strncmp(name, "dm-", sizeof "dm-" - 1)
-          )
-        )
-      ) {
-        add_str_list(is_disk ? &hd_data->disks : &hd_data->partitions, name);
-      }
-    }
-    free_mem(last_base);
-    free_mem(last_name);
-
-    last_base = new_str(base);
-    last_name = name; name = NULL;
-  }
+  if(
+    !strncmp(name, "loop", sizeof "loop" - 1) ||
+    (
+      !hd_data->flags.list_md &&
+      (
+        !strncmp(name, "md", sizeof "md" - 1) ||
+        !strncmp(name, "dm-", sizeof "dm-" - 1)
+      )
+    ) ||
+    search_str_list(hd_data->cdroms, name) ||
+    get_sysfs_attr_by_path(sf_cdev, "partition")
+  ) return 0;
 
-  free_mem(last_base);
-  free_mem(last_name);
+  if(
+    (hd_attr_uint(get_sysfs_attr_by_path(sf_cdev, "size"), &ul0, 0) && !ul0) ||
+    (hd_attr_uint(get_sysfs_attr_by_path(sf_cdev, "hidden"), &ul1, 0) && ul1)
+  ) return 0;
 
-  free_str_list(pl0);
+  str_printf(&sf_dm, 0, "%s/dm", sf_cdev);
+  s = get_sysfs_attr_by_path(sf_dm, "uuid");
+  part = s && !strncmp(s, "part", sizeof "part" - 1);
+  free_mem(sf_dm);
 
-  if(hd_data->debug) {
-    ADD2LOG("disks:\n");
-    for(sl = hd_data->disks; sl; sl = sl->next) ADD2LOG("  %s\n", sl->str);
-    ADD2LOG("partitions:\n");
-    for(sl = hd_data->partitions; sl; sl = sl->next) ADD2LOG("  %s\n", sl->str);
-  }
+  return !part;
 }
 
 
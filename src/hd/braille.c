@@ -9,28 +9,64 @@
 #include "hd.h"
 #include "hd_int.h"
 #include "braille.h"
+#include "serprobe.h"
 
 /**
  * @defgroup BRAILLEint Braille devices
  * @ingroup  libhdDEVint
  * @brief Braille displays functions
  *
+ * All ports are probed in parallel (see ser_probe_run()); every port tries
+ * the protocols in braille_proto[] until one finds a display.
+ *
  * @{
  */
 
 #if !defined(LIBHD_TINY) && !defined(__sparc__)
 
-static unsigned do_alva(hd_data_t *hd_data, char *dev_name, int cnt);
-static unsigned do_fhp(hd_data_t *hd_data, char *dev_name, unsigned baud, int cnt);
-static unsigned do_fhp_new(hd_data_t *hd_data, char *dev_name, int cnt);
-static unsigned do_ht(hd_data_t *hd_data, char *dev_name, int cnt);
-static unsigned do_baum(hd_data_t *hd_data, char *dev_name, int cnt);
+/* result, one per port */
+typedef struct {
+  unsigned hd_idx, vend, dev;
+} braille_id_t;
+
+static void braille_step(ser_probe_t *port, ser_probe_event_t event);
+static void braille_start(ser_probe_t *port);
+static void braille_found(ser_probe_t *port, unsigned dev);
+static void add_braille(hd_data_t *hd_data, ser_device_t *sm_list, braille_id_t *id);
+static void do_alva(ser_probe_t *port, ser_probe_event_t event);
+static void do_fhp(ser_probe_t *port, ser_probe_event_t event, speed_t baud);
+static void do_fhp_old(ser_probe_t *port, ser_probe_event_t event);
+static void do_fhp_el(ser_probe_t *port, ser_probe_event_t event);
+static void do_fhp_new(ser_probe_t *port, ser_probe_event_t event);
+static void do_ht(ser_probe_t *port, ser_probe_event_t event);
+static void do_baum(ser_probe_t *port, ser_probe_event_t event);
+
+/* in this order */
+static struct {
+  char *name;
+  enum probe_feature feature;
+  unsigned vend;
+  void (*step)(ser_probe_t *port, ser_probe_event_t event);
+} braille_proto[] = {
+  { "alva",    pr_braille_alva, 0x5001, do_alva    },
+  { "fhp_old", pr_braille_fhp,  0x5002, do_fhp_old },
+  { "fhp_el",  pr_braille_fhp,  0x5002, do_fhp_el  },
+  { "ht",      pr_braille_ht,   0x5003, do_ht      },
+  { "baum",    pr_braille_baum, 0x5004, do_baum    },
+  { "fhp new", pr_braille_fhp,  0x5002, do_fhp_new }
+};
+
+#define MAX_BRAILLE_PROTO	(sizeof braille_proto / sizeof *braille_proto)
+
+static ser_plugin_t braille_plugin = { "braille", 0, braille_step, NULL };
 
 void hd_scan_braille(hd_data_t *hd_data)
 {
-  hd_t *hd, *hd_tmp;
-  int cnt = 0;
-  unsigned *dev, *vend;
+  hd_t *hd;
+  ser_device_t *sm, *sm_next, *sm_list = NULL, **sm_last = &sm_list;
+  braille_id_t *ids, *id;
+  unsigned u, cnt = 0, len;
+  int fd;
 
   if(!hd_probe_feature(hd_data, pr_braille)) return;
 
@@ -39,11 +75,6 @@ void hd_scan_braille(hd_data_t *hd_data)
   /* some clean-up */
   remove_hd_entries(hd_data);
 
-  dev = hd_shm_add(hd_data, NULL, sizeof *dev);
-  vend = hd_shm_add(hd_data, NULL, sizeof *vend);
-
-  if(!dev || !vend) return;
-
   for(hd = hd_data->hd; hd; hd = hd->next) {
     if(
       hd->base_class.id == bc_comm &&
@@ -52,64 +83,157 @@ void hd_scan_braille(hd_data_t *hd_data)
       !hd->tag.skip_braille &&
       !has_something_attached(hd_data, hd)
     ) {
+      sm = *sm_last = new_mem(sizeof *sm);
+      sm_last = &sm->next;
+      sm->dev_name = new_str(hd->unix_dev_name);
+      sm->hd_idx = hd->idx;
+      sm->fd = -1;
       cnt++;
-      *dev = *vend = 0;
+    }
+  }
 
-      hd_fork(hd_data, 10, 10);
+  if(!sm_list) return;
 
-      if(hd_data->flags.forked) {
+  ids = new_mem(cnt * sizeof *ids);
 
-        if(hd_probe_feature(hd_data, pr_braille_alva)) {
-          PROGRESS(1, cnt, "alva");
-          *vend = MAKE_ID(TAG_SPECIAL, 0x5001);
-          *dev = do_alva(hd_data, hd->unix_dev_name, cnt);
-        }
+  hd_fork(hd_data, 10, 10);
 
-        if(!*dev && hd_probe_feature(hd_data, pr_braille_fhp)) {
-          PROGRESS(1, cnt, "fhp_old");
-          *vend = MAKE_ID(TAG_SPECIAL, 0x5002);
-          *dev = do_fhp(hd_data, hd->unix_dev_name, B19200, cnt);
-          if(!*dev) {
-            PROGRESS(1, cnt, "fhp_el");
-            *dev = do_fhp(hd_data, hd->unix_dev_name, B38400, cnt);
-          }
-        }
+  if(hd_data->flags.forked) {
+    PROGRESS(1, 0, "open");
 
-        if(!*dev && hd_probe_feature(hd_data, pr_braille_ht)) {
-          PROGRESS(1, cnt, "ht");
-          *vend = MAKE_ID(TAG_SPECIAL, 0x5003);
-          *dev = do_ht(hd_data, hd->unix_dev_name, cnt);
-        }
+    for(sm = sm_list; sm; sm = sm->next) {
+      if((fd = open(sm->dev_name, O_RDWR | O_NONBLOCK | O_NOCTTY)) >= 0) {
+        sm->fd = fd;
+        tcgetattr(fd, &sm->tio);	/* save current settings */
+      }
+    }
 
-        if(!*dev && hd_probe_feature(hd_data, pr_braille_baum)) {
-          PROGRESS(1, cnt, "baum");
-          *vend = MAKE_ID(TAG_SPECIAL, 0x5004);
-          *dev = do_baum(hd_data, hd->unix_dev_name, cnt);
-        }
+    ser_probe_run(hd_data, sm_list, &braille_plugin, ids);
 
-        if(!*dev && hd_probe_feature(hd_data, pr_braille_fhp)) {
-          PROGRESS(1, cnt, "fhp new");
-          *vend = MAKE_ID(TAG_SPECIAL, 0x5002);
-          *dev = do_fhp_new(hd_data, hd->unix_dev_name, cnt);
-        }
+    /* results were passed on as they came in, see braille_found() */
+    for(sm = sm_list; sm; sm = sm->next) {
+      if(sm->fd >= 0) close(sm->fd);
+    }
+  }
+  else {
+    for(u = 0, id = NULL; u < cnt && (id = hd_shm_get(hd_data, shm_braille, id, &len)); ) {
+      if(len == sizeof *id) ids[u++] = *id;
+    }
+  }
 
-      }
+  hd_fork_done(hd_data);
 
-      hd_fork_done(hd_data);
+  for(u = 0; u < cnt; u++) add_braille(hd_data, sm_list, ids + u);
 
-      if(*dev && *vend) {
-        hd_tmp = add_hd_entry(hd_data, __LINE__, 0);
-        hd_tmp->base_class.id = bc_braille;
-        hd_tmp->bus.id = bus_serial;
-        hd_tmp->unix_dev_name = new_str(hd->unix_dev_name);
-        hd_tmp->attached_to = hd->idx;
-        hd_tmp->vendor.id = *vend;
-        hd_tmp->device.id = *dev;
-      }
+  hd_shm_clean(hd_data);
+
+  free_mem(ids);
+
+  for(sm = sm_list; sm; sm = sm_next) {
+    sm_next = sm->next;
+    free_mem(sm->dev_name);
+    free_mem(sm);
+  }
+}
+
+
+/*
+ * Probe one port.
+ *
+ * port->count is the current protocol, port->state its state.
+ */
+void braille_step(ser_probe_t *port, ser_probe_event_t event)
+{
+  if(event == sp_start) {
+    if(port->sm->fd < 0) {
+      ser_probe_done(port);
     }
+    else {
+      port->count = 0;
+      braille_start(port);
+    }
+    return;
   }
 
-  hd_shm_clean(hd_data);
+  braille_proto[port->count].step(port, event);
+}
+
+
+/*
+ * Start protocol port->count or the next enabled one after it.
+ */
+void braille_start(ser_probe_t *port)
+{
+  hd_data_t *hd_data = port->hd_data;
+
+  for(; port->count < MAX_BRAILLE_PROTO; port->count++) {
+    if(!hd_probe_feature(hd_data, braille_proto[port->count].feature)) continue;
+
+    PROGRESS(1, port->index, braille_proto[port->count].name);
+
+    port->state = 0;
+    port->max_len = 0;
+    port->timer = 0;
+    ser_probe_clear(port);
+    braille_proto[port->count].step(port, sp_start);
+
+    return;
+  }
+
+  ser_probe_done(port);
+}
+
+
+/*
+ * Protocol finished; dev is 0 if there was no display.
+ *
+ * A display is passed to the parent right away: if another port makes the
+ * child time out, it's not lost.
+ */
+void braille_found(ser_probe_t *port, unsigned dev)
+{
+  hd_data_t *hd_data = port->hd_data;
+  ser_device_t *sm = port->sm;
+  braille_id_t *id = (braille_id_t *) port->arg + port->index - 1;
+
+  /* reset serial lines */
+  tcflush(sm->fd, TCIOFLUSH);
+  tcsetattr(sm->fd, TCSAFLUSH, &sm->tio);
+
+  if(dev) {
+    id->hd_idx = sm->hd_idx;
+    id->vend = MAKE_ID(TAG_SPECIAL, braille_proto[port->count].vend);
+    id->dev = dev;
+    hd_shm_add(hd_data, shm_braille, id, sizeof *id);
+    ser_probe_done(port);
+  }
+  else {
+    port->count++;
+    braille_start(port);
+  }
+}
+
+
+void add_braille(hd_data_t *hd_data, ser_device_t *sm_list, braille_id_t *id)
+{
+  hd_t *hd;
+  ser_device_t *sm;
+
+  if(!id->dev || !id->vend) return;
+
+  for(sm = sm_list; sm; sm = sm->next) {
+    if(sm->hd_idx == id->hd_idx) break;
+  }
+
+  if(!sm) return;
+
+  hd = add_hd_entry(hd_data, __LINE__, 0);
+  hd->base_class.id = bc_braille;
+  hd->bus.id = bus_serial;
+  hd->unix_dev_name = new_str(sm->dev_name);
+  hd->attached_to = sm->hd_idx;
+  hd->vendor.id = id->vend;
+  hd->device.id = id->dev;
 }
 
 
@@ -127,25 +251,17 @@ void hd_scan_braille(hd_data_t *hd_data)
 #define BRL_ID	"\033ID="
 
 
-#define WAIT_DTR	700000
-#define WAIT_FLUSH	200
+#define WAIT_DTR	700	/* ms */
+#define WAIT_FLUSH	200	/* us */
 
-unsigned do_alva(hd_data_t *hd_data, char *dev_name, int cnt)
+void do_alva(ser_probe_t *port, ser_probe_event_t event)
 {
-  int fd, i, timeout = 100;
-  struct termios oldtio, newtio;		/* old & new terminal settings */
+  hd_data_t *hd_data = port->hd_data;
+  ser_device_t *sm = port->sm;
+  struct termios newtio;		/* new terminal settings */
   int model = -1;
-  unsigned char buffer[sizeof BRL_ID];
   unsigned dev = 0;
 
-  PROGRESS(2, cnt, "alva open");
-
-  /* Open the Braille display device for random access */
-  fd = open(dev_name, O_RDWR | O_NOCTTY);
-  if(fd < 0) return 0;
-
-  tcgetattr(fd, &oldtio);	/* save current settings */
-
   /* Set flow control and 8n1, enable reading */
   memset(&newtio, 0, sizeof newtio);
   newtio.c_cflag = CRTSCTS | CS8 | CLOCAL | CREAD;
@@ -156,55 +272,67 @@ unsigned do_alva(hd_data_t *hd_data, char *dev_name, int cnt)
   newtio.c_cc[VMIN] = 0;	/* set nonblocking read */
   newtio.c_cc[VTIME] = 0;
 
-  PROGRESS(3, cnt, "alva init ok");
-
-  PROGRESS(4, cnt, "alva read data");
-
-  /* autodetecting ABT model */
-  /* to force DTR off */
-  cfsetispeed(&newtio, B0);
-  cfsetospeed(&newtio, B0);
-  tcsetattr(fd, TCSANOW, &newtio);	/* activate new settings */
-  usleep(WAIT_DTR);
-
-  tcflush(fd, TCIOFLUSH);		/* clean line */
-  usleep(WAIT_FLUSH);
-
-  /* DTR back on */
-  cfsetispeed(&newtio, B9600);
-  cfsetospeed(&newtio, B9600);
-  tcsetattr(fd, TCSANOW, &newtio);	/* activate new settings */
-  usleep(WAIT_DTR);			/* give time to send ID string */
-
-  if((i = read(fd, buffer, sizeof buffer)) == sizeof buffer) {
-    if(!strncmp(buffer, BRL_ID, sizeof BRL_ID - 1)) {
-      /* Find out which model we are connected to... */
-      switch(model = buffer[sizeof buffer - 1])
-      {
-        case    1:
-        case    2:
-        case    3:
-        case    4:
-        case 0x0b:
-        case 0x0d:
-        case 0x0e:
-         dev = MAKE_ID(TAG_SPECIAL, model);
-         break;
+  switch(port->state) {
+    case 0:
+      PROGRESS(4, port->index, "alva read data");
+
+      /* autodetecting ABT model */
+      /* to force DTR off */
+      cfsetispeed(&newtio, B0);
+      cfsetospeed(&newtio, B0);
+      tcsetattr(sm->fd, TCSANOW, &newtio);	/* activate new settings */
+
+      port->state = 1;
+      ser_probe_timer(port, WAIT_DTR);
+      break;
+
+    case 1:
+      if(event != sp_timeout) break;
+
+      tcflush(sm->fd, TCIOFLUSH);		/* clean line */
+      usleep(WAIT_FLUSH);
+      ser_probe_clear(port);
+
+      /* DTR back on */
+      cfsetispeed(&newtio, B9600);
+      cfsetospeed(&newtio, B9600);
+      tcsetattr(sm->fd, TCSANOW, &newtio);	/* activate new settings */
+
+      port->max_len = sizeof BRL_ID;
+      port->state = 2;
+      ser_probe_timer(port, WAIT_DTR);		/* give time to send ID string */
+      break;
+
+    case 2:
+      /* wait for the ID string */
+      if(event == sp_input && (unsigned) sm->buf_len < port->max_len) break;
+
+      if(sm->buf_len == sizeof BRL_ID) {
+        if(!strncmp((char *) sm->buf, BRL_ID, sizeof BRL_ID - 1)) {
+          /* Find out which model we are connected to... */
+          switch(model = sm->buf[sizeof BRL_ID - 1])
+          {
+            case    1:
+            case    2:
+            case    3:
+            case    4:
+            case 0x0b:
+            case 0x0d:
+            case 0x0e:
+             dev = MAKE_ID(TAG_SPECIAL, model);
+             break;
+          }
+        }
       }
-    }
-  }
-  ADD2LOG("alva.%d@%s[%d]: ", timeout, dev_name, i);
-  if(i > 0) hd_log_hex(hd_data, 1, i, buffer);
-  ADD2LOG("\n");
+      ADD2LOG("alva@%s[%d]: ", sm->dev_name, sm->buf_len);
+      if(sm->buf_len > 0) hd_log_hex(hd_data, 1, sm->buf_len, sm->buf);
+      ADD2LOG("\n");
 
-  PROGRESS(5, cnt, "alva read done");
+      PROGRESS(5, port->index, "alva read done");
 
-  /* reset serial lines */
-  tcflush(fd, TCIOFLUSH);
-  tcsetattr(fd, TCSAFLUSH, &oldtio);
-  close(fd);
-
-  return dev;
+      braille_found(port, dev);
+      break;
+  }
 }
 
 
@@ -218,89 +346,100 @@ unsigned do_alva(hd_data_t *hd_data, char *dev_name, int cnt)
  * Foundation.  Please see the file COPYING for details.
  */
 
-unsigned do_fhp(hd_data_t *hd_data, char *dev_name, unsigned baud, int cnt)
+void do_fhp(ser_probe_t *port, ser_probe_event_t event, speed_t baud)
 {
-  int fd, i;
+  hd_data_t *hd_data = port->hd_data;
+  ser_device_t *sm = port->sm;
   char crash[] = { 2, 'S', 0, 0, 0, 0 };
-  unsigned char buf[10];
-  struct termios oldtio, newtio;	/* old & new terminal settings */
+  unsigned char *buf = sm->buf;
+  struct termios newtio;		/* new terminal settings */
   unsigned dev;
+  int i;
 
-  PROGRESS(2, cnt, "fhp open");
-
-  /* Now open the Braille display device for random access */
-  fd = open(dev_name, O_RDWR | O_NOCTTY);
-  if(fd < 0) return 0;
-
-  tcgetattr(fd, &oldtio);	/* save current settings */
-
-  /* Set bps, flow control and 8n1, enable reading */
-  memset(&newtio, 0, sizeof newtio);
-  newtio.c_cflag = baud | CS8 | CLOCAL | CREAD;
-
-  /* Ignore bytes with parity errors and make terminal raw and dumb */
-  newtio.c_iflag = IGNPAR;
-  newtio.c_oflag = 0;				/* raw output */
-  newtio.c_lflag = 0;				/* don't echo or generate signals */
-  newtio.c_cc[VMIN] = 0;			/* set nonblocking read */
-  newtio.c_cc[VTIME] = 0;
-  tcflush(fd, TCIFLUSH);			/* clean line */
-  tcsetattr(fd, TCSANOW, &newtio);		/* activate new settings */
-
-  PROGRESS(3, cnt, "fhp init ok");
-
-  crash[2] = 0x200 >> 8;
-  crash[3] = 0x200 & 0xff;
-  crash[5] = (7+10) & 0xff;
-
-  write(fd, crash, sizeof crash);
-  write(fd, "1111111111",10);
-  write(fd, "\03", 1);
-
-  crash[2] = 0x0 >> 8;
-  crash[3] = 0x0 & 0xff;
-  crash[5] = 5 & 0xff;
-
-  write(fd, crash, sizeof crash);
-  write(fd, "1111111111", 10);
-  write(fd, "\03", 1);
-
-  usleep(500000);		/* 100000 should be enough */
-
-  PROGRESS(4, cnt, "fhp write ok");
-
-  i = read(fd, &buf, 10);
+  switch(port->state) {
+    case 0:
+      /* Set bps, flow control and 8n1, enable reading */
+      memset(&newtio, 0, sizeof newtio);
+      newtio.c_cflag = baud | CS8 | CLOCAL | CREAD;
+
+      /* Ignore bytes with parity errors and make terminal raw and dumb */
+      newtio.c_iflag = IGNPAR;
+      newtio.c_oflag = 0;				/* raw output */
+      newtio.c_lflag = 0;				/* don't echo or generate signals */
+      newtio.c_cc[VMIN] = 0;			/* set nonblocking read */
+      newtio.c_cc[VTIME] = 0;
+      tcflush(sm->fd, TCIFLUSH);			/* clean line */
+      tcsetattr(sm->fd, TCSANOW, &newtio);		/* activate new settings */
+
+      PROGRESS(3, port->index, "fhp init ok");
+
+      crash[2] = 0x200 >> 8;
+      crash[3] = 0x200 & 0xff;
+      crash[5] = (7+10) & 0xff;
+
+      ser_probe_write(port, crash, sizeof crash);
+      write(sm->fd, "1111111111",10);
+      write(sm->fd, "\03", 1);
+
+      crash[2] = 0x0 >> 8;
+      crash[3] = 0x0 & 0xff;
+      crash[5] = 5 & 0xff;
+
+      write(sm->fd, crash, sizeof crash);
+      write(sm->fd, "1111111111", 10);
+      write(sm->fd, "\03", 1);
+
+      PROGRESS(4, port->index, "fhp write ok");
+
+      port->max_len = 10;
+      port->state = 1;
+      ser_probe_timer(port, 500);		/* 100 should be enough */
+      break;
+
+    case 1:
+      if(event == sp_input && (unsigned) sm->buf_len < port->max_len) break;
+
+      i = sm->buf_len;
+
+      PROGRESS(5, port->index, "fhp read done");
+
+      ADD2LOG("fhp@%s[%d]: ", sm->dev_name, i);
+      if(i > 0) hd_log_hex(hd_data, 1, i, buf);
+      ADD2LOG("\n");
+
+      dev = 0;
+      if(i == 10 && buf[0] == 0x02 && buf[1] == 0x49) {
+        switch(buf[2]) {
+          case  1:
+          case  2:
+          case  3:
+          case 64:
+          case 65:
+          case 66:
+          case 67:
+          case 68:
+            dev = buf[2];
+            dev = MAKE_ID(TAG_SPECIAL, dev);
+            break;
+        }
+      }
+      if(!dev) ADD2LOG("no fhp display: 0x%02x\n", i >= 2 ? buf[2] : 0);
 
-  PROGRESS(5, cnt, "fhp read done");
+      braille_found(port, dev);
+      break;
+  }
+}
 
-  ADD2LOG("fhp@%s[%d]: ", dev_name, i);
-  if(i > 0) hd_log_hex(hd_data, 1, i, buf);
-  ADD2LOG("\n");
 
-  dev = 0;
-  if(i == 10 && buf[0] == 0x02 && buf[1] == 0x49) {
-    switch(buf[2]) {
-      case  1:
-      case  2:
-      case  3:
-      case 64:
-      case 65:
-      case 66:
-      case 67:
-      case 68:
-        dev = buf[2];
-        dev = MAKE_ID(TAG_SPECIAL, dev);
-        break;
-    }
-  }
-  if(!dev) ADD2LOG("no fhp display: 0x%02x\n", i >= 2 ? buf[2] : 0);
+void do_fhp_old(ser_probe_t *port, ser_probe_event_t event)
+{
+  do_fhp(port, event, B19200);
+}
 
-  /* reset serial lines */
-  tcflush(fd, TCIOFLUSH);
-  tcsetattr(fd, TCSAFLUSH, &oldtio);
-  close(fd);
 
-  return dev;
+void do_fhp_el(ser_probe_t *port, ser_probe_event_t event)
+{
+  do_fhp(port, event, B38400);
 }
 
 
@@ -314,98 +453,115 @@ unsigned do_fhp(hd_data_t *hd_data, char *dev_name, unsigned baud, int cnt)
  * Foundation.  Please see the file COPYING for details.
 */
 
-unsigned do_ht(hd_data_t *hd_data, char *dev_name, int cnt)
+void do_ht(ser_probe_t *port, ser_probe_event_t event)
 {
-  int fd, i;
-  unsigned char code = 0xff, buf[2] = { 0, 0 };
-  struct termios oldtio, newtio;
+  hd_data_t *hd_data = port->hd_data;
+  ser_device_t *sm = port->sm;
+  unsigned char code = 0xff, *buf = sm->buf;
+  struct termios newtio;
   unsigned dev = 0;
+  int i = 0;
+
+  switch(port->state) {
+    case 0:
+      newtio = sm->tio;
+      newtio.c_cflag = CLOCAL | PARODD | PARENB | CREAD | CS8;
+      newtio.c_iflag = IGNPAR;
+      newtio.c_oflag = 0;
+      newtio.c_lflag = 0;
+      newtio.c_cc[VMIN] = 0;
+      newtio.c_cc[VTIME] = 0;
+
+      /*
+       * Force down DTR, flush any pending data and then the port to what we
+       * want it to be
+       */
+      if(
+        cfsetispeed(&newtio, B0) ||
+        cfsetospeed(&newtio, B0) ||
+        tcsetattr(sm->fd, TCSANOW, &newtio) ||
+        tcflush(sm->fd, TCIOFLUSH) ||
+        cfsetispeed(&newtio, B19200) ||
+        cfsetospeed(&newtio, B19200) ||
+        tcsetattr(sm->fd, TCSANOW, &newtio)
+      ) {
+        ADD2LOG("ht@%s[0]: \n", sm->dev_name);
+        ADD2LOG("no ht display: 0x%02x\n", 0);
+        braille_found(port, 0);
+        break;
+      }
 
-  PROGRESS(2, cnt, "ht open");
+      /* Pause 20ms to let them take effect */
+      port->state = 1;
+      ser_probe_timer(port, 20);
+      break;
 
-  fd = open(dev_name, O_RDWR | O_NOCTTY);
-  if(fd < 0) return 0;
+    case 1:
+      if(event != sp_timeout) break;
 
-  tcgetattr(fd, &oldtio);
+      PROGRESS(3, port->index, "ht init ok");
 
-  newtio = oldtio;
-  newtio.c_cflag = CLOCAL | PARODD | PARENB | CREAD | CS8;
-  newtio.c_iflag = IGNPAR;
-  newtio.c_oflag = 0;
-  newtio.c_lflag = 0;
-  newtio.c_cc[VMIN] = 0;
-  newtio.c_cc[VTIME] = 0;
+      ser_probe_write(port, &code, 1);	/* reset brl */
 
-  i = 0;
-  /*
-   * Force down DTR, flush any pending data and then the port to what we
-   * want it to be
-   */
-  if(
-    !(
-      cfsetispeed(&newtio, B0) ||
-      cfsetospeed(&newtio, B0) ||
-      tcsetattr(fd, TCSANOW, &newtio) ||
-      tcflush(fd, TCIOFLUSH) ||
-      cfsetispeed(&newtio, B19200) ||
-      cfsetospeed(&newtio, B19200) ||
-      tcsetattr(fd, TCSANOW, &newtio)
-    )
-  ) {
-    /* Pause 20ms to let them take effect */
-    usleep(20 * 1000);
-
-    PROGRESS(3, cnt, "ht init ok");
-
-    write(fd, &code, 1);	/* reset brl */
-    usleep(40 * 1000);		/* wait for reset */
-
-    PROGRESS(4, cnt, "ht write ok");
-
-    read(fd, buf, 1);
-    i = 1;
-
-    PROGRESS(5, cnt, "ht read done");
-
-    if(buf[0] == 0xfe) {	/* resetok now read id */
-      usleep(80 * 1000);
-      read(fd, buf + 1, 1);
-      i = 2;
+      PROGRESS(4, port->index, "ht write ok");
+
+      port->max_len = 1;
+      port->state = 2;
+      ser_probe_timer(port, 40);		/* wait for reset */
+      break;
 
-      PROGRESS(6, cnt, "ht read done");
+    case 2:
+      if(event == sp_input && (unsigned) sm->buf_len < port->max_len) break;
+
+      PROGRESS(5, port->index, "ht read done");
+
+      if(buf[0] == 0xfe) {	/* resetok now read id */
+        port->max_len = 2;
+        port->state = 3;
+        ser_probe_timer(port, 80);
+        break;
+      }
+
+      i = 1;
+      break;
+
+    case 3:
+      if(event == sp_input && (unsigned) sm->buf_len < port->max_len) break;
+
+      PROGRESS(6, port->index, "ht read done");
 
       switch(buf[1]) {
-  	case 0x05:
-  	case 0x09:
-  	case 0x36:
-  	case 0x38:
-  	case 0x44:
-  	case 0x72:
-  	case 0x74:
-  	case 0x78:
-  	case 0x80:
-  	case 0x84:
-  	case 0x88:
-  	case 0x89:
+        case 0x05:
+        case 0x09:
+        case 0x36:
+        case 0x38:
+        case 0x44:
+        case 0x72:
+        case 0x74:
+        case 0x78:
+        case 0x80:
+        case 0x84:
+        case 0x88:
+        case 0x89:
           dev = buf[1];
           dev = MAKE_ID(TAG_SPECIAL, dev);
           break;
       }
-    }
+
+      i = 2;
+      break;
   }
 
-  ADD2LOG("ht@%s[%d]: ", dev_name, i);
-  if(i > 0) hd_log_hex(hd_data, 1, i, buf);
+  /* bytes read; 0 while we're still waiting */
+  if(!i) return;
+
+  ADD2LOG("ht@%s[%d]: ", sm->dev_name, i);
+  hd_log_hex(hd_data, 1, i, buf);
   ADD2LOG("\n");
 
   if(!dev) ADD2LOG("no ht display: 0x%02x\n", buf[1]);
 
-  /* reset serial lines */
-  tcflush(fd, TCIOFLUSH);
-  tcsetattr(fd, TCSAFLUSH, &oldtio);
-  close(fd);
-
-  return dev;
+  braille_found(port, dev);
 }
 
 
@@ -422,159 +578,165 @@ unsigned do_ht(hd_data_t *hd_data, char *dev_name, int cnt)
 #define BAUDRATE	B19200		/* But both run at 19k2 */
 #define MAXREAD		18
 
-unsigned do_baum(hd_data_t *hd_data, char *dev_name, int cnt)
+void do_baum(ser_probe_t *port, ser_probe_event_t event)
 {
   static char device_id[] = { 0x1b, 0x84 };
-  int fd;
-  struct termios oldtio, curtio;
-  unsigned char buf[MAXREAD + 1];
+  hd_data_t *hd_data = port->hd_data;
+  ser_device_t *sm = port->sm;
+  struct termios curtio;
+  char *buf = (char *) sm->buf;
+  unsigned dev = 0;
   int i;
 
-  PROGRESS(2, cnt, "baum open");
-
-  fd = open(dev_name, O_RDWR | O_NOCTTY);
-  if(fd < 0) return 0;
-
-  tcgetattr(fd, &curtio);
-
-  oldtio = curtio;
-  cfmakeraw(&curtio);
+  switch(port->state) {
+    case 0:
+      curtio = sm->tio;
+      cfmakeraw(&curtio);
 
-  /* no SIGTTOU to backgrounded processes */
-  curtio.c_lflag &= ~TOSTOP;
-  curtio.c_cflag = BAUDRATE | CS8 | CLOCAL | CREAD;
-  /* no input parity check, no XON/XOFF */
-  curtio.c_iflag &= ~(INPCK | ~IXOFF);
+      /* no SIGTTOU to backgrounded processes */
+      curtio.c_lflag &= ~TOSTOP;
+      curtio.c_cflag = BAUDRATE | CS8 | CLOCAL | CREAD;
+      /* no input parity check, no XON/XOFF */
+      curtio.c_iflag &= ~(INPCK | ~IXOFF);
 
-  curtio.c_cc[VTIME] = 2;	/* 0.1s timeout between chars on input */
-  curtio.c_cc[VMIN] = 0;	/* no minimum input */
+      curtio.c_cc[VTIME] = 2;	/* 0.1s timeout between chars on input */
+      curtio.c_cc[VMIN] = 0;	/* no minimum input */
 
-  tcsetattr(fd, TCSAFLUSH, &curtio);
+      tcsetattr(sm->fd, TCSAFLUSH, &curtio);
 
-  /* write ID-request */
-  write(fd, device_id, sizeof device_id);
+      /* write ID-request */
+      ser_probe_write(port, device_id, sizeof device_id);
 
-  /* wait for response */
-  usleep(250000);
+      PROGRESS(3, port->index, "baum write ok");
 
-  PROGRESS(3, cnt, "baum write ok");
+      /* wait for response */
+      port->max_len = MAXREAD;
+      port->state = 1;
+      ser_probe_timer(port, 250);
+      break;
 
-  i = read(fd, buf, sizeof buf - 1);
-  buf[sizeof buf - 1] = 0;
+    case 1:
+      if(event == sp_input && (unsigned) sm->buf_len < port->max_len) break;
 
-  PROGRESS(4, cnt, "baum read done");
+      i = sm->buf_len;
 
-  ADD2LOG("baum@%s[%d]: ", dev_name, i);
-  if(i > 0) hd_log_hex(hd_data, 1, i, buf);
-  ADD2LOG("\n");
+      PROGRESS(4, port->index, "baum read done");
 
-  /* reset serial lines */
-  tcflush(fd, TCIOFLUSH);
-  tcsetattr(fd, TCSAFLUSH, &oldtio);
-  close(fd);
+      ADD2LOG("baum@%s[%d]: ", sm->dev_name, i);
+      if(i > 0) hd_log_hex(hd_data, 1, i, sm->buf);
+      ADD2LOG("\n");
 
-  if(!strcmp(buf + 2, "Baum Vario40")) return MAKE_ID(TAG_SPECIAL, 1);
-  if(!strcmp(buf + 2, "Baum Vario80")) return MAKE_ID(TAG_SPECIAL, 2);
+      if(i > 2) {
+        if(!strcmp(buf + 2, "Baum Vario40")) dev = MAKE_ID(TAG_SPECIAL, 1);
+        if(!strcmp(buf + 2, "Baum Vario80")) dev = MAKE_ID(TAG_SPECIAL, 2);
+      }
 
-  return 0;
+      braille_found(port, dev);
+      break;
+  }
 }
 
 
-unsigned do_fhp_new(hd_data_t *hd_data, char *dev_name, int cnt)
+void do_fhp_new(ser_probe_t *port, ser_probe_event_t event)
 {
-  int i, fd, status = 0;
+  hd_data_t *hd_data = port->hd_data;
+  ser_device_t *sm = port->sm;
+  int i, status = 0;
   unsigned id;
-  unsigned char retstr[50] = "";
+  unsigned char *retstr = sm->buf;
   unsigned char brlauto[] = { 2, 0x42, 0x50, 0x50, 3 };
-  struct termios oldtio, tiodata = { };
-
-  PROGRESS(2, cnt, "fhp2 open");
-
-  fd = open(dev_name, O_RDWR | O_NONBLOCK | O_NOCTTY);
-  if(fd < 0) return 0;
-
-  fcntl(fd, F_SETFL, 0);	// remove O_NONBLOCK
+  struct termios tiodata = { };
+
+  switch(port->state) {
+    case 0:
+      /* Set bps, and 8n1, enable reading */
+      tiodata.c_cflag = (CLOCAL | CREAD | CS8);
+      tiodata.c_iflag = IGNPAR;
+      tiodata.c_lflag = 0;
+      tiodata.c_cc[VMIN] = 0;
+      tiodata.c_cc[VTIME] = 0;
+
+      if(
+        cfsetispeed(&tiodata, B0) ||
+        cfsetospeed(&tiodata, B0) ||
+        tcsetattr(sm->fd, TCSANOW, &tiodata) ||
+        tcflush(sm->fd, TCIOFLUSH) ||
+        cfsetispeed(&tiodata, B57600) ||
+        cfsetospeed(&tiodata, B57600) ||
+        tcsetattr(sm->fd, TCSANOW, &tiodata)
+      ) {
+        /* init error */
+        braille_found(port, 0);
+        break;
+      }
 
-  tcgetattr(fd, &oldtio);
+      tcflush(sm->fd, TCIOFLUSH);
 
-  /* Set bps, and 8n1, enable reading */
-  tiodata.c_cflag = (CLOCAL | CREAD | CS8);
-  tiodata.c_iflag = IGNPAR;
-  tiodata.c_lflag = 0;
-  tiodata.c_cc[VMIN] = 0;
-  tiodata.c_cc[VTIME] = 0;
+      port->state = 1;
+      ser_probe_timer(port, 100);
+      break;
 
-  if(
-    cfsetispeed(&tiodata, B0) ||
-    cfsetospeed(&tiodata, B0) ||
-    tcsetattr(fd, TCSANOW, &tiodata) ||
-    tcflush(fd, TCIOFLUSH) ||
-    cfsetispeed(&tiodata, B57600) ||
-    cfsetospeed(&tiodata, B57600) ||
-    tcsetattr(fd, TCSANOW, &tiodata)
-  ) {
-     /* init error */
+    case 1:
+      if(event != sp_timeout) break;
 
-    tcflush(fd, TCIOFLUSH);
-    tcsetattr(fd, TCSAFLUSH, &oldtio);
-    close(fd);
+      /* get status of inteface */
+      ioctl(sm->fd, TIOCMGET, &status);
 
-    return 0;
-  }
+      /* clear dtr-line */
+      status &= ~TIOCM_DTR;
 
-  tcflush(fd, TCIOFLUSH);
-  usleep(100 * 1000);
+      /* set new status */
+      ioctl(sm->fd, TIOCMSET, &status);
 
-  /* get status of inteface */
-  ioctl(fd, TIOCMGET, &status);
+      port->state = 2;
+      ser_probe_timer(port, 100);
+      break;
 
-  /* clear dtr-line */
-  status &= ~TIOCM_DTR;
+    case 2:
+      if(event != sp_timeout) break;
 
-  /* set new status */
-  ioctl(fd, TIOCMSET, &status);
+      ser_probe_write(port, brlauto, sizeof brlauto);
 
-  usleep(100 * 1000);
+      PROGRESS(3, port->index, "fhp2 write ok");
 
-  write(fd, brlauto, sizeof brlauto);
+      port->max_len = 20;
+      port->state = 3;
+      ser_probe_timer(port, 100);
+      break;
 
-  PROGRESS(3, cnt, "fhp2 write ok");
+    case 3:
+      if(event == sp_input && (unsigned) sm->buf_len < port->max_len) break;
 
-  usleep(100 * 1000);
+      i = sm->buf_len;
 
-  i = read(fd, retstr, 20);
+      PROGRESS(4, port->index, "fhp2 read done");
 
-  PROGRESS(4, cnt, "fhp2 read done");
+      ADD2LOG("fhp2@%s[%d]: ", sm->dev_name, i);
+      if(i > 0) hd_log_hex(hd_data, 1, i, retstr);
+      ADD2LOG("\n");
 
-  ADD2LOG("fhp2@%s[%d]: ", dev_name, i);
-  if(i > 0) hd_log_hex(hd_data, 1, i, retstr);
-  ADD2LOG("\n");
+      id = 0;
 
-  id = 0;
+      if(i == 10 && retstr[1] == 'J') {
+        id = retstr[3];
 
-  if(i == 10 && retstr[1] == 'J') {
-    id = retstr[3];
+        /* papenmeir new serial and usb device IDs */
+        switch(id) {
+          case 0x55:
+          case 0x57:
+          case 0x58:
+            id = MAKE_ID(TAG_SPECIAL, id);
+            break;
 
-    /* papenmeir new serial and usb device IDs */
-    switch(id) {
-      case 0x55:
-      case 0x57:
-      case 0x58:
-        id = MAKE_ID(TAG_SPECIAL, id);
-        break;
+          default:
+            ADD2LOG("unknown id %d\n", id);
+            id = 0;
+        }
+      }
 
-      default:
-        ADD2LOG("unknown id %d\n", id);
-        id = 0;
-    }
+      braille_found(port, id);
+      break;
   }
-
-  /* reset serial lines */
-  tcflush(fd, TCIOFLUSH);
-  tcsetattr(fd, TCSAFLUSH, &oldtio);
-  close(fd);
-
-  return id;
 }
 
 
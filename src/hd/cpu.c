@@ -29,8 +29,39 @@
  * @{
  */
 
+/*
+ * Data shared by all cpu entries of the same model. Feature names are
+ * interned in cpu_models_s; a model keeps its features as a bitmap into
+ * that table plus a list referencing the interned names.
+ */
+typedef struct cpu_model_s {
+  struct cpu_model_s *next;
+  char *key;			/* vendor, model, platform, raw feature string */
+  unsigned char *map;		/* feature bitmap, bit n: cpu_models_s.name[n] */
+  str_list_t *features;		/* feature list, strings belong to cpu_models_s */
+  unsigned units;
+  unsigned cache_ok:1;		/* cache_* are valid */
+  unsigned cache_l1d, cache_l1i, cache_l2, cache_l3;
+} cpu_model_t;
+
+struct cpu_models_s {
+  cpu_model_t *list;
+  unsigned names;		/* interned feature names */
+  char **name;
+};
+
 static void read_cpuinfo(hd_data_t *hd_data);
 static void dump_cpu_data(hd_data_t *hd_data);
+static cpu_model_t *cpu_model(hd_data_t *hd_data, cpu_info_t *ct, char *features, int *is_new);
+static int cpu_model_has_feature(hd_data_t *hd_data, cpu_model_t *cm, char *feature);
+static void read_cpu_topology(hd_data_t *hd_data);
+static void read_cpu_cache(cpu_info_t *ct, char *dir);
+static unsigned cpu_list_rank(char *list, unsigned cpu);
+#if !defined(__i386__) && !defined (__x86_64__)
+static unsigned *online_cpus(unsigned *cnt);
+static int cmp_cpu_num(const void *p0, const void *p1);
+#endif
+static void collapse_cpus(hd_data_t *hd_data);
 
 #if defined(__i386__) || defined(__x86_64__)
 static inline unsigned units_per_cpu();
@@ -55,14 +86,34 @@ void hd_scan_cpu(hd_data_t *hd_data)
 
   PROGRESS(1, 0, "cpuinfo");
 
+  /*
+   * sysfs has no vendor, model name or feature flags, so /proc/cpuinfo is
+   * still needed; per-model data is shared (see cpu_model()) and topology,
+   * clock limits and caches come from sysfs.
+   */
   read_cpuinfo(hd_data);
 
+  if(hd_probe_feature(hd_data, pr_cpu_sysfs)) {
+    PROGRESS(2, 0, "sysfs");
+
+    read_cpu_topology(hd_data);
+  }
+
+  if(hd_probe_feature(hd_data, pr_cpu_collapse)) collapse_cpus(hd_data);
+
   for(hd0 = hd_data->hd; hd0; hd0 = hd0->next) {
     if(hd0->base_class.id == bc_internal && hd0->sub_class.id == sc_int_cpu) break;
   }
 
   if(!hd0 || hd0->next) return;		/* 0 or > 1 entries */
 
+  if(
+    hd0->detail &&
+    hd0->detail->type == hd_detail_cpu &&
+    hd0->detail->cpu.data &&
+    hd0->detail->cpu.data->count
+  ) return;				/* collapsed entry */
+
   /* only one entry, maybe UP kernel on SMP system */
 
   cpus = 0;
@@ -90,9 +141,10 @@ void read_cpuinfo(hd_data_t *hd_data)
 
 #if defined(__i386__) || defined (__x86_64__)
   char model_id[80], vendor_id[80], features[0x400];
-  unsigned mhz, cache, family, model, stepping;
+  unsigned mhz, cache, family, model, stepping, cpu, u;
   double bogo;
-  char *t0, *t;
+  cpu_model_t *cm;
+  int is_new;
 #endif
 
 #ifdef __ia64__
@@ -112,7 +164,6 @@ void read_cpuinfo(hd_data_t *hd_data)
   unsigned cpu_variation, cpu_revision, vendor_id;
   unsigned u;
   double bogo;
-  char *t0, *t;
 #endif
 
 #ifdef __aarch64__
@@ -120,7 +171,6 @@ void read_cpuinfo(hd_data_t *hd_data)
   unsigned cpu_variation, cpu_revision, vendor_id;
   unsigned u;
   double bogo;
-  char *t0, *t;
 #endif
 
 #ifdef __PPC__
@@ -212,7 +262,7 @@ void read_cpuinfo(hd_data_t *hd_data)
 #endif	/* __alpha__ */
 
 #ifdef __arm__
-  *model_id = *system_id = *serial_number = 0;
+  *model_id = *system_id = *serial_number = *features = 0;
   cpu_variation = cpu_revision = 0;
   ct = 0; bogo = 0;
 
@@ -260,11 +310,7 @@ void read_cpuinfo(hd_data_t *hd_data)
      }
     }
 
-    if(*features) {
-      for(t0 = features; (t = strsep(&t0, " ")); ) {
-        add_str_list(&ct->features, new_str(t));
-      }
-    }
+    cpu_model(hd_data, ct, features, NULL);
 
     hd = add_hd_entry(hd_data, __LINE__, 0);
     hd->base_class.id = bc_internal;
@@ -277,7 +323,7 @@ void read_cpuinfo(hd_data_t *hd_data)
 #endif	/* __arm__ */
 
 #ifdef __aarch64__
-  *model_id = *system_id = *serial_number = 0;
+  *model_id = *system_id = *serial_number = *features = 0;
   cpu_variation = cpu_revision = 0;
   ct = 0; bogo = 0;
 
@@ -325,11 +371,7 @@ void read_cpuinfo(hd_data_t *hd_data)
      }
     }
 
-    if(*features) {
-      for(t0 = features; (t = strsep(&t0, " ")); ) {
-        add_str_list(&ct->features, t);
-      }
-    }
+    cpu_model(hd_data, ct, features, NULL);
 
     hd = add_hd_entry(hd_data, __LINE__, 0);
     hd->base_class.id = bc_internal;
@@ -386,7 +428,7 @@ void read_cpuinfo(hd_data_t *hd_data)
 
 #if defined(__i386__) || defined (__x86_64__)
   *model_id = *vendor_id = *features = 0;
-  mhz = cache = family = model = stepping = 0;
+  mhz = cache = family = model = stepping = cpu = 0;
   bogo = 0;
 
   for(sl = hd_data->cpu; sl; sl = sl->next) {
@@ -404,6 +446,7 @@ void read_cpuinfo(hd_data_t *hd_data)
     if(strstr(sl->str, "processor") == sl->str || !sl->next) {		/* EOF */
       if(*model_id || *vendor_id) {	/* at least one of those */
         ct = new_mem(sizeof *ct);
+        ct->cpu = cpu;
 #ifdef __i386__
 	ct->architecture = arch_intel;
 #endif
@@ -457,18 +500,17 @@ void read_cpuinfo(hd_data_t *hd_data)
         hd->detail->type = hd_detail_cpu;
         hd->detail->cpu.data = ct;
 
-        if(*features) {
-          for(t0 = features; (t = strsep(&t0, " ")); ) {
-            add_str_list(&ct->features, t);
-            if(!strcmp(t, "ht")) ct->units = units_per_cpu();
-          }
-        }
+        cm = cpu_model(hd_data, ct, features, &is_new);
+        if(is_new && cpu_model_has_feature(hd_data, cm, "ht")) cm->units = units_per_cpu();
+        ct->units = cm->units;
 
         *model_id = *vendor_id = 0;
         mhz = cache = family = model= 0;
         bogo = 0;
         cpus++;
       }
+      /* number of the next record */
+      if(sscanf(sl->str, "processor : %u", &u) == 1) cpu = u;
     }
   }
 #endif /* __i386__ || __x86_64__ */
@@ -694,6 +736,371 @@ void dump_cpu_data(hd_data_t *hd_data)
 }
 
 
+/*
+ * Look up (or create) the model entry for ct and let ct share its feature list.
+ *
+ * features: space separated feature string as found in /proc/cpuinfo
+ * (it is not modified).
+ * If is_new is set, it tells whether a new model entry was created.
+ */
+cpu_model_t *cpu_model(hd_data_t *hd_data, cpu_info_t *ct, char *features, int *is_new)
+{
+  struct cpu_models_s *models;
+  cpu_model_t *cm, **cm_next;
+  str_list_t *sl;
+  char *key = NULL, *s, *t, *t0;
+  unsigned u;
+
+  if(!(models = hd_data->cpu_models)) models = hd_data->cpu_models = new_mem(sizeof *models);
+
+  str_printf(&key, 0, "%s|%s|%s|%u.%u.%u|%s",
+    ct->vend_name ?: "", ct->model_name ?: "", ct->platform ?: "",
+    ct->family, ct->model, ct->stepping, features ?: ""
+  );
+
+  if(is_new) *is_new = 0;
+
+  for(cm_next = &models->list; (cm = *cm_next); cm_next = &cm->next) {
+    if(!strcmp(cm->key, key)) break;
+  }
+
+  if(cm) {
+    free_mem(key);
+  }
+  else {
+    *cm_next = cm = new_mem(sizeof *cm);
+    cm->key = key;
+    if(is_new) *is_new = 1;
+
+    if(features && *features) {
+      /* enough room for all names that might get added */
+      for(u = models->names + 1, t = features; *t; t++) if(*t == ' ') u++;
+      cm->map = new_mem((u + 7) >> 3);
+
+      s = new_str(features);
+      for(t0 = s; (t = strsep(&t0, " ")); ) {
+        if(!*t) continue;
+        for(u = 0; u < models->names; u++) {
+          if(!strcmp(models->name[u], t)) break;
+        }
+        if(u == models->names) {
+          models->name = add_mem(models->name, sizeof *models->name, models->names);
+          models->name[models->names++] = new_str(t);
+        }
+        cm->map[u >> 3] |= 1 << (u & 7);
+
+        sl = add_str_list(&cm->features, NULL);
+        sl->str = models->name[u];
+      }
+      free_mem(s);
+    }
+  }
+
+  ct->cpu_model = cm;
+  ct->features = cm->features;
+
+  return cm;
+}
+
+
+/*
+ * Check if cpu model has a feature.
+ */
+int cpu_model_has_feature(hd_data_t *hd_data, cpu_model_t *cm, char *feature)
+{
+  struct cpu_models_s *models = hd_data->cpu_models;
+  unsigned u;
+
+  if(!models || !cm || !cm->map) return 0;
+
+  for(u = 0; u < models->names; u++) {
+    if(!strcmp(models->name[u], feature)) return (cm->map[u >> 3] >> (u & 7)) & 1;
+  }
+
+  return 0;
+}
+
+
+/*
+ * Free interned cpu models.
+ */
+struct cpu_models_s *free_cpu_models(struct cpu_models_s *models)
+{
+  cpu_model_t *cm, *next;
+  str_list_t *sl, *sl_next;
+  unsigned u;
+
+  if(!models) return NULL;
+
+  for(cm = models->list; cm; cm = next) {
+    next = cm->next;
+    /* the strings belong to models->name */
+    for(sl = cm->features; sl; sl = sl_next) {
+      sl_next = sl->next;
+      free_mem(sl);
+    }
+    free_mem(cm->key);
+    free_mem(cm->map);
+    free_mem(cm);
+  }
+
+  for(u = 0; u < models->names; u++) free_mem(models->name[u]);
+  free_mem(models->name);
+
+  return free_mem(models);
+}
+
+
+/*
+ * Add topology, cache and frequency info from /sys/devices/system/cpu.
+ *
+ * Cache sizes are read only once per cpu model.
+ */
+void read_cpu_topology(hd_data_t *hd_data)
+{
+  hd_t *hd;
+  cpu_info_t *ct;
+  char *dir = NULL, *s;
+  uint64_t ul0;
+#if !defined(__i386__) && !defined (__x86_64__)
+  unsigned *cpu, cpus, u = 0;
+
+  /*
+   * Only x86 has the logical cpu number in /proc/cpuinfo; elsewhere map
+   * the entries in order to the online cpuN directories.
+   */
+  cpu = online_cpus(&cpus);
+#endif
+
+  for(hd = hd_data->hd; hd; hd = hd->next) {
+    if(
+      hd->module != hd_data->module ||
+      !hd->detail ||
+      hd->detail->type != hd_detail_cpu ||
+      !(ct = hd->detail->cpu.data)
+    ) continue;
+
+#if !defined(__i386__) && !defined (__x86_64__)
+    if(u >= cpus) break;
+    ct->cpu = cpu[u++];
+#endif
+
+    str_printf(&dir, 0, SYS_CPU "/cpu%u", ct->cpu);
+
+    if(hd_attr_uint(get_sysfs_attr_by_path(dir, "topology/physical_package_id"), &ul0, 0)) {
+      ct->topology = 1;
+      ct->package = ul0;
+      if(hd_attr_uint(get_sysfs_attr_by_path(dir, "topology/core_id"), &ul0, 0)) ct->core = ul0;
+      if((s = get_sysfs_attr_by_path(dir, "topology/thread_siblings_list"))) {
+        ct->thread = cpu_list_rank(s, ct->cpu);
+      }
+    }
+
+    if(hd_attr_uint(get_sysfs_attr_by_path(dir, "cpufreq/cpuinfo_min_freq"), &ul0, 0)) {
+      ct->clock_min = (ul0 + 500) / 1000;
+    }
+    if(hd_attr_uint(get_sysfs_attr_by_path(dir, "cpufreq/cpuinfo_max_freq"), &ul0, 0)) {
+      ct->clock_max = (ul0 + 500) / 1000;
+    }
+
+    if(ct->cpu_model && ct->cpu_model->cache_ok) {
+      ct->cache_l1d = ct->cpu_model->cache_l1d;
+      ct->cache_l1i = ct->cpu_model->cache_l1i;
+      ct->cache_l2 = ct->cpu_model->cache_l2;
+      ct->cache_l3 = ct->cpu_model->cache_l3;
+    }
+    else {
+      read_cpu_cache(ct, dir);
+      if(ct->cpu_model) {
+        ct->cpu_model->cache_ok = 1;
+        ct->cpu_model->cache_l1d = ct->cache_l1d;
+        ct->cpu_model->cache_l1i = ct->cache_l1i;
+        ct->cpu_model->cache_l2 = ct->cache_l2;
+        ct->cpu_model->cache_l3 = ct->cache_l3;
+      }
+    }
+
+    ADD2LOG(
+      "  cpu%u: package %u, core %u, thread %u, clock %u-%u MHz, cache %u/%u/%u/%u kB\n",
+      ct->cpu, ct->package, ct->core, ct->thread, ct->clock_min, ct->clock_max,
+      ct->cache_l1d, ct->cache_l1i, ct->cache_l2, ct->cache_l3
+    );
+  }
+
+#if !defined(__i386__) && !defined (__x86_64__)
+  free_mem(cpu);
+#endif
+
+  free_mem(dir);
+}
+
+
+#if !defined(__i386__) && !defined (__x86_64__)
+/*
+ * Sorted list of online cpu numbers, taken from the cpuN directory names.
+ */
+unsigned *online_cpus(unsigned *cnt)
+{
+  str_list_t *sl, *sl0;
+  unsigned *cpu = NULL, u;
+  char *dir = NULL, *s;
+  uint64_t ul0;
+
+  *cnt = 0;
+
+  sl0 = read_dir(SYS_CPU, 'd');
+
+  for(sl = sl0; sl; sl = sl->next) {
+    if(strncmp(sl->str, "cpu", sizeof "cpu" - 1)) continue;
+    u = strtoul(sl->str + sizeof "cpu" - 1, &s, 10);
+    if(s == sl->str + sizeof "cpu" - 1 || *s) continue;
+
+    /* no 'online' attribute: cpu can't be offlined */
+    str_printf(&dir, 0, SYS_CPU "/%s", sl->str);
+    if(hd_attr_uint(get_sysfs_attr_by_path(dir, "online"), &ul0, 0) && !ul0) continue;
+
+    cpu = add_mem(cpu, sizeof *cpu, *cnt);
+    cpu[(*cnt)++] = u;
+  }
+
+  free_str_list(sl0);
+  free_mem(dir);
+
+  if(*cnt > 1) qsort(cpu, *cnt, sizeof *cpu, cmp_cpu_num);
+
+  return cpu;
+}
+
+
+int cmp_cpu_num(const void *p0, const void *p1)
+{
+  unsigned u0 = *(const unsigned *) p0, u1 = *(const unsigned *) p1;
+
+  return u0 < u1 ? -1 : u0 > u1;
+}
+#endif
+
+
+/*
+ * Read cache sizes from dir/cache/index*.
+ */
+void read_cpu_cache(cpu_info_t *ct, char *dir)
+{
+  char *path = NULL, *type;
+  str_list_t *sl, *sl0;
+  uint64_t level, size;
+  char *s;
+
+  str_printf(&path, 0, "%s/cache", dir);
+  sl0 = read_dir(path, 'd');
+
+  for(sl = sl0; sl; sl = sl->next) {
+    if(strncmp(sl->str, "index", sizeof "index" - 1)) continue;
+    str_printf(&path, 0, "%s/cache/%s", dir, sl->str);
+
+    if(!hd_attr_uint(get_sysfs_attr_by_path(path, "level"), &level, 0)) continue;
+
+    /* e.g. "32K" */
+    if(!(s = get_sysfs_attr_by_path(path, "size"))) continue;
+    size = strtoull(s, &s, 10);
+    if(*s == 'M') size <<= 10;
+
+    if(!(type = get_sysfs_attr_by_path(path, "type"))) continue;
+
+    if(level == 1) {
+      if(!strncmp(type, "Instruction", sizeof "Instruction" - 1)) {
+        ct->cache_l1i = size;
+      }
+      else {
+        ct->cache_l1d = size;
+      }
+    }
+    else if(level == 2) {
+      ct->cache_l2 = size;
+    }
+    else if(level == 3) {
+      ct->cache_l3 = size;
+    }
+  }
+
+  free_str_list(sl0);
+  free_mem(path);
+}
+
+
+/*
+ * Position of cpu in a cpu list like "0-3,8-11".
+ */
+unsigned cpu_list_rank(char *list, unsigned cpu)
+{
+  unsigned u0, u1, rank = 0;
+  char *s = list;
+
+  while(*s) {
+    u0 = u1 = strtoul(s, &s, 10);
+    if(*s == '-') u1 = strtoul(s + 1, &s, 10);
+    if(cpu < u0) break;
+    if(cpu <= u1) return rank + cpu - u0;
+    rank += u1 - u0 + 1;
+    if(*s != ',') break;
+    s++;
+  }
+
+  return 0;
+}
+
+
+/*
+ * Collapse identical threads into a single entry (cpu.collapse).
+ *
+ * Entries are considered identical if they share the model and
+ * clock settings. The first entry of each group gets the thread count,
+ * the others are removed.
+ */
+void collapse_cpus(hd_data_t *hd_data)
+{
+  hd_t *hd;
+  cpu_info_t *ct, *ct1, **group = NULL;
+  unsigned u, groups = 0;
+  int removed = 0;
+
+  for(hd = hd_data->hd; hd; hd = hd->next) {
+    if(
+      hd->module != hd_data->module ||
+      !hd->detail ||
+      hd->detail->type != hd_detail_cpu ||
+      !(ct = hd->detail->cpu.data) ||
+      !ct->cpu_model
+    ) continue;
+
+    for(u = 0; u < groups; u++) {
+      ct1 = group[u];
+      if(
+        ct1->cpu_model == ct->cpu_model &&
+        ct1->clock == ct->clock &&
+        ct1->clock_min == ct->clock_min &&
+        ct1->clock_max == ct->clock_max
+      ) break;
+    }
+
+    if(u == groups) {
+      group = add_mem(group, sizeof *group, groups);
+      group[groups++] = ct;
+      ct->count = 1;
+    }
+    else {
+      group[u]->count++;
+      hd->tag.remove = 1;
+      removed++;
+    }
+  }
+
+  free_mem(group);
+
+  if(removed) remove_tagged_hd_entries(hd_data);
+}
+
+
 #if defined(__i386__) || defined(__x86_64__)
 inline unsigned units_per_cpu()
 {
@@ -918,6 +1325,7 @@ int ia64DetectSMP(hd_data_t *hd_data)
   const char *rsd_klog = "ACPI 2.0=";
   const char *rsd_systab = "ACPI20=";
   char *s;
+  unsigned pos;
 
   mem_fd = open("/dev/mem", O_RDONLY);
   if(mem_fd == -1) return -1;
@@ -939,7 +1347,8 @@ int ia64DetectSMP(hd_data_t *hd_data)
 
   if(!hd_data->klog) read_klog(hd_data);
 
-  for(sl = hd_data->klog; sl; sl = sl->next) {
+  /* 'efi: ACPI 2.0=...' or 'EFI v1.10 by ...: ... ACPI 2.0=...' */
+  for(pos = 0; (sl = klog_find(hd_data, "efi", &pos)); ) {
     if((s = strstr(sl->str, rsd_klog))) {
       if(sscanf(s + strlen(rsd_klog), "%lx", &addr) == 1) {
       found_it:
@@ -1 +1,2 @@
 void hd_scan_cpu(hd_data_t *hd_data);
+struct cpu_models_s *free_cpu_models(struct cpu_models_s *models);
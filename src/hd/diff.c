@@ -0,0 +1,466 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "hd.h"
+#include "hd_int.h"
+
+/**
+ * @defgroup DIFFint Hardware inventory diff
+ * @ingroup  libhdInternals
+ * @brief Compare two hardware lists
+ *
+ * Entries are joined via a hash table keyed by unique id. Entries without
+ * a unique id fall back to sysfs id and device name.
+ *
+ * @{
+ */
+
+#ifndef LIBHD_TINY
+
+/* join key types, in order of preference */
+enum diff_key { dk_unique_id, dk_sysfs_id, dk_dev_name, dk_max };
+
+typedef struct {
+  unsigned hash;
+  enum diff_key type;
+  char *key;
+  unsigned idx;			/* index into old list */
+} diff_slot_t;
+
+typedef struct {
+  unsigned size;		/* power of 2 */
+  diff_slot_t *slot;
+} diff_hash_t;
+
+static char *diff_key(hd_t *hd, enum diff_key type);
+static unsigned diff_hash_str(enum diff_key type, char *key);
+static void diff_hash_add(diff_hash_t *ht, enum diff_key type, char *key, unsigned idx);
+static hd_t *diff_hash_find(diff_hash_t *ht, enum diff_key type, char *key, hd_t **old, unsigned char *used, hd_t *hd);
+static hd_diff_t *diff_new(hd_diff_type_t type, hd_t *hd_old, hd_t *hd_new);
+static void diff_entry(hd_data_t *hd_data, hd_diff_t *diff);
+static void diff_str_list(hd_diff_t *diff, unsigned mask, char *label, str_list_t *sl_old, str_list_t *sl_new);
+static str_list_t *diff_res_list(hd_res_t *res);
+static int diff_link(hd_res_t *res);
+
+
+/*
+ * Compare two hardware lists.
+ *
+ * Returns a list of added, removed and changed entries. The entries keep
+ * pointers into hd_old and hd_new; don't free these lists before the result.
+ */
+hd_diff_t *hd_diff(hd_data_t *hd_data, hd_t *hd_old, hd_t *hd_new)
+{
+  hd_diff_t *diff = NULL, **next = &diff, *d;
+  diff_hash_t ht = {};
+  hd_t *hd, *hd1, **old;
+  unsigned u, cnt, changed = 0;
+  unsigned char *used;
+  enum diff_key type;
+  char *s;
+
+  for(cnt = 0, hd = hd_old; hd; hd = hd->next) cnt++;
+
+  old = new_mem((cnt + 1) * sizeof *old);
+  used = new_mem(cnt + 1);
+
+  for(u = 0, hd = hd_old; hd; hd = hd->next) old[u++] = hd;
+
+  for(ht.size = 16; ht.size < 2 * dk_max * cnt; ht.size <<= 1);
+  ht.slot = new_mem(ht.size * sizeof *ht.slot);
+
+  for(u = 0; u < cnt; u++) {
+    for(type = 0; type < dk_max; type++) {
+      if((s = diff_key(old[u], type))) diff_hash_add(&ht, type, s, u);
+    }
+  }
+
+  for(hd = hd_new; hd; hd = hd->next) {
+    for(hd1 = NULL, type = 0; type < dk_max && !hd1; type++) {
+      if((s = diff_key(hd, type))) hd1 = diff_hash_find(&ht, type, s, old, used, hd);
+    }
+
+    if(hd1) {
+      d = diff_new(hd_diff_changed, hd1, hd);
+      diff_entry(hd_data, d);
+      if(!d->changed) {
+        hd_free_diff(d);
+        continue;
+      }
+      changed++;
+    }
+    else {
+      d = diff_new(hd_diff_added, NULL, hd);
+    }
+
+    *next = d;
+    next = &d->next;
+  }
+
+  for(u = 0; u < cnt; u++) {
+    if(used[u]) continue;
+    *next = diff_new(hd_diff_removed, old[u], NULL);
+    next = &(*next)->next;
+  }
+
+  ADD2LOG("diff: %u old, %u changed\n", cnt, changed);
+
+  free_mem(ht.slot);
+  free_mem(used);
+  free_mem(old);
+
+  return diff;
+}
+
+
+/*
+ * Free diff list.
+ */
+hd_diff_t *hd_free_diff(hd_diff_t *diff)
+{
+  hd_diff_t *next;
+
+  for(; diff; diff = next) {
+    next = diff->next;
+    free_str_list(diff->info);
+    free_mem(diff);
+  }
+
+  return NULL;
+}
+
+
+char *diff_key(hd_t *hd, enum diff_key type)
+{
+  switch(type) {
+    case dk_unique_id:
+      return hd->unique_id;
+
+    case dk_sysfs_id:
+      return hd->sysfs_id;
+
+    case dk_dev_name:
+      return hd->unix_dev_name;
+
+    default:
+      return NULL;
+  }
+}
+
+
+/*
+ * FNV-1a, seeded with key type.
+ */
+unsigned diff_hash_str(enum diff_key type, char *key)
+{
+  unsigned hash = 2166136261u ^ type;
+
+  while(*key) {
+    hash ^= (unsigned char) *key++;
+    hash *= 16777619u;
+  }
+
+  return hash;
+}
+
+
+void diff_hash_add(diff_hash_t *ht, enum diff_key type, char *key, unsigned idx)
+{
+  unsigned hash, u;
+
+  hash = diff_hash_str(type, key);
+
+  for(u = hash & (ht->size - 1); ht->slot[u].key; u = (u + 1) & (ht->size - 1));
+
+  ht->slot[u].hash = hash;
+  ht->slot[u].type = type;
+  ht->slot[u].key = key;
+  ht->slot[u].idx = idx;
+}
+
+
+/*
+ * Look up first unused old entry matching key and mark it used.
+ *
+ * Fallback keys (everything but unique id) only join entries if at least
+ * one of them has no unique id. Otherwise a replaced card in the same slot
+ * would show up as changed.
+ */
+hd_t *diff_hash_find(diff_hash_t *ht, enum diff_key type, char *key, hd_t **old, unsigned char *used, hd_t *hd)
+{
+  unsigned hash, u;
+  diff_slot_t *slot;
+
+  hash = diff_hash_str(type, key);
+
+  for(u = hash & (ht->size - 1); (slot = ht->slot + u)->key; u = (u + 1) & (ht->size - 1)) {
+    if(
+      slot->hash != hash ||
+      slot->type != type ||
+      used[slot->idx] ||
+      strcmp(slot->key, key)
+    ) continue;
+
+    if(type != dk_unique_id && hd->unique_id && old[slot->idx]->unique_id) continue;
+
+    used[slot->idx] = 1;
+
+    return old[slot->idx];
+  }
+
+  return NULL;
+}
+
+
+hd_diff_t *diff_new(hd_diff_type_t type, hd_t *hd_old, hd_t *hd_new)
+{
+  hd_diff_t *diff;
+
+  diff = new_mem(sizeof *diff);
+
+  diff->type = type;
+  diff->hd_old = hd_old;
+  diff->hd_new = hd_new;
+
+  return diff;
+}
+
+
+/*
+ * Compare driver, status, resources, and link state of two matching entries.
+ */
+void diff_entry(hd_data_t *hd_data, hd_diff_t *diff)
+{
+  hd_t *hd0 = diff->hd_old, *hd1 = diff->hd_new;
+  str_list_t *sl0 = NULL, *sl1 = NULL;
+  char *s = NULL;
+  int i0, i1;
+
+  /* driver */
+  if(hd0->drivers || hd1->drivers) {
+    diff_str_list(diff, HD_DIFF_DRIVER, "driver", hd0->drivers, hd1->drivers);
+  }
+  else if(hd0->driver || hd1->driver) {
+    if(hd0->driver) add_str_list(&sl0, hd0->driver);
+    if(hd1->driver) add_str_list(&sl1, hd1->driver);
+    diff_str_list(diff, HD_DIFF_DRIVER, "driver", sl0, sl1);
+    sl0 = free_str_list(sl0);
+    sl1 = free_str_list(sl1);
+  }
+
+  /* device name */
+  if(
+    (hd0->unix_dev_name || hd1->unix_dev_name) &&
+    (!hd0->unix_dev_name || !hd1->unix_dev_name || strcmp(hd0->unix_dev_name, hd1->unix_dev_name))
+  ) {
+    diff->changed |= HD_DIFF_DEVNAME;
+    str_printf(&s, 0, "device: %s -> %s", hd0->unix_dev_name ?: "-", hd1->unix_dev_name ?: "-");
+    add_str_list(&diff->info, s);
+  }
+
+  /* ids */
+  if(
+    hd0->vendor.id != hd1->vendor.id ||
+    hd0->device.id != hd1->device.id ||
+    hd0->sub_vendor.id != hd1->sub_vendor.id ||
+    hd0->sub_device.id != hd1->sub_device.id ||
+    hd0->revision.id != hd1->revision.id
+  ) {
+    diff->changed |= HD_DIFF_ID;
+    str_printf(&s, 0, "id: %04x:%04x %04x:%04x rev %x -> %04x:%04x %04x:%04x rev %x",
+      ID_VALUE(hd0->vendor.id), ID_VALUE(hd0->device.id),
+      ID_VALUE(hd0->sub_vendor.id), ID_VALUE(hd0->sub_device.id), ID_VALUE(hd0->revision.id),
+      ID_VALUE(hd1->vendor.id), ID_VALUE(hd1->device.id),
+      ID_VALUE(hd1->sub_vendor.id), ID_VALUE(hd1->sub_device.id), ID_VALUE(hd1->revision.id)
+    );
+    add_str_list(&diff->info, s);
+  }
+
+  /* status */
+#define DIFF_STATUS(a) \
+  if(hd0->status.a != hd1->status.a) { \
+    diff->changed |= HD_DIFF_STATUS; \
+    str_printf(&s, 0, "status." #a ": %s -> %s", \
+      hd_status_value_name(hd0->status.a) ?: "-", \
+      hd_status_value_name(hd1->status.a) ?: "-" \
+    ); \
+    add_str_list(&diff->info, s); \
+  }
+
+  DIFF_STATUS(configured)
+  DIFF_STATUS(available)
+  DIFF_STATUS(needed)
+  DIFF_STATUS(active)
+
+#undef DIFF_STATUS
+
+  /* resources */
+  sl0 = diff_res_list(hd0->res);
+  sl1 = diff_res_list(hd1->res);
+  diff_str_list(diff, HD_DIFF_RES, "resource", sl0, sl1);
+  free_str_list(sl0);
+  free_str_list(sl1);
+
+  /* link state */
+  i0 = diff_link(hd0->res);
+  i1 = diff_link(hd1->res);
+  if(i0 != i1) {
+    diff->changed |= HD_DIFF_LINK;
+    str_printf(&s, 0, "link: %s -> %s",
+      i0 < 0 ? "-" : i0 ? "yes" : "no",
+      i1 < 0 ? "-" : i1 ? "yes" : "no"
+    );
+    add_str_list(&diff->info, s);
+  }
+
+  free_mem(s);
+
+  if(diff->changed) {
+    ADD2LOG("  diff %s: 0x%x\n", hd1->unique_id ?: hd1->sysfs_id ?: hd1->unix_dev_name ?: "?", diff->changed);
+  }
+}
+
+
+/*
+ * Report entries that are only in one of the lists (order is ignored).
+ */
+void diff_str_list(hd_diff_t *diff, unsigned mask, char *label, str_list_t *sl_old, str_list_t *sl_new)
+{
+  str_list_t *sl;
+  char *s = NULL;
+
+  for(sl = sl_old; sl; sl = sl->next) {
+    if(!search_str_list(sl_new, sl->str)) {
+      diff->changed |= mask;
+      str_printf(&s, 0, "%s: -%s", label, sl->str);
+      add_str_list(&diff->info, s);
+    }
+  }
+
+  for(sl = sl_new; sl; sl = sl->next) {
+    if(!search_str_list(sl_old, sl->str)) {
+      diff->changed |= mask;
+      str_printf(&s, 0, "%s: +%s", label, sl->str);
+      add_str_list(&diff->info, s);
+    }
+  }
+
+  free_mem(s);
+}
+
+
+/*
+ * Canonical string representation of resources.
+ *
+ * Interrupt counters and link state are left out; the latter is handled
+ * separately.
+ */
+str_list_t *diff_res_list(hd_res_t *res)
+{
+  str_list_t *sl = NULL;
+  char *s = NULL;
+
+  for(; res; res = res->next) {
+    switch(res->any.type) {
+      case res_mem:
+        str_printf(&s, 0, "mem 0x%"PRIx64"-0x%"PRIx64"%s",
+          res->mem.base, res->mem.base + res->mem.range - 1,
+          res->mem.enabled ? "" : " (disabled)"
+        );
+        break;
+
+      case res_phys_mem:
+        str_printf(&s, 0, "phys mem 0x%"PRIx64, res->phys_mem.range);
+        break;
+
+      case res_io:
+        str_printf(&s, 0, "io 0x%04"PRIx64"-0x%04"PRIx64"%s",
+          res->io.base, res->io.base + res->io.range - 1,
+          res->io.enabled ? "" : " (disabled)"
+        );
+        break;
+
+      case res_irq:
+        str_printf(&s, 0, "irq %u%s", res->irq.base, res->irq.enabled ? "" : " (disabled)");
+        break;
+
+      case res_dma:
+        str_printf(&s, 0, "dma %u%s", res->dma.base, res->dma.enabled ? "" : " (disabled)");
+        break;
+
+      case res_size:
+        str_printf(&s, 0, "size %u,%"PRIu64",%"PRIu64, res->size.unit, res->size.val1, res->size.val2);
+        break;
+
+      case res_disk_geo:
+        str_printf(&s, 0, "geometry %u/%u/%u (%u)",
+          res->disk_geo.cyls, res->disk_geo.heads, res->disk_geo.sectors, res->disk_geo.geotype
+        );
+        break;
+
+      case res_cache:
+        str_printf(&s, 0, "cache %u kB", res->cache.size);
+        break;
+
+      case res_baud:
+        str_printf(&s, 0, "baud %u %u%c%u",
+          res->baud.speed, res->baud.bits, res->baud.parity ?: 'n', res->baud.stopbits
+        );
+        break;
+
+      case res_monitor:
+        str_printf(&s, 0, "monitor %ux%u@%uHz%s",
+          res->monitor.width, res->monitor.height, res->monitor.vfreq,
+          res->monitor.interlaced ? " interlaced" : ""
+        );
+        break;
+
+      case res_framebuffer:
+        str_printf(&s, 0, "framebuffer 0x%04x %ux%u %u bits",
+          res->framebuffer.mode, res->framebuffer.width, res->framebuffer.height,
+          res->framebuffer.colorbits
+        );
+        break;
+
+      case res_hwaddr:
+        str_printf(&s, 0, "hwaddr %s", res->hwaddr.addr ?: "-");
+        break;
+
+      case res_fc:
+        str_printf(&s, 0, "fc 0x%"PRIx64" 0x%"PRIx64" 0x%x",
+          res->fc.wwpn_ok ? res->fc.wwpn : 0,
+          res->fc.fcp_lun_ok ? res->fc.fcp_lun : 0,
+          res->fc.port_id_ok ? res->fc.port_id : 0
+        );
+        break;
+
+      default:
+        continue;
+    }
+
+    add_str_list(&sl, s);
+  }
+
+  free_mem(s);
+
+  return sl;
+}
+
+
+/*
+ * Return link state (0/1) or -1 if there is none.
+ */
+int diff_link(hd_res_t *res)
+{
+  for(; res; res = res->next) {
+    if(res->any.type == res_link) return res->link.state;
+  }
+
+  return -1;
+}
+
+#endif	/* LIBHD_TINY */
+
+/** @} */
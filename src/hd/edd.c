@@ -11,6 +11,7 @@
 #include "hd_int.h"
 #include "hddb.h"
 #include "edd.h"
+#include "index.h"
 
 /**
  * @defgroup EDDint EDD partition information
@@ -23,7 +24,7 @@
 #if defined(__i386__) || defined(__x86_64__)
 
 static void read_edd_info(hd_data_t *hd_data);
-static int does_match(edd_info_t *ei, hd_t *hd, unsigned type);
+static int does_match(hd_data_t *hd_data, edd_info_t *ei, hd_t *hd, unsigned type);
 static int does_match0(edd_info_t *ei, edd_info_t *ei0, unsigned type);
 static int is_disk(hd_t *hd);
 static uint64_t disk_size(hd_t *hd);
@@ -187,6 +188,9 @@ void assign_edd_info(hd_data_t *hd_data)
   bios_info_t *bt;
   edd_info_t *ei;
 
+  /* matches are unique only among all disks */
+  if(hd_index_only_pruned(hd_data)) return;
+
   for(hd = hd_data->hd; hd; hd = hd->next) {
     if(is_disk(hd)) hd->rom_id = free_mem(hd->rom_id);
   }
@@ -211,7 +215,7 @@ void assign_edd_info(hd_data_t *hd_data)
       for(hd = hd_data->hd; hd; hd = hd->next) {
         if(!is_disk(hd) || hd->rom_id) continue;
 
-        if(does_match(ei, hd, type)) {
+        if(does_match(hd_data, ei, hd, type)) {
           if(!matches) {
             match_edd = u;
             match_hd = hd;
@@ -237,7 +241,7 @@ void assign_edd_info(hd_data_t *hd_data)
         else {
           for(hd = hd_data->hd; hd; hd = hd->next) {
             if(!is_disk(hd) || hd->rom_id) continue;
-            if(does_match(ei, hd, type)) {
+            if(does_match(hd_data, ei, hd, type)) {
               str_printf(&hd->rom_id, 0, "0x%02x", match_edd + 0x80);
               ADD2LOG("  %s = %s (match %d)\n", hd->unix_dev_name, hd->rom_id, type);
             }
@@ -271,11 +275,15 @@ void assign_edd_info(hd_data_t *hd_data)
 }
 
 
-int does_match(edd_info_t *ei, hd_t *hd, unsigned type)
+int does_match(hd_data_t *hd_data, edd_info_t *ei, hd_t *hd, unsigned type)
 {
   int i = 0;
   uint64_t u64;
 
+  /* in case they were skipped during the scan */
+  hd_get_block0(hd_data, hd);
+  hd_get_res(hd_data, hd);
+
   switch(type) {
     case 0:
       i = ei->signature == edd_disk_signature(hd) && ei->sectors == disk_size(hd);
@@ -29,8 +29,8 @@ static void dump_floppy_data(hd_data_t *hd_data);
 void hd_scan_floppy(hd_data_t *hd_data)
 {
   hd_t *hd;
-  char b0[10], b1[10], c;
-  unsigned u;
+  char b0[10], b1[10], c, buf[16];
+  unsigned u, pos;
   int fd, i, floppy_ctrls = 0, floppy_ctrl_idx = 0;
   str_list_t *sl;
   hd_res_t *res;
@@ -76,9 +76,10 @@ void hd_scan_floppy(hd_data_t *hd_data)
 
   if(!hd_data->klog) read_klog(hd_data);
 
-  for(sl = hd_data->klog; sl; sl = sl->next) {
-    if(sscanf(sl->str, "<4>floppy%u: no floppy controllers foun%c", &u, &c) == 2) {
-      if(u < sizeof floppy_stat / sizeof *floppy_stat) {
+  for(i = 0; i < sizeof floppy_stat / sizeof *floppy_stat; i++) {
+    sprintf(buf, "floppy%d", i);
+    for(pos = 0; (sl = klog_find(hd_data, buf, &pos)); ) {
+      if(sscanf(sl->str, "<4>floppy%u: no floppy controllers foun%c", &u, &c) == 2 && u == i) {
         floppy_stat[u] = 0;
       }
     }
@@ -9,6 +9,8 @@
 #include <ctype.h>
 #include <errno.h>
 #include <dirent.h>
+#include <stddef.h>
+#include <limits.h>
 #include <time.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -16,8 +18,6 @@
 #include <sys/time.h>
 #include <sys/ioctl.h>
 #include <sys/mount.h>
-#include <sys/ipc.h>
-#include <sys/shm.h>
 #include <sys/mman.h>
 #include <linux/pci.h>
 #include <linux/hdreg.h>
@@ -92,6 +92,7 @@
 #include "wlan.h"
 #include "hal.h"
 #include "klog.h"
+#include "index.h"
 
 /* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
  * various functions commmon to all probing modules
@@ -160,6 +161,31 @@ typedef struct disk_s {
   unsigned char *data;
 } disk_t;
 
+/*
+ * Result channel of forked probes: a memfd holding hd_shm_head_t followed
+ * by hd_shm_rec_t records. Records are 8-byte aligned; pointers inside a
+ * record are stored as offsets from the record data.
+ */
+typedef struct {
+  volatile unsigned updated;	/* child progress counter */
+  unsigned used;		/* bytes of complete records */
+} hd_shm_head_t;
+
+typedef struct {
+  unsigned type;		/* hd_shm_type_t */
+  unsigned len;			/* data length, without padding */
+} hd_shm_rec_t;
+
+/* record being built (child) */
+typedef struct {
+  unsigned char *buf;
+  unsigned len;
+} shm_buf_t;
+
+#define SHM_ALIGN(a)		(((a) + 7) & ~7u)
+#define SHM_OFS(a)		((void *) (uintptr_t) (a))
+#define SHM_PTR(base, a)	((a) ? (void *) ((char *) (base) + (uintptr_t) (a)) : NULL)
+
 typedef struct {
   enum probe_feature val, parent;
   unsigned mask;	/* bit 0: default, bit 1: all, bit 2: max, bit 3: linuxrc */
@@ -172,7 +198,6 @@ static pr_flags_t *pr_flags_by_id(enum probe_feature feature);
 static int set_probe_val(hd_data_t *hd_data, enum probe_feature feature, char *val);
 static void fix_probe_features(hd_data_t *hd_data);
 static void set_probe_feature(hd_data_t *hd_data, enum probe_feature feature, unsigned val);
-static void free_old_hd_entries(hd_data_t *hd_data);
 static hd_t *free_hd_entry(hd_t *hd);
 static hd_t *add_hd_entry2(hd_t **hd, hd_t *new_hd);
 static void timeout_alarm_handler(int signal);
@@ -180,11 +205,20 @@ static void get_probe_env(hd_data_t *hd_data);
 static void hd_scan_xtra(hd_data_t *hd_data);
 static hd_t *hd_get_device_by_id(hd_data_t *hd_data, char *id);
 static int has_item(hd_hw_item_t *items, hd_hw_item_t item);
-static int has_hw_class(hd_t *hd, hd_hw_item_t *items);
+static int has_status(hd_t *hd, hd_status_t status);
+static void select_hw_classes(hd_data_t *hd_data, hd_hw_item_t *items, unsigned char *sel);
 static void hd_scan_with_hal(hd_data_t *hd_data);
 static void hd_scan_no_hal(hd_data_t *hd_data);
+static void assign_parent_ids(hd_data_t *hd_data);
+static int update_match(hd_t *hd, char *path, char *class_id);
+static int sysfs_below(char *id, char *path);
+static uint64_t crc64_block(uint64_t id, unsigned char *s, unsigned len);
+static char *numid2str(uint64_t id, int len, char *buf);
+static uint64_t id1_common(hd_t *hd);
+static void add_old_id(hd_t *hd, uint64_t id1);
 
 static void test_read_block0_open(void *arg);
+static void lazy_sync(hd_t *hd, hd_t *hd0);
 static void get_kernel_version(hd_data_t *hd_data);
 static int is_modem(hd_data_t *hd_data, hd_t *hd);
 static int is_audio(hd_data_t *hd_data, hd_t *hd);
@@ -198,8 +232,11 @@ static void sigchld_handler(int);
 static void sigusr1_handler(int);
 static pid_t child_id;
 static volatile pid_t child;
-static char *hd_shm_add_str(hd_data_t *hd_data, char *str);
-static str_list_t *hd_shm_add_str_list(hd_data_t *hd_data, str_list_t *sl);
+static void shm_reset(hd_data_t *hd_data);
+static void shm_map_result(hd_data_t *hd_data);
+static unsigned shm_buf_add(shm_buf_t *buf, void *ptr, unsigned len);
+static char *shm_buf_str(shm_buf_t *buf, char *str);
+static str_list_t *shm_buf_str_list(shm_buf_t *buf, str_list_t *sl);
 
 static hd_udevinfo_t *hd_free_udevinfo(hd_udevinfo_t *ui);
 static hd_sysfsdrv_t *hd_free_sysfsdrv(hd_sysfsdrv_t *sf);
@@ -287,11 +324,15 @@ static pr_flags_t pr_flags[] = {
   { pr_bios_fb,       pr_bios_vesa,       0, "bios.fb",      p_bool },
   { pr_bios_mode,     pr_bios_vesa,       0, "bios.mode",    p_bool },
   { pr_bios_vbe,      pr_bios_mode,       0, "bios.vbe",     p_bool }, // just an alias
+  { pr_bios_vesa_cache, pr_bios_vesa, 4|2|1, "bios.vesa.cache", p_bool }, // reuse mode list
   { pr_bios_crc,      0,                  0, "bios.crc",     p_bool }, // require bios crc check to succeed
   { pr_bios_vram,     0,                  0, "bios.vram",    p_bool }, // map video bios ram
   { pr_bios_acpi,     0,                  0, "bios.acpi",    p_bool }, // dump acpi data
   { pr_cpu,           0,            8|4|2|1, "cpu",          p_bool },
+  { pr_cpu_sysfs,     pr_cpu,         4|2|1, "cpu.sysfs",    p_bool },
+  { pr_cpu_collapse,  pr_cpu,             0, "cpu.collapse", p_bool },
   { pr_monitor,       0,            8|4|2|1, "monitor",      p_bool },
+  { pr_monitor_drm,   pr_monitor,     4|2|1, "monitor.drm",  p_bool },
   { pr_serial,        0,              4|2|1, "serial",       p_bool },
   { pr_mouse,         0,              4|2|1, "mouse",        p_bool },
   { pr_scsi,          0,            8|4|2|1, "scsi",         p_bool },
@@ -668,6 +709,7 @@ void hd_set_probe_feature_hw(hd_data_t *hd_data, hd_hw_item_t item)
       // hd_set_probe_feature(hd_data, pr_bios_fb);
       hd_set_probe_feature(hd_data, pr_fb);
       hd_set_probe_feature(hd_data, pr_monitor);
+      hd_set_probe_feature(hd_data, pr_monitor_drm);
       break;
 
     case hw_framebuffer:
@@ -675,6 +717,7 @@ void hd_set_probe_feature_hw(hd_data_t *hd_data, hd_hw_item_t item)
       hd_set_probe_feature(hd_data, pr_prom);
       hd_set_probe_feature(hd_data, pr_pci);
       hd_set_probe_feature(hd_data, pr_bios_fb);
+      hd_set_probe_feature(hd_data, pr_bios_vesa_cache);
       hd_set_probe_feature(hd_data, pr_fb);
       break;
 
@@ -831,6 +874,7 @@ void hd_set_probe_feature_hw(hd_data_t *hd_data, hd_hw_item_t item)
 
     case hw_cpu:
       hd_set_probe_feature(hd_data, pr_cpu);
+      hd_set_probe_feature(hd_data, pr_cpu_sysfs);
       break;
 
     case hw_bios:
@@ -841,6 +885,7 @@ void hd_set_probe_feature_hw(hd_data_t *hd_data, hd_hw_item_t item)
     case hw_vbe:
       hd_set_probe_feature(hd_data, pr_bios_ddc);
       hd_set_probe_feature(hd_data, pr_bios_fb);
+      hd_set_probe_feature(hd_data, pr_bios_vesa_cache);
       hd_set_probe_feature(hd_data, pr_bios_mode);
       hd_set_probe_feature(hd_data, pr_monitor);
       break;
@@ -968,6 +1013,7 @@ hd_data_t *hd_free_hd_data(hd_data_t *hd_data)
   unsigned u;
 
   add_hd_entry2(&hd_data->old_hd, hd_data->hd); hd_data->hd = NULL;
+  hd_data->index = hd_index_free(hd_data->index);
   hd_data->log = free_mem(hd_data->log);
   free_old_hd_entries(hd_data);		/* hd_data->old_hd */
   /* hd_data->pci is always NULL */
@@ -984,6 +1030,8 @@ hd_data_t *hd_free_hd_data(hd_data_t *hd_data)
   hd_data->cpu = free_str_list(hd_data->cpu);
   hd_data->klog = free_str_list(hd_data->klog);
   hd_data->klog_raw = free_str_list(hd_data->klog_raw);
+  hd_data->klog_index = free_klog_index(hd_data->klog_index);
+  hd_data->cpu_models = free_cpu_models(hd_data->cpu_models);
   hd_data->proc_usb = free_str_list(hd_data->proc_usb);
   /* hd_data->usb is always NULL */
 
@@ -1000,6 +1048,7 @@ hd_data_t *hd_free_hd_data(hd_data_t *hd_data)
   hd_data->modinfo = free_mem(hd_data->modinfo_ext);
 
   if(hd_data->hddb2[0]) {
+    hddb_index_free(hd_data->hddb2[0]->index);
     free_mem(hd_data->hddb2[0]->list);
     free_mem(hd_data->hddb2[0]->ids); 
     free_mem(hd_data->hddb2[0]->strings);
@@ -1031,6 +1080,7 @@ hd_data_t *hd_free_hd_data(hd_data_t *hd_data)
   hd_data->cdroms = free_str_list(hd_data->cdroms);
 
   hd_data->smbios = smbios_free(hd_data->smbios);
+  smbios_free_index(hd_data);
 
   hd_data->udevinfo = hd_free_udevinfo(hd_data->udevinfo);
   hd_data->sysfsdrv = hd_free_sysfsdrv(hd_data->sysfsdrv);
@@ -1312,7 +1362,7 @@ hd_detail_t *free_hd_detail(hd_detail_t *d)
         free_mem(c->vend_name);
         free_mem(c->model_name);
         free_mem(c->platform);
-        free_str_list(c->features);
+        if(!c->cpu_model) free_str_list(c->features);
         free_mem(c);
       }
       break;
@@ -1453,6 +1503,7 @@ misc_t *free_misc(misc_t *m)
       free_mem(m->irq[i].dev[j]);
     }
     free_mem(m->irq[i].dev);
+    free_mem(m->irq[i].cpu_events);
   }
   free_mem(m->irq);
 
@@ -1775,6 +1826,7 @@ hd_t *add_hd_entry(hd_data_t *hd_data, unsigned line, unsigned count)
   hd_t *hd;
 
   hd = add_hd_entry2(&hd_data->hd, new_mem(sizeof *hd));
+  hd_index_invalidate(hd_data);
 
   hd->idx = ++(hd_data->last_idx);
   hd->module = hd_data->module;
@@ -1797,7 +1849,7 @@ void hd_scan(hd_data_t *hd_data)
 {
   char *s = NULL;
   int i, j;
-  hd_t *hd, *hd2;
+  hd_t *hd;
   uint64_t irqs;
   str_list_t *sl, *sl0;
   pr_flags_t *pf;
@@ -1844,6 +1896,9 @@ void hd_scan(hd_data_t *hd_data)
 
   fix_probe_features(hd_data);
 
+  /* hd_update_device() probes with the same features */
+  for(i = 0; i < (int) sizeof hd_data->probe; i++) hd_data->probe_used[i] |= hd_data->probe[i];
+
   if(hd_data->debug && !hd_data->flags.internal) {
     for(i = sizeof hd_data->probe - 1; i >= 0; i--) {
       str_printf(&s, -1, "%02x", hd_data->probe[i]);
@@ -1888,6 +1943,9 @@ void hd_scan(hd_data_t *hd_data)
     ADD2LOG("shm: failed to get shm segment; will not fork\n");
   }
 
+  /* hd_data->only may be a new list */
+  hd_index_only_invalidate(hd_data);
+
   if(hd_data->only) {
     s = hd_join(", ", hd_data->only);
     ADD2LOG("only: %s\n", s);
@@ -1913,26 +1971,7 @@ void hd_scan(hd_data_t *hd_data)
   /* and again... */
   for(hd = hd_data->hd; hd; hd = hd->next) hd_add_id(hd_data, hd);
 
-  /* assign parent & child ids */
-  for(hd = hd_data->hd; hd; hd = hd->next) {
-    hd->child_ids = free_str_list(hd->child_ids);
-    if((hd2 = hd_get_device_by_idx(hd_data, hd->attached_to))) {
-      free_mem(hd->parent_id);
-      hd->parent_id = new_str(hd2->unique_id);
-    }
-    else if((hd2 = hd_get_device_by_id(hd_data, hd->parent_id))) {
-      hd->attached_to = hd2->idx;
-    }
-    else {
-      hd->attached_to = 0;
-    }
-  }
-
-  for(hd = hd_data->hd; hd; hd = hd->next) {
-    if((hd2 = hd_get_device_by_idx(hd_data, hd->attached_to))) {
-      add_str_list(&hd2->child_ids, hd->unique_id);
-    }
-  }
+  assign_parent_ids(hd_data);
 
   /* assign a hw_class & build a useful model string */
   for(hd = hd_data->hd; hd; hd = hd->next) {
@@ -1950,6 +1989,9 @@ void hd_scan(hd_data_t *hd_data)
   /* we are done... */
   for(hd = hd_data->hd; hd; hd = hd->next) hd->tag.fixed = 1;
 
+  /* classes & ids may have changed */
+  hd_index_invalidate(hd_data);
+
   hd_data->module = mod_none;
 
   if(hd_data->debug && !hd_data->flags.internal && hd_data->klog) {
@@ -1990,6 +2032,286 @@ void hd_scan(hd_data_t *hd_data)
 }
 
 
+/*
+ * Assign parent & child ids.
+ */
+void assign_parent_ids(hd_data_t *hd_data)
+{
+  hd_t *hd, *hd2;
+
+  for(hd = hd_data->hd; hd; hd = hd->next) {
+    hd->child_ids = free_str_list(hd->child_ids);
+    if((hd2 = hd_get_device_by_idx(hd_data, hd->attached_to))) {
+      free_mem(hd->parent_id);
+      hd->parent_id = new_str(hd2->unique_id);
+    }
+    else if((hd2 = hd_get_device_by_id(hd_data, hd->parent_id))) {
+      hd->attached_to = hd2->idx;
+    }
+    else {
+      hd->attached_to = 0;
+    }
+  }
+
+  for(hd = hd_data->hd; hd; hd = hd->next) {
+    if((hd2 = hd_get_device_by_idx(hd_data, hd->attached_to))) {
+      add_str_list(&hd2->child_ids, hd->unique_id);
+    }
+  }
+}
+
+
+/*
+ * Scanners hd_update_device() can run for a single device.
+ *
+ * Network cards get their interfaces (and their hw address & link state)
+ * from the net scan, so it's run again, too.
+ */
+static struct {
+  char *subsystem;
+  unsigned module;
+  enum probe_feature feature;
+  void (*scan)(hd_data_t *hd_data);
+  unsigned with_net:1;
+} update_scanner[] = {
+  { "pci", mod_pci, pr_pci, hd_scan_sysfs_pci, 1 },
+  { "usb", mod_usb, pr_usb, hd_scan_sysfs_usb, 1 },
+  { "block", mod_block, pr_block, hd_scan_sysfs_block, 0 },
+  { "net", mod_net, pr_net, hd_scan_net, 0 }
+};
+
+
+/*
+ * Update hd_data->hd for a single device event.
+ *
+ * Entries for the device and its children are removed; for 'add' and
+ * 'change' the device is probed again (just the scanner for its subsystem,
+ * restricted to the device and its children via hd_data->only), with the
+ * probing features the earlier scans used.
+ *
+ * Needs an earlier hd_scan(). Returns 1 if hd_data->hd has changed, 0 if
+ * not and -1 if the event can't be handled (do a rescan then).
+ */
+int hd_update_device(hd_data_t *hd_data, hd_uevent_t *uevent)
+{
+  hd_t *hd, *hd2;
+  char *devpath, *name, *class_id = NULL, *path = NULL;
+  str_list_t *only_save;
+  unsigned char probe_save[sizeof hd_data->probe];
+  unsigned u, cnt;
+  int scanner = -1, remove = 0, changed = 0;
+
+  if(
+    !uevent || !uevent->action || !uevent->devpath || !uevent->subsystem ||
+    !hd_data->last_idx
+  ) return -1;
+
+  if(!strcmp(uevent->action, "remove")) {
+    remove = 1;
+  }
+  else if(
+    strcmp(uevent->action, "add") &&
+    strcmp(uevent->action, "change") &&
+    strcmp(uevent->action, "bind") &&
+    strcmp(uevent->action, "unbind")
+  ) {
+    /* e.g. 'move': the old path is gone, rescan */
+    return -1;
+  }
+
+  devpath = uevent->devpath;
+  if(!strncmp(devpath, "/sys/", sizeof "/sys/" - 1)) devpath += sizeof "/sys" - 1;
+
+  for(u = 0; u < sizeof update_scanner / sizeof *update_scanner; u++) {
+    if(!strcmp(uevent->subsystem, update_scanner[u].subsystem)) scanner = u;
+  }
+
+  if(!remove && scanner < 0) return -1;
+
+  ADD2LOG("update: %s %s (%s)\n", uevent->action, devpath, uevent->subsystem);
+
+  /* class devices have ids like /class/net/eth0 */
+  name = strrchr(devpath, '/');
+  name = name ? name + 1 : devpath;
+  str_printf(&class_id, 0, "/class/%s/%s", uevent->subsystem, name);
+
+  /* drop old entries; on 'add' & 'change' just those the scanner will recreate */
+  for(hd = hd_data->hd; hd; hd = hd->next) {
+    if(
+      update_match(hd, devpath, class_id) &&
+      (
+        remove ||
+        hd->module == update_scanner[scanner].module ||
+        (update_scanner[scanner].with_net && hd->module == mod_net)
+      )
+    ) {
+      hd->tag.remove = 1;
+    }
+  }
+
+  /* and everything attached to them */
+  if(remove) {
+    do {
+      for(cnt = 0, hd = hd_data->hd; hd; hd = hd->next) {
+        if(
+          !hd->tag.remove &&
+          (hd2 = hd_get_device_by_idx(hd_data, hd->attached_to)) &&
+          hd2->tag.remove
+        ) {
+          hd->tag.remove = 1;
+          cnt++;
+        }
+      }
+    } while(cnt);
+  }
+
+  for(hd = hd_data->hd; hd; hd = hd->next) {
+    if(hd->tag.remove) {
+      ADD2LOG("  removed: #%u %s\n", hd->idx, hd->sysfs_id ?: "");
+      changed = 1;
+    }
+  }
+
+  remove_tagged_hd_entries(hd_data);
+
+  str_printf(&path, 0, "/sys%s", devpath);
+
+  if(!remove && !access(path, F_OK)) {
+    only_save = hd_data->only;
+    hd_data->only = NULL;
+    add_str_list(&hd_data->only, path);
+    hd_index_only_invalidate(hd_data);
+
+    memcpy(probe_save, hd_data->probe, sizeof probe_save);
+    memcpy(hd_data->probe, hd_data->probe_used, sizeof hd_data->probe);
+    hd_set_probe_feature(hd_data, update_scanner[scanner].feature);
+
+    /* keep fixed entries, see remove_hd_entries() */
+    hd_data->flags.update = 1;
+    update_scanner[scanner].scan(hd_data);
+    if(update_scanner[scanner].with_net) hd_scan_net(hd_data);
+    hd_data->flags.update = 0;
+    hd_data->module = mod_none;
+
+    memcpy(hd_data->probe, probe_save, sizeof hd_data->probe);
+
+    free_str_list(hd_data->only);
+    hd_data->only = only_save;
+    hd_index_only_invalidate(hd_data);
+
+    /*
+     * The scan also produced entries for the parents (and maybe some
+     * more); keep only the device and its children.
+     */
+    for(hd = hd_data->hd; hd; hd = hd->next) {
+      if(!hd->tag.fixed) hd->tag.remove = !update_match(hd, devpath, class_id);
+    }
+
+    do {
+      for(cnt = 0, hd = hd_data->hd; hd; hd = hd->next) {
+        if(
+          !hd->tag.fixed &&
+          hd->tag.remove &&
+          (hd2 = hd_get_device_by_idx(hd_data, hd->attached_to)) &&
+          !hd2->tag.fixed &&
+          !hd2->tag.remove
+        ) {
+          hd->tag.remove = 0;
+          cnt++;
+        }
+      }
+    } while(cnt);
+
+    /* link to the existing parent entries instead */
+    for(hd = hd_data->hd; hd; hd = hd->next) {
+      if(hd->tag.fixed || !hd->tag.remove) continue;
+      hd2 = hd->sysfs_id ? hd_find_sysfs_id(hd_data, hd->sysfs_id) : NULL;
+      if(hd2 && !hd2->tag.fixed) hd2 = NULL;
+      for(u = hd2 ? hd2->idx : 0, hd2 = hd_data->hd; hd2; hd2 = hd2->next) {
+        if(!hd2->tag.fixed && hd2->attached_to == hd->idx) hd2->attached_to = u;
+      }
+    }
+
+    remove_tagged_hd_entries(hd_data);
+
+    for(hd = hd_data->hd; hd; hd = hd->next) {
+      if(hd->tag.fixed) continue;
+      ADD2LOG("  added: #%u %s\n", hd->idx, hd->sysfs_id ?: "");
+      /* hd_list() always does this, too */
+      hd_int_update(hd_data, hd);
+      hd_add_id(hd_data, hd);
+      changed = 1;
+    }
+  }
+
+  assign_parent_ids(hd_data);
+
+  for(hd = hd_data->hd; hd; hd = hd->next) {
+    if(hd->tag.fixed) continue;
+    assign_hw_class(hd_data, hd);
+    create_model_name(hd_data, hd);
+    hd->tag.fixed = 1;
+  }
+
+  hd_index_invalidate(hd_data);
+
+  free_mem(class_id);
+  free_mem(path);
+
+  return changed;
+}
+
+
+/*
+ * Check if hd is the device at sysfs path (without '/sys') or one of its
+ * children.
+ *
+ * class_id is the id the device has as class device (/class/net/eth0).
+ */
+int update_match(hd_t *hd, char *path, char *class_id)
+{
+  char *s, *t, *id = NULL, real[PATH_MAX];
+  int i = 0;
+
+  if(hd->sysfs_device_link && sysfs_below(hd->sysfs_device_link, path)) return 1;
+
+  if(!(s = hd->sysfs_id)) return 0;
+
+  if(sysfs_below(s, path) || sysfs_below(s, class_id)) return 1;
+
+  if(!strncmp(s, "/devices/", sizeof "/devices/" - 1)) return 0;
+
+  /* class devices: use the real path if it's still there... */
+  str_printf(&id, 0, "/sys%s", s);
+  if(realpath(id, real)) {
+    i = sysfs_below(real + sizeof "/sys" - 1, path);
+  }
+  /* ... else the name (partitions are /class/block/<disk>/<partition>) */
+  else if(
+    (t = strrchr(class_id, '/')) &&
+    !strncmp(s, class_id, t - class_id + 1) &&
+    (s = strrchr(s, '/')) &&
+    !strcmp(s, t)
+  ) {
+    i = 1;
+  }
+  free_mem(id);
+
+  return i;
+}
+
+
+/*
+ * Check if sysfs id is path or below path.
+ */
+int sysfs_below(char *id, char *path)
+{
+  size_t len = strlen(path);
+
+  return !strncmp(id, path, len) && (id[len] == 0 || id[len] == '/');
+}
+
+
 void hd_scan_with_hal(hd_data_t *hd_data)
 {
   hd_t *hd;
@@ -2515,6 +2837,45 @@ str_list_t *reverse_str_list(str_list_t *list)
 }
 
 
+/*
+ * Read a binary file (e.g. a sysfs blob), at most max_len bytes.
+ *
+ * Returns a malloc'ed buffer and its size in *len; NULL if there's no data.
+ */
+unsigned char *read_bin_file(char *file_name, unsigned *len, unsigned max_len)
+{
+  unsigned char *buf = NULL;
+  unsigned size = 0, buf_size = 0;
+  ssize_t r;
+  int fd;
+
+  *len = 0;
+
+  if((fd = open(file_name, O_RDONLY)) == -1) return NULL;
+
+  for(;;) {
+    if(size == buf_size) {
+      if(buf_size >= max_len) break;
+      buf_size = buf_size ? buf_size << 1 : 0x1000;
+      if(buf_size > max_len) buf_size = max_len;
+      buf = resize_mem(buf, buf_size);
+    }
+    r = read(fd, buf + size, buf_size - size);
+    if(r < 0 && errno == EINTR) continue;
+    if(r <= 0) break;
+    size += r;
+  }
+
+  close(fd);
+
+  if(!size) buf = free_mem(buf);
+
+  *len = size;
+
+  return buf;
+}
+
+
 /*
  * Read a file; return a linked list of lines.
  *
@@ -2652,7 +3013,7 @@ void progress(hd_data_t *hd_data, unsigned pos, unsigned count, char *msg)
   char buf1[32], buf2[32], buf3[128], *fn;
 
   if(hd_data->shm.ok && hd_data->flags.forked) {
-    ((hd_data_t *) (hd_data->shm.data))->shm.updated++;
+    ((hd_shm_head_t *) hd_data->shm.data)->updated++;
   }
 
   if(!msg) msg = "";
@@ -2708,8 +3069,10 @@ void remove_hd_entries(hd_data_t *hd_data)
 {
   hd_t *hd;
 
+  hd_index_only_rescan(hd_data);
+
   for(hd = hd_data->hd; hd; hd = hd->next) {
-    if(hd->module == hd_data->module) {
+    if(hd->module == hd_data->module && !(hd_data->flags.update && hd->tag.fixed)) {
       hd->tag.remove = 1;
     }
   }
@@ -2735,6 +3098,8 @@ void remove_tagged_hd_entries(hd_data_t *hd_data)
 
       hd = *prev = hd->next;
       (*h)->next = NULL;
+
+      hd_index_invalidate(hd_data);
     }
     else {
       hd = *(prev = &hd->next);
@@ -2882,7 +3247,20 @@ int hd_smp_support(hd_data_t *hd_data)
   if(!hd) hd = hd_list(hd_data, hw_cpu, 1, NULL);
   hd_data->flags.internal = u;
 
-  for(is_smp = 0, hd0 = hd; hd0; hd0 = hd0->next) is_smp++;
+  for(is_smp = 0, hd0 = hd; hd0; hd0 = hd0->next) {
+    /* collapsed entries (cpu.collapse) stand for several threads */
+    if(
+      hd0->detail &&
+      hd0->detail->type == hd_detail_cpu &&
+      hd0->detail->cpu.data &&
+      hd0->detail->cpu.data->count
+    ) {
+      is_smp += hd0->detail->cpu.data->count;
+    }
+    else {
+      is_smp++;
+    }
+  }
   if(is_smp == 1) is_smp = 0;
 
 #if defined(__i386__) || defined (__x86_64__)
@@ -3214,9 +3592,10 @@ void hd_copy(hd_t *dst, hd_t *src)
 
 hd_t *hd_list(hd_data_t *hd_data, hd_hw_item_t item, int rescan, hd_t *hd_old)
 {
-  hd_t *hd, *hd1, *hd_list = NULL;
+  hd_t *hd, *hd1, *hd_list = NULL, **list;
   unsigned char probe_save[sizeof hd_data->probe];
-  unsigned fast_save;
+  unsigned fast_save, u, len, *rows;
+  hd_set_t *old;
 
   if(rescan) {
     memcpy(probe_save, hd_data->probe, sizeof probe_save);
@@ -3231,38 +3610,44 @@ hd_t *hd_list(hd_data_t *hd_data, hd_hw_item_t item, int rescan, hd_t *hd_old)
     memcpy(hd_data->probe, probe_save, sizeof hd_data->probe);
     hd_data->flags.fast = fast_save;
   }
+  else {
+    /* hd_data->only may be a new list; hd_scan() does this, too */
+    hd_index_only_invalidate(hd_data);
+  }
+
+  list = hd_index_list(hd_data, &len);
+  rows = hd_index_find(hd_data, hd_idx_class, item == hw_manual ? hw_all : item, &len);
+  old = hd_set_new(hd_old);
+
+  for(u = 0; u < len; u++) {
+    hd = list[rows[u]];
 
-  for(hd = hd_data->hd; hd; hd = hd->next) {
     if(!hd_report_this(hd_data, hd)) continue;
 
-    if(
-      (
-        item == hw_manual || hd_is_hw_class(hd, item)
-      )
 #ifndef LIBHD_TINY
 /* with LIBHD_TINY hd->status is not maintained (cf. manual.c) */
-      && (
+    if(
+      !(
         hd_data->hal ||
         hd->status.available == status_yes ||
         hd->status.available == status_unknown ||
         item == hw_manual ||
         hd_data->flags.list_all
       )
+    ) continue;
 #endif
-    ) {
-//      if(hd->is.softraiddisk) continue;		/* don't report them */
 
-      /* don't report old entries again */
-      for(hd1 = hd_old; hd1; hd1 = hd1->next) {
-        if(!cmp_hd(hd1, hd)) break;
-      }
-      if(!hd1) {
-        hd1 = add_hd_entry2(&hd_list, new_mem(sizeof *hd_list));
-        hd_copy(hd1, hd);
-      }
-    }
+//    if(hd->is.softraiddisk) continue;		/* don't report them */
+
+    /* don't report old entries again */
+    if(hd_set_has(old, hd)) continue;
+
+    hd1 = add_hd_entry2(&hd_list, new_mem(sizeof *hd_list));
+    hd_copy(hd1, hd);
   }
 
+  hd_set_free(old);
+
   if(item == hw_manual) {
     for(hd = hd_list; hd; hd = hd->next) {
       hd->status.available = hd->status.available_orig;
@@ -3275,8 +3660,9 @@ hd_t *hd_list(hd_data_t *hd_data, hd_hw_item_t item, int rescan, hd_t *hd_old)
 
 hd_t *hd_list_with_status(hd_data_t *hd_data, hd_hw_item_t item, hd_status_t status)
 {
-  hd_t *hd, *hd1, *hd_list = NULL;
+  hd_t *hd, *hd1, *hd_list = NULL, **list;
   unsigned char probe_save[sizeof hd_data->probe];
+  unsigned u, len, *rows;
 
   memcpy(probe_save, hd_data->probe, sizeof probe_save);
   hd_clear_probe_feature(hd_data, pr_all);
@@ -3284,17 +3670,14 @@ hd_t *hd_list_with_status(hd_data_t *hd_data, hd_hw_item_t item, hd_status_t sta
   hd_scan(hd_data);
   memcpy(hd_data->probe, probe_save, sizeof hd_data->probe);
 
-  for(hd = hd_data->hd; hd; hd = hd->next) {
-    if(hd_is_hw_class(hd, item)) {
-      if(
-        (status.configured == 0 || status.configured == hd->status.configured) &&
-        (status.available == 0 || status.available == hd->status.available) &&
-        (status.needed == 0 || status.needed == hd->status.needed) &&
-        (status.reconfig == 0 || status.reconfig == hd->status.reconfig)
-      ) {
-        hd1 = add_hd_entry2(&hd_list, new_mem(sizeof *hd_list));
-        hd_copy(hd1, hd);
-      }
+  list = hd_index_list(hd_data, &len);
+  rows = hd_index_find(hd_data, hd_idx_class, item, &len);
+
+  for(u = 0; u < len; u++) {
+    hd = list[rows[u]];
+    if(has_status(hd, status)) {
+      hd1 = add_hd_entry2(&hd_list, new_mem(sizeof *hd_list));
+      hd_copy(hd1, hd);
     }
   }
 
@@ -3302,19 +3685,35 @@ hd_t *hd_list_with_status(hd_data_t *hd_data, hd_hw_item_t item, hd_status_t sta
 }
 
 
-/* check if item is in items */
-int has_item(hd_hw_item_t *items, hd_hw_item_t item)
+/* check if hd matches status; 0 fields match anything */
+int has_status(hd_t *hd, hd_status_t status)
 {
-  while(*items) if(*items++ == item) return 1;
+  return
+    (status.configured == 0 || status.configured == hd->status.configured) &&
+    (status.available == 0 || status.available == hd->status.available) &&
+    (status.needed == 0 || status.needed == hd->status.needed) &&
+    (status.reconfig == 0 || status.reconfig == hd->status.reconfig);
+}
 
-  return 0;
+
+/*
+ * Mark rows (see hd_index_list()) of entries with one of items in sel.
+ */
+void select_hw_classes(hd_data_t *hd_data, hd_hw_item_t *items, unsigned char *sel)
+{
+  unsigned u, len, *rows;
+
+  for(; *items; items++) {
+    rows = hd_index_find(hd_data, hd_idx_class, *items, &len);
+    for(u = 0; u < len; u++) sel[rows[u]] = 1;
+  }
 }
 
 
-/* check if one of items is in hw_class */
-int has_hw_class(hd_t *hd, hd_hw_item_t *items)
+/* check if item is in items */
+int has_item(hd_hw_item_t *items, hd_hw_item_t item)
 {
-  while(*items) if(hd_is_hw_class(hd, *items++)) return 1;
+  while(*items) if(*items++ == item) return 1;
 
   return 0;
 }
@@ -3325,9 +3724,9 @@ int has_hw_class(hd_t *hd, hd_hw_item_t *items)
  */
 hd_t *hd_list2(hd_data_t *hd_data, hd_hw_item_t *items, int rescan)
 {
-  hd_t *hd, *hd1, *hd_list = NULL;
-  unsigned char probe_save[sizeof hd_data->probe];
-  unsigned fast_save;
+  hd_t *hd, *hd1, *hd_list = NULL, **list;
+  unsigned char probe_save[sizeof hd_data->probe], *sel;
+  unsigned fast_save, u, len;
   hd_hw_item_t *item_ptr;
   int is_manual;
 
@@ -3350,32 +3749,46 @@ hd_t *hd_list2(hd_data_t *hd_data, hd_hw_item_t *items, int rescan)
     memcpy(hd_data->probe, probe_save, sizeof hd_data->probe);
     hd_data->flags.fast = fast_save;
   }
+  else {
+    hd_index_only_invalidate(hd_data);
+  }
+
+  list = hd_index_list(hd_data, &len);
+  sel = new_mem(len + 1);
+
+  select_hw_classes(hd_data, items, sel);
+  if(is_manual) {
+    for(u = 0; u < len; u++) sel[u] |= list[u]->module == mod_manual;
+  }
+
+  for(u = 0; u < len; u++) {
+    if(!sel[u]) continue;
+
+    hd = list[u];
 
-  for(hd = hd_data->hd; hd; hd = hd->next) {
     if(!hd_report_this(hd_data, hd)) continue;
-    if(
-      (
-        (is_manual && hd->module == mod_manual) || has_hw_class(hd, items)
-      )
+
 #ifndef LIBHD_TINY
 /* with LIBHD_TINY hd->status is not maintained (cf. manual.c) */
-      && (
+    if(
+      !(
         hd_data->hal ||
         hd->status.available == status_yes ||
         hd->status.available == status_unknown ||
         is_manual ||
         hd_data->flags.list_all
       )
+    ) continue;
 #endif
-    ) {
-//      if(hd->is.softraiddisk) continue;		/* don't report them */
 
-      /* don't report old entries again */
-      hd1 = add_hd_entry2(&hd_list, new_mem(sizeof *hd_list));
-      hd_copy(hd1, hd);
-    }
+//    if(hd->is.softraiddisk) continue;		/* don't report them */
+
+    hd1 = add_hd_entry2(&hd_list, new_mem(sizeof *hd_list));
+    hd_copy(hd1, hd);
   }
 
+  free_mem(sel);
+
   if(is_manual) {
     for(hd = hd_list; hd; hd = hd->next) {
       if(hd->module == mod_manual) {
@@ -3393,8 +3806,9 @@ hd_t *hd_list2(hd_data_t *hd_data, hd_hw_item_t *items, int rescan)
  */
 hd_t *hd_list_with_status2(hd_data_t *hd_data, hd_hw_item_t *items, hd_status_t status)
 {
-  hd_t *hd, *hd1, *hd_list = NULL;
-  unsigned char probe_save[sizeof hd_data->probe];
+  hd_t *hd1, *hd_list = NULL, **list;
+  unsigned char probe_save[sizeof hd_data->probe], *sel;
+  unsigned u, len;
 
   if(!items) return NULL;
 
@@ -3404,42 +3818,50 @@ hd_t *hd_list_with_status2(hd_data_t *hd_data, hd_hw_item_t *items, hd_status_t
   hd_scan(hd_data);
   memcpy(hd_data->probe, probe_save, sizeof hd_data->probe);
 
-  for(hd = hd_data->hd; hd; hd = hd->next) {
-    if(has_hw_class(hd, items)) {
-      if(
-        (status.configured == 0 || status.configured == hd->status.configured) &&
-        (status.available == 0 || status.available == hd->status.available) &&
-        (status.needed == 0 || status.needed == hd->status.needed) &&
-        (status.reconfig == 0 || status.reconfig == hd->status.reconfig)
-      ) {
-        hd1 = add_hd_entry2(&hd_list, new_mem(sizeof *hd_list));
-        hd_copy(hd1, hd);
-      }
+  list = hd_index_list(hd_data, &len);
+  sel = new_mem(len + 1);
+
+  select_hw_classes(hd_data, items, sel);
+
+  for(u = 0; u < len; u++) {
+    if(sel[u] && has_status(list[u], status)) {
+      hd1 = add_hd_entry2(&hd_list, new_mem(sizeof *hd_list));
+      hd_copy(hd1, list[u]);
     }
   }
 
+  free_mem(sel);
+
   return hd_list;
 }
 
 
 hd_t *hd_base_class_list(hd_data_t *hd_data, unsigned base_class)
 {
-  hd_t *hd, *hd1, *hd_list = NULL;
-//  hd_t *bridge_hd;
+  hd_t *hd, *hd1, *hd_list = NULL, **list;
+  unsigned u0, u1, len, len0, len1 = 0, *rows0, *rows1 = NULL, row;
 
-  for(hd = hd_data->hd; hd; hd = hd->next) {
-    /* add multimedia/sc_multi_video to display */
-    if(
-      hd->base_class.id == base_class ||
-      (
-        base_class == bc_display &&
-        hd->base_class.id == bc_multimedia &&
-        hd->sub_class.id == sc_multi_video
-      )
-    ) {
-      hd1 = add_hd_entry2(&hd_list, new_mem(sizeof *hd_list));
-      hd_copy(hd1, hd);
+  list = hd_index_list(hd_data, &len);
+  rows0 = hd_index_find(hd_data, hd_idx_base_class, base_class, &len0);
+
+  /* add multimedia/sc_multi_video to display */
+  if(base_class == bc_display) {
+    rows1 = hd_index_find(hd_data, hd_idx_base_class, bc_multimedia, &len1);
+  }
+
+  /* merge both buckets, keeping list order */
+  for(u0 = u1 = 0; u0 < len0 || u1 < len1;) {
+    if(u1 == len1 || (u0 < len0 && rows0[u0] < rows1[u1])) {
+      row = rows0[u0++];
     }
+    else {
+      row = rows1[u1++];
+      if(list[row]->sub_class.id != sc_multi_video) continue;
+    }
+
+    hd = list[row];
+    hd1 = add_hd_entry2(&hd_list, new_mem(sizeof *hd_list));
+    hd_copy(hd1, hd);
   }
 
   return hd_list;
@@ -3447,10 +3869,15 @@ hd_t *hd_base_class_list(hd_data_t *hd_data, unsigned base_class)
 
 hd_t *hd_sub_class_list(hd_data_t *hd_data, unsigned base_class, unsigned sub_class)
 {
-  hd_t *hd, *hd1, *hd_list = NULL;
+  hd_t *hd, *hd1, *hd_list = NULL, **list;
+  unsigned u, len, *rows;
 
-  for(hd = hd_data->hd; hd; hd = hd->next) {
-    if(hd->base_class.id == base_class && hd->sub_class.id == sub_class) {
+  list = hd_index_list(hd_data, &len);
+  rows = hd_index_find(hd_data, hd_idx_base_class, base_class, &len);
+
+  for(u = 0; u < len; u++) {
+    hd = list[rows[u]];
+    if(hd->sub_class.id == sub_class) {
       hd1 = add_hd_entry2(&hd_list, new_mem(sizeof *hd_list));
       hd_copy(hd1, hd);
     }
@@ -3461,13 +3888,15 @@ hd_t *hd_sub_class_list(hd_data_t *hd_data, unsigned base_class, unsigned sub_cl
 
 hd_t *hd_bus_list(hd_data_t *hd_data, unsigned bus)
 {
-  hd_t *hd, *hd1, *hd_list = NULL;
+  hd_t *hd1, *hd_list = NULL, **list;
+  unsigned u, len, *rows;
 
-  for(hd = hd_data->hd; hd; hd = hd->next) {
-    if(hd->bus.id == bus) {
-      hd1 = add_hd_entry2(&hd_list, new_mem(sizeof *hd_list));
-      hd_copy(hd1, hd);
-    }
+  list = hd_index_list(hd_data, &len);
+  rows = hd_index_find(hd_data, hd_idx_bus, bus, &len);
+
+  for(u = 0; u < len; u++) {
+    hd1 = add_hd_entry2(&hd_list, new_mem(sizeof *hd_list));
+    hd_copy(hd1, list[rows[u]]);
   }
 
   return hd_list;
@@ -3721,7 +4150,7 @@ unsigned hd_boot_disk(hd_data_t *hd_data, int *matches)
     if(
       hd->base_class.id == bc_storage_device &&
       hd->sub_class.id == sc_sdev_disk &&
-      hd->block0
+      hd_get_block0(hd_data, hd)
     ) {
       if(dev_name_duplicate(dl0, hd->unix_dev_name)) continue;
       dl = add_disk_entry(&dl0, new_mem(sizeof *dl0));
@@ -4111,23 +4540,99 @@ unsigned has_something_attached(hd_data_t *hd_data, hd_t *hd)
 }
 
 
-/* ##### FIX: replace with a real crc later ##### */
+/*
+ * Powers of the per byte multiplier (73 * 65521).
+ */
+#define CRC64_M1	0x48fbb9ull
+#define CRC64_M2	0x14ce8f944bb1ull
+#define CRC64_M3	0xee8df1c172293de9ull
+#define CRC64_M4	0x8f047b5359093061ull
+#define CRC64_M5	0x6e98e21cf55b1119ull
+#define CRC64_M6	0x6a52cd1a679ade11ull
+#define CRC64_M7	0xb45c3f382b6d2549ull
+#define CRC64_M8	0x9071f8dde1f684c1ull
+
+static const uint64_t crc64_mul[9] = {
+  1, CRC64_M1, CRC64_M2, CRC64_M3, CRC64_M4, CRC64_M5, CRC64_M6, CRC64_M7, CRC64_M8
+};
+
+/*
+ * What byte c adds to the id before the multiplication; the sign extension
+ * is what the original 'uc + ((uc + 57) << 27)' did.
+ */
+#define CRC64_TERM(c)	((uint64_t) (c) + (uint64_t) (int64_t) (int32_t) ((uint32_t) ((c) + 57) << 27))
+
+#define CRC64_T4(c, m)	CRC64_TERM(c) * m, CRC64_TERM(c + 1) * m, CRC64_TERM(c + 2) * m, CRC64_TERM(c + 3) * m
+#define CRC64_T16(c, m)	CRC64_T4(c, m), CRC64_T4(c + 4, m), CRC64_T4(c + 8, m), CRC64_T4(c + 12, m)
+#define CRC64_T64(c, m)	CRC64_T16(c, m), CRC64_T16(c + 16, m), CRC64_T16(c + 32, m), CRC64_T16(c + 48, m)
+#define CRC64_T256(m)	{ CRC64_T64(0, m), CRC64_T64(64, m), CRC64_T64(128, m), CRC64_T64(192, m) }
+
+/*
+ * crc64_tab[d - 1][c]: contribution of byte c, d bytes before the end of
+ * a block.
+ */
+static const uint64_t crc64_tab[8][256] = {
+  CRC64_T256(CRC64_M1), CRC64_T256(CRC64_M2), CRC64_T256(CRC64_M3), CRC64_T256(CRC64_M4),
+  CRC64_T256(CRC64_M5), CRC64_T256(CRC64_M6), CRC64_T256(CRC64_M7), CRC64_T256(CRC64_M8)
+};
+
+#undef CRC64_T256
+#undef CRC64_T64
+#undef CRC64_T16
+#undef CRC64_T4
+
+
+/*
+ * Not a real crc, but the ids depend on it - don't change the result.
+ *
+ * Per byte it's id = (id + CRC64_TERM(c)) * CRC64_M1. That's linear, so a
+ * block of up to 8 bytes is id * M^len plus a table lookup per byte, see
+ * crc64_block().
+ */
 void crc64(uint64_t *id, void *p, int len)
 {
-  unsigned char uc;
+  unsigned char *s = p;
+  uint64_t x = *id;
 
-  for(; len; len--, p++) {
-    uc = *(unsigned char *) p;
-    *id += uc + ((uc + 57) << 27);
-    *id *= 73;
-    *id *= 65521;
-  }
+  for(; len >= 8; len -= 8, s += 8) x = crc64_block(x, s, 8);
+  if(len > 0) x = crc64_block(x, s, len);
+
+  *id = x;
 }
 
-char *numid2str(uint64_t id, int len)
+
+/*
+ * Add len (1..8) bytes to id.
+ */
+uint64_t crc64_block(uint64_t id, unsigned char *s, unsigned len)
 {
-  static char buf[32];
+  unsigned char *end = s + len;
+
+  id *= crc64_mul[len];
+
+  switch(len) {
+    case 8: id += crc64_tab[7][end[-8]];
+    case 7: id += crc64_tab[6][end[-7]];
+    case 6: id += crc64_tab[5][end[-6]];
+    case 5: id += crc64_tab[4][end[-5]];
+    case 4: id += crc64_tab[3][end[-4]];
+    case 3: id += crc64_tab[2][end[-3]];
+    case 2: id += crc64_tab[1][end[-2]];
+    case 1: id += crc64_tab[0][end[-1]];
+  }
+
+  return id;
+}
+
+
+/* numid2str() buffer size */
+#define NUMID_LEN	32
 
+/*
+ * Format id (the lowest len bits) into buf (NUMID_LEN bytes).
+ */
+char *numid2str(uint64_t id, int len, char *buf)
+{
 #ifdef NUMERIC_UNIQUE_ID
   /* numeric */
 
@@ -4140,8 +4645,8 @@ char *numid2str(uint64_t id, int len)
   int i;
   unsigned char u;
 
-  memset(buf, 0, sizeof buf);
-  for(i = 0; len > 0 && i < (int) sizeof buf - 1; i++, len -= 6, id >>= 6) {
+  memset(buf, 0, NUMID_LEN);
+  for(i = 0; len > 0 && i < NUMID_LEN - 1; i++, len -= 6, id >>= 6) {
     u = id & 0x3f;
     if(u < 10) {
       u += '0';			/* 0..9 */
@@ -4173,13 +4678,43 @@ char *numid2str(uint64_t id, int len)
 #define STR_CRC(a, b)	if(hd->b) crc64(&a, hd->b, strlen(hd->b) + 1);
 
 
+/*
+ * Fields both id1 variants start with.
+ */
+uint64_t id1_common(hd_t *hd)
+{
+  uint64_t id1 = 0;
+
+  INT_CRC(id1, base_class.id);
+  INT_CRC(id1, sub_class.id);
+  INT_CRC(id1, prog_if.id);
+  INT_CRC(id1, device.id);
+  INT_CRC(id1, vendor.id);
+  INT_CRC(id1, sub_device.id);
+  INT_CRC(id1, sub_vendor.id);
+  INT_CRC(id1, revision.id);
+
+  return id1;
+}
+
+
 // old method
 void hd_add_old_id(hd_t *hd)
 {
-  uint64_t id0 = 0, id1 = 0;
-
   if(hd->unique_id) return;
 
+  add_old_id(hd, id1_common(hd));
+}
+
+
+/*
+ * id1: see id1_common().
+ */
+void add_old_id(hd_t *hd, uint64_t id1)
+{
+  uint64_t id0 = 0;
+  char buf0[NUMID_LEN], buf1[NUMID_LEN];
+
   INT_CRC(id0, bus.id);
   INT_CRC(id0, slot);
   INT_CRC(id0, func);
@@ -4189,14 +4724,6 @@ void hd_add_old_id(hd_t *hd)
   STR_CRC(id0, unix_dev_name);
   STR_CRC(id0, rom_id);
 
-  INT_CRC(id1, base_class.id);
-  INT_CRC(id1, sub_class.id);
-  INT_CRC(id1, prog_if.id);
-  INT_CRC(id1, device.id);
-  INT_CRC(id1, vendor.id);
-  INT_CRC(id1, sub_device.id);
-  INT_CRC(id1, sub_vendor.id);
-  INT_CRC(id1, revision.id);
   INT_CRC(id1, compat_device.id);
   INT_CRC(id1, compat_vendor.id);
   STR_CRC(id1, device.name);
@@ -4207,28 +4734,22 @@ void hd_add_old_id(hd_t *hd)
   STR_CRC(id1, serial);
 
   id0 += (id0 >> 32);
-  str_printf(&hd->unique_id, 0, "%s", numid2str(id0, 24));
-  str_printf(&hd->unique_id, -1, ".%s", numid2str(id1, 64));
+  str_printf(&hd->unique_id, 0, "%s.%s", numid2str(id0, 24, buf0), numid2str(id1, 64, buf1));
 }
 
 void hd_add_id(hd_data_t *hd_data, hd_t *hd)
 {
-  uint64_t id0 = 0, id1 = 0;
+  uint64_t id0 = 0, id1;
+  char buf[NUMID_LEN];
 
   if(hd->unique_id) return;
 
-  hd_add_old_id(hd);
+  id1 = id1_common(hd);
+
+  add_old_id(hd, id1);
   hd->old_unique_id = hd->unique_id;
   hd->unique_id = NULL;
 
-  INT_CRC(id1, base_class.id);
-  INT_CRC(id1, sub_class.id);
-  INT_CRC(id1, prog_if.id);
-  INT_CRC(id1, device.id);
-  INT_CRC(id1, vendor.id);
-  INT_CRC(id1, sub_device.id);
-  INT_CRC(id1, sub_vendor.id);
-  INT_CRC(id1, revision.id);
   if(
     hd->detail &&
     hd->detail->type == hd_detail_ccw &&
@@ -4244,7 +4765,7 @@ void hd_add_id(hd_data_t *hd_data, hd_t *hd)
   if(!hd->revision.name) STR_CRC(id1, revision.name);
   STR_CRC(id1, serial);
 
-  hd->unique_id1 = new_str(numid2str(id1, 64));
+  hd->unique_id1 = new_str(numid2str(id1, 64, buf));
 
   INT_CRC(id0, bus.id);
 
@@ -4274,7 +4795,7 @@ void hd_add_id(hd_data_t *hd_data, hd_t *hd)
 
   id0 += (id0 >> 32);
 
-  str_printf(&hd->unique_id, 0, "%s.%s", numid2str(id0, 24), hd->unique_id1);
+  str_printf(&hd->unique_id, 0, "%s.%s", numid2str(id0, 24, buf), hd->unique_id1);
 }
 #undef INT_CRC
 #undef STR_CRC
@@ -4365,6 +4886,114 @@ unsigned char *read_block0(hd_data_t *hd_data, char *dev, int *timeout)
 }
 
 
+/*
+ * hd_list() & co return copies; load details into the original entry and
+ * update the copy.
+ *
+ * Always sync: another copy may have triggered the load.
+ */
+void lazy_sync(hd_t *hd, hd_t *hd0)
+{
+  if(hd == hd0) return;
+
+  hd->block0 = hd0->block0;
+  hd->detail = hd0->detail;
+  hd->res = hd0->res;
+  hd->is = hd0->is;
+  hd->lazy = hd0->lazy;
+}
+
+
+/** \relates s_hd_t
+ * Get first block of a storage device.
+ *
+ * If the scan was run with hd_data->flags.lazy set, the block is read now.
+ */
+unsigned char *hd_get_block0(hd_data_t *hd_data, hd_t *hd)
+{
+  hd_t *hd0;
+  int timeout = 5;
+
+  if(!hd) return NULL;
+
+  hd0 = hd->ref ?: hd;
+
+  if(hd0->lazy.block0) {
+    hd0->lazy.block0 = 0;
+    hd0->block0 = read_block0(hd_data, hd0->unix_dev_name, &timeout);
+    hd0->is.notready = hd0->block0 ? 0 : 1;
+  }
+
+  lazy_sync(hd, hd0);
+
+  return hd->block0;
+}
+
+
+/** \relates s_hd_t
+ * Get iso9660 & el torito info of a cdrom.
+ *
+ * If the scan was run with hd_data->flags.lazy set, the medium is read now.
+ */
+cdrom_info_t *hd_get_cdrom_info(hd_data_t *hd_data, hd_t *hd)
+{
+  hd_t *hd0;
+
+  if(!hd) return NULL;
+
+  hd0 = hd->ref ?: hd;
+
+  if(hd0->lazy.cdrom) {
+    hd0->lazy.cdrom = 0;
+    hd_read_cdrom_info(hd_data, hd0);
+  }
+
+  lazy_sync(hd, hd0);
+
+  return hd->detail && hd->detail->type == hd_detail_cdrom ? hd->detail->cdrom.data : NULL;
+}
+
+
+/** \relates s_hd_t
+ * Get resource list, including disk size & geometry and network link state.
+ *
+ * If the scan was run with hd_data->flags.lazy set, these are read now.
+ */
+hd_res_t *hd_get_res(hd_data_t *hd_data, hd_t *hd)
+{
+  hd_t *hd0;
+
+  if(!hd) return NULL;
+
+  hd0 = hd->ref ?: hd;
+
+  if(hd0->lazy.size) {
+    hd0->lazy.size = 0;
+    add_disk_size(hd_data, hd0);
+  }
+
+  if(hd0->lazy.link) {
+    hd0->lazy.link = 0;
+    hd_net_link_state(hd_data, hd0);
+  }
+
+  lazy_sync(hd, hd0);
+
+  return hd->res;
+}
+
+
+/** \relates s_hd_t
+ * Read all details skipped during a lazy scan.
+ */
+void hd_load_details(hd_data_t *hd_data, hd_t *hd)
+{
+  hd_get_block0(hd_data, hd);
+  hd_get_cdrom_info(hd_data, hd);
+  hd_get_res(hd_data, hd);
+}
+
+
 void get_kernel_version(hd_data_t *hd_data)
 {
   unsigned u1, u2;
@@ -5266,9 +5895,11 @@ void hd_fork(hd_data_t *hd_data, int timeout, int total_timeout)
   void (*old_sigchld_handler)(int);
   struct timespec wait_time;
   int i, j, sleep_intr = 1;
-  hd_data_t *hd_data_shm;
+  hd_shm_head_t *head;
   time_t stop_time;
   int updated, rem_time;
+  unsigned len;
+  char *log;
   sigset_t new_set, old_set;
   int kill_sig[] = { SIGUSR1, SIGKILL };
 
@@ -5279,7 +5910,9 @@ void hd_fork(hd_data_t *hd_data, int timeout, int total_timeout)
     return;
   }
 
-  hd_data_shm = hd_data->shm.data;
+  /* drop results of the previous child */
+  shm_reset(hd_data);
+  head = hd_data->shm.data;
 
   stop_time = time(NULL) + total_timeout;
   rem_time = total_timeout;
@@ -5295,7 +5928,7 @@ void hd_fork(hd_data_t *hd_data, int timeout, int total_timeout)
   wait_time.tv_sec = timeout;
   wait_time.tv_nsec = 0;
 
-  updated = hd_data_shm->shm.updated;
+  updated = head->updated;
 
   child = fork();
 
@@ -5312,7 +5945,7 @@ void hd_fork(hd_data_t *hd_data, int timeout, int total_timeout)
         sleep_intr = nanosleep(&wait_time, &wait_time);
 //        fprintf(stderr, "woke up %d\n", sleep_intr);
         rem_time = stop_time - time(NULL);
-        if(updated != hd_data_shm->shm.updated && rem_time >= 0) {
+        if(updated != head->updated && rem_time >= 0) {
           /* reset time if there was some progress and we've got some time left  */
           rem_time++;
           wait_time.tv_sec = rem_time > timeout ? timeout : rem_time;
@@ -5320,7 +5953,7 @@ void hd_fork(hd_data_t *hd_data, int timeout, int total_timeout)
 
           sleep_intr = 1;
         }
-        updated = hd_data_shm->shm.updated;
+        updated = head->updated;
       }
 
       if(child_id != child) {
@@ -5335,7 +5968,11 @@ void hd_fork(hd_data_t *hd_data, int timeout, int total_timeout)
         }
       }
 
-      hd_log(hd_data, hd_data_shm->log, hd_data_shm->log_size);
+      shm_map_result(hd_data);
+
+      for(log = NULL; (log = hd_shm_get(hd_data, shm_log, log, &len));) {
+        hd_log(hd_data, log, len);
+      }
 
       ADD2LOG("******  stopped child process %d (%ds)  ******\n", (int) child, rem_time);
     }
@@ -5369,19 +6006,11 @@ void hd_fork_done(hd_data_t *hd_data)
 
 
 /*
- * Copy log to shm segment.
+ * Copy log to result channel.
  */
 void copy_log2shm(hd_data_t *hd_data)
 {
-  hd_data_t *hd_data_shm;
-
-  hd_data_shm = hd_data->shm.data;
-
-  if(hd_data->log) {
-    hd_data_shm->log_size = hd_data->log_size;
-    hd_data_shm->log_max = hd_data->log_size + 1;
-    hd_data_shm->log = hd_shm_add(hd_data, hd_data->log, hd_data_shm->log_max);
-  }
+  if(hd_data->log) hd_shm_add(hd_data, shm_log, hd_data->log, hd_data->log_size);
 }
 
 
@@ -5412,38 +6041,47 @@ void sigusr1_handler(int num)
 
 
 /*
- * Get a sufficiently large shm segment.
+ * Set up result channel for forked probes.
+ *
+ * It starts with one page and grows (in the child) as needed.
  */
 void hd_shm_init(hd_data_t *hd_data)
 {
   void *p;
+  int fd;
 
   if(hd_data->shm.ok || hd_data->flags.nofork) return;
 
   memset(&hd_data->shm, 0, sizeof hd_data->shm);
+  hd_data->shm.fd = -1;
 
-  hd_data->shm.size = 256*1024;
+  fd = memfd_create("libhd", MFD_CLOEXEC);
 
-  hd_data->shm.id = shmget(IPC_PRIVATE, hd_data->shm.size, IPC_CREAT | 0600);
-
-  if(hd_data->shm.id == -1) {
-    ADD2LOG("shm: shmget failed (errno %d)\n", errno);
+  if(fd == -1) {
+    ADD2LOG("shm: memfd_create failed (errno %d)\n", errno);
     return;
   }
 
-  p = shmat(hd_data->shm.id, NULL, 0);
+  hd_data->shm.size = getpagesize();
 
-  if(p == (void *) -1) {
-    ADD2LOG("shm: shmat for segment %d failed (errno %d)\n", hd_data->shm.id, errno);
+  if(ftruncate(fd, hd_data->shm.size)) {
+    ADD2LOG("shm: ftruncate failed (errno %d)\n", errno);
+    close(fd);
+    return;
   }
 
-  shmctl(hd_data->shm.id, IPC_RMID, NULL);
+  p = mmap(NULL, hd_data->shm.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
 
-  if(p == (void *) -1) return;
+  if(p == MAP_FAILED) {
+    ADD2LOG("shm: mmap failed (errno %d)\n", errno);
+    close(fd);
+    return;
+  }
 
+  hd_data->shm.fd = fd;
   hd_data->shm.data = p;
 
-  ADD2LOG("shm: attached segment %d at %p\n", hd_data->shm.id, hd_data->shm.data);
+  ADD2LOG("shm: memfd %d mapped at %p\n", hd_data->shm.fd, hd_data->shm.data);
 
   hd_data->shm.ok = 1;
 
@@ -5452,146 +6090,329 @@ void hd_shm_init(hd_data_t *hd_data)
 
 
 /*
- * Reset shm usage, remove references to shm area.
+ * Drop results, remove references to them.
  */
 void hd_shm_clean(hd_data_t *hd_data)
 {
-  hd_data_t *hd_data_shm;
-
   if(!hd_data->shm.ok) return;
 
   if(hd_is_shm_ptr(hd_data, hd_data->ser_mouse)) hd_data->ser_mouse = NULL;
   if(hd_is_shm_ptr(hd_data, hd_data->ser_modem)) hd_data->ser_modem = NULL;
 
+  shm_reset(hd_data);
+}
 
-  hd_data->shm.used = sizeof *hd_data;
-  hd_data->shm.updated = 0;
 
-  memcpy(hd_data_shm = hd_data->shm.data, hd_data, sizeof *hd_data);
+/*
+ * Release result channel.
+ */
+void hd_shm_done(hd_data_t *hd_data)
+{
+  if(!hd_data->shm.ok) return;
 
-  hd_data_shm->log = NULL;
+  hd_shm_clean(hd_data);
+
+  munmap(hd_data->shm.data, hd_data->shm.size);
+  close(hd_data->shm.fd);
+
+  hd_data->shm.fd = -1;
+  hd_data->shm.ok = 0;
 }
 
 
 /*
- * Release shm segment.
+ * Unmap results and empty channel (parent).
  */
-void hd_shm_done(hd_data_t *hd_data)
+void shm_reset(hd_data_t *hd_data)
 {
+  hd_shm_head_t *head;
+
   if(!hd_data->shm.ok) return;
 
-  shmdt(hd_data->shm.data);
+  if(hd_data->shm.result) {
+    munmap(hd_data->shm.result, hd_data->shm.result_size);
+    hd_data->shm.result = NULL;
+    hd_data->shm.result_size = 0;
+  }
+
+  head = hd_data->shm.data;
+  head->used = 0;
+  head->updated = 0;
 
-  hd_data->shm.ok = 0;
+  /* give back what the last child used */
+  if(ftruncate(hd_data->shm.fd, hd_data->shm.size)) {
+    ADD2LOG("shm: ftruncate failed (errno %d)\n", errno);
+  }
 }
 
 
 /*
- * Copy into shm area. If ptr is NULL return a shm area of size len.
+ * Map records written by the child (parent).
+ *
+ * The mapping is private: pointers can be relocated in place.
  */
-void *hd_shm_add(hd_data_t *hd_data, void *ptr, unsigned len)
+void shm_map_result(hd_data_t *hd_data)
 {
-  if(!hd_data->shm.ok || !len) return NULL;
+  hd_shm_head_t *head = hd_data->shm.data;
+  struct stat sbuf;
+  unsigned size;
+  void *p;
 
-  hd_data = hd_data->shm.data;
+  if(!hd_data->shm.ok || hd_data->shm.result) return;
+
+  size = sizeof *head + head->used;
+
+  /* a killed child might have left less than it claims */
+  if(fstat(hd_data->shm.fd, &sbuf) || sbuf.st_size < size) {
+    ADD2LOG("shm: result truncated\n");
+    return;
+  }
 
-  if(hd_data->shm.size - hd_data->shm.used < len) return NULL;
+  p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, hd_data->shm.fd, 0);
 
-  if(ptr) {
-    ptr = memcpy(hd_data->shm.data + hd_data->shm.used, ptr, len);
+  if(p == MAP_FAILED) {
+    ADD2LOG("shm: mmap failed (errno %d)\n", errno);
+    return;
+  }
+
+  hd_data->shm.result = p;
+  hd_data->shm.result_size = size;
+}
+
+
+/*
+ * Append record to result channel (child).
+ *
+ * Returns 1 on success.
+ */
+int hd_shm_add(hd_data_t *hd_data, hd_shm_type_t type, void *ptr, unsigned len)
+{
+  hd_shm_head_t *head;
+  hd_shm_rec_t *rec;
+  unsigned size, need;
+  void *p;
+
+  if(!hd_data->shm.ok) return 0;
+
+  head = hd_data->shm.data;
+  need = sizeof *head + head->used + sizeof *rec + SHM_ALIGN(len);
+
+  if(need > hd_data->shm.size) {
+    for(size = hd_data->shm.size; size < need; size <<= 1);
+
+    if(ftruncate(hd_data->shm.fd, size)) return 0;
+
+    p = mremap(hd_data->shm.data, hd_data->shm.size, size, MREMAP_MAYMOVE);
+    if(p == MAP_FAILED) return 0;
+
+    hd_data->shm.data = head = p;
+    hd_data->shm.size = size;
+  }
+
+  rec = (hd_shm_rec_t *) ((char *) hd_data->shm.data + sizeof *head + head->used);
+  rec->type = type;
+  rec->len = len;
+  if(ptr && len) memcpy(rec + 1, ptr, len);
+
+  /* make it visible only when it's complete */
+  head->used += sizeof *rec + SHM_ALIGN(len);
+
+  return 1;
+}
+
+
+/*
+ * Find next record of type after prev (parent).
+ *
+ * prev is NULL or a value returned earlier; len may be NULL.
+ * Returns record data or NULL.
+ */
+void *hd_shm_get(hd_data_t *hd_data, hd_shm_type_t type, void *prev, unsigned *len)
+{
+  hd_shm_rec_t *rec;
+  char *end;
+
+  if(!hd_data->shm.result) return NULL;
+
+  end = (char *) hd_data->shm.result + hd_data->shm.result_size;
+
+  if(prev) {
+    rec = (hd_shm_rec_t *) prev - 1;
+    rec = (hd_shm_rec_t *) ((char *) prev + SHM_ALIGN(rec->len));
   }
   else {
-    ptr = memset(hd_data->shm.data + hd_data->shm.used, 0, len);
+    rec = (hd_shm_rec_t *) ((char *) hd_data->shm.result + sizeof (hd_shm_head_t));
   }
 
-  hd_data->shm.used += len;
+  for(; (char *) (rec + 1) <= end; rec = (hd_shm_rec_t *) ((char *) (rec + 1) + SHM_ALIGN(rec->len))) {
+    if((char *) (rec + 1) + rec->len > end) break;
+    if(rec->type == type) {
+      if(len) *len = rec->len;
+      return rec + 1;
+    }
+  }
 
-  return ptr;
+  return NULL;
 }
 
 
 /*
- * Check if ptr points to a valid shm address.
+ * Check if ptr points into the current results.
  */
 int hd_is_shm_ptr(hd_data_t *hd_data, void *ptr)
 {
-  if(!hd_data->shm.ok || !ptr) return 0;
-
-  hd_data = hd_data->shm.data;
+  if(!hd_data->shm.result || !ptr) return 0;
 
   if(
-    ptr < hd_data->shm.data ||
-    ptr >= hd_data->shm.data + hd_data->shm.used
+    (char *) ptr < (char *) hd_data->shm.result ||
+    (char *) ptr >= (char *) hd_data->shm.result + hd_data->shm.result_size
   ) return 0;
-  
+
   return 1;
 }
 
 
-char *hd_shm_add_str(hd_data_t *hd_data, char *str)
+/*
+ * Append len bytes (zeroed if ptr is NULL) to record.
+ *
+ * Returns offset.
+ */
+unsigned shm_buf_add(shm_buf_t *buf, void *ptr, unsigned len)
 {
-  return hd_shm_add(hd_data, str, str ? strlen(str) + 1 : 0);
+  unsigned ofs = buf->len;
+
+  buf->len += SHM_ALIGN(len);
+  buf->buf = resize_mem(buf->buf, buf->len);
+  memset(buf->buf + ofs, 0, buf->len - ofs);
+  if(ptr) memcpy(buf->buf + ofs, ptr, len);
+
+  return ofs;
+}
+
+
+char *shm_buf_str(shm_buf_t *buf, char *str)
+{
+  return str ? SHM_OFS(shm_buf_add(buf, str, strlen(str) + 1)) : NULL;
 }
 
 
-str_list_t *hd_shm_add_str_list(hd_data_t *hd_data, str_list_t *sl)
+/*
+ * Note: offset 0 is the record's main struct, so a list never starts there.
+ */
+str_list_t *shm_buf_str_list(shm_buf_t *buf, str_list_t *sl)
 {
-  str_list_t *sl0 = NULL, **sl_shm;
+  unsigned ofs, first = 0, last = 0;
+  char *str;
 
-  for(sl_shm = &sl0; sl; sl = sl->next, sl_shm = &(*sl_shm)->next) {
-    *sl_shm = hd_shm_add(hd_data, NULL, sizeof **sl_shm);
-    (*sl_shm)->str = hd_shm_add_str(hd_data, sl->str);
+  for(; sl; sl = sl->next) {
+    str = shm_buf_str(buf, sl->str);
+    ofs = shm_buf_add(buf, NULL, sizeof *sl);
+    ((str_list_t *) (buf->buf + ofs))->str = str;
+    if(last) {
+      ((str_list_t *) (buf->buf + last))->next = SHM_OFS(ofs);
+    }
+    else {
+      first = ofs;
+    }
+    last = ofs;
   }
 
-  return sl0;
+  return SHM_OFS(first);
 }
 
 
+/* string members of ser_device_t */
+static size_t ser_str_ofs[] = {
+  offsetof(ser_device_t, dev_name),
+  offsetof(ser_device_t, serial),
+  offsetof(ser_device_t, class_name),
+  offsetof(ser_device_t, dev_id),
+  offsetof(ser_device_t, user_name),
+  offsetof(ser_device_t, vend),
+  offsetof(ser_device_t, init_string1),
+  offsetof(ser_device_t, init_string2),
+  offsetof(ser_device_t, pppd_option)
+};
+
+
+/*
+ * Pass serial mice & modems to parent (child).
+ */
 void hd_move_to_shm(hd_data_t *hd_data)
 {
-  hd_data_t *hd_data_shm;
-  ser_device_t *ser, **ser_shm;
+  ser_device_t *ser;
   struct {
-    ser_device_t **src, **dst;
-  } ser_dev[2];
-  unsigned u;
+    ser_device_t *list;
+    hd_shm_type_t type;
+  } ser_dev[] = {
+    { hd_data->ser_mouse, shm_ser_mouse },
+    { hd_data->ser_modem, shm_ser_modem }
+  };
+  shm_buf_t buf;
+  unsigned u, v;
+  char *s;
+  str_list_t *sl;
 
   if(!hd_data->shm.ok) return;
 
-  hd_data_shm = hd_data->shm.data;
+  for(u = 0; u < sizeof ser_dev / sizeof *ser_dev; u++) {
+    for(ser = ser_dev[u].list; ser; ser = ser->next) {
+      memset(&buf, 0, sizeof buf);
 
-  ser_dev[0].src = &hd_data->ser_mouse;
-  ser_dev[0].dst = &hd_data_shm->ser_mouse;
-  ser_dev[1].src = &hd_data->ser_modem;
-  ser_dev[1].dst = &hd_data_shm->ser_modem;
+      shm_buf_add(&buf, ser, sizeof *ser);
+      ((ser_device_t *) buf.buf)->next = NULL;
 
-  for(u = 0; u < sizeof ser_dev / sizeof *ser_dev; u++) {
-    if(*ser_dev[u].src) {
-      /* copy serial mouse data */
-      for(
-        ser = *ser_dev[u].src, ser_shm = ser_dev[u].dst;
-        ser;
-        ser = ser->next, ser_shm = &(*ser_shm)->next
-      ) {
-        *ser_shm = hd_shm_add(hd_data, ser, sizeof *ser);
+      for(v = 0; v < sizeof ser_str_ofs / sizeof *ser_str_ofs; v++) {
+        s = shm_buf_str(&buf, *(char **) ((char *) ser + ser_str_ofs[v]));
+        *(char **) (buf.buf + ser_str_ofs[v]) = s;
       }
 
-      for(ser = *ser_dev[u].dst; ser; ser = ser->next) {
-        ser->dev_name = hd_shm_add_str(hd_data, ser->dev_name);
-        ser->serial = hd_shm_add_str(hd_data, ser->serial);
-        ser->class_name = hd_shm_add_str(hd_data, ser->class_name);
-        ser->dev_id = hd_shm_add_str(hd_data, ser->dev_id);
-        ser->user_name = hd_shm_add_str(hd_data, ser->user_name);
-        ser->vend = hd_shm_add_str(hd_data, ser->vend);
-        ser->init_string1 = hd_shm_add_str(hd_data, ser->init_string1);
-        ser->init_string2 = hd_shm_add_str(hd_data, ser->init_string2);
-        ser->pppd_option = hd_shm_add_str(hd_data, ser->pppd_option);
-
-        ser->at_resp = hd_shm_add_str_list(hd_data, ser->at_resp);
-      }
+      sl = shm_buf_str_list(&buf, ser->at_resp);
+      ((ser_device_t *) buf.buf)->at_resp = sl;
+
+      hd_shm_add(hd_data, ser_dev[u].type, buf.buf, buf.len);
+
+      free_mem(buf.buf);
     }
   }
+}
+
+
+/*
+ * Get serial mice & modems from child (parent).
+ *
+ * The entries live in the result mapping until hd_shm_clean().
+ */
+void hd_move_from_shm(hd_data_t *hd_data)
+{
+  ser_device_t *ser, **next;
+  hd_shm_type_t type;
+  str_list_t *sl;
+  unsigned u, len;
+  char **s;
 
+  for(type = shm_ser_mouse; type <= shm_ser_modem; type++) {
+    next = type == shm_ser_mouse ? &hd_data->ser_mouse : &hd_data->ser_modem;
+    while(*next) next = &(*next)->next;
+
+    for(ser = NULL; (ser = hd_shm_get(hd_data, type, ser, &len));) {
+      if(len < sizeof *ser) continue;
+
+      for(u = 0; u < sizeof ser_str_ofs / sizeof *ser_str_ofs; u++) {
+        s = (char **) ((char *) ser + ser_str_ofs[u]);
+        *s = SHM_PTR(ser, *s);
+      }
+
+      ser->at_resp = SHM_PTR(ser, ser->at_resp);
+      for(sl = ser->at_resp; sl; sl = sl->next) {
+        sl->str = SHM_PTR(ser, sl->str);
+        sl->next = SHM_PTR(ser, sl->next);
+      }
+
+      *next = ser;
+      next = &ser->next;
+    }
+  }
 }
 
 
@@ -5816,9 +6637,9 @@ int hd_report_this(hd_data_t *hd_data, hd_t *hd)
 {
   if(!hd_data->only) return 1;
 
-  if(search_str_list(hd_data->only, hd->sysfs_id)) return 1;
+  if(hd_index_only(hd_data, hd->sysfs_id)) return 1;
 
-  return search_str_list(hd_data->only, hd->unix_dev_name) ? 1 : 0;
+  return hd_index_only(hd_data, hd->unix_dev_name);
 }
 
 
@@ -120,7 +120,8 @@ typedef enum probe_feature {
   pr_bios_fb, pr_bios_mode, pr_input, pr_block_mods, pr_bios_vesa,
   pr_cpuemu_debug, pr_scsi_noserial, pr_wlan, pr_bios_crc, pr_hal,
   pr_bios_vram, pr_bios_acpi, pr_bios_ddc_ports, pr_modules_pata,
-  pr_net_eeprom, pr_x86emu,
+  pr_net_eeprom, pr_x86emu, pr_cpu_sysfs, pr_cpu_collapse, pr_monitor_drm,
+  pr_bios_vesa_cache,
   pr_max, pr_lxrc, pr_default, 
   pr_all		/**< pr_all must be last */
 } hd_probe_feature_t;
@@ -1473,6 +1474,19 @@ typedef struct {
   char *platform;		/**< x86: NULL */
   str_list_t *features;		/**< x86: flags */
   double bogo;			/**< bogo mips */
+  struct cpu_model_s *cpu_model;	/**< (Internal) shared per-model data; if set, \ref features belongs to it */
+  unsigned cpu;			/**< logical cpu number */
+  unsigned topology:1;		/**< \ref package, \ref core, \ref thread are valid */
+  unsigned package;		/**< physical package id */
+  unsigned core;		/**< core id (within package) */
+  unsigned thread;		/**< thread number (within core) */
+  unsigned clock_min;		/**< min. clock in MHz (cpufreq) */
+  unsigned clock_max;		/**< max. clock in MHz (cpufreq) */
+  unsigned cache_l1d;		/**< L1 data cache in kB */
+  unsigned cache_l1i;		/**< L1 instruction cache in kB */
+  unsigned cache_l2;		/**< L2 cache in kB */
+  unsigned cache_l3;		/**< L3 cache in kB */
+  unsigned count;		/**< number of identical threads this entry stands for (0: just this one) */
 } cpu_info_t;
 
 
@@ -1538,6 +1552,7 @@ typedef struct {
   unsigned *ids;
   unsigned strings_len, strings_max;
   char *strings;
+  struct hddb_index_s *index;	/**< (Internal) search index, built on first use */
 } hddb2_data_t;
 
 
@@ -1625,6 +1640,27 @@ typedef struct hal_device_s {
   hal_prop_t *prop;
 } hal_device_t;
 
+/**
+ * (Internal) kernel log message, see \ref hd_klog_t
+ */
+typedef struct {
+  uint64_t seq;			/**< /dev/kmsg sequence number (0: unknown) */
+  unsigned hash;		/**< subsystem hash */
+  int next;			/**< next message with same subsystem hash (-1: none) */
+  str_list_t *sl;		/**< line in \ref hd_data_t::klog */
+} hd_klog_msg_t;
+
+/**
+ * (Internal) kernel log index
+ * Messages are indexed by subsystem (the first word of the message).
+ */
+typedef struct {
+  unsigned len;			/**< messages */
+  hd_klog_msg_t *msg;
+  unsigned hash_size;		/**< power of 2 */
+  int *hash;			/**< first message per hash bucket (-1: none) */
+} hd_klog_t;
+
 /**
  * resource types: see @ref RESOURCEpub
  */
@@ -1863,6 +1899,8 @@ typedef struct {
   int devs;
   char **dev;
   unsigned tag;
+  unsigned cpus;		/**< entries in cpu_events */
+  unsigned *cpu_events;		/**< per cpu event counts */
 } misc_irq_t;
 
 typedef struct {
@@ -2586,6 +2624,19 @@ typedef struct s_hd_t {
   char *modalias;		/**< module alias */
   char *label;			/**< Consistent Device Name (CDN), pci firmware spec 3.1, chapter 4.6.7 */
 
+  /**
+   * (Internal) Details not read yet.
+   * Set if \ref hd_data_t::flags.lazy was set during the scan. Use
+   * hd_get_block0(), hd_get_cdrom_info(), hd_get_res() or hd_load_details()
+   * to access them.
+   */
+  struct lazy_s {
+    unsigned block0:1;		/**< \ref block0 */
+    unsigned cdrom:1;		/**< iso9660 & el torito info */
+    unsigned size:1;		/**< disk size & geometry resources */
+    unsigned link:1;		/**< network link state resource */
+  } lazy;
+
   /*
    * These are used internally for memory management.
    * Do not even _think_ of modifying these!
@@ -2643,7 +2694,7 @@ typedef struct {
     unsigned iseries:1;		/**< Set if we are on an iSeries machine. */
     unsigned list_all:1;	/**< Return even devices with status 'not available'. */
     unsigned fast:1;		/**< Don't check tricky hardware. */
-    unsigned list_md:1;		/**< Report md & lvm devices from /proc/partitions */
+    unsigned list_md:1;		/**< Report md & lvm devices */
     unsigned nofork:1;		/**< don't run potentially hanging code in a subprocess */
     unsigned nosysfs:1;		/**< don't ask sysfs */
     unsigned forked:1;		/**< we're running in a subprocess */
@@ -2658,6 +2709,8 @@ typedef struct {
     unsigned vbox:1;		/**< running in virtual box  */
     unsigned vmware:1;		/**< running in vmware  */
     unsigned vmware_mouse:1;	/**< has vmware mouse */
+    unsigned lazy:1;		/**< read slow device details only on demand, see hd_load_details() */
+    unsigned update:1;		/**< internal: hd_update_device() is running */
   } flags;
 
 
@@ -2708,18 +2761,18 @@ typedef struct {
   devtree_t *devtree;		/**< (Internal) prom device tree on ppc */
   unsigned kernel_version;	/**< (Internal) kernel version */
   hd_t *manual;			/**< (Internal) hardware config info */
-  str_list_t *disks;		/**< (Internal) disks according to /proc/partitions */
-  str_list_t *partitions;	/**< (Internal) dto, partitions */
+  str_list_t *disks;		/**< (Internal) unused */
+  str_list_t *partitions;	/**< (Internal) unused */
   str_list_t *cdroms;		/**< (Internal) cdroms according to PROC_CDROM_INFO */
   hd_smbios_t *smbios;		/**< (Internal) smbios data */
   struct {
     unsigned ok:1;
-    unsigned size;
-    unsigned used;
-    void *data;
-    int id;
-    int updated;
-  } shm;			/**< (Internal) our shm segment */
+    unsigned size;		/**< mapped channel size */
+    void *data;			/**< channel (shared with child) */
+    int fd;			/**< memfd */
+    void *result;		/**< child results (private mapping) */
+    unsigned result_size;
+  } shm;			/**< (Internal) result channel of forked probes */
   unsigned pci_config_type;	/**< (Internal) PCI config type (1 or 2), 0: unknown */
   hd_udevinfo_t *udevinfo;	/**< (Internal) udev info */
   hd_sysfsdrv_t *sysfsdrv;	/**< (Internal) sysfs driver info */
@@ -2732,9 +2785,111 @@ typedef struct {
   size_t log_size;		/**< (Internal) current log size (including final 0) */
   size_t log_max;		/**< (Internal) log buffer size */
   str_list_t *klog_raw;		/**< (Internal) unmodified kernel log */
+  hd_klog_t *klog_index;	/**< (Internal) kernel log index */
+  struct cpu_models_s *cpu_models;	/**< (Internal) interned cpu models */
+  struct smbios_index_s *smbios_index;	/**< (Internal) smbios entries by type */
+  struct hd_index_s *index;	/**< (Internal) hd list indexes, see hd_list() */
+  unsigned char probe_used[(pr_all + 7) / 8];	/**< (Internal) probing features hd_scan() has run with so far */
 } hd_data_t;
 
 
+/**
+ * @defgroup DIFFpub Hardware inventory diff
+ * @ingroup libhdPublic
+ * @brief Compare two hardware lists, see \ref hd_diff().
+ * @{
+ */
+
+/** diff entry type */
+typedef enum diff_type {
+  hd_diff_added = 1, hd_diff_removed, hd_diff_changed
+} hd_diff_type_t;
+
+/** \ref hd_diff_t::changed bits */
+#define HD_DIFF_DRIVER		(1 <<  0)	/**< driver list */
+#define HD_DIFF_RES		(1 <<  1)	/**< resources */
+#define HD_DIFF_STATUS		(1 <<  2)	/**< config status */
+#define HD_DIFF_LINK		(1 <<  3)	/**< network link state */
+#define HD_DIFF_DEVNAME		(1 <<  4)	/**< device name */
+#define HD_DIFF_ID		(1 <<  5)	/**< vendor/device ids */
+
+/**
+ * Difference between two hardware lists.
+ * Pointers reference the lists passed to \ref hd_diff().
+ */
+typedef struct s_hd_diff_t {
+  struct s_hd_diff_t *next;
+  hd_diff_type_t type;
+  unsigned changed;		/**< HD_DIFF_* bitmask (only for \ref hd_diff_changed) */
+  hd_t *hd_old;			/**< entry in old list (NULL if added) */
+  hd_t *hd_new;			/**< entry in new list (NULL if removed) */
+  str_list_t *info;		/**< readable field deltas */
+} hd_diff_t;
+
+/** @} */
+
+
+/**
+ * @defgroup SNAPSHOTpub Columnar hardware list
+ * @ingroup libhdPublic
+ * @brief Compact column view of a hardware list, see \ref hd_snapshot().
+ * @{
+ */
+
+/** \ref hd_snapshot_t columns */
+typedef enum hd_col {
+  hd_col_hw_class, hd_col_bus, hd_col_base_class, hd_col_sub_class,
+  hd_col_prog_if, hd_col_vendor, hd_col_device, hd_col_sub_vendor,
+  hd_col_sub_device,
+  hd_col_parent,		/**< row of parent entry */
+  hd_col_model,			/**< name id */
+  hd_col_driver,		/**< name id */
+  hd_col_dev_name,		/**< name id */
+  hd_col_max
+} hd_col_t;
+
+/** \ref hd_col_parent value if there is no parent */
+#define HD_SNAPSHOT_NONE	(~0u)
+
+/**
+ * Hardware list as parallel arrays.
+ * Strings are interned: \ref name[id] is the string; id 0 means no string.
+ */
+typedef struct {
+  unsigned rows;		/**< number of entries */
+  hd_t **hd;			/**< entries (point into list passed to \ref hd_snapshot()) */
+  unsigned *col[hd_col_max];	/**< columns, \ref rows entries each */
+  unsigned char *hw_class_list;	/**< hd_t::hw_class_list of all rows */
+  unsigned names;		/**< number of interned strings (including id 0) */
+  char **name;			/**< interned strings */
+} hd_snapshot_t;
+
+/** @} */
+
+
+/**
+ * @defgroup UEVENTpub Kernel device events
+ * @ingroup libhdPublic
+ * @brief Read kernel uevents, see \ref hd_uevent_open().
+ * @{
+ */
+
+/**
+ * Kernel device event.
+ */
+typedef struct {
+  char *action;			/**< add, remove, change, ... */
+  char *devpath;		/**< sysfs path, without '/sys' */
+  char *subsystem;
+  char *devtype;
+  char *devname;		/**< device name, without '/dev/' */
+  char *driver;
+  uint64_t seqnum;		/**< kernel event number */
+  str_list_t *env;		/**< all 'key=value' pairs */
+} hd_uevent_t;
+
+/** @} */
+
 /* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
  *
  *                      libhd interface functions
@@ -2768,6 +2923,7 @@ hd_t *hd_sub_class_list(hd_data_t *hd_data, unsigned base_class, unsigned sub_cl
 hd_t *hd_bus_list(hd_data_t *hd_data, unsigned bus);
 const char* hd_busid_to_hwcfg(int busid);
 hd_t *hd_list(hd_data_t *hd_data, hd_hw_item_t item, int rescan, hd_t *hd_old);
+int hd_update_device(hd_data_t *hd_data, hd_uevent_t *uevent);
 hd_t *hd_list_with_status(hd_data_t *hd_data, hd_hw_item_t item, hd_status_t status);
 hd_t *hd_list2(hd_data_t *hd_data, hd_hw_item_t *items, int rescan);
 hd_t *hd_list_with_status2(hd_data_t *hd_data, hd_hw_item_t *items, hd_status_t status);
@@ -2810,6 +2966,26 @@ int hd_change_status(const char *id, hd_status_t status, const char *config_stri
 int hd_change_config_status(hd_data_t *hd_data, const char *id, hd_status_t status, const char *config_string);
 int hd_read_mmap(hd_data_t *hd_data, char *name, unsigned char *buf, off_t start, unsigned size);
 
+/* implemented in diff.c */
+hd_diff_t *hd_diff(hd_data_t *hd_data, hd_t *hd_old, hd_t *hd_new);
+hd_diff_t *hd_free_diff(hd_diff_t *diff);
+
+/* implemented in snapshot.c */
+hd_snapshot_t *hd_snapshot(hd_data_t *hd_data, hd_t *hd_list);
+hd_snapshot_t *hd_free_snapshot(hd_snapshot_t *snap);
+unsigned char *hd_snapshot_mask(hd_snapshot_t *snap);
+unsigned hd_snapshot_filter(hd_snapshot_t *snap, hd_col_t col, unsigned val, unsigned char *mask);
+unsigned hd_snapshot_filter_class(hd_snapshot_t *snap, hd_hw_item_t item, unsigned char *mask);
+unsigned hd_snapshot_rows(hd_snapshot_t *snap, unsigned char *mask, unsigned *rows);
+unsigned hd_snapshot_group(hd_snapshot_t *snap, hd_col_t col, unsigned char *mask, unsigned **keys, unsigned **counts);
+unsigned hd_snapshot_name_id(hd_snapshot_t *snap, char *str);
+
+/* implemented in uevent.c */
+int hd_uevent_open(void);
+hd_uevent_t *hd_uevent_read(int fd);
+hd_uevent_t *hd_free_uevent(hd_uevent_t *uevent);
+const hd_hw_item_t *hd_uevent_hw_items(hd_uevent_t *uevent);
+
 /* implemented in hddb.c */
 
 /**
@@ -2820,6 +2996,7 @@ void hddb_add_info(hd_data_t *hd_data, hd_t *hd);
 
 void hddb_dump_raw(hddb2_data_t *hddb, FILE *f);
 void hddb_dump(hddb2_data_t *hddb, FILE *f);
+int hddb_import(hd_data_t *hd_data, char *file);
 
 
 /* implemented in hdp.c */
@@ -2828,6 +3005,12 @@ void hd_dump_entry(hd_data_t *hd_data, hd_t *hd, FILE *f);
 /* implemented in cdrom.c */
 cdrom_info_t *hd_read_cdrom_info(hd_data_t *hd_data, hd_t *hd);
 
+/* details skipped during a lazy scan (hd_data->flags.lazy) */
+unsigned char *hd_get_block0(hd_data_t *hd_data, hd_t *hd);
+cdrom_info_t *hd_get_cdrom_info(hd_data_t *hd_data, hd_t *hd);
+hd_res_t *hd_get_res(hd_data_t *hd_data, hd_t *hd);
+void hd_load_details(hd_data_t *hd_data, hd_t *hd);
+
 /**
  * @ingroup MANUALpub
  * @brief Manually configured devices
@@ -27,6 +27,11 @@
 #define PROC_APM		"/proc/apm"
 #define PROC_XEN_BALLOON	"/proc/xen/balloon"
 
+#define SYS_KERNEL_IRQ		"/sys/kernel/irq"
+#define SYS_CPU			"/sys/devices/system/cpu"
+#define SYS_DMI_TABLES		"/sys/firmware/dmi/tables"
+#define SYS_CLASS_DRM		"/sys/class/drm"
+
 #define DEV_NVRAM		"/dev/nvram"
 #define DEV_PSAUX		"/dev/psaux"
 #define DEV_ADBMOUSE		"/dev/adbmouse"
@@ -46,6 +51,7 @@
 #define PROG_UDEVADM		"/sbin/udevadm"
 
 #define KLOG_BOOT		"/var/log/boot.msg"
+#define DEV_KMSG		"/dev/kmsg"
 #define ISAPNP_CONF		"/etc/isapnp.conf"
 
 #define KERNEL_22		0x020200
@@ -79,6 +85,13 @@ enum mod_idx {
   mod_sysfs, mod_dsl, mod_block, mod_edd, mod_input, mod_wlan, mod_hal
 };
 
+/*
+ * Record types passed from forked probes, see hd_shm_add().
+ */
+typedef enum {
+  shm_log = 1, shm_ser_mouse, shm_ser_modem, shm_braille
+} hd_shm_type_t;
+
 void *new_mem(size_t size);
 void *resize_mem(void *, size_t);
 void *add_mem(void *, size_t, size_t);
@@ -96,6 +109,7 @@ scsi_t *free_scsi(scsi_t *scsi, int free_all);
 hd_detail_t *free_hd_detail(hd_detail_t *d);
 devtree_t *free_devtree(hd_data_t *hd_data);
 void hd_add_id(hd_data_t *hd_data, hd_t *hd);
+void crc64(uint64_t *id, void *p, int len);
 
 char *isa_id2str(unsigned);
 char *eisa_vendor_str(unsigned);
@@ -115,12 +129,14 @@ str_list_t *add_str_list(str_list_t **sl, char *str);
 str_list_t *free_str_list(str_list_t *list);
 str_list_t *reverse_str_list(str_list_t *list);
 str_list_t *read_file(char *file_name, unsigned start_line, unsigned lines);
+unsigned char *read_bin_file(char *file_name, unsigned *len, unsigned max_len);
 str_list_t *read_dir(char *dir_name, int type);
 char *hd_read_sysfs_link(char *base_dir, char *link_name);
 void progress(hd_data_t *hd_data, unsigned pos, unsigned count, char *msg);
 
 void remove_hd_entries(hd_data_t *hd_data);
 void remove_tagged_hd_entries(hd_data_t *hd_data);
+void free_old_hd_entries(hd_data_t *hd_data);
 
 driver_info_t *free_driver_info(driver_info_t *di);
 
@@ -182,9 +198,11 @@ void hd_fork_done(hd_data_t *hd_data);
 void hd_shm_init(hd_data_t *hd_data);
 void hd_shm_clean(hd_data_t *hd_data);
 void hd_shm_done(hd_data_t *hd_data);
-void *hd_shm_add(hd_data_t *hd_data, void *ptr, unsigned len);
+int hd_shm_add(hd_data_t *hd_data, hd_shm_type_t type, void *ptr, unsigned len);
+void *hd_shm_get(hd_data_t *hd_data, hd_shm_type_t type, void *prev, unsigned *len);
 int hd_is_shm_ptr(hd_data_t *hd_data, void *ptr);
 void hd_move_to_shm(hd_data_t *hd_data);
+void hd_move_from_shm(hd_data_t *hd_data);
 
 void read_udevinfo(hd_data_t *hd_data);
 
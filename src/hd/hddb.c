@@ -3,8 +3,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include <ctype.h>
 #include <fnmatch.h>
+#include <regex.h>
 #include <sys/utsname.h>
 
 #include "hd.h"
@@ -72,6 +74,24 @@ typedef struct {
   unsigned hwclass;
 } hddb_search_t;
 
+/* hddb search index, see hddb_index_build() */
+struct hddb_index_s {
+  unsigned rest_len;
+  unsigned *rest;		/* items without string key */
+  unsigned bits;		/* 2^bits buckets */
+  unsigned *start;		/* items in bucket b: row[start[b]] .. row[start[b + 1] - 1] */
+  unsigned *row;
+  unsigned re_len;
+  unsigned *re_pos;		/* hddb->ids positions of regexps, ascending */
+  regex_t *re;
+  unsigned char *re_ok;		/* re[] is valid */
+};
+
+/* part of hddb->list, see hddb_index_rows() */
+typedef struct {
+  unsigned len, *row;
+} hddb_rows_t;
+
 /* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - */
 static void hddb_init_pci(hd_data_t *hd_data);
 static char *get_mi_field(char *str, char *tag, int field_len, unsigned *value, unsigned *has_value);
@@ -87,10 +107,25 @@ static unsigned store_value(hddb2_data_t *x, unsigned val);
 static unsigned store_entry(hddb2_data_t *x, tmp_entry_t *te);
 static void clear_entry(tmp_entry_t *te);
 static void add_value(tmp_entry_t *te, hddb_entry_t idx, unsigned val);
-static hddb_entry_mask_t add_entry(hddb2_data_t *hddb2, tmp_entry_t *te, hddb_entry_t idx, char *str);
+static hddb_entry_mask_t add_entry(hddb2_data_t *hddb2, tmp_entry_t *te, hddb_entry_t idx, char *str, int key);
+static void import_name(hddb2_data_t *hddb2, unsigned tag, hddb_entry_t *ent, unsigned *id, unsigned keys, char *name);
+static int import_hex(char **str, unsigned digits, unsigned *val);
+static char *import_strip(char *str);
+static unsigned import_ids(hddb2_data_t *hddb2, FILE *f, unsigned tag);
+static int import_hwdb_key(char *str, unsigned *tag, hddb_entry_t *ent, unsigned *id, unsigned *keys);
+static unsigned import_hwdb(hddb2_data_t *hddb2, FILE *f);
+static int import_file(hd_data_t *hd_data, hddb2_data_t *hddb2, char *file);
+static void import_upstream(hd_data_t *hd_data, char *file);
 static int compare_ids(hddb2_data_t *hddb, hddb_search_t *hs, hddb_entry_mask_t mask, unsigned key);
 static void complete_ids(hddb2_data_t *hddb, hddb_search_t *hs, hddb_entry_mask_t key_mask, hddb_entry_mask_t mask, unsigned val_idx);
 static int hddb_search(hd_data_t *hd_data, hddb_search_t *hs, int max_recursions);
+static char *search_str(hddb_search_t *hs, hddb_entry_t ent);
+static unsigned hddb_key_string(hddb2_data_t *hddb, hddb_entry_mask_t mask, unsigned key, hddb_entry_t *str_ent);
+static unsigned hddb_str_hash(hddb_entry_t ent, char *str);
+static struct hddb_index_s *hddb_index_build(hd_data_t *hd_data, hddb2_data_t *hddb);
+static struct hddb_index_s *hddb_get_index(hd_data_t *hd_data, hddb2_data_t *hddb);
+static unsigned hddb_index_rows(struct hddb_index_s *idx, hddb_search_t *hs, unsigned first, hddb_rows_t *row, char **str);
+static regex_t *hddb_regexp(hddb2_data_t *hddb, unsigned pos);
 #ifdef HDDB_TEST
 static void test_db(hd_data_t *hd_data);
 #endif
@@ -489,6 +524,8 @@ int cmp_dir_entry_s(const void *p0, const void *p1)
 
 void hddb_init(hd_data_t *hd_data)
 {
+  unsigned u;
+
   hddb_init_pci(hd_data);
   hddb_init_external(hd_data);
 
@@ -496,6 +533,10 @@ void hddb_init(hd_data_t *hd_data)
   hd_data->hddb2[1] = &hddb_internal;
 #endif
 
+  for(u = 0; u < sizeof hd_data->hddb2 / sizeof *hd_data->hddb2; u++) {
+    if(hd_data->hddb2[u]) hddb_get_index(hd_data, hd_data->hddb2[u]);
+  }
+
 #ifdef HDDB_TEST
   test_db(hd_data);
 #endif
@@ -514,6 +555,7 @@ void hddb_init_external(hd_data_t *hd_data)
   hddb_list_t dbl = {};
   hddb2_data_t *hddb2;
   char *s;
+  static char *upstream_ids[] = { "pci.ids", "usb.ids" };
 
   if(hd_data->hddb2[0]) return;
 
@@ -644,7 +686,7 @@ void hddb_init_external(hd_data_t *hd_data)
     }
 
     if(state != 4) {
-      u = add_entry(hddb2, tmp_entry, l->key, l->value);
+      u = add_entry(hddb2, tmp_entry, l->key, l->value, l->prefix != pref_add);
       if(u) {
         entry_mask |= u;
       }
@@ -694,6 +736,28 @@ void hddb_init_external(hd_data_t *hd_data)
     free_mem(hddb2->strings);
     hd_data->hddb2[0] = free_mem(hd_data->hddb2[0]);
   }
+
+  /*
+   * Upstream id lists, if any (pci.ids, usb.ids, hwdb/ *.hwdb).
+   *
+   * They come last, so local entries win.
+   */
+  for(u = 0; u < sizeof upstream_ids / sizeof *upstream_ids; u++) {
+    import_upstream(hd_data, hd_get_hddb_path(upstream_ids[u]));
+  }
+
+  id_dir = reverse_str_list(sort_str_list(read_dir(hd_get_hddb_path("hwdb"), 'r'), cmp_dir_entry_s));
+
+  for(sl = id_dir; sl; sl = sl->next) {
+    u = strlen(sl->str);
+    if(u <= 5 || strcmp(sl->str + u - 5, ".hwdb")) continue;
+    s = NULL;
+    str_printf(&s, 0, "hwdb/%s", sl->str);
+    import_upstream(hd_data, hd_get_hddb_path(s));
+    free_mem(s);
+  }
+
+  free_str_list(id_dir);
 }
 
 
@@ -925,7 +989,12 @@ int parse_id(char *str, unsigned *id, unsigned *range, unsigned *mask)
 }
 
 
-hddb_entry_mask_t add_entry(hddb2_data_t *hddb2, tmp_entry_t *te, hddb_entry_t idx, char *str)
+/*
+ * Add a key (key = 1) or value (key = 0) line to te.
+ *
+ * Only key strings may be regular expressions.
+ */
+hddb_entry_mask_t add_entry(hddb2_data_t *hddb2, tmp_entry_t *te, hddb_entry_t idx, char *str, int key)
 {
   hddb_entry_mask_t mask = 0;
   int i;
@@ -983,9 +1052,19 @@ hddb_entry_mask_t add_entry(hddb2_data_t *hddb2, tmp_entry_t *te, hddb_entry_t i
       /* strings */
 
       mask |= 1 << idx;
-      u = store_string(hddb2, str);
-      // fprintf(stderr, ">>> %s\n", str);
-      add_value(te, idx, MAKE_DATA(FLAG_STRING, u));
+      i = strlen(str);
+      if(key && i >= 2 && *str == '/' && str[i - 1] == '/' && idx != he_driver && idx != he_requires) {
+        /* regular expression: /regexp/ */
+        str[i - 1] = 0;
+        u = store_string(hddb2, str + 1);
+        str[i - 1] = '/';
+        add_value(te, idx, MAKE_DATA(FLAG_REGEXP, u));
+      }
+      else {
+        u = store_string(hddb2, str);
+        // fprintf(stderr, ">>> %s\n", str);
+        add_value(te, idx, MAKE_DATA(FLAG_STRING, u));
+      }
     }
     else {
       /* special */
@@ -1043,7 +1122,7 @@ hddb_entry_mask_t add_entry(hddb2_data_t *hddb2, tmp_entry_t *te, hddb_entry_t i
           s[0] = c;
           s[1] = '\t';
           strcpy(s + 2, str);
-          mask |= add_entry(hddb2, te, he_driver, s);
+          mask |= add_entry(hddb2, te, he_driver, s, key);
           s = free_mem(s);
         }
       }
@@ -1054,6 +1133,362 @@ hddb_entry_mask_t add_entry(hddb2_data_t *hddb2, tmp_entry_t *te, hddb_entry_t i
 }
 
 
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - */
+/*
+ * Importer for upstream id lists (pci.ids, usb.ids) and systemd hwdb files.
+ *
+ * The names are appended to the hddb as plain key -> name items, so entries
+ * read before (local files) win over them.
+ */
+
+/* hwdb properties we know and the last key entry they belong to */
+static struct {
+  char *name;
+  hddb_entry_t ent;
+} import_hwdb_props[] = {
+  { "ID_VENDOR_FROM_DATABASE", he_vendor_id },
+  { "ID_MODEL_FROM_DATABASE", he_device_id },
+  { "ID_MODEL_FROM_DATABASE", he_subdevice_id },
+  { "ID_PCI_CLASS_FROM_DATABASE", he_baseclass_id },
+  { "ID_PCI_SUBCLASS_FROM_DATABASE", he_subclass_id },
+  { "ID_PCI_INTERFACE_FROM_DATABASE", he_progif_id }
+};
+
+
+/*
+ * Add item with keys ent[0 .. keys - 1] = id[] (with tag) and the name
+ * belonging to the last key.
+ */
+void import_name(hddb2_data_t *hddb2, unsigned tag, hddb_entry_t *ent, unsigned *id, unsigned keys, char *name)
+{
+  tmp_entry_t tmp_entry[he_nomask];
+  hddb_list_t dbl = {};
+  hddb_entry_t name_ent;
+  unsigned u;
+
+  if(!keys || !*name) return;
+
+  clear_entry(tmp_entry);
+  for(u = 0; u < keys; u++) {
+    add_value(tmp_entry, ent[u], MAKE_DATA(FLAG_ID, MAKE_ID(tag, id[u])));
+    dbl.key_mask |= 1 << ent[u];
+  }
+  dbl.key = store_entry(hddb2, tmp_entry);
+
+  /* he_*_id -> he_*_name */
+  name_ent = ent[keys - 1] + he_bus_name - he_bus_id;
+
+  clear_entry(tmp_entry);
+  add_value(tmp_entry, name_ent, MAKE_DATA(FLAG_STRING, store_string(hddb2, name)));
+  dbl.value_mask = 1 << name_ent;
+  dbl.value = store_entry(hddb2, tmp_entry);
+
+  store_list(hddb2, &dbl);
+}
+
+
+/*
+ * Parse exactly 'digits' hex digits.
+ */
+int import_hex(char **str, unsigned digits, unsigned *val)
+{
+  unsigned u;
+  char *s = *str;
+
+  for(*val = u = 0; u < digits; u++, s++) {
+    if(!isxdigit(*s)) return 0;
+    *val = (*val << 4) + (isdigit(*s) ? *s - '0' : (tolower(*s) - 'a') + 10);
+  }
+
+  *str = s;
+
+  return 1;
+}
+
+
+/*
+ * Drop leading & trailing white space (in place).
+ */
+char *import_strip(char *str)
+{
+  char *s;
+
+  while(isspace(*str)) str++;
+  for(s = str + strlen(str); s > str && isspace(s[-1]); *--s = 0);
+
+  return str;
+}
+
+
+/*
+ * pci.ids or usb.ids format.
+ *
+ * Vendors, devices, subsystems and (pci only) device classes are read;
+ * other sections are skipped.
+ */
+unsigned import_ids(hddb2_data_t *hddb2, FILE *f, unsigned tag)
+{
+  static hddb_entry_t vend_ent[] = { he_vendor_id, he_device_id, he_subvendor_id, he_subdevice_id };
+  static hddb_entry_t class_ent[] = { he_baseclass_id, he_subclass_id, he_progif_id };
+  char *buf = NULL, *s;
+  size_t size = 0;
+  unsigned level, cnt = 0, id[4];
+  enum { sec_none, sec_vendor, sec_class } section = sec_none;
+
+  while(getline(&buf, &size, f) > 0) {
+    if(*buf == '#') continue;
+    for(level = 0, s = buf; *s == '\t'; s++) level++;
+    if(!*import_strip(s)) continue;
+
+    if(level == 0) {
+      section = sec_none;
+      if(import_hex(&s, 4, id) && isspace(*s)) {
+        section = sec_vendor;
+        import_name(hddb2, tag, vend_ent, id, 1, import_strip(s));
+        cnt++;
+      }
+      else if(tag == TAG_PCI && s[0] == 'C' && s[1] == ' ') {
+        s += 2;
+        if(import_hex(&s, 2, id) && isspace(*s)) {
+          section = sec_class;
+          import_name(hddb2, 0, class_ent, id, 1, import_strip(s));
+          cnt++;
+        }
+      }
+    }
+    else if(section == sec_vendor && level == 1) {
+      if(import_hex(&s, 4, id + 1) && isspace(*s)) {
+        import_name(hddb2, tag, vend_ent, id, 2, import_strip(s));
+        cnt++;
+      }
+    }
+    else if(section == sec_vendor && level == 2) {
+      if(
+        import_hex(&s, 4, id + 2) && *s++ == ' ' &&
+        import_hex(&s, 4, id + 3) && isspace(*s)
+      ) {
+        import_name(hddb2, tag, vend_ent, id, 4, import_strip(s));
+        cnt++;
+      }
+    }
+    else if(section == sec_class && (level == 1 || level == 2)) {
+      if(import_hex(&s, 2, id + level) && isspace(*s)) {
+        import_name(hddb2, 0, class_ent, id, level + 1, import_strip(s));
+        cnt++;
+      }
+    }
+  }
+
+  free(buf);
+
+  return cnt;
+}
+
+
+/*
+ * Parse hwdb match line.
+ *
+ * Supported are (all ending in '*'):
+ *   pci:v<vendor>[d<device>[sv<subvendor>sd<subdevice>]]
+ *   pci:v*bc<class>[sc<subclass>[i<progif>]]
+ *   usb:v<vendor>[p<device>]
+ */
+int import_hwdb_key(char *str, unsigned *tag, hddb_entry_t *ent, unsigned *id, unsigned *keys)
+{
+  *keys = 0;
+
+  if(!strncmp(str, "pci:v*bc", sizeof "pci:v*bc" - 1)) {
+    str += sizeof "pci:v*bc" - 1;
+    *tag = 0;
+    ent[0] = he_baseclass_id;
+    if(!import_hex(&str, 2, id)) return 0;
+    *keys = 1;
+    if(!strncmp(str, "sc", 2)) {
+      str += 2;
+      ent[1] = he_subclass_id;
+      if(!import_hex(&str, 2, id + 1)) return 0;
+      *keys = 2;
+      if(*str == 'i') {
+        str++;
+        ent[2] = he_progif_id;
+        if(!import_hex(&str, 2, id + 2)) return 0;
+        *keys = 3;
+      }
+    }
+  }
+  else if(!strncmp(str, "pci:v", sizeof "pci:v" - 1)) {
+    str += sizeof "pci:v" - 1;
+    *tag = TAG_PCI;
+    ent[0] = he_vendor_id;
+    /* 32 bit ids, but only 16 bits are used */
+    if(strncmp(str, "0000", 4)) return 0;
+    str += 4;
+    if(!import_hex(&str, 4, id)) return 0;
+    *keys = 1;
+    if(!strncmp(str, "d0000", 5)) {
+      str += 5;
+      ent[1] = he_device_id;
+      if(!import_hex(&str, 4, id + 1)) return 0;
+      *keys = 2;
+      if(!strncmp(str, "sv0000", 6)) {
+        str += 6;
+        ent[2] = he_subvendor_id;
+        if(!import_hex(&str, 4, id + 2)) return 0;
+        if(strncmp(str, "sd0000", 6)) return 0;
+        str += 6;
+        ent[3] = he_subdevice_id;
+        if(!import_hex(&str, 4, id + 3)) return 0;
+        *keys = 4;
+      }
+    }
+  }
+  else if(!strncmp(str, "usb:v", sizeof "usb:v" - 1)) {
+    str += sizeof "usb:v" - 1;
+    *tag = TAG_USB;
+    ent[0] = he_vendor_id;
+    if(!import_hex(&str, 4, id)) return 0;
+    *keys = 1;
+    if(*str == 'p') {
+      str++;
+      ent[1] = he_device_id;
+      if(!import_hex(&str, 4, id + 1)) return 0;
+      *keys = 2;
+    }
+  }
+
+  return *keys && !strcmp(str, "*");
+}
+
+
+/*
+ * systemd hwdb format.
+ *
+ * Only name properties for pci & usb ids are read; see import_hwdb_key().
+ */
+unsigned import_hwdb(hddb2_data_t *hddb2, FILE *f)
+{
+  char *buf = NULL, *s, *t;
+  size_t size = 0;
+  unsigned u, v, cnt = 0, matches = 0, props = 0;
+  struct {
+    unsigned tag, keys, id[4];
+    hddb_entry_t ent[4];
+  } match[16];
+
+  while(getline(&buf, &size, f) > 0) {
+    if(*buf == '#') continue;
+
+    if(!isspace(*buf)) {
+      /* match line; a new block starts after the properties */
+      if(props) matches = props = 0;
+      if(
+        matches < sizeof match / sizeof *match &&
+        import_hwdb_key(
+          import_strip(buf), &match[matches].tag, match[matches].ent,
+          match[matches].id, &match[matches].keys
+        )
+      ) matches++;
+      continue;
+    }
+
+    s = import_strip(buf);
+    if(!*s) {
+      matches = props = 0;
+      continue;
+    }
+
+    props++;
+
+    if(!(t = strchr(s, '='))) continue;
+    *t++ = 0;
+
+    for(u = 0; u < matches; u++) {
+      for(v = 0; v < sizeof import_hwdb_props / sizeof *import_hwdb_props; v++) {
+        if(
+          import_hwdb_props[v].ent == match[u].ent[match[u].keys - 1] &&
+          !strcmp(import_hwdb_props[v].name, s)
+        ) {
+          import_name(hddb2, match[u].tag, match[u].ent, match[u].id, match[u].keys, t);
+          cnt++;
+          break;
+        }
+      }
+    }
+  }
+
+  free(buf);
+
+  return cnt;
+}
+
+
+/*
+ * Import file into hddb2; the format is guessed from the file name:
+ * '*.hwdb' is a systemd hwdb file, 'usb*' is in usb.ids format, anything
+ * else in pci.ids format.
+ *
+ * Returns number of added items or -1.
+ */
+int import_file(hd_data_t *hd_data, hddb2_data_t *hddb2, char *file)
+{
+  FILE *f;
+  char *name;
+  int len, cnt;
+
+  if(!(f = fopen(file, "r"))) return -1;
+
+  hddb2->index = hddb_index_free(hddb2->index);
+
+  name = (name = strrchr(file, '/')) ? name + 1 : file;
+  len = strlen(name);
+
+  if(len > 5 && !strcmp(name + len - 5, ".hwdb")) {
+    cnt = import_hwdb(hddb2, f);
+  }
+  else {
+    cnt = import_ids(hddb2, f, strncmp(name, "usb", 3) ? TAG_PCI : TAG_USB);
+  }
+
+  fclose(f);
+
+  ADD2LOG("id file: %s, %d entries\n", file, cnt);
+
+  return cnt;
+}
+
+
+/*
+ * Import file into the external hddb, if it exists.
+ */
+void import_upstream(hd_data_t *hd_data, char *file)
+{
+  if(access(file, R_OK)) return;
+
+  if(!hd_data->hddb2[0]) hd_data->hddb2[0] = new_mem(sizeof *hd_data->hddb2[0]);
+
+  import_file(hd_data, hd_data->hddb2[0], file);
+}
+
+
+/*
+ * Add upstream ids from file (pci.ids, usb.ids or systemd hwdb format)
+ * to the external hddb.
+ *
+ * Entries from local hddb files and from earlier imports take precedence.
+ * See import_file() for how the format is chosen.
+ *
+ * Returns number of added items or -1 if the file couldn't be read.
+ */
+int hddb_import(hd_data_t *hd_data, char *file)
+{
+  if(!hd_data->hddb2[0]) hddb_init_external(hd_data);
+
+  if(!hd_data->hddb2[0]) hd_data->hddb2[0] = new_mem(sizeof *hd_data->hddb2[0]);
+
+  return import_file(hd_data, hd_data->hddb2[0], file);
+}
+
+
 /* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - */
 void hddb_dump_raw(hddb2_data_t *hddb, FILE *f)
 {
@@ -1083,6 +1518,9 @@ void hddb_dump_raw(hddb2_data_t *hddb, FILE *f)
     if(fl == FLAG_STRING && v < hddb->strings_len) {
       fprintf(f, "\"%s\"", hddb->strings + v);
     }
+    else if(fl == FLAG_REGEXP && v < hddb->strings_len) {
+      fprintf(f, "/%s/", hddb->strings + v);
+    }
     else if(fl == FLAG_MASK) {
       fprintf(f, "&0x%04x", v);
     }
@@ -1210,6 +1648,12 @@ void hddb_dump_skey(hddb2_data_t *hddb, FILE *f, prefix_t pre, hddb_entry_mask_t
           fprintf(f, "%s", str_val);
         }
       }
+      else if(fl == FLAG_REGEXP) {
+        if(val < hddb->strings_len) {
+          str_val = hddb->strings + val;
+          fprintf(f, "/%s/", str_val);
+        }
+      }
       fputc('\n', f);
     }
     else {
@@ -1302,6 +1746,7 @@ int compare_ids(hddb2_data_t *hddb, hddb_search_t *hs, hddb_entry_mask_t mask, u
   unsigned rm_val = 0, r_or_m = 0, res = 0;
   unsigned fl, val, ok, *ids, id;
   char *str, *str_val;
+  regex_t *re;
 
   if(key >= hddb->ids_len) return 1;
 
@@ -1392,57 +1837,10 @@ int compare_ids(hddb2_data_t *hddb, hddb_search_t *hs, hddb_entry_mask_t mask, u
           break;
       }
     }
-    else if(fl == FLAG_STRING) {
+    else if(fl == FLAG_STRING || fl == FLAG_REGEXP) {
       if(val < hddb->strings_len) str_val = hddb->strings + val;
-      ok = 2;
-      switch(ent) {
-        case he_bus_name:
-          str = hs->bus.name;
-          break;
-
-        case he_baseclass_name:
-          str = hs->base_class.name;
-          break;
-
-        case he_subclass_name:
-          str = hs->sub_class.name;
-          break;
-
-        case he_progif_name:
-          str = hs->prog_if.name;
-          break;
-
-        case he_vendor_name:
-          str = hs->vendor.name;
-          break;
-
-        case he_device_name:
-          str = hs->device.name;
-          break;
-
-        case he_subvendor_name:
-          str = hs->sub_vendor.name;
-          break;
-
-        case he_subdevice_name:
-          str = hs->sub_device.name;
-          break;
-
-        case he_rev_name:
-          str = hs->revision.name;
-          break;
-
-        case he_serial:
-          str = hs->serial;
-          break;
-
-        case he_requires:
-          str = hs->requires;
-          break;
-
-        default:
-          ok = 0;
-      }
+      ok = fl == FLAG_STRING ? 2 : 3;
+      str = search_str(hs, ent);
     }
 
     switch(ok) {
@@ -1470,6 +1868,11 @@ int compare_ids(hddb2_data_t *hddb, hddb_search_t *hs, hddb_entry_mask_t mask, u
         }
         break;
 
+      case 3:
+        re = hddb_regexp(hddb, ids - hddb->ids);
+        if(!str || !re || regexec(re, str, 0, NULL, 0)) res = 1;
+        break;
+
       default:
         res = 1;
     }
@@ -1492,8 +1895,11 @@ int compare_ids(hddb2_data_t *hddb, hddb_search_t *hs, hddb_entry_mask_t mask, u
         break;
 
       case 2:
+      case 3:
         printf(
-          "cmp: 0x%05x: (ent = %2d, id = \"%s\", val = \"%s\") = %d\n",
+          ok == 2 ?
+            "cmp: 0x%05x: (ent = %2d, id = \"%s\", val = \"%s\") = %d\n" :
+            "cmp: 0x%05x: (ent = %2d, id = \"%s\", val = /%s/) = %d\n",
           key, ent, str, str_val, res
         );
         
@@ -1516,6 +1922,51 @@ int compare_ids(hddb2_data_t *hddb, hddb_search_t *hs, hddb_entry_mask_t mask, u
 }
 
 
+/*
+ * Name in hs belonging to entry ent.
+ */
+char *search_str(hddb_search_t *hs, hddb_entry_t ent)
+{
+  switch(ent) {
+    case he_bus_name:
+      return hs->bus.name;
+
+    case he_baseclass_name:
+      return hs->base_class.name;
+
+    case he_subclass_name:
+      return hs->sub_class.name;
+
+    case he_progif_name:
+      return hs->prog_if.name;
+
+    case he_vendor_name:
+      return hs->vendor.name;
+
+    case he_device_name:
+      return hs->device.name;
+
+    case he_subvendor_name:
+      return hs->sub_vendor.name;
+
+    case he_subdevice_name:
+      return hs->sub_device.name;
+
+    case he_rev_name:
+      return hs->revision.name;
+
+    case he_serial:
+      return hs->serial;
+
+    case he_requires:
+      return hs->requires;
+
+    default:
+      return NULL;
+  }
+}
+
+
 void complete_ids(
   hddb2_data_t *hddb, hddb_search_t *hs,
   hddb_entry_mask_t key_mask, hddb_entry_mask_t mask, unsigned val_idx
@@ -1727,13 +2178,276 @@ void complete_ids(
   }
 }
 
-int hddb_search(hd_data_t *hd_data, hddb_search_t *hs, int max_recursions)
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - */
+/*
+ * Find first exact string in key.
+ *
+ * Returns hddb->strings offset or -1.
+ */
+unsigned hddb_key_string(hddb2_data_t *hddb, hddb_entry_mask_t mask, unsigned key, hddb_entry_t *str_ent)
+{
+  hddb_entry_t ent;
+  unsigned *ids;
+
+  if(key >= hddb->ids_len) return -1;
+
+  ids = hddb->ids + key;
+
+  for(ent = 0; ent < he_nomask && mask; ent++, mask >>= 1) {
+    if(!(mask & 1)) continue;
+
+    /* skip range & mask */
+    while(
+      ids < hddb->ids + hddb->ids_len - 1 &&
+      (DATA_FLAG(*ids) == (FLAG_CONT | FLAG_RANGE) || DATA_FLAG(*ids) == (FLAG_CONT | FLAG_MASK))
+    ) ids++;
+
+    if(
+      (DATA_FLAG(*ids) & ~FLAG_CONT) == FLAG_STRING &&
+      DATA_VALUE(*ids) < hddb->strings_len
+    ) {
+      *str_ent = ent;
+      return DATA_VALUE(*ids);
+    }
+
+    while((*ids & (1 << 31)) && ids < hddb->ids + hddb->ids_len - 1) ids++;
+
+    if(++ids >= hddb->ids + hddb->ids_len) break;
+  }
+
+  return -1;
+}
+
+
+/*
+ * FNV-1a over entry & string.
+ */
+unsigned hddb_str_hash(hddb_entry_t ent, char *str)
+{
+  unsigned hash = (2166136261u ^ ent) * 16777619u;
+
+  while(*str) {
+    hash ^= (unsigned char) *str++;
+    hash *= 16777619u;
+  }
+
+  return hash;
+}
+
+
+/*
+ * hddb search index.
+ *
+ * Items are put into buckets by the hash of their first exact string key
+ * (entry & name); items without string key are kept in a separate list.
+ * A search then only looks at items without string key and at the buckets
+ * matching the names it has. All lists are in hddb->list order, so the
+ * result is the same as going through the complete list.
+ *
+ * Regular expression keys (FLAG_REGEXP) are compiled here, too.
+ */
+struct hddb_index_s *hddb_index_build(hd_data_t *hd_data, hddb2_data_t *hddb)
+{
+  struct hddb_index_s *idx;
+  unsigned u, v, b, cnt, *bucket;
+  hddb_entry_t ent;
+  int err;
+  char buf[64];
+
+  idx = new_mem(sizeof *idx);
+
+  bucket = new_mem((hddb->list_len + 1) * sizeof *bucket);
+
+  for(cnt = u = 0; u < hddb->list_len; u++) {
+    v = hddb_key_string(hddb, hddb->list[u].key_mask, hddb->list[u].key, &ent);
+    bucket[u] = -1;
+    if(v != -1u) {
+      bucket[u] = hddb_str_hash(ent, hddb->strings + v);
+      cnt++;
+    }
+  }
+
+  for(idx->bits = 4; (1u << idx->bits) < 2 * cnt; idx->bits++);
+
+  idx->start = new_mem(((1 << idx->bits) + 1) * sizeof *idx->start);
+  idx->row = new_mem((cnt + 1) * sizeof *idx->row);
+  idx->rest = new_mem((hddb->list_len - cnt + 1) * sizeof *idx->rest);
+
+  for(u = 0; u < hddb->list_len; u++) {
+    if(bucket[u] == -1u) {
+      idx->rest[idx->rest_len++] = u;
+    }
+    else {
+      bucket[u] &= (1 << idx->bits) - 1;
+      idx->start[bucket[u] + 1]++;
+    }
+  }
+
+  for(b = 0; b < (1u << idx->bits); b++) idx->start[b + 1] += idx->start[b];
+
+  /* fill buckets; start[b] is moved to the end of bucket b - 1 here... */
+  for(u = 0; u < hddb->list_len; u++) {
+    if(bucket[u] != -1u) idx->row[idx->start[bucket[u]]++] = u;
+  }
+
+  /* ... and back again */
+  for(b = 1u << idx->bits; b > 0; b--) idx->start[b] = idx->start[b - 1];
+  idx->start[0] = 0;
+
+  free_mem(bucket);
+
+  /* compile regular expressions */
+  for(cnt = u = 0; u < hddb->ids_len; u++) {
+    if((DATA_FLAG(hddb->ids[u]) & ~FLAG_CONT) == FLAG_REGEXP) cnt++;
+  }
+
+  if(cnt) {
+    idx->re_pos = new_mem(cnt * sizeof *idx->re_pos);
+    idx->re = new_mem(cnt * sizeof *idx->re);
+    idx->re_ok = new_mem(cnt * sizeof *idx->re_ok);
+
+    for(u = 0; u < hddb->ids_len; u++) {
+      if((DATA_FLAG(hddb->ids[u]) & ~FLAG_CONT) != FLAG_REGEXP) continue;
+      v = DATA_VALUE(hddb->ids[u]);
+      idx->re_pos[idx->re_len] = u;
+      if(v < hddb->strings_len) {
+        err = regcomp(idx->re + idx->re_len, hddb->strings + v, REG_EXTENDED | REG_NOSUB);
+        if(err) {
+          regerror(err, idx->re + idx->re_len, buf, sizeof buf);
+          ADD2LOG("hddb: invalid regexp /%s/: %s\n", hddb->strings + v, buf);
+        }
+        else {
+          idx->re_ok[idx->re_len] = 1;
+        }
+      }
+      idx->re_len++;
+    }
+  }
+
+  return idx;
+}
+
+
+/*
+ * Get hddb index, build it if necessary.
+ *
+ * hddb_internal is shared by all hd_data_t instances: the index is
+ * published with an atomic compare-and-swap; a concurrent loser drops its
+ * copy.
+ */
+struct hddb_index_s *hddb_get_index(hd_data_t *hd_data, hddb2_data_t *hddb)
+{
+  struct hddb_index_s *idx, *expected = NULL;
+
+  idx = __atomic_load_n(&hddb->index, __ATOMIC_ACQUIRE);
+  if(idx) return idx;
+
+  idx = hddb_index_build(hd_data, hddb);
+
+  if(!__atomic_compare_exchange_n(&hddb->index, &expected, idx, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+    /* someone else was faster */
+    hddb_index_free(idx);
+    idx = expected;
+  }
+
+  return idx;
+}
+
+
+/*
+ * Free hddb index; call whenever the hddb changes.
+ */
+struct hddb_index_s *hddb_index_free(struct hddb_index_s *idx)
 {
   unsigned u;
+
+  if(!idx) return NULL;
+
+  for(u = 0; u < idx->re_len; u++) {
+    if(idx->re_ok[u]) regfree(idx->re + u);
+  }
+
+  free_mem(idx->re_pos);
+  free_mem(idx->re);
+  free_mem(idx->re_ok);
+
+  free_mem(idx->rest);
+  free_mem(idx->start);
+  free_mem(idx->row);
+
+  return free_mem(idx);
+}
+
+
+/*
+ * Get item lists to search for hs, starting at item first.
+ *
+ * These are the items without string key and the buckets matching the
+ * names in hs (stored in str[]). Returns number of lists.
+ */
+unsigned hddb_index_rows(struct hddb_index_s *idx, hddb_search_t *hs, unsigned first, hddb_rows_t *row, char **str)
+{
+  hddb_entry_t ent;
+  unsigned b, u, rows = 0;
+
+  row[rows].len = idx->rest_len;
+  row[rows++].row = idx->rest;
+
+  for(ent = 0; ent < he_nomask; ent++) {
+    str[ent] = hs->key & (1 << ent) ? search_str(hs, ent) : NULL;
+    if(!str[ent]) continue;
+    b = hddb_str_hash(ent, str[ent]) & ((1 << idx->bits) - 1);
+    if(idx->start[b] == idx->start[b + 1]) continue;
+    row[rows].len = idx->start[b + 1] - idx->start[b];
+    row[rows++].row = idx->row + idx->start[b];
+  }
+
+  for(u = 0; u < rows; u++) {
+    while(row[u].len && *row[u].row < first) {
+      row[u].len--;
+      row[u].row++;
+    }
+  }
+
+  return rows;
+}
+
+
+/*
+ * Compiled regexp at hddb->ids position pos.
+ */
+regex_t *hddb_regexp(hddb2_data_t *hddb, unsigned pos)
+{
+  struct hddb_index_s *idx = __atomic_load_n(&hddb->index, __ATOMIC_ACQUIRE);
+  unsigned lo, hi, mid;
+
+  if(!idx) return NULL;
+
+  for(lo = 0, hi = idx->re_len; lo < hi;) {
+    mid = (lo + hi) / 2;
+    if(idx->re_pos[mid] < pos) {
+      lo = mid + 1;
+    }
+    else {
+      hi = mid;
+    }
+  }
+
+  return lo < idx->re_len && idx->re_pos[lo] == pos && idx->re_ok[lo] ? idx->re + lo : NULL;
+}
+
+
+int hddb_search(hd_data_t *hd_data, hddb_search_t *hs, int max_recursions)
+{
+  unsigned u, v, rows;
   int i;
   hddb2_data_t *hddb;
   int db_idx;
   hddb_entry_mask_t all_values = 0;
+  struct hddb_index_s *idx;
+  hddb_entry_t ent;
+  char *str[he_nomask];
+  hddb_rows_t row[he_nomask + 1];
 
   if(!hs) return 0;
 
@@ -1743,7 +2457,23 @@ int hddb_search(hd_data_t *hd_data, hddb_search_t *hs, int max_recursions)
     for(db_idx = 0; (unsigned) db_idx < sizeof hd_data->hddb2 / sizeof *hd_data->hddb2; db_idx++) {
       if(!(hddb = hd_data->hddb2[db_idx])) continue;
 
-      for(u = 0; u < hddb->list_len; u++) {
+      idx = hddb_get_index(hd_data, hddb);
+
+      rows = hddb_index_rows(idx, hs, 0, row, str);
+
+      /* merge item lists, in list order */
+      for(;;) {
+        for(u = -1, v = 0; v < rows; v++) {
+          if(row[v].len && *row[v].row < u) u = *row[v].row;
+        }
+        if(u == -1u) break;
+        for(v = 0; v < rows; v++) {
+          if(row[v].len && *row[v].row == u) {
+            row[v].len--;
+            row[v].row++;
+          }
+        }
+
         if(
           (hs->key & hddb->list[u].key_mask) == hddb->list[u].key_mask
           /* && (hs->value & hddb->list[u].value_mask) != hddb->list[u].value_mask */
@@ -1754,6 +2484,12 @@ int hddb_search(hd_data_t *hd_data, hddb_search_t *hs, int max_recursions)
               hddb->list[u].key_mask,
               hddb->list[u].value_mask, hddb->list[u].value
             );
+
+            /* names we search for might have changed */
+            for(ent = 0; ent < he_nomask; ent++) {
+              if((hs->key & (1 << ent)) && search_str(hs, ent) != str[ent]) break;
+            }
+            if(ent < he_nomask) rows = hddb_index_rows(idx, hs, u + 1, row, str);
           }
         }
       }
@@ -1,4 +1,5 @@
 void hddb_init(hd_data_t *hd_data);
+struct hddb_index_s *hddb_index_free(struct hddb_index_s *idx);
 
 unsigned device_class(hd_data_t *hd_data, unsigned vendor, unsigned device);
 unsigned sub_device_class(hd_data_t *hd_data, unsigned vendor, unsigned device, unsigned sub_vendor, unsigned sub_device);
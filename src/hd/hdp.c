@@ -54,6 +54,8 @@ void hd_dump_entry(hd_data_t *hd_data, hd_t *h, FILE *f)
 
   if(!h) return;
 
+  hd_load_details(hd_data, h);
+
   s = "";
   if(h->is.agp) s = "(AGP)";
   //  pci_flag_pm: dump_line0(", supports PM");
@@ -1131,6 +1133,17 @@ void dump_cpu(hd_data_t *hd_data, hd_t *hd, FILE *f)
   if(ct->bogo) dump_line("BogoMips: %.2f\n", ct->bogo);
   if(ct->cache) dump_line("Cache: %u kb\n", ct->cache);
   if(ct->units) dump_line("Units/Processor: %u\n", ct->units);
+  if(ct->topology) {
+    dump_line("Topology: package %u, core %u, thread %u\n", ct->package, ct->core, ct->thread);
+  }
+  if(ct->clock_max) dump_line("Clock Range: %u - %u MHz\n", ct->clock_min, ct->clock_max);
+  if(ct->cache_l1d || ct->cache_l1i || ct->cache_l2 || ct->cache_l3) {
+    dump_line(
+      "Caches: L1d %u kb, L1i %u kb, L2 %u kb, L3 %u kb\n",
+      ct->cache_l1d, ct->cache_l1i, ct->cache_l2, ct->cache_l3
+    );
+  }
+  if(ct->count > 1) dump_line("Threads: %u\n", ct->count);
 }
 
 
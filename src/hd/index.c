@@ -0,0 +1,613 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+#include "hd.h"
+#include "hd_int.h"
+#include "index.h"
+
+/**
+ * @defgroup INDEXint Hardware list indexes
+ * @ingroup  libhdInternals
+ * @brief Bucket indexes over hd_data->hd used by hd_list() & co
+ *
+ * Entries are grouped by hw class, base class and bus. The index is built
+ * on first use and dropped whenever hd_data->hd changes (new or removed
+ * entries, hd_scan()). hd_data->only gets a hash table of its own, plus
+ * the sysfs paths of its entries so scanners can skip unrelated devices.
+ *
+ * @{
+ */
+
+typedef struct {
+  unsigned len;			/* number of distinct keys */
+  unsigned *key;		/* sorted keys */
+  unsigned *start;		/* rows of key[i]: row[start[i]] .. row[start[i + 1] - 1] */
+  unsigned *row;		/* rows, in list order per key */
+} hd_bucket_t;
+
+typedef struct {
+  unsigned key, row;
+} hd_bucket_pair_t;
+
+struct hd_index_s {
+  unsigned valid:1;		/* device part is up to date */
+  unsigned len;			/* entries in hd_data->hd */
+  hd_t **hd;			/* entries in list order */
+  unsigned *all;		/* 0 .. len - 1 (for hw_all) */
+  hd_bucket_t bucket[hd_idx_max];
+
+  str_list_t *only;		/* copy of hd_data->only the hash was built for */
+  unsigned only_ok:1;		/* hash is valid */
+  unsigned only_size;		/* power of 2 */
+  char **only_slot;
+  str_list_t *only_sysfs;	/* sysfs paths of hd_data->only entries */
+  str_list_t *only_ids;		/* hd->sysfs_id values they correspond to */
+  unsigned only_prune:1;	/* every entry has a sysfs path */
+  unsigned char only_pruned[(mod_hal + 8) / 8];	/* modules that skipped some device */
+};
+
+struct hd_set_s {
+  unsigned size;		/* power of 2 */
+  hd_t **slot;
+};
+
+static struct hd_index_s *get_index(hd_data_t *hd_data);
+static struct hd_index_s *get_only(hd_data_t *hd_data);
+static void add_only_slot(struct hd_index_s *idx, char *str);
+static char *only_sysfs_path(char *str);
+static char *only_class_id(char *path);
+static int sysfs_related(char *path0, char *path1);
+static void free_buckets(struct hd_index_s *idx);
+static void build_bucket(hd_bucket_t *bucket, hd_bucket_pair_t *pair, unsigned len);
+static int cmp_pair(const void *p0, const void *p1);
+static unsigned hash_str(unsigned hash, char *str);
+static unsigned hash_hd(hd_t *hd);
+
+
+/*
+ * Drop hd list index; call whenever hd_data->hd changes.
+ */
+void hd_index_invalidate(hd_data_t *hd_data)
+{
+  if(hd_data->index) free_buckets(hd_data->index);
+}
+
+
+/*
+ * Free index.
+ */
+struct hd_index_s *hd_index_free(struct hd_index_s *idx)
+{
+  if(!idx) return NULL;
+
+  free_buckets(idx);
+  free_mem(idx->only_slot);
+  free_str_list(idx->only);
+  free_str_list(idx->only_sysfs);
+  free_str_list(idx->only_ids);
+
+  return free_mem(idx);
+}
+
+
+/*
+ * Entries of hd_data->hd as array.
+ */
+hd_t **hd_index_list(hd_data_t *hd_data, unsigned *len)
+{
+  struct hd_index_s *idx = get_index(hd_data);
+
+  *len = idx->len;
+
+  return idx->hd;
+}
+
+
+/*
+ * Rows (see hd_index_list()) with key; in list order.
+ *
+ * For hd_idx_class, hw_all matches every entry.
+ */
+unsigned *hd_index_find(hd_data_t *hd_data, hd_index_type_t type, unsigned key, unsigned *len)
+{
+  struct hd_index_s *idx = get_index(hd_data);
+  hd_bucket_t *bucket;
+  unsigned lo, hi, mid;
+
+  *len = 0;
+
+  if(type >= hd_idx_max) return NULL;
+
+  if(type == hd_idx_class && key == hw_all) {
+    *len = idx->len;
+    return idx->all;
+  }
+
+  bucket = idx->bucket + type;
+
+  for(lo = 0, hi = bucket->len; lo < hi;) {
+    mid = (lo + hi) / 2;
+    if(bucket->key[mid] < key) {
+      lo = mid + 1;
+    }
+    else {
+      hi = mid;
+    }
+  }
+
+  if(lo == bucket->len || bucket->key[lo] != key) return NULL;
+
+  *len = bucket->start[lo + 1] - bucket->start[lo];
+
+  return bucket->row + bucket->start[lo];
+}
+
+
+/*
+ * Drop hd_data->only hash; call when hd_data->only may have been replaced.
+ */
+void hd_index_only_invalidate(hd_data_t *hd_data)
+{
+  struct hd_index_s *idx = hd_data->index;
+
+  if(!idx) return;
+
+  idx->only_ok = 0;
+}
+
+
+/*
+ * The current module is about to replace all its entries; forget that it
+ * skipped some devices before.
+ *
+ * Not during hd_update_device(): it keeps the other entries.
+ */
+void hd_index_only_rescan(hd_data_t *hd_data)
+{
+  struct hd_index_s *idx = hd_data->index;
+
+  if(!idx || hd_data->flags.update) return;
+
+  idx->only_pruned[hd_data->module / 8] &= ~(1 << (hd_data->module & 7));
+}
+
+
+/*
+ * Check if str is in hd_data->only or is the sysfs id of one of its entries.
+ */
+int hd_index_only(hd_data_t *hd_data, char *str)
+{
+  struct hd_index_s *idx;
+  unsigned u, mask;
+
+  if(!str || !hd_data->only) return 0;
+
+  idx = get_only(hd_data);
+
+  mask = idx->only_size - 1;
+  for(u = hash_str(2166136261u, str) & mask; idx->only_slot[u]; u = (u + 1) & mask) {
+    if(!strcmp(idx->only_slot[u], str)) return 1;
+  }
+
+  return 0;
+}
+
+
+/*
+ * Check if the device at sysfs path might be needed for hd_data->only.
+ *
+ * That is, if it is one of the devices in hd_data->only, one of their
+ * parents (for attached_to links) or one of their children (e.g. the
+ * block devices or interfaces of a controller).
+ *
+ * Returns 1 if there's no hd_data->only or some entry in it has no sysfs
+ * path (can't tell then).
+ */
+int hd_index_only_sysfs(hd_data_t *hd_data, char *path)
+{
+  struct hd_index_s *idx;
+  str_list_t *sl;
+  char real[PATH_MAX];
+
+  if(!hd_data->only || !path) return 1;
+
+  idx = get_only(hd_data);
+
+  if(!idx->only_prune || !realpath(path, real)) return 1;
+
+  for(sl = idx->only_sysfs; sl; sl = sl->next) {
+    if(sysfs_related(real, sl->str)) return 1;
+  }
+
+  if(!hd_data->flags.update) {
+    idx->only_pruned[hd_data->module / 8] |= 1 << (hd_data->module & 7);
+  }
+
+  return 0;
+}
+
+
+/*
+ * Check if hd_index_only_sysfs() made a scanner skip some device and
+ * the scanner's entries are still in hd_data->hd; hd_data->hd is
+ * incomplete then.
+ */
+int hd_index_only_pruned(hd_data_t *hd_data)
+{
+  struct hd_index_s *idx = hd_data->index;
+  unsigned u;
+
+  if(!idx) return 0;
+
+  for(u = 0; u < sizeof idx->only_pruned; u++) {
+    if(idx->only_pruned[u]) return 1;
+  }
+
+  return 0;
+}
+
+
+/*
+ * Hash set of hd list entries; entries are compared with cmp_hd().
+ */
+hd_set_t *hd_set_new(hd_t *hd_list)
+{
+  hd_set_t *set;
+  hd_t *hd;
+  unsigned u, cnt;
+
+  if(!hd_list) return NULL;
+
+  for(cnt = 0, hd = hd_list; hd; hd = hd->next) cnt++;
+
+  set = new_mem(sizeof *set);
+  for(set->size = 16; set->size < 2 * cnt; set->size <<= 1);
+  set->slot = new_mem(set->size * sizeof *set->slot);
+
+  for(hd = hd_list; hd; hd = hd->next) {
+    for(u = hash_hd(hd) & (set->size - 1); set->slot[u]; u = (u + 1) & (set->size - 1));
+    set->slot[u] = hd;
+  }
+
+  return set;
+}
+
+
+/*
+ * Check if set has an entry equal to hd.
+ */
+int hd_set_has(hd_set_t *set, hd_t *hd)
+{
+  unsigned u;
+
+  if(!set) return 0;
+
+  for(u = hash_hd(hd) & (set->size - 1); set->slot[u]; u = (u + 1) & (set->size - 1)) {
+    if(!cmp_hd(set->slot[u], hd)) return 1;
+  }
+
+  return 0;
+}
+
+
+hd_set_t *hd_set_free(hd_set_t *set)
+{
+  if(!set) return NULL;
+
+  free_mem(set->slot);
+
+  return free_mem(set);
+}
+
+
+struct hd_index_s *get_index(hd_data_t *hd_data)
+{
+  struct hd_index_s *idx;
+  hd_bucket_pair_t *pair;
+  hd_t *hd;
+  unsigned u, cnt;
+  hd_hw_item_t item;
+
+  if(!hd_data->index) hd_data->index = new_mem(sizeof *hd_data->index);
+  idx = hd_data->index;
+
+  if(idx->valid) return idx;
+
+  for(cnt = 0, hd = hd_data->hd; hd; hd = hd->next) cnt++;
+
+  idx->len = cnt;
+  idx->hd = new_mem((cnt + 1) * sizeof *idx->hd);
+  idx->all = new_mem((cnt + 1) * sizeof *idx->all);
+
+  for(u = 0, hd = hd_data->hd; hd; hd = hd->next, u++) {
+    idx->hd[u] = hd;
+    idx->all[u] = u;
+  }
+
+  /* hw classes: one pair per class bit */
+  for(cnt = u = 0; u < idx->len; u++) {
+    for(item = 1; item < hw_all; item++) cnt += hd_is_hw_class(idx->hd[u], item);
+  }
+  pair = new_mem((cnt + 1) * sizeof *pair);
+  for(cnt = u = 0; u < idx->len; u++) {
+    for(item = 1; item < hw_all; item++) {
+      if(hd_is_hw_class(idx->hd[u], item)) {
+        pair[cnt].key = item;
+        pair[cnt++].row = u;
+      }
+    }
+  }
+  build_bucket(idx->bucket + hd_idx_class, pair, cnt);
+  free_mem(pair);
+
+  pair = new_mem((idx->len + 1) * sizeof *pair);
+
+  for(u = 0; u < idx->len; u++) {
+    pair[u].key = idx->hd[u]->base_class.id;
+    pair[u].row = u;
+  }
+  build_bucket(idx->bucket + hd_idx_base_class, pair, idx->len);
+
+  for(u = 0; u < idx->len; u++) {
+    pair[u].key = idx->hd[u]->bus.id;
+    pair[u].row = u;
+  }
+  build_bucket(idx->bucket + hd_idx_bus, pair, idx->len);
+
+  free_mem(pair);
+
+  idx->valid = 1;
+
+  return idx;
+}
+
+
+/*
+ * Index for hd_data->only; rebuilt after hd_index_only_invalidate().
+ *
+ * The hash points into a copy of the list: hd_data->only may be freed and
+ * rebuilt between scans (hwscand does that for every request).
+ */
+struct hd_index_s *get_only(hd_data_t *hd_data)
+{
+  struct hd_index_s *idx;
+  str_list_t *sl, **next;
+  unsigned cnt;
+  char *s, *s1;
+
+  if(!hd_data->index) hd_data->index = new_mem(sizeof *hd_data->index);
+  idx = hd_data->index;
+
+  if(idx->only_ok) return idx;
+
+  idx->only = free_str_list(idx->only);
+  for(cnt = 0, sl = hd_data->only, next = &idx->only; sl; sl = sl->next, next = &(*next)->next) {
+    cnt++;
+    *next = new_mem(sizeof **next);
+    (*next)->str = new_str(sl->str);
+  }
+  idx->only_ok = 1;
+
+  idx->only_sysfs = free_str_list(idx->only_sysfs);
+  idx->only_ids = free_str_list(idx->only_ids);
+  idx->only_prune = 1;
+
+  for(sl = hd_data->only; sl; sl = sl->next) {
+    if((s = only_sysfs_path(sl->str))) {
+      ADD2LOG("  only: %s -> %s\n", sl->str, s);
+      add_str_list(&idx->only_sysfs, s);
+      add_str_list(&idx->only_ids, hd_sysfs_id(s));
+      if((s1 = only_class_id(s))) {
+        add_str_list(&idx->only_ids, s1);
+        free_mem(s1);
+      }
+      free_mem(s);
+    }
+    else {
+      ADD2LOG("  only: %s: no sysfs device, probing everything\n", sl->str);
+      idx->only_prune = 0;
+    }
+  }
+
+  for(idx->only_size = 16; idx->only_size < 6 * cnt; idx->only_size <<= 1);
+  free_mem(idx->only_slot);
+  idx->only_slot = new_mem(idx->only_size * sizeof *idx->only_slot);
+
+  /* the names as given and the sysfs ids they resolve to */
+  for(sl = idx->only; sl; sl = sl->next) add_only_slot(idx, sl->str);
+  for(sl = idx->only_ids; sl; sl = sl->next) add_only_slot(idx, sl->str);
+
+  return idx;
+}
+
+
+void add_only_slot(struct hd_index_s *idx, char *str)
+{
+  unsigned u, mask = idx->only_size - 1;
+
+  if(!str) return;
+
+  for(u = hash_str(2166136261u, str) & mask; idx->only_slot[u]; u = (u + 1) & mask) {
+    if(!strcmp(idx->only_slot[u], str)) return;
+  }
+
+  idx->only_slot[u] = str;
+}
+
+
+/*
+ * Real sysfs path for a device name (/dev/sda), sysfs id (/devices/...,
+ * /class/block/sda), sysfs path (/sys/...) or interface name (eth0).
+ */
+char *only_sysfs_path(char *str)
+{
+  struct stat sbuf;
+  char *path = NULL, *s = NULL, real[PATH_MAX];
+
+  if(!str || !*str) return NULL;
+
+  if(!strncmp(str, "/dev/", sizeof "/dev/" - 1)) {
+    if(!stat(str, &sbuf) && (S_ISBLK(sbuf.st_mode) || S_ISCHR(sbuf.st_mode))) {
+      str_printf(&s, 0, "/sys/dev/%s/%u:%u",
+        S_ISBLK(sbuf.st_mode) ? "block" : "char",
+        major(sbuf.st_rdev), minor(sbuf.st_rdev)
+      );
+    }
+  }
+  else if(!strncmp(str, "/sys/", sizeof "/sys/" - 1)) {
+    s = new_str(str);
+  }
+  else if(*str == '/') {
+    str_printf(&s, 0, "/sys%s", str);
+  }
+  else {
+    str_printf(&s, 0, "/sys/class/net/%s", str);
+  }
+
+  if(s && realpath(s, real)) path = new_str(real);
+
+  free_mem(s);
+
+  return path;
+}
+
+
+/*
+ * Class device entries (block, net, ...) use /class/<class>/<name> as
+ * sysfs id; partitions add the disk name: /class/block/sda/sda1.
+ *
+ * Return that id for the real sysfs path, if it is a class device.
+ */
+char *only_class_id(char *path)
+{
+  char *s, *class, *name, *parent, *id = NULL;
+
+  s = hd_read_sysfs_link(path, "subsystem");
+  if(!s || strncmp(s, "/sys/class/", sizeof "/sys/class/" - 1)) return NULL;
+  class = s + sizeof "/sys/class/" - 1;
+
+  name = strrchr(path, '/');
+  for(parent = name; parent > path && parent[-1] != '/'; parent--);
+
+  if(!strcmp(class, "block") && parent > path && strncmp(parent, "block/", sizeof "block/" - 1)) {
+    str_printf(&id, 0, "/class/%s/%s", class, parent);
+  }
+  else {
+    str_printf(&id, 0, "/class/%s%s", class, name);
+  }
+
+  return id;
+}
+
+
+/*
+ * Check if one path is below (or equal to) the other.
+ */
+int sysfs_related(char *path0, char *path1)
+{
+  size_t len0 = strlen(path0), len1 = strlen(path1);
+
+  if(len0 > len1) return sysfs_related(path1, path0);
+
+  return !strncmp(path0, path1, len0) && (path1[len0] == 0 || path1[len0] == '/');
+}
+
+
+void free_buckets(struct hd_index_s *idx)
+{
+  hd_index_type_t type;
+
+  idx->hd = free_mem(idx->hd);
+  idx->all = free_mem(idx->all);
+  idx->len = 0;
+
+  for(type = 0; type < hd_idx_max; type++) {
+    free_mem(idx->bucket[type].key);
+    free_mem(idx->bucket[type].start);
+    free_mem(idx->bucket[type].row);
+    memset(idx->bucket + type, 0, sizeof *idx->bucket);
+  }
+
+  idx->valid = 0;
+}
+
+
+/*
+ * Sort (key, row) pairs and split them into buckets.
+ */
+void build_bucket(hd_bucket_t *bucket, hd_bucket_pair_t *pair, unsigned len)
+{
+  unsigned u, keys;
+
+  qsort(pair, len, sizeof *pair, cmp_pair);
+
+  for(keys = u = 0; u < len; u++) keys += !u || pair[u].key != pair[u - 1].key;
+
+  bucket->len = keys;
+  bucket->key = new_mem((keys + 1) * sizeof *bucket->key);
+  bucket->start = new_mem((keys + 1) * sizeof *bucket->start);
+  bucket->row = new_mem((len + 1) * sizeof *bucket->row);
+
+  for(keys = u = 0; u < len; u++) {
+    if(!u || pair[u].key != pair[u - 1].key) {
+      bucket->key[keys] = pair[u].key;
+      bucket->start[keys++] = u;
+    }
+    bucket->row[u] = pair[u].row;
+  }
+  bucket->start[keys] = len;
+}
+
+
+int cmp_pair(const void *p0, const void *p1)
+{
+  const hd_bucket_pair_t *pair0 = p0, *pair1 = p1;
+
+  if(pair0->key != pair1->key) return pair0->key < pair1->key ? -1 : 1;
+
+  return pair0->row < pair1->row ? -1 : pair0->row > pair1->row;
+}
+
+
+/*
+ * FNV-1a, continuing from hash.
+ */
+unsigned hash_str(unsigned hash, char *str)
+{
+  while(*str) {
+    hash ^= (unsigned char) *str++;
+    hash *= 16777619u;
+  }
+
+  return hash;
+}
+
+
+/*
+ * Hash over the fields cmp_hd() looks at.
+ */
+unsigned hash_hd(hd_t *hd)
+{
+  unsigned u, hash = 2166136261u, val[] = {
+    hd->bus.id, hd->slot, hd->func, hd->base_class.id, hd->sub_class.id,
+    hd->prog_if.id, hd->device.id, hd->vendor.id, hd->sub_vendor.id,
+    hd->revision.id, hd->compat_device.id, hd->compat_vendor.id,
+    hd->module, hd->line
+  };
+
+  for(u = 0; u < sizeof val / sizeof *val; u++) {
+    hash ^= val[u];
+    hash *= 16777619u;
+  }
+
+  if(hd->unix_dev_name) hash = hash_str(hash, hd->unix_dev_name);
+
+  return hash;
+}
+
+/** @} */
@@ -0,0 +1,18 @@
+/* keys for hd_index_find() */
+typedef enum { hd_idx_class, hd_idx_base_class, hd_idx_bus, hd_idx_max } hd_index_type_t;
+
+typedef struct hd_set_s hd_set_t;
+
+void hd_index_invalidate(hd_data_t *hd_data);
+struct hd_index_s *hd_index_free(struct hd_index_s *idx);
+hd_t **hd_index_list(hd_data_t *hd_data, unsigned *len);
+unsigned *hd_index_find(hd_data_t *hd_data, hd_index_type_t type, unsigned key, unsigned *len);
+void hd_index_only_invalidate(hd_data_t *hd_data);
+void hd_index_only_rescan(hd_data_t *hd_data);
+int hd_index_only(hd_data_t *hd_data, char *str);
+int hd_index_only_sysfs(hd_data_t *hd_data, char *path);
+int hd_index_only_pruned(hd_data_t *hd_data);
+
+hd_set_t *hd_set_new(hd_t *hd_list);
+int hd_set_has(hd_set_t *set, hd_t *hd);
+hd_set_t *hd_set_free(hd_set_t *set);
@@ -9,7 +9,9 @@
 #include "hd.h"
 #include "hd_int.h"
 #include "int.h"
+#include "smbios.h"
 #include "edd.h"
+#include "index.h"
 
 /**
  * @defgroup LIBHDint Internal utilities
@@ -20,13 +22,16 @@
  */
 
 static void int_hotplug(hd_data_t *hd_data);
+static void int_hotplug_hd(hd_t *hd);
 static void int_cdrom(hd_data_t *hd_data);
+static void int_cdrom_hd(hd_t *hd);
 #if defined(__i386__) || defined (__x86_64__)
 static int set_bios_id(hd_data_t *hd_data, hd_t *hd_ref, int bios_id);
 static int bios_ctrl_order(hd_data_t *hd_data, unsigned *sctrl, int sctrl_len);
 static void int_bios(hd_data_t *hd_data);
 #endif
 static void int_media_check(hd_data_t *hd_data);
+static void int_media_check_hd(hd_data_t *hd_data, hd_t *hd, int *cnt);
 static int contains_word(char *str, char *str2);
 static int is_zip(hd_t *hd);
 static void int_floppy(hd_data_t *hd_data);
@@ -35,8 +40,11 @@ static void int_mouse(hd_data_t *hd_data);
 static void new_id(hd_data_t *hd_data, hd_t *hd);
 static void int_modem(hd_data_t *hd_data);
 static void int_wlan(hd_data_t *hd_data);
+static void int_wlan_hd(hd_data_t *hd_data, hd_t *hd);
 static void int_udev(hd_data_t *hd_data);
+static void int_udev_hd(hd_data_t *hd_data, hd_t *hd);
 static void int_devicenames(hd_data_t *hd_data);
+static void int_devicenames_hd(hd_t *hd);
 #if defined(__i386__) || defined (__x86_64__)
 static void int_softraid(hd_data_t *hd_data);
 #endif
@@ -134,15 +142,20 @@ void hd_scan_int(hd_data_t *hd_data)
 void int_hotplug(hd_data_t *hd_data)
 {
   hd_t *hd;
+
+  for(hd = hd_data->hd; hd; hd = hd->next) int_hotplug_hd(hd);
+}
+
+
+void int_hotplug_hd(hd_t *hd)
+{
   hal_prop_t *prop;
 
-  for(hd = hd_data->hd; hd; hd = hd->next) {
-    if(hd->bus.id == bus_usb || hd->usb_guid) {
-      hd->hotplug = hp_usb;
-    }
-    if((prop = hal_get_bool(hd->hal_prop, "storage.hotpluggable")) && prop->val.b) {
-      hd->is.hotpluggable = 1;
-    }
+  if(hd->bus.id == bus_usb || hd->usb_guid) {
+    hd->hotplug = hp_usb;
+  }
+  if((prop = hal_get_bool(hd->hal_prop, "storage.hotpluggable")) && prop->val.b) {
+    hd->is.hotpluggable = 1;
   }
 }
 
@@ -152,43 +165,48 @@ void int_hotplug(hd_data_t *hd_data)
 void int_cdrom(hd_data_t *hd_data)
 {
   hd_t *hd;
+
+  for(hd = hd_data->hd; hd; hd = hd->next) int_cdrom_hd(hd);
+}
+
+
+void int_cdrom_hd(hd_t *hd)
+{
   hal_prop_t *prop;
 
-  for(hd = hd_data->hd; hd; hd = hd->next) {
-    if(
-      hd->base_class.id == bc_storage_device &&
-      hd->sub_class.id == sc_sdev_cdrom
-    ) {
-      if(!hd->prog_if.id && hd->device.name && strstr(hd->device.name, "DVD")) hd->is.dvd = 1;
+  if(
+    hd->base_class.id != bc_storage_device ||
+    hd->sub_class.id != sc_sdev_cdrom
+  ) return;
 
-      if((prop = hal_get_bool(hd->hal_prop, "storage.cdrom.cdr")) && prop->val.b) {
-        hd->is.cdr = 1;
-      }
-      if((prop = hal_get_bool(hd->hal_prop, "storage.cdrom.cdrw")) && prop->val.b) {
-        hd->is.cdrw = 1;
-      }
-      if((prop = hal_get_bool(hd->hal_prop, "storage.cdrom.dvdr")) && prop->val.b) {
-        hd->is.dvdr = 1;
-      }
-      if((prop = hal_get_bool(hd->hal_prop, "storage.cdrom.dvdrw")) && prop->val.b) {
-        hd->is.dvdrw = 1;
-      }
-      if((prop = hal_get_bool(hd->hal_prop, "storage.cdrom.dvdram")) && prop->val.b) {
-        hd->is.dvdram = 1;
-      }
-      if((prop = hal_get_bool(hd->hal_prop, "storage.cdrom.dvdplusr")) && prop->val.b) {
-        hd->is.dvdpr = 1;
-      }
-      if((prop = hal_get_bool(hd->hal_prop, "storage.cdrom.dvdplusrw")) && prop->val.b) {
-        hd->is.dvdprw = 1;
-      }
-      if((prop = hal_get_bool(hd->hal_prop, "storage.cdrom.dvdplusrdl")) && prop->val.b) {
-        hd->is.dvdprdl = 1;
-      }
+  if(!hd->prog_if.id && hd->device.name && strstr(hd->device.name, "DVD")) hd->is.dvd = 1;
 
-      if(hd->is.dvd) hd->prog_if.id = 3;
-    }
+  if((prop = hal_get_bool(hd->hal_prop, "storage.cdrom.cdr")) && prop->val.b) {
+    hd->is.cdr = 1;
+  }
+  if((prop = hal_get_bool(hd->hal_prop, "storage.cdrom.cdrw")) && prop->val.b) {
+    hd->is.cdrw = 1;
+  }
+  if((prop = hal_get_bool(hd->hal_prop, "storage.cdrom.dvdr")) && prop->val.b) {
+    hd->is.dvdr = 1;
+  }
+  if((prop = hal_get_bool(hd->hal_prop, "storage.cdrom.dvdrw")) && prop->val.b) {
+    hd->is.dvdrw = 1;
+  }
+  if((prop = hal_get_bool(hd->hal_prop, "storage.cdrom.dvdram")) && prop->val.b) {
+    hd->is.dvdram = 1;
   }
+  if((prop = hal_get_bool(hd->hal_prop, "storage.cdrom.dvdplusr")) && prop->val.b) {
+    hd->is.dvdpr = 1;
+  }
+  if((prop = hal_get_bool(hd->hal_prop, "storage.cdrom.dvdplusrw")) && prop->val.b) {
+    hd->is.dvdprw = 1;
+  }
+  if((prop = hal_get_bool(hd->hal_prop, "storage.cdrom.dvdplusrdl")) && prop->val.b) {
+    hd->is.dvdprdl = 1;
+  }
+
+  if(hd->is.dvd) hd->prog_if.id = 3;
 }
 
 #if defined(__i386__) || defined (__x86_64__)
@@ -301,6 +319,9 @@ void int_bios(hd_data_t *hd_data)
   /* don't do anything if there is useful edd info */
   if(hd_data->flags.edd_used) return;
 
+  /* disk order can't be guessed from some of the disks */
+  if(hd_index_only_pruned(hd_data)) return;
+
   for(i = 0, hd = hd_data->hd; hd; hd = hd->next) {
     if(
       hd->base_class.id == bc_storage_device &&
@@ -476,32 +497,45 @@ void int_bios(hd_data_t *hd_data)
 void int_media_check(hd_data_t *hd_data)
 {
   hd_t *hd;
-  int i, j = 0;
+  int j = 0;
 
-  for(hd = hd_data->hd; hd; hd = hd->next) {
-    if(!hd_report_this(hd_data, hd)) continue;
-    if(
-      hd->base_class.id == bc_storage_device &&
-      (
-        /* hd->sub_class.id == sc_sdev_cdrom || */ /* cf. cdrom.c */
-        hd->sub_class.id == sc_sdev_disk ||
-        hd->sub_class.id == sc_sdev_floppy
-      ) &&
-      hd->unix_dev_name &&
-      !hd->block0 &&
-      !hd->is.notready &&
-      hd->status.available != status_no
-    ) {
-      i = 5;
-      PROGRESS(4, ++j, hd->unix_dev_name);
-      hd->block0 = read_block0(hd_data, hd->unix_dev_name, &i);
-      hd->is.notready = hd->block0 ? 0 : 1;
+  for(hd = hd_data->hd; hd; hd = hd->next) int_media_check_hd(hd_data, hd, &j);
+}
+
+
+/*
+ * cnt: progress counter.
+ */
+void int_media_check_hd(hd_data_t *hd_data, hd_t *hd, int *cnt)
+{
+  int i;
+
+  if(!hd_report_this(hd_data, hd)) return;
+  if(
+    hd->base_class.id == bc_storage_device &&
+    (
+      /* hd->sub_class.id == sc_sdev_cdrom || */ /* cf. cdrom.c */
+      hd->sub_class.id == sc_sdev_disk ||
+      hd->sub_class.id == sc_sdev_floppy
+    ) &&
+    hd->unix_dev_name &&
+    !hd->block0 &&
+    !hd->is.notready &&
+    hd->status.available != status_no
+  ) {
+    if(hd_data->flags.lazy) {
+      hd->lazy.block0 = 1;
+      return;
+    }
+    i = 5;
+    PROGRESS(4, ++*cnt, hd->unix_dev_name);
+    hd->block0 = read_block0(hd_data, hd->unix_dev_name, &i);
+    hd->is.notready = hd->block0 ? 0 : 1;
 #if defined(__i386__) || defined(__x86_64__)
-      if(hd->block0) {
-        ADD2LOG("  mbr sig: 0x%08x\n", edd_disk_signature(hd));
-      }
-#endif
+    if(hd->block0) {
+      ADD2LOG("  mbr sig: 0x%08x\n", edd_disk_signature(hd));
     }
+#endif
   }
 }
 
@@ -855,6 +889,13 @@ void int_modem(hd_data_t *hd_data)
 void int_wlan(hd_data_t *hd_data)
 {
   hd_t *hd;
+
+  for(hd = hd_data->hd; hd; hd = hd->next) int_wlan_hd(hd_data, hd);
+}
+
+
+void int_wlan_hd(hd_data_t *hd_data, hd_t *hd)
+{
   driver_info_t *di;
   str_list_t *sl;
   unsigned u, found;
@@ -914,25 +955,23 @@ void int_wlan(hd_data_t *hd_data)
     "zd1201"
   };
 
-  for(hd = hd_data->hd; hd; hd = hd->next) {
-    for(found = 0, di = hd->driver_info; di && !found; di = di->next) {
-      if(di->any.type == di_module) {
-        for(sl = di->module.names; sl && !found; sl = sl->next) {
-          for(u = 0; u < sizeof wlan_mods / sizeof *wlan_mods; u++) {
-            if(!strcmp(sl->str, wlan_mods[u])) {
-              found = 1;
-              break;
-            }
+  for(found = 0, di = hd->driver_info; di && !found; di = di->next) {
+    if(di->any.type == di_module) {
+      for(sl = di->module.names; sl && !found; sl = sl->next) {
+        for(u = 0; u < sizeof wlan_mods / sizeof *wlan_mods; u++) {
+          if(!strcmp(sl->str, wlan_mods[u])) {
+            found = 1;
+            break;
           }
         }
       }
     }
-    if(found) {
-      hd->is.wlan = 1;
-      hd->base_class.id = bc_network;
-      hd->sub_class.id = 0x82;			/* wlan */
-      hddb_add_info(hd_data, hd);
-    }
+  }
+  if(found) {
+    hd->is.wlan = 1;
+    hd->base_class.id = bc_network;
+    hd->sub_class.id = 0x82;			/* wlan */
+    hddb_add_info(hd_data, hd);
   }
 }
 
@@ -942,57 +981,58 @@ void int_wlan(hd_data_t *hd_data)
  */
 void int_udev(hd_data_t *hd_data)
 {
-  hd_udevinfo_t *ui;
   hd_t *hd;
+
+  for(hd = hd_data->hd; hd; hd = hd->next) int_udev_hd(hd_data, hd);
+}
+
+
+void int_udev_hd(hd_data_t *hd_data, hd_t *hd)
+{
+  hd_udevinfo_t *ui;
   str_list_t *sl;
 
   if(!hd_data->udevinfo) read_udevinfo(hd_data);
 
   if(!hd_data->udevinfo) return;
 
-  for(hd = hd_data->hd; hd; hd = hd->next) {
-    if(!hd->unix_dev_names && hd->unix_dev_name) {
-      add_str_list(&hd->unix_dev_names, hd->unix_dev_name);
-    }
-
-    if(!hd->sysfs_id) continue;
+  if(!hd->unix_dev_names && hd->unix_dev_name) {
+    add_str_list(&hd->unix_dev_names, hd->unix_dev_name);
+  }
 
-    for(ui = hd_data->udevinfo; ui; ui = ui->next) {
-      if(ui->name && !strcmp(ui->sysfs, hd->sysfs_id)) {
-        if(!search_str_list(hd->unix_dev_names, ui->name)) {
-          add_str_list(&hd->unix_dev_names, ui->name);
-        }
-        for(sl = ui->links; sl; sl = sl->next) {
-          if(!search_str_list(hd->unix_dev_names, sl->str)) {
-            add_str_list(&hd->unix_dev_names, sl->str);
-          }
+  for(ui = hd_data->udevinfo; ui && hd->sysfs_id; ui = ui->next) {
+    if(ui->name && !strcmp(ui->sysfs, hd->sysfs_id)) {
+      if(!search_str_list(hd->unix_dev_names, ui->name)) {
+        add_str_list(&hd->unix_dev_names, ui->name);
+      }
+      for(sl = ui->links; sl; sl = sl->next) {
+        if(!search_str_list(hd->unix_dev_names, sl->str)) {
+          add_str_list(&hd->unix_dev_names, sl->str);
         }
+      }
 
-        if(!hd->unix_dev_name || hd_data->flags.udev) {
-          sl = hd->unix_dev_names;
-
-          if(hd_data->flags.udev) {
-            /* use first link as canonical device name */
-            if(ui->links) sl = sl->next;
-          }
+      if(!hd->unix_dev_name || hd_data->flags.udev) {
+        sl = hd->unix_dev_names;
 
-          hd->unix_dev_name = new_str(sl->str);
+        if(hd_data->flags.udev) {
+          /* use first link as canonical device name */
+          if(ui->links) sl = sl->next;
         }
 
-        break;
+        hd->unix_dev_name = new_str(sl->str);
       }
+
+      break;
     }
   }
 
-  for(hd = hd_data->hd; hd; hd = hd->next) {
-    if(!hd->unix_dev_names) continue;
+  if(!hd->unix_dev_names) return;
 
-    for(ui = hd_data->udevinfo; ui; ui = ui->next) {
-      if(search_str_list(hd->unix_dev_names, ui->name)) {
-        for(sl = ui->links; sl; sl = sl->next) {
-          if(!search_str_list(hd->unix_dev_names, sl->str)) {
-            add_str_list(&hd->unix_dev_names, sl->str);
-          }
+  for(ui = hd_data->udevinfo; ui; ui = ui->next) {
+    if(search_str_list(hd->unix_dev_names, ui->name)) {
+      for(sl = ui->links; sl; sl = sl->next) {
+        if(!search_str_list(hd->unix_dev_names, sl->str)) {
+          add_str_list(&hd->unix_dev_names, sl->str);
         }
       }
     }
@@ -1007,13 +1047,17 @@ void int_devicenames(hd_data_t *hd_data)
 {
   hd_t *hd;
 
-  for(hd = hd_data->hd; hd; hd = hd->next) {
-    if(
-      hd->unix_dev_name &&
-      !search_str_list(hd->unix_dev_names, hd->unix_dev_name)
-    ) {
-      add_str_list(&hd->unix_dev_names, hd->unix_dev_name);
-    }
+  for(hd = hd_data->hd; hd; hd = hd->next) int_devicenames_hd(hd);
+}
+
+
+void int_devicenames_hd(hd_t *hd)
+{
+  if(
+    hd->unix_dev_name &&
+    !search_str_list(hd->unix_dev_names, hd->unix_dev_name)
+  ) {
+    add_str_list(&hd->unix_dev_names, hd->unix_dev_name);
   }
 }
 
@@ -1087,6 +1131,7 @@ void int_system(hd_data_t *hd_data)
   struct stat sbuf;
   sys_info_t *st;
   hd_sysfsdrv_t *sf;
+  unsigned u;
 
   for(hd_sys = hd_data->hd; hd_sys; hd_sys = hd_sys->next) {
     if(
@@ -1113,9 +1158,8 @@ void int_system(hd_data_t *hd_data)
     is.notebook = 1;
   }
 
-  for(sm = hd_data->smbios; sm; sm = sm->next) {
+  for(u = 0; (sm = smbios_get(hd_data, sm_sysinfo, u)); u++) {
     if(
-      sm->any.type == sm_sysinfo &&
       sm->sysinfo.manuf &&
       !strcasecmp(sm->sysinfo.manuf, "ibm")
     ) {
@@ -1123,7 +1167,6 @@ void int_system(hd_data_t *hd_data)
     }
 
     if(
-      sm->any.type == sm_sysinfo &&
       sm->sysinfo.manuf &&
       !strcasecmp(sm->sysinfo.manuf, "toshiba")
     ) {
@@ -1138,7 +1181,6 @@ void int_system(hd_data_t *hd_data)
     }
 
     if(
-      sm->any.type == sm_sysinfo &&
       sm->sysinfo.manuf &&
       !strncasecmp(sm->sysinfo.manuf, "sony", sizeof "sony" - 1)
     ) {
@@ -1157,26 +1199,24 @@ void int_system(hd_data_t *hd_data)
         hd_sys->vendor.name = new_str("Sony");
       }
     }
+  }
 
+  for(u = 0; (sm = smbios_get(hd_data, sm_chassis, u)); u++) {
     if(
-      sm->any.type == sm_chassis &&
-      (
-        (sm->chassis.ch_type.id >= 8 && sm->chassis.ch_type.id <= 11) ||
-        sm->chassis.ch_type.id == 14
-      )
+      (sm->chassis.ch_type.id >= 8 && sm->chassis.ch_type.id <= 11) ||
+      sm->chassis.ch_type.id == 14
     ) {
       is.notebook = 1;
     }
+  }
 
-    /*
-     * bnc #591703
-     * in case chassis info is missing: assume it's a notebook if
-     * it has track point or touch pad
-     */
-    if(
-      sm->any.type == sm_mouse &&
-      (sm->mouse.mtype.id == 5 || sm->mouse.mtype.id == 7)
-    ) {
+  /*
+   * bnc #591703
+   * in case chassis info is missing: assume it's a notebook if
+   * it has track point or touch pad
+   */
+  for(u = 0; (sm = smbios_get(hd_data, sm_mouse, u)); u++) {
+    if(sm->mouse.mtype.id == 5 || sm->mouse.mtype.id == 7) {
       is.notebook = 1;
     }
   }
@@ -1318,6 +1358,31 @@ void int_update_driver_data(hd_data_t *hd_data, hd_t *hd)
 }
 
 
+/*
+ * The per device parts of hd_scan_int() for a single new entry, see
+ * hd_update_device().
+ */
+void hd_int_update(hd_data_t *hd_data, hd_t *hd)
+{
+  int j = 0;
+
+  int_cdrom_hd(hd);
+  int_media_check_hd(hd_data, hd, &j);
+
+  hd_sysfs_driver_list(hd_data);
+
+  hd_data->flags.keep_kmods = 1;
+  hddb_add_info(hd_data, hd);
+  hd_data->flags.keep_kmods = 0;
+
+  int_update_driver_data(hd_data, hd);
+  int_hotplug_hd(hd);
+  int_wlan_hd(hd_data, hd);
+  int_udev_hd(hd_data, hd);
+  int_devicenames_hd(hd);
+}
+
+
 /*
  * Add driver data, if it is missing.
  *
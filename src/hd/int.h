@@ -1 +1,2 @@
 void hd_scan_int(hd_data_t *hd_data);
+void hd_int_update(hd_data_t *hd_data, hd_t *hd);
@@ -1,6 +1,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <inttypes.h>
 #include <sys/klog.h>
 
 #include "hd.h"
@@ -15,9 +19,18 @@
  * @{
  */
 
+/* upper limit for a single /dev/kmsg record, including ' KEY=value' lines */
+#define KMSG_MAX_RECORD		0x100000
+
 static int str_ok(str_list_t *sl);
+static unsigned prio_len(const char *str);
 static int str_list_cmp(str_list_t *sl1, str_list_t *sl2);
-static void _read_klog(hd_data_t *hd_data);
+static void _read_klog(hd_data_t *hd_data, uint64_t **seq, unsigned *seq_len);
+static str_list_t *read_kmsg(hd_data_t *hd_data, uint64_t **seq, unsigned *seq_len);
+static str_list_t *read_klogctl(void);
+static unsigned subsys_hash(const char *str, unsigned len);
+static const char *subsys_name(const char *str, unsigned *len);
+static void klog_index(hd_data_t *hd_data, uint64_t *seq, unsigned seq_len);
 
 
 /*
@@ -28,6 +41,20 @@ int str_ok(str_list_t *sl)
   return sl->str[0] == '<' && sl->str[2] == '>' && sl->str[1] >= '0' && sl->str[1] <= '9';
 }
 
+
+/*
+ * Length of '<prio>' prefix; facility and level, so maybe more than one digit.
+ */
+unsigned prio_len(const char *str)
+{
+  const char *s = str;
+
+  if(*s++ != '<') return 0;
+  while(*s >= '0' && *s <= '9') s++;
+
+  return s > str + 1 && *s == '>' ? s - str + 1 : 0;
+}
+
 /*
  * Check if sl1 is idential to sl2; sl1 may be shorter as sl2.
  *
@@ -51,8 +78,10 @@ void read_klog(hd_data_t *hd_data)
 {
   str_list_t *sl, **sl_new;
   char *str, *s;
+  uint64_t *seq = NULL;
+  unsigned seq_len = 0, i;
 
-  _read_klog(hd_data);
+  _read_klog(hd_data, &seq, &seq_len);
 
   free_str_list(hd_data->klog_raw);
   hd_data->klog_raw = hd_data->klog;
@@ -60,31 +89,35 @@ void read_klog(hd_data_t *hd_data)
 
   for(sl = hd_data->klog_raw, sl_new = &hd_data->klog; sl; sl = sl->next, sl_new = &(*sl_new)->next) {
     str = add_str_list(sl_new, sl->str)->str;
-    if(str[0] == '<' && str[1] && str[2] == '>' && str[3] == '[') {
-      s = str + 4;
+    if((i = prio_len(str)) && str[i] == '[') {
+      s = str + i + 1;
       while(*s && *s != ']') s++;
       if(*s) s++;
       if(*s) s++;	// skip space
-      for(str += 3; (*str++ = *s++););
+      for(str += i; (*str++ = *s++););
     }
   }
+
+  klog_index(hd_data, seq, seq_len);
+
+  free_mem(seq);
 }
 
 
 /*
  * Read kernel log info. Combine with /var/log/boot.msg.
+ *
+ * If the log comes from /dev/kmsg, seq holds the sequence numbers of the
+ * last seq_len lines.
  */
-void _read_klog(hd_data_t *hd_data)
+void _read_klog(hd_data_t *hd_data, uint64_t **seq, unsigned *seq_len)
 {
-  char buf[0x2000 + 1], *s;
-  int i, j, len, n;
   str_list_t *sl, *sl1, *sl2, *sl_last, **ssl, *sl_next;
 
   /* some clean-up */
   hd_data->klog = free_str_list(hd_data->klog);
 
   sl1 = read_file(KLOG_BOOT, 0, 0);
-  sl2 = NULL;
 
   /*
    * remove non-canonical lines (not starting with <[0-9]>) at the start and
@@ -113,27 +146,15 @@ void _read_klog(hd_data_t *hd_data)
     }
   }
 
-  n = klogctl(3, buf, sizeof buf - 1);
-  if(n <= 0) {
+  if(!(sl2 = read_kmsg(hd_data, seq, seq_len))) sl2 = read_klogctl();
+
+  if(!sl2) {
     hd_data->klog = sl1;
     return;
   }
 
-  if(n > (int) sizeof buf - 1) n = sizeof buf - 1;
-  buf[n] = 0;
-  for(i = j = 0; i < n; i++) {
-    if(buf[i] == '\n') {
-      len = i - j + 1;
-      s = new_mem(len + 1);
-      memcpy(s, buf + j, len);
-      add_str_list(&sl2, s);
-      s = free_mem(s);
-      j = i + 1;
-    }
-  }
-
   /* the 1st line may be incomplete */
-  if(sl2 && !str_ok(sl2)) {
+  if(!*seq && !str_ok(sl2)) {
     sl_next = sl2->next;
     sl2->next = NULL;
     free_str_list(sl2);
@@ -170,6 +191,252 @@ void _read_klog(hd_data_t *hd_data)
 }
 
 
+/*
+ * Read complete kernel ring buffer from /dev/kmsg.
+ *
+ * Records look like 'prio,seq,usec,flags;message', followed by optional
+ * ' KEY=value' lines. They are converted to the format klogctl() uses, so
+ * '<prio>[sec.usec] message'; prio includes the facility.
+ *
+ * Records that don't fit into the buffer fail with EINVAL; the buffer is
+ * grown then and the read repeated.
+ */
+str_list_t *read_kmsg(hd_data_t *hd_data, uint64_t **seq, unsigned *seq_len)
+{
+  str_list_t *sl0 = NULL, **sl_next = &sl0;
+  char *buf, *s, *t;
+  size_t buf_size = 0x2000;
+  unsigned prio, lost = 0;
+  uint64_t u, usec, last = 0;
+  int fd, i;
+  unsigned seq_max = 0;
+  ssize_t n;
+
+  if((fd = open(DEV_KMSG, O_RDONLY | O_NONBLOCK)) == -1) return NULL;
+
+  buf = new_mem(buf_size);
+
+  for(;;) {
+    n = read(fd, buf, buf_size - 1);
+    if(n < 0) {
+      /* message was overwritten while we were reading */
+      if(errno == EPIPE) continue;
+      if(errno == EINTR) continue;
+      if(errno == EINVAL && buf_size < KMSG_MAX_RECORD) {
+        buf = resize_mem(buf, buf_size <<= 1);
+        continue;
+      }
+      break;
+    }
+    if(n == 0) break;
+    buf[n] = 0;
+
+    if(
+      sscanf(buf, "%u,%"SCNu64",%"SCNu64",%n", &prio, &u, &usec, &i) < 3 ||
+      !(s = strchr(buf + i, ';'))
+    ) continue;
+
+    if(*seq_len && u != last + 1) lost += u - last - 1;
+    last = u;
+
+    /* message ends at first newline; continuation lines are dropped */
+    s++;
+    if((t = strchr(s, '\n'))) *t = 0;
+
+    *sl_next = new_mem(sizeof **sl_next);
+    str_printf(&(*sl_next)->str, 0,
+      "<%u>[%5"PRIu64".%06"PRIu64"] %s\n", prio, usec / 1000000, usec % 1000000, s
+    );
+    sl_next = &(*sl_next)->next;
+
+    if(*seq_len >= seq_max) *seq = resize_mem(*seq, (seq_max += 0x400) * sizeof **seq);
+    (*seq)[(*seq_len)++] = u;
+  }
+
+  close(fd);
+
+  free_mem(buf);
+
+  if(*seq_len) {
+    ADD2LOG("  kmsg: %u messages, seq %"PRIu64" - %"PRIu64", %u lost\n", *seq_len, **seq, last, lost);
+  }
+
+  return sl0;
+}
+
+
+/*
+ * Read kernel ring buffer via syslog(2).
+ */
+str_list_t *read_klogctl()
+{
+  char *buf;
+  int i, j, n, size;
+  str_list_t *sl0 = NULL;
+
+  /* SYSLOG_ACTION_SIZE_BUFFER */
+  size = klogctl(10, NULL, 0);
+  if(size < 0x2000) size = 0x2000;
+
+  buf = new_mem(size + 1);
+
+  n = klogctl(3, buf, size);
+  if(n > size) n = size;
+
+  for(i = j = 0; i < n; i++) {
+    if(buf[i] == '\n') {
+      buf[i] = 0;
+      str_printf(&add_str_list(&sl0, "")->str, 0, "%s\n", buf + j);
+      j = i + 1;
+    }
+  }
+
+  free_mem(buf);
+
+  return sl0;
+}
+
+
+/*
+ * Subsystem: first word of message; ':' ends it, too.
+ */
+const char *subsys_name(const char *str, unsigned *len)
+{
+  const char *s;
+
+  str += prio_len(str);
+  while(*str == ' ' || *str == '\t') str++;
+
+  for(s = str; *s && *s != ':' && *s != ' ' && *s != '\t' && *s != '\n'; s++);
+
+  *len = s - str;
+
+  return str;
+}
+
+
+/*
+ * Case-insensitive (ASCII) FNV-1a hash.
+ */
+unsigned subsys_hash(const char *str, unsigned len)
+{
+  unsigned hash = 2166136261u;
+  unsigned char c;
+
+  while(len--) {
+    c = *str++;
+    if(c >= 'A' && c <= 'Z') c += 'a' - 'A';
+    hash ^= c;
+    hash *= 16777619u;
+  }
+
+  return hash;
+}
+
+
+/*
+ * Index hd_data->klog by subsystem.
+ */
+void klog_index(hd_data_t *hd_data, uint64_t *seq, unsigned seq_len)
+{
+  hd_klog_t *klog;
+  hd_klog_msg_t *msg;
+  str_list_t *sl;
+  const char *s;
+  unsigned u, len;
+  int *last;
+
+  hd_data->klog_index = free_klog_index(hd_data->klog_index);
+
+  klog = hd_data->klog_index = new_mem(sizeof *klog);
+
+  for(sl = hd_data->klog; sl; sl = sl->next) klog->len++;
+
+  if(!klog->len) return;
+
+  for(klog->hash_size = 64; klog->hash_size < klog->len; klog->hash_size <<= 1);
+
+  klog->msg = new_mem(klog->len * sizeof *klog->msg);
+  klog->hash = new_mem(klog->hash_size * sizeof *klog->hash);
+  last = new_mem(klog->hash_size * sizeof *last);
+
+  for(u = 0; u < klog->hash_size; u++) klog->hash[u] = last[u] = -1;
+
+  for(u = 0, sl = hd_data->klog; sl; sl = sl->next, u++) {
+    msg = klog->msg + u;
+    msg->sl = sl;
+    msg->next = -1;
+    /* kmsg lines are the last ones */
+    if(u + seq_len >= klog->len) msg->seq = seq[u + seq_len - klog->len];
+
+    s = subsys_name(sl->str, &len);
+    msg->hash = subsys_hash(s, len);
+
+    /* append, to keep log order */
+    if(last[msg->hash & (klog->hash_size - 1)] == -1) {
+      klog->hash[msg->hash & (klog->hash_size - 1)] = u;
+    }
+    else {
+      klog->msg[last[msg->hash & (klog->hash_size - 1)]].next = u;
+    }
+    last[msg->hash & (klog->hash_size - 1)] = u;
+  }
+
+  free_mem(last);
+}
+
+
+/*
+ * Find kernel log lines belonging to subsystem subsys (case does not
+ * matter).
+ *
+ * Start with *pos = 0; returns NULL if there are no more lines.
+ *
+ * The index is built on first use.
+ */
+str_list_t *klog_find(hd_data_t *hd_data, const char *subsys, unsigned *pos)
+{
+  hd_klog_t *klog;
+  hd_klog_msg_t *msg;
+  const char *s;
+  unsigned hash, len;
+  int i;
+
+  if(!hd_data->klog_index) klog_index(hd_data, NULL, 0);
+
+  klog = hd_data->klog_index;
+
+  if(!klog->len) return NULL;
+
+  hash = subsys_hash(subsys, strlen(subsys));
+
+  i = *pos ? klog->msg[*pos - 1].next : klog->hash[hash & (klog->hash_size - 1)];
+
+  for(; i >= 0; i = msg->next) {
+    msg = klog->msg + i;
+    if(msg->hash != hash) continue;
+    s = subsys_name(msg->sl->str, &len);
+    if(len == strlen(subsys) && !strncasecmp(s, subsys, len)) {
+      *pos = i + 1;
+      return msg->sl;
+    }
+  }
+
+  return NULL;
+}
+
+
+hd_klog_t *free_klog_index(hd_klog_t *klog)
+{
+  if(!klog) return NULL;
+
+  free_mem(klog->msg);
+  free_mem(klog->hash);
+
+  return free_mem(klog);
+}
+
+
 /*
  * Add some klog data to the global log.
  */
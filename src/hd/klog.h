@@ -1,2 +1,4 @@
 void read_klog(hd_data_t *hd_data);
 void dump_klog(hd_data_t *hd_data);
+str_list_t *klog_find(hd_data_t *hd_data, const char *subsys, unsigned *pos);
+hd_klog_t *free_klog_index(hd_klog_t *klog);
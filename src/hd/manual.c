@@ -557,6 +557,24 @@ void prop2hd(hd_data_t *hd_data, hd_t *hd, int status_only)
     }
   }
 
+  if((prop = hal_get_list(list, "hwinfo.res.hwaddr"))) {
+    for(sl = prop->val.list; sl; sl = sl->next) {
+      res = add_res_entry(&hd->res, new_mem(sizeof *res));
+      res->any.type = res_hwaddr;
+      res->hwaddr.addr = new_str(sl->str);
+    }
+  }
+
+  if((prop = hal_get_list(list, "hwinfo.res.link"))) {
+    for(sl = prop->val.list; sl; sl = sl->next) {
+      if(sscanf(sl->str, "%u", &u0) == 1) {
+        res = add_res_entry(&hd->res, new_mem(sizeof *res));
+        res->any.type = res_link;
+        res->link.state = u0;
+      }
+    }
+  }
+
   hddb_add_info(hd_data, hd);
 
 }
@@ -744,6 +762,8 @@ void hd2prop(hd_data_t *hd_data, hd_t *hd)
   hal_invalidate_all(*list, "hwinfo.res.diskgeometry");
   hal_invalidate_all(*list, "hwinfo.res.monitor");
   hal_invalidate_all(*list, "hwinfo.res.framebuffer");
+  hal_invalidate_all(*list, "hwinfo.res.hwaddr");
+  hal_invalidate_all(*list, "hwinfo.res.link");
   
   for(res = hd->res; res; res = res->next) {
     switch(res->any.type) {
@@ -837,6 +857,18 @@ void hd2prop(hd_data_t *hd_data, hd_t *hd)
         hd2prop_append_list(list, "hwinfo.res.framebuffer", s);
         break;
 
+      case res_hwaddr:
+        hd2prop_append_list(list, "hwinfo.res.hwaddr", res->hwaddr.addr);
+        break;
+
+      case res_link:
+        str_printf(&s, 0,
+          "%u",
+          res->link.state
+        );
+        hd2prop_append_list(list, "hwinfo.res.link", s);
+        break;
+
       default:
         break;
     }
@@ -21,6 +21,7 @@
 
 #include "hd.h"
 #include "hd_int.h"
+#include "monitor.h"
 
 #define STR_SIZE 128
 
@@ -32,6 +33,9 @@
 
 #define VBE_BUF		0x8000
 
+/* bump if vbe_info_t changes */
+#define VBE_CACHE_VERSION	1
+
 #define ADD_RES(w, h, f, i) \
   res[res_cnt].width = w, \
   res[res_cnt].height = h, \
@@ -90,6 +94,10 @@ void list_modes(vm_t *vm, vbe_info_t *vbe);
 void print_edid(int port, unsigned char *edid);
 int chk_edid_info(unsigned char *edid);
 
+static uint64_t vbe_cache_key(hd_data_t *hd_data);
+static int vbe_cache_read(hd_data_t *hd_data, uint64_t key, vbe_info_t *vbe);
+static void vbe_cache_write(hd_data_t *hd_data, uint64_t key, vbe_info_t *vbe);
+
 
 void get_vbe_info(hd_data_t *hd_data, vbe_info_t *vbe)
 {
@@ -98,6 +106,33 @@ void get_vbe_info(hd_data_t *hd_data, vbe_info_t *vbe)
   unsigned u, tbits, dbits;
   str_list_t *sl;
   vm_t *vm;
+  int ddc, fb, cache = 0;
+  uint64_t key = 0;
+
+  /* the kernel has already read the EDIDs, don't ask the BIOS */
+  ddc = hd_probe_feature(hd_data, pr_bios_ddc);
+  if(ddc && hd_probe_feature(hd_data, pr_monitor_drm) && hd_drm_has_edid(hd_data)) {
+    ADD2LOG("vbe: drm has edid, no ddc probing\n");
+    ddc = 0;
+  }
+
+  /*
+   * The mode list depends only on the video bios, so we can reuse it. DDC
+   * data and the current mode are not cached: monitors get replaced and
+   * the mode depends on the boot loader.
+   */
+  fb = hd_probe_feature(hd_data, pr_bios_fb);
+  if(fb && hd_probe_feature(hd_data, pr_bios_vesa_cache) && (key = vbe_cache_key(hd_data))) {
+    if(vbe_cache_read(hd_data, key, vbe)) {
+      fb = 0;
+    }
+    else {
+      cache = 1;
+    }
+  }
+
+  /* nothing left to do for the emulator */
+  if(!ddc && !fb && !hd_probe_feature(hd_data, pr_bios_mode)) return;
 
   PROGRESS(4, 1, "vbe info");
 
@@ -175,13 +210,15 @@ void get_vbe_info(hd_data_t *hd_data, vbe_info_t *vbe)
   if(i > sizeof vbe->ddc_port / sizeof *vbe->ddc_port) i = sizeof vbe->ddc_port / sizeof *vbe->ddc_port;
   if(i) vm->ports = i;
 
-  if(hd_probe_feature(hd_data, pr_bios_fb)) {
+  if(fb) {
     PROGRESS(4, 2, "mode info");
 
     list_modes(vm, vbe);
+
+    if(cache && vbe->ok) vbe_cache_write(hd_data, key, vbe);
   }
 
-  if(hd_probe_feature(hd_data, pr_bios_ddc)) {
+  if(ddc) {
     PROGRESS(4, 3, "ddc info");
 
     ADD2LOG("vbe: probing %d ports\n", vm->ports);
@@ -818,4 +855,204 @@ void get_video_mode(vm_t *vm, vbe_info_t *vbe)
 }
 
 
+/*
+ * Cache key: video bios image plus id & resources of the boot vga device
+ * (the bios reads the framebuffer address from pci config space).
+ *
+ * Returns 0 if there's no video bios.
+ */
+uint64_t vbe_cache_key(hd_data_t *hd_data)
+{
+  static char *attr[] = { "vendor", "device", "subsystem_vendor", "subsystem_device", "resource" };
+  unsigned char *rom;
+  uint64_t key = 0;
+  unsigned u;
+  str_list_t *sf_bus, *sf_bus_e;
+  char *sf_dev, *s;
+
+  /* read by hd_scan_bios() */
+  rom = hd_data->bios_rom.data;
+  if(
+    !rom ||
+    hd_data->bios_rom.start != VBIOS_ROM ||
+    rom[0] != 0x55 || rom[1] != 0xaa || !rom[2] ||
+    rom[2] * 0x200 > hd_data->bios_rom.size
+  ) return 0;
+
+  crc64(&key, rom, rom[2] * 0x200);
+
+  sf_bus = read_dir("/sys/bus/pci/devices", 'l');
+
+  for(sf_bus_e = sf_bus; sf_bus_e; sf_bus_e = sf_bus_e->next) {
+    sf_dev = new_str(hd_read_sysfs_link("/sys/bus/pci/devices", sf_bus_e->str));
+
+    if((s = get_sysfs_attr_by_path(sf_dev, "boot_vga")) && strtoul(s, NULL, 0) == 1) {
+      for(u = 0; u < sizeof attr / sizeof *attr; u++) {
+        if((s = get_sysfs_attr_by_path(sf_dev, attr[u]))) crc64(&key, s, strlen(s));
+      }
+    }
+
+    free_mem(sf_dev);
+  }
+
+  free_str_list(sf_bus);
+
+  return key ?: 1;
+}
+
+
+/*
+ * Get mode list from cache.
+ *
+ * Returns 1 if vbe has been filled in.
+ */
+int vbe_cache_read(hd_data_t *hd_data, uint64_t key, vbe_info_t *vbe)
+{
+  char buf[32], *name;
+  str_list_t *cache, *sl;
+  unsigned u, modes = 0, ok = 0;
+  int i;
+  vbe_mode_info_t *mi;
+  vbe_info_t v = { };
+  struct {
+    char *key;
+    char **val;
+  } str[] = {
+    { "oem_name", &v.oem_name },
+    { "vendor_name", &v.vendor_name },
+    { "product_name", &v.product_name },
+    { "product_revision", &v.product_revision }
+  };
+
+  snprintf(buf, sizeof buf, "vbe/%016"PRIx64, key);
+  name = hd_get_hddb_path(buf);
+
+  if(!(cache = read_file(name, 0, 0))) {
+    ADD2LOG("vbe: %s: not cached\n", name);
+    return 0;
+  }
+
+  if(sscanf(cache->str, "# vbe cache %u", &u) != 1 || u != VBE_CACHE_VERSION) {
+    free_str_list(cache);
+    return 0;
+  }
+
+  for(sl = cache->next; sl; sl = sl->next) {
+    if(!strncmp(sl->str, "mode ", sizeof "mode " - 1)) v.modes++;
+  }
+
+  v.mode = new_mem(v.modes * sizeof *v.mode);
+
+  for(sl = cache->next; sl; sl = sl->next) {
+    for(u = 0; u < sizeof str / sizeof *str; u++) {
+      i = strlen(str[u].key);
+      if(!strncmp(sl->str, str[u].key, i) && sl->str[i] == ' ') {
+        free_mem(*str[u].val);
+        *str[u].val = canon_str(sl->str + i + 1, strlen(sl->str + i + 1));
+        break;
+      }
+    }
+    if(u < sizeof str / sizeof *str) continue;
+    if(sscanf(sl->str, "version 0x%x", &v.version) == 1) continue;
+    if(sscanf(sl->str, "oem_version 0x%x", &v.oem_version) == 1) continue;
+    if(sscanf(sl->str, "memory 0x%x", &v.memory) == 1) continue;
+    if(sscanf(sl->str, "fb_start 0x%x", &v.fb_start) == 1) continue;
+    if(modes < v.modes) {
+      mi = v.mode + modes;
+      i = sscanf(sl->str,
+        "mode 0x%x 0x%x %u %u %u %u 0x%x 0x%x 0x%x 0x%x 0x%x 0x%x 0x%x %u",
+        &mi->number, &mi->attributes, &mi->width, &mi->height,
+        &mi->bytes_p_line, &mi->pixel_size, &mi->fb_start,
+        &mi->win_A_start, &mi->win_A_attr, &mi->win_B_start, &mi->win_B_attr,
+        &mi->win_size, &mi->win_gran, &mi->pixel_clock
+      );
+      if(i == 14) {
+        modes++;
+        continue;
+      }
+    }
+    break;
+  }
+
+  ok = !sl && modes == v.modes && v.version;
+
+  free_str_list(cache);
+
+  if(!ok) {
+    ADD2LOG("vbe: %s: invalid cache entry\n", name);
+    free_mem(v.oem_name);
+    free_mem(v.vendor_name);
+    free_mem(v.product_name);
+    free_mem(v.product_revision);
+    free_mem(v.mode);
+
+    return 0;
+  }
+
+  ADD2LOG("vbe: %s: %u cached video modes\n", name, v.modes);
+
+  vbe->ok = 1;
+  vbe->version = v.version;
+  vbe->oem_version = v.oem_version;
+  vbe->memory = v.memory;
+  vbe->fb_start = v.fb_start;
+  vbe->oem_name = v.oem_name;
+  vbe->vendor_name = v.vendor_name;
+  vbe->product_name = v.product_name;
+  vbe->product_revision = v.product_revision;
+  vbe->modes = v.modes;
+  vbe->mode = v.mode;
+
+  return 1;
+}
+
+
+/*
+ * Store mode list in cache.
+ */
+void vbe_cache_write(hd_data_t *hd_data, uint64_t key, vbe_info_t *vbe)
+{
+  char *name = NULL, *tmp = NULL;
+  FILE *f;
+  unsigned u;
+  vbe_mode_info_t *mi;
+
+  name = new_str(hd_get_hddb_path("vbe"));
+  mkdir(name, 0755);
+  str_printf(&name, -1, "/%016"PRIx64, key);
+  str_printf(&tmp, 0, "%s.%u", name, (unsigned) getpid());
+
+  if((f = fopen(tmp, "w"))) {
+    fprintf(f, "# vbe cache %u\n", VBE_CACHE_VERSION);
+    fprintf(f, "version 0x%04x\n", vbe->version);
+    fprintf(f, "oem_version 0x%04x\n", vbe->oem_version);
+    fprintf(f, "memory 0x%x\n", vbe->memory);
+    fprintf(f, "fb_start 0x%x\n", vbe->fb_start);
+    fprintf(f, "oem_name %s\n", vbe->oem_name ?: "");
+    fprintf(f, "vendor_name %s\n", vbe->vendor_name ?: "");
+    fprintf(f, "product_name %s\n", vbe->product_name ?: "");
+    fprintf(f, "product_revision %s\n", vbe->product_revision ?: "");
+    for(u = 0; u < vbe->modes; u++) {
+      mi = vbe->mode + u;
+      fprintf(f,
+        "mode 0x%04x 0x%04x %u %u %u %u 0x%x 0x%x 0x%x 0x%x 0x%x 0x%x 0x%x %u\n",
+        mi->number, mi->attributes, mi->width, mi->height,
+        mi->bytes_p_line, mi->pixel_size, mi->fb_start,
+        mi->win_A_start, mi->win_A_attr, mi->win_B_start, mi->win_B_attr,
+        mi->win_size, mi->win_gran, mi->pixel_clock
+      );
+    }
+    if(fclose(f) || rename(tmp, name)) {
+      unlink(tmp);
+    }
+    else {
+      ADD2LOG("vbe: %s: cached %u video modes\n", name, vbe->modes);
+    }
+  }
+
+  free_mem(tmp);
+  free_mem(name);
+}
+
+
 #endif	/* defined(__i386__) || defined (__x86_64__) */
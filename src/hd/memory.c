@@ -126,10 +126,11 @@ uint64_t klog_mem(hd_data_t *hd_data, uint64_t *alt)
   str_list_t *sl;
   char *s;
   int i;
+  unsigned pos = 0;
 
   if(!hd_data->klog) read_klog(hd_data);
 
-  for(sl = hd_data->klog; sl; sl = sl->next) {
+  while((sl = klog_find(hd_data, "Memory", &pos))) {
     if(strstr(sl->str, "<6>Memory: ") == sl->str) {
       if(sscanf(sl->str, "<6>Memory: %"SCNu64"k/%"SCNu64"k", &u0, &u1) == 2) {
         mem0 = u1 << 10;
@@ -179,10 +180,11 @@ uint64_t klog_mem2(hd_data_t *hd_data)
   uint64_t u0, u1, mem = 0;
   str_list_t *sl;
   char buf[64];
+  unsigned pos = 0;
 
   if(!hd_data->klog) read_klog(hd_data);
 
-  for(sl = hd_data->klog; sl; sl = sl->next) {
+  while((sl = klog_find(hd_data, "BIOS-provided", &pos))) {
     if(strstr(sl->str, "<6>BIOS-provided physical RAM map:") == sl->str) {
       for(sl = sl->next ; sl; sl = sl->next) {
         ADD2LOG(" -- %s", sl->str);
@@ -17,6 +17,10 @@
 static void read_ioports(misc_t *m);
 static void read_dmas(misc_t *m);
 static void read_irqs(misc_t *m);
+static void read_irqs_sysfs(misc_t *m);
+static void parse_irq_line(misc_t *m, char *s, unsigned cpus);
+static void add_irq(misc_t *m, unsigned irq, char *names, unsigned *cpu_events, unsigned cpus);
+static char *next_token(char **s);
 static int active_vga_card(hd_t *);
 
 static void dump_misc_proc_data(hd_data_t *hd_data);
@@ -546,58 +550,214 @@ void read_dmas(misc_t *m)
  *
  * This is somewhat more tricky, as the irq event counts are done separately
  * per cpu *and* there may be irq sharing.
+ *
+ * Lines get long with many cpus, so don't use read_file() but parse each
+ * line in a single pass. If /proc/interrupts is not there, try sysfs.
  */
 void read_irqs(misc_t *m)
 {
-  char buf[100], buf2[100], *s;
-  misc_irq_t *ir;
-  int i, j;
-  unsigned u, v, k;
-  str_list_t *sl;
+  FILE *f;
+  char *buf = NULL, *s, *t;
+  size_t len = 0;
+  unsigned cpus = 0;
+  str_list_t **next;
+
+  if(!(f = fopen(PROC_INTERRUPTS, "r"))) {
+    read_irqs_sysfs(m);
+    return;
+  }
 
-  if(!(m->proc_irq = read_file(PROC_INTERRUPTS, 1, 0))) return;
-
-  for(sl = m->proc_irq; sl; sl = sl->next) {
-    /* irq */
-    i = 0;
-    if(sscanf(sl->str, " %u: %n", &u, &i) < 1) continue;
-    v = 0;
-    j = i;
-    /* add up all event counters */
-    while(j < (int) strlen(sl->str) && sscanf(sl->str + j, " %u %n", &k, &i) >= 1) {
-      if(!i) break;
-      v += k;
-      j += i;
-    }
-    /* device driver name string */
-#if defined(__PPC__)
+  /* header line: one column per (online) cpu */
+  if(getline(&buf, &len, f) > 0) {
+    for(s = buf; next_token(&s); cpus++);
+  }
+
+  for(next = &m->proc_irq; getline(&buf, &len, f) > 0; next = &(*next)->next) {
+    *next = new_mem(sizeof **next);
+    (*next)->str = new_str(buf);
+
+    if((t = strchr(buf, '\n'))) *t = 0;
+    parse_irq_line(m, buf, cpus);
+  }
+
+  free(buf);
+  fclose(f);
+}
+
+
+/*
+ * Parse a /proc/interrupts line.
+ *
+ *   irq: count_cpu0 ... count_cpuN [chip] [hwirq[-flow]] [Edge|Level] dev1, dev2, ...
+ */
+void parse_irq_line(misc_t *m, char *s, unsigned cpus)
+{
+  unsigned irq, k, *cpu_events;
+  unsigned long v;
+  char *t;
+
+  irq = strtoul(s, &t, 10);
+  if(t == s || *t != ':') return;
+  s = t + 1;
+
+  cpu_events = cpus ? new_mem(cpus * sizeof *cpu_events) : NULL;
+
+  /* event counters; if the cpu count is unknown, take what's there */
+  for(k = 0; !cpus || k < cpus; k++) {
+    v = strtoul(s, &t, 10);
+    if(t == s) break;
+    if(!cpus) cpu_events = add_mem(cpu_events, sizeof *cpu_events, k);
+    cpu_events[k] = v;
+    s = t;
+  }
+
+#if !defined(__alpha__) && !defined(__sparc__)
+  /* chip name */
+  next_token(&s);
+
+  /*
+   * hwirq number (maybe with flow type, '1048576-edge') and trigger type;
+   * device names may start with a digit, too ('3w-9xxx')
+   */
+  while(*s == ' ' || *s == '\t') s++;
+  for(t = s; *t >= '0' && *t <= '9'; t++);
+  if(t != s && *t == '-') {
+    t++;
     if(
-      sscanf(sl->str + j, " %*s Edge %99[^\n]", buf) == 1 ||
-      sscanf(sl->str + j, " %*s Level %99[^\n]", buf) == 1 ||
-      sscanf(sl->str + j, " %*s %99[^\n]", buf) == 1
+      !strncmp(t, "edge", sizeof "edge" - 1) ||
+      !strncmp(t, "level", sizeof "level" - 1) ||
+      !strncmp(t, "fasteoi", sizeof "fasteoi" - 1)
     ) {
-#else
-#if defined(__alpha__) || defined(__sparc__)
-    if(sscanf(sl->str + j, " %99[^\n]", buf) == 1) {
-#else	/* __i386__ || __x86_64__ || __ia64__ */
-    if(sscanf(sl->str + j, " %*s %99[^\n]", buf) == 1) {
-#endif
+      while(*t >= 'a' && *t <= 'z') t++;
+    }
+    else {
+      t = s;
+    }
+  }
+  if(t != s && (*t == ' ' || *t == '\t' || !*t)) next_token(&s);
+
+  while(*s == ' ' || *s == '\t') s++;
+  if(
+    !strncmp(s, "Edge ", sizeof "Edge " - 1) ||
+    !strncmp(s, "Level ", sizeof "Level " - 1)
+  ) {
+    next_token(&s);
+  }
 #endif
-      m->irq = add_mem(m->irq, sizeof *m->irq, m->irq_len);
-      ir = m->irq + m->irq_len++;
-      ir->irq = u;
-      ir->events = v;
-
-      /* split device driver names (separated by ',') */
-      s = buf;
-      while(*s && sscanf(s, " %99[^,] %n", buf2, &j) >= 1) {
-        ir->dev = add_mem(ir->dev, sizeof *ir->dev, ir->devs);
-        ir->dev[ir->devs++] = new_str(buf2);
-        s += j;
-        if(*s) s++;	/* skip ',' */
+
+  add_irq(m, irq, s, cpu_events, k);
+}
+
+
+/*
+ * Read /sys/kernel/irq/<irq>/{actions,per_cpu_count}.
+ */
+void read_irqs_sysfs(misc_t *m)
+{
+  FILE *f;
+  str_list_t *sl0, *sl;
+  char *buf = NULL, *names, *path = NULL, *s, *t;
+  size_t len = 0;
+  unsigned irq, cpus, *cpu_events;
+
+  sl0 = read_dir(SYS_KERNEL_IRQ, 'd');
+
+  for(sl = sl0; sl; sl = sl->next) {
+    irq = strtoul(sl->str, &s, 10);
+    if(*s) continue;
+
+    str_printf(&path, 0, SYS_KERNEL_IRQ "/%s/actions", sl->str);
+    if(!(f = fopen(path, "r"))) continue;
+    names = getline(&buf, &len, f) > 0 ? new_str(buf) : NULL;
+    fclose(f);
+
+    if(!names) continue;
+    if((t = strchr(names, '\n'))) *t = 0;
+
+    cpus = 0;
+    cpu_events = NULL;
+
+    str_printf(&path, 0, SYS_KERNEL_IRQ "/%s/per_cpu_count", sl->str);
+    if((f = fopen(path, "r"))) {
+      if(getline(&buf, &len, f) > 0) {
+        for(s = buf; (t = strchr(s, ',')); s = t + 1) cpus++;
+        cpu_events = new_mem(++cpus * sizeof *cpu_events);
+        for(cpus = 0, s = buf; *s && *s != '\n'; cpus++) {
+          cpu_events[cpus] = strtoul(s, &t, 10);
+          if(t == s) break;
+          s = *t == ',' ? t + 1 : t;
+        }
       }
+      fclose(f);
     }
+
+    add_irq(m, irq, names, cpu_events, cpus);
+
+    free_mem(names);
+  }
+
+  free(buf);
+  free_mem(path);
+  free_str_list(sl0);
+}
+
+
+/*
+ * Add irq entry; names is a ','-separated device name list.
+ *
+ * cpu_events is taken over.
+ */
+void add_irq(misc_t *m, unsigned irq, char *names, unsigned *cpu_events, unsigned cpus)
+{
+  misc_irq_t *ir;
+  unsigned k;
+  char *s, *t;
+
+  while(*names == ' ' || *names == '\t') names++;
+
+  if(!*names) {
+    free_mem(cpu_events);
+    return;
   }
+
+  m->irq = add_mem(m->irq, sizeof *m->irq, m->irq_len);
+  ir = m->irq + m->irq_len++;
+  ir->irq = irq;
+  ir->cpus = cpus;
+  ir->cpu_events = cpu_events;
+
+  for(k = 0; k < cpus; k++) ir->events += cpu_events[k];
+
+  /* split device driver names (separated by ',') */
+  for(s = names; *s; s = *t ? t + 1 : t) {
+    while(*s == ' ' || *s == '\t') s++;
+    for(t = s; *t && *t != ','; t++);
+    k = t - s;
+    while(k && (s[k - 1] == ' ' || s[k - 1] == '\t')) k--;
+    if(!k) continue;
+    ir->dev = add_mem(ir->dev, sizeof *ir->dev, ir->devs);
+    ir->dev[ir->devs] = new_mem(k + 1);
+    memcpy(ir->dev[ir->devs++], s, k);
+  }
+}
+
+
+/*
+ * Return start of next whitespace separated token and advance *s.
+ * Note: the token is not 0-terminated.
+ */
+char *next_token(char **s)
+{
+  char *t = *s;
+
+  while(*t == ' ' || *t == '\t' || *t == '\n') t++;
+  *s = t;
+
+  if(!*t) return NULL;
+
+  while(**s && **s != ' ' && **s != '\t' && **s != '\n') (*s)++;
+
+  return t;
 }
 
 void gather_resources(misc_t *m, hd_res_t **r, char *name, unsigned which)
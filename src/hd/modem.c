@@ -14,6 +14,7 @@
 #include "hd_int.h"
 #include "hddb.h"
 #include "modem.h"
+#include "serprobe.h"
 
 /**
  * @defgroup MODEMint Modem devices
@@ -62,19 +63,49 @@ static char *init_strings[] = {
 
 #define MAX_INIT_STRING	(sizeof init_strings / sizeof *init_strings)
 
+/* checked against the ATI response, cf. check_ati() */
+static int ati_cmds[] = { 1, 3, 4, 5, 6 };
+
+#define MAX_ATI_CMD	(sizeof ati_cmds / sizeof *ati_cmds)
+
+/* max. time for an AT command response (ms) */
+#define AT_TIMEOUT	1200
+
+/* modem_step() states */
+enum { ms_pnp, ms_at, ms_init, ms_ati, ms_ati_n, ms_speed, ms_pnp_id };
+
+/* per port data */
+typedef struct {
+  char *at;			/* last AT command */
+  unsigned raw:1;		/* keep response as is */
+  unsigned log:1;		/* log response */
+  str_list_t *ati;		/* ATI response */
+} modem_port_t;
+
 static void get_serial_modem(hd_data_t* hd_data);
+static void modem_step(ser_probe_t *port, ser_probe_event_t event);
+static void modem_next_speed(ser_probe_t *port);
+static void modem_finish(ser_probe_t *port);
+static void at_send_init(ser_probe_t *port);
+static void at_send_ati(ser_probe_t *port);
+static void check_ati(ser_device_t *sm, int atx, str_list_t *ati);
 static void add_serial_modem(hd_data_t* hd_data);
 static int dev_name_duplicate(hd_data_t *hd_data, char *dev_name);
 static void guess_modem_name(hd_data_t *hd_data, ser_device_t *sm);
 static void at_cmd(hd_data_t *hd_data, char *at, int raw, int log_it);
-static void write_modem(hd_data_t *hd_data, char *msg);
-static void read_modem(hd_data_t *hd_data);
+static void at_step(ser_probe_t *port, ser_probe_event_t event);
+static void at_send(ser_probe_t *port, char *at, int raw, int log_it);
+static int at_final(ser_probe_t *port);
+static void at_done(ser_probe_t *port);
 static ser_device_t *add_ser_modem_entry(ser_device_t **sm, ser_device_t *new_sm);
 static int set_modem_speed(ser_device_t *sm, unsigned baud);    
 static int init_modem(ser_device_t *mi);
 static unsigned chk4id(ser_device_t *mi);
 static void dump_ser_modem_data(hd_data_t *hd_data);
 
+static ser_plugin_t modem_plugin = { "modem", sizeof (modem_port_t), modem_step, modem_finish };
+static ser_plugin_t at_plugin = { "at", sizeof (modem_port_t), at_step, modem_finish };
+
 void hd_scan_modem(hd_data_t *hd_data)
 {
   ser_device_t *sm, *sm_next;
@@ -98,7 +129,7 @@ void hd_scan_modem(hd_data_t *hd_data)
   }
   else {
     /* take data from shm */
-    hd_data->ser_modem = ((hd_data_t *) (hd_data->shm.data))->ser_modem;
+    hd_move_from_shm(hd_data);
     if((hd_data->debug & HD_DEB_MODEM)) dump_ser_modem_data(hd_data);
   }
 
@@ -151,9 +182,7 @@ str_list_t *str_list_dup(str_list_t *orig)
 void get_serial_modem(hd_data_t *hd_data)
 {
   hd_t *hd;
-  int i, j, fd;
-  unsigned modem_info, baud;
-  char *command;
+  int fd;
   ser_device_t *sm;
   int chk_usb = hd_probe_feature(hd_data, pr_modem_usb);
 
@@ -191,239 +220,278 @@ void get_serial_modem(hd_data_t *hd_data)
 
   PROGRESS(2, 0, "init");
 
-  usleep(300000);		/* PnP protocol; 200ms seems to be too fast  */
-  
+  /* all ports in parallel, see modem_step() */
+  ser_probe_run(hd_data, hd_data->ser_modem, &modem_plugin, NULL);
+
   for(sm = hd_data->ser_modem; sm; sm = sm->next) {
+    if(sm->is_modem && !sm->user_name) guess_modem_name(hd_data, sm);
+
+    /* reset serial lines */
+    tcflush(sm->fd, TCIOFLUSH);
+    tcsetattr(sm->fd, TCSAFLUSH, &sm->tio);
+    close(sm->fd);
+  }
+}
+
+
+/*
+ * Modem probing, one port.
+ *
+ * PnP wait, AT test at a few speeds, init strings, ATI commands, speed
+ * sweep and finally the PnP id. Every AT command ends with the final
+ * result code or after AT_TIMEOUT.
+ */
+void modem_step(ser_probe_t *port, ser_probe_event_t event)
+{
+  static unsigned at_speeds[] = { 115200, 38400, 9600, 1200 };
+  hd_data_t *hd_data = port->hd_data;
+  ser_device_t *sm = port->sm;
+  modem_port_t *mp = port->data;
+  unsigned modem_info;
+  int ok;
+
+  if(event == sp_start) {
+    port->state = ms_pnp;
+    ser_probe_timer(port, 300);		/* PnP protocol; 200ms seems to be too fast  */
+    return;
+  }
+
+  if(port->state == ms_pnp) {
+    if(event != sp_timeout) return;
+
     modem_info = TIOCM_DTR | TIOCM_RTS;
     ioctl(sm->fd, TIOCMBIS, &modem_info);
-    ioctl(sm->fd, TIOCMGET, &modem_info);
-    if(!(modem_info & (TIOCM_DSR | TIOCM_CD))) {
+    /*
+     * No DSR and no CD: nothing connected. If the lines can't be read at
+     * all (e.g. a pty), go on with the AT test.
+     */
+    if(!ioctl(sm->fd, TIOCMGET, &modem_info) && !(modem_info & (TIOCM_DSR | TIOCM_CD))) {
       sm->do_io = 0;
+      ser_probe_done(port);
+      return;
     }
-  }
 
-  /* just a quick test if we get a response to an AT command */
+    /* just a quick test if we get a response to an AT command */
+    PROGRESS(3, port->index, "at test");
+    port->state = ms_at;
+    port->count = 0;
+    set_modem_speed(sm, at_speeds[0]);
+    at_send(port, "AT\r", 1, 1);
+
+    return;
+  }
 
-  for(i = 0; i < 4; i++) {
-    PROGRESS(3, i + 1, "at test");
+  /* wait for the complete response */
+  if(event == sp_input && !at_final(port)) return;
 
-    for(sm = hd_data->ser_modem; sm; sm = sm->next) {
-      if(!sm->is_modem)
-        set_modem_speed(sm, i == 0 ? 115200 : i == 1 ? 38400 : i == 2 ? 9600 : 1200);
-    }
+  at_done(port);
 
-    at_cmd(hd_data, "AT\r", 1, 1);
+  ok = strstr((char *) sm->buf, "OK") || strstr((char *) sm->buf, "0");
 
-    for(sm = hd_data->ser_modem; sm; sm = sm->next) {
-      if(strstr(sm->buf, "OK") || strstr(sm->buf, "0")) {
+  switch(port->state) {
+    case ms_at:
+      if(ok) {
         sm->is_modem = 1;
+        sm->max_baud = sm->cur_baud;
+
+        /* check for init string */
+        PROGRESS(4, port->index, "init string");
+        port->state = ms_init;
+        port->count = 0;
+        at_send_init(port);
+      }
+      else if(++port->count < sizeof at_speeds / sizeof *at_speeds) {
+        set_modem_speed(sm, at_speeds[port->count]);
+        at_send(port, "AT\r", 1, 1);
+      }
+      else {
         sm->do_io = 0;
+        ser_probe_done(port);
       }
-      sm->buf_len = 0;		/* clear buffer */
-    }
-  }
-
-  for(sm = hd_data->ser_modem; sm; sm = sm->next) {
-    if((sm->do_io = sm->is_modem)) {
-      sm->max_baud = sm->cur_baud;
-    }
-  }
-
-  /* check for init string */
-  PROGRESS(4, 0, "init string");
-
-  command = NULL;
-  for(i = 0; (unsigned) i < MAX_INIT_STRING; i++) {
-    str_printf(&command, 0, "AT %s\r", init_strings[i]);
-    at_cmd(hd_data, command, 1, 1);
+      break;
 
-    for(sm = hd_data->ser_modem; sm; sm = sm->next) {
-      if(strstr(sm->buf, "OK") || strstr(sm->buf, "0")) {
+    case ms_init:
+      if(ok) {
         str_printf(&sm->init_string2, -1,
-          "%s %s", sm->init_string2 ? "" : "AT", init_strings[i]
+          "%s %s", sm->init_string2 ? "" : "AT", init_strings[port->count]
         );
       }
-    }
-  }
-  command = free_mem(command);
+      if(++port->count < MAX_INIT_STRING) {
+        at_send_init(port);
+      }
+      else {
+        str_printf(&sm->init_string1, -1, "ATZ");
+        port->state = ms_ati;
+        at_send(port, "ATI\r", 0, 1);
+      }
+      break;
 
-  for(sm = hd_data->ser_modem; sm; sm = sm->next)
-    if(sm->is_modem)
-      str_printf(&sm->init_string1, -1, "ATZ");
-
-  {
-    int cmds[] = { 1, 3, 4, 5, 6 };
-    char at[10];
-    int i, j, ModemsCount = 0;
-    str_list_t **responces = NULL;
-    for(sm = hd_data->ser_modem; sm; sm = sm->next)
-      if(sm->is_modem)
-	ModemsCount++;
-    responces = new_mem(ModemsCount * sizeof *responces);
-    
-    at_cmd(hd_data, "ATI\r", 0, 1);
-    for(j = 0, sm = hd_data->ser_modem; sm; sm = sm->next) {
-      if(sm->is_modem)
-	responces[j++] = str_list_dup(sm->at_resp);
-    }
+    case ms_ati:
+      mp->ati = str_list_dup(sm->at_resp);
+      port->state = ms_ati_n;
+      port->count = 0;
+      at_send_ati(port);
+      break;
 
-    for(i = 0; (unsigned) i < sizeof cmds / sizeof *cmds; i++) {
-      int atx = cmds[i];
-      sprintf(at, "ATI%d\r", atx);
-      at_cmd(hd_data, at, 0, 1);
-      for(j = 0, sm = hd_data->ser_modem; sm; sm = sm->next) {
-	if(sm->is_modem) {
-	  if(atx == 1 && check_for_responce(responces[j], "Hagenuk", 7) &&
-	     (check_for_responce(sm->at_resp, "Speed Dragon", 12) ||
-	      check_for_responce(sm->at_resp, "Power Dragon", 12))) {
-	    free_mem(sm->init_string1);
-	    free_mem(sm->init_string2);
-	    sm->init_string1 = new_str("AT&F");
-	    sm->init_string2 = new_str("ATB8");
-	  }
-	  if(atx == 3 && check_for_responce(responces[j], "346900", 6) &&
-	     check_for_responce(sm->at_resp, "3Com U.S. Robotics ISDN", 23)) {
-	    free_mem(sm->init_string1);
-	    free_mem(sm->init_string2);
-	    sm->init_string1 = new_str("AT&F");
-	    sm->init_string2 = new_str("AT*PPP=1");
-	  }
-	  if(atx == 4 && check_for_responce(responces[j], "SP ISDN", 7) &&
-	     check_for_responce(sm->at_resp, "Sportster ISDN TA", 17)) {
-	    free_mem(sm->init_string1);
-	    free_mem(sm->init_string2);
-	    sm->init_string1 = new_str("AT&F");
-	    sm->init_string2 = new_str("ATB3");
-	  }
-	  if(atx == 6 && check_for_responce(responces[j], "644", 3) &&
-	     check_for_responce(sm->at_resp, "ELSA MicroLink ISDN", 19)) {
-	    free_mem(sm->init_string1);
-	    free_mem(sm->init_string2);
-	    sm->init_string1 = new_str("AT&F");
-	    sm->init_string2 = new_str("AT$IBP=HDLCP");
-	    free_mem(sm->pppd_option);
-	    sm->pppd_option = new_str("default-asyncmap");
-	  }
-	  if(atx == 6 && check_for_responce(responces[j], "643", 3) &&
-	     check_for_responce(sm->at_resp, "MicroLink ISDN/TLV.34", 21)) {
-	    free_mem(sm->init_string1);
-	    free_mem(sm->init_string2);
-	    sm->init_string1 = new_str("AT&F");
-	    sm->init_string2 = new_str("AT\\N10%P1");
-	  }
-	  if(atx == 5 && check_for_responce(responces[j], "ISDN TA", 6) &&
-	     check_for_responce(sm->at_resp, "ISDN TA;ASU", 4)) {
-	    free_mem(sm->vend);
-	    sm->vend = new_str("ASUS");
-	    free_mem(sm->user_name);
-	    sm->user_name = new_str("ISDNLink TA");
-	    free_mem(sm->init_string1);
-	    free_mem(sm->init_string2);
-	    sm->init_string1 = new_str("AT&F");
-	    sm->init_string2 = new_str("ATB40");
-	  }
-	  if(atx==3 && check_for_responce(responces[j], "128000", 6) &&
-	     check_for_responce(sm->at_resp, "Lasat Speed", 11)) {
-	    free_mem(sm->init_string1);
-	    free_mem(sm->init_string2);
-	    sm->init_string1 = new_str("AT&F");
-	    sm->init_string2 = new_str("AT\\P1&B2X3");
-	  }
-	  if(atx == 1 &&
-	     (check_for_responce(responces[j], "28642", 5) ||
-	      check_for_responce(responces[j], "1281", 4) ||
-	      check_for_responce(responces[j], "1282", 4) ||
-	      check_for_responce(responces[j], "1283", 4) ||
-	      check_for_responce(responces[j], "1291", 4) ||
-	      check_for_responce(responces[j], "1292", 4) ||
-	      check_for_responce(responces[j], "1293", 4)) &&
-	     (check_for_responce(sm->at_resp, "Elite 2864I", 11) ||
-	      check_for_responce(sm->at_resp, "ZyXEL omni", 10))) {
-	    free_mem(sm->init_string1);
-	    free_mem(sm->init_string2);
-	    sm->init_string1 = new_str("AT&F");
-	    sm->init_string2 = new_str("AT&O2B40");
-	  }
-	  j++;
-	}
+    case ms_ati_n:
+      check_ati(sm, ati_cmds[port->count], mp->ati);
+      if(++port->count < MAX_ATI_CMD) {
+        at_send_ati(port);
       }
-    }
-
-    for(i = 0; i < ModemsCount; i++) free_str_list(responces[i]);
-    free_mem(responces);
-  }
+      else {
+        /* now, go for the maximum speed... */
+        PROGRESS(5, port->index, "speed");
+        port->state = ms_speed;
+        port->count = MAX_SPEED;
+        modem_next_speed(port);
+      }
+      break;
 
-  /* now, go for the maximum speed... */
-  PROGRESS(5, 0, "speed");
+    case ms_speed:
+      if(ok) sm->max_baud = sm->cur_baud;
+      modem_next_speed(port);
+      break;
 
-  for(i = MAX_SPEED - 1; i >= 0; i--) {
-    baud = speeds[i].baud;
-    for(j = 0, sm = hd_data->ser_modem; sm; sm = sm->next) {
-      if(sm->is_modem) {
-        if(baud > sm->max_baud) {
-          sm->do_io = set_modem_speed(sm, baud) ? 0 : 1;
-          if(sm->do_io) j++;
-        }
-      }
-    }
+    case ms_pnp_id:
+      chk4id(sm);
+      ser_probe_done(port);
+      break;
+  }
+}
 
-    /* no modems */
-    if(!j) continue;
 
-    at_cmd(hd_data, "AT\r", 1, 0);
+/*
+ * Try next speed above max_baud; if there's none, ask for the PnP id.
+ *
+ * port->count is the number of speeds left to try.
+ */
+void modem_next_speed(ser_probe_t *port)
+{
+  hd_data_t *hd_data = port->hd_data;
+  ser_device_t *sm = port->sm;
+  unsigned baud;
 
-    for(sm = hd_data->ser_modem; sm; sm = sm->next) {
-      if(strstr(sm->buf, "OK") || strstr(sm->buf, "0")) {
-        sm->max_baud = sm->cur_baud;
-      }
-      else {
-        sm->do_io = 0;
-      }
-      sm->buf_len = 0;		/* clear buffer */
+  while(port->count) {
+    baud = speeds[--port->count].baud;
+    if(baud > sm->max_baud && !set_modem_speed(sm, baud)) {
+      at_send(port, "AT\r", 1, 0);
+      return;
     }
   }
 
   /* now, fix it all up... */
-  for(sm = hd_data->ser_modem; sm; sm = sm->next) {
-    if(sm->is_modem) {
-      set_modem_speed(sm, sm->max_baud);
-      sm->do_io = 1;
-    }
-  }
+  set_modem_speed(sm, sm->max_baud);
 
-#if 0
-  /* just for testing */
-  if((hd_data->debug & HD_DEB_MODEM)) {
-    int i;
-    int cmds[] = { 0, 1, 2, 3, 6 };
-    char at[10];
+  PROGRESS(5, port->index, "pnp id");
+  port->state = ms_pnp_id;
+  at_send(port, "ATI9\r", 1, 1);
+}
 
-    PROGRESS(8, 0, "testing");
 
-    at_cmd(hd_data, "ATI\r", 0, 1);
-    for(i = 0; (unsigned) i < sizeof cmds / sizeof *cmds; i++) {
-      sprintf(at, "ATI%d\r", cmds[i]);
-      at_cmd(hd_data, at, 0, 1);
-    }
-    at_cmd(hd_data, "AT\r", 0, 1);
-  }
-#endif
+void modem_finish(ser_probe_t *port)
+{
+  modem_port_t *mp = port->data;
 
-  PROGRESS(5, 0, "pnp id");
+  free_mem(mp->at);
+  free_str_list(mp->ati);
+}
 
-  at_cmd(hd_data, "ATI9\r", 1, 1);
 
-  for(sm = hd_data->ser_modem; sm; sm = sm->next) {
-    if(sm->is_modem) {
-      chk4id(sm);
+void at_send_init(ser_probe_t *port)
+{
+  char *command = NULL;
 
-      if(!sm->user_name) guess_modem_name(hd_data, sm);
-    }
+  str_printf(&command, 0, "AT %s\r", init_strings[port->count]);
+  at_send(port, command, 1, 1);
+  free_mem(command);
+}
 
-    /* reset serial lines */
-    tcflush(sm->fd, TCIOFLUSH);
-    tcsetattr(sm->fd, TCSAFLUSH, &sm->tio);
-    close(sm->fd);
+
+void at_send_ati(ser_probe_t *port)
+{
+  char at[16];
+
+  sprintf(at, "ATI%d\r", ati_cmds[port->count]);
+  at_send(port, at, 0, 1);
+}
+
+
+/*
+ * Look for known modems in ATI (ati) and ATI<atx> (sm->at_resp) responses
+ * and set init strings.
+ */
+void check_ati(ser_device_t *sm, int atx, str_list_t *ati)
+{
+  if(atx == 1 && check_for_responce(ati, "Hagenuk", 7) &&
+     (check_for_responce(sm->at_resp, "Speed Dragon", 12) ||
+      check_for_responce(sm->at_resp, "Power Dragon", 12))) {
+    free_mem(sm->init_string1);
+    free_mem(sm->init_string2);
+    sm->init_string1 = new_str("AT&F");
+    sm->init_string2 = new_str("ATB8");
+  }
+  if(atx == 3 && check_for_responce(ati, "346900", 6) &&
+     check_for_responce(sm->at_resp, "3Com U.S. Robotics ISDN", 23)) {
+    free_mem(sm->init_string1);
+    free_mem(sm->init_string2);
+    sm->init_string1 = new_str("AT&F");
+    sm->init_string2 = new_str("AT*PPP=1");
+  }
+  if(atx == 4 && check_for_responce(ati, "SP ISDN", 7) &&
+     check_for_responce(sm->at_resp, "Sportster ISDN TA", 17)) {
+    free_mem(sm->init_string1);
+    free_mem(sm->init_string2);
+    sm->init_string1 = new_str("AT&F");
+    sm->init_string2 = new_str("ATB3");
+  }
+  if(atx == 6 && check_for_responce(ati, "644", 3) &&
+     check_for_responce(sm->at_resp, "ELSA MicroLink ISDN", 19)) {
+    free_mem(sm->init_string1);
+    free_mem(sm->init_string2);
+    sm->init_string1 = new_str("AT&F");
+    sm->init_string2 = new_str("AT$IBP=HDLCP");
+    free_mem(sm->pppd_option);
+    sm->pppd_option = new_str("default-asyncmap");
+  }
+  if(atx == 6 && check_for_responce(ati, "643", 3) &&
+     check_for_responce(sm->at_resp, "MicroLink ISDN/TLV.34", 21)) {
+    free_mem(sm->init_string1);
+    free_mem(sm->init_string2);
+    sm->init_string1 = new_str("AT&F");
+    sm->init_string2 = new_str("AT\\N10%P1");
+  }
+  if(atx == 5 && check_for_responce(ati, "ISDN TA", 6) &&
+     check_for_responce(sm->at_resp, "ISDN TA;ASU", 4)) {
+    free_mem(sm->vend);
+    sm->vend = new_str("ASUS");
+    free_mem(sm->user_name);
+    sm->user_name = new_str("ISDNLink TA");
+    free_mem(sm->init_string1);
+    free_mem(sm->init_string2);
+    sm->init_string1 = new_str("AT&F");
+    sm->init_string2 = new_str("ATB40");
+  }
+  if(atx==3 && check_for_responce(ati, "128000", 6) &&
+     check_for_responce(sm->at_resp, "Lasat Speed", 11)) {
+    free_mem(sm->init_string1);
+    free_mem(sm->init_string2);
+    sm->init_string1 = new_str("AT&F");
+    sm->init_string2 = new_str("AT\\P1&B2X3");
+  }
+  if(atx == 1 &&
+     (check_for_responce(ati, "28642", 5) ||
+      check_for_responce(ati, "1281", 4) ||
+      check_for_responce(ati, "1282", 4) ||
+      check_for_responce(ati, "1283", 4) ||
+      check_for_responce(ati, "1291", 4) ||
+      check_for_responce(ati, "1292", 4) ||
+      check_for_responce(ati, "1293", 4)) &&
+     (check_for_responce(sm->at_resp, "Elite 2864I", 11) ||
+      check_for_responce(sm->at_resp, "ZyXEL omni", 10))) {
+    free_mem(sm->init_string1);
+    free_mem(sm->init_string2);
+    sm->init_string1 = new_str("AT&F");
+    sm->init_string2 = new_str("AT&O2B40");
   }
 }
 
@@ -673,117 +741,134 @@ void guess_modem_name(hd_data_t *hd_data, ser_device_t *modem)
 
 }
 
+/*
+ * Send AT command to all modems with do_io set and get the responses.
+ */
 void at_cmd(hd_data_t *hd_data, char *at, int raw, int log_it)
 {
   static unsigned u = 1;
-  char *s, *s0;
-  ser_device_t *sm;
-  str_list_t *sl;
-  int modems = 0;
+  modem_port_t cmd = { .at = at, .raw = raw, .log = log_it };
 
-  for(sm = hd_data->ser_modem; sm; sm = sm->next) {
-    if(sm->do_io) {
-      sm->buf_len = 0;
-      modems++;
-    }
-  }
+  PROGRESS(9, u, "at cmd");
+  ser_probe_run(hd_data, hd_data->ser_modem, &at_plugin, &cmd);
+  PROGRESS(9, u, "at cmd ok");
+  u++;
+}
 
-  if(modems == 0) return;
 
-  PROGRESS(9, u, "write at cmd");
-  write_modem(hd_data, at);
-  PROGRESS(9, u, "read at resp");
-  usleep (200000);
-  read_modem(hd_data);
-  PROGRESS(9, u, "read ok");
-  u++;
+/*
+ * Single AT command, cf. at_cmd().
+ */
+void at_step(ser_probe_t *port, ser_probe_event_t event)
+{
+  modem_port_t *cmd = port->arg;
 
-  for(sm = hd_data->ser_modem; sm; sm = sm->next) {
-    if(sm->do_io) {
-      sm->at_resp = free_str_list(sm->at_resp);
-      if(sm->buf_len == 0 || raw) continue;
-      s0 = sm->buf;
-      while((s = strsep(&s0, "\r\n"))) {
-        if(*s) add_str_list(&sm->at_resp, s);
-      }
+  if(event == sp_start) {
+    if(port->sm->do_io) {
+      at_send(port, cmd->at, cmd->raw, cmd->log);
     }
+    else {
+      ser_probe_done(port);
+    }
+    return;
   }
 
-  if(!(hd_data->debug & HD_DEB_MODEM) || !log_it) return;
+  if(event == sp_input && !at_final(port)) return;
 
-  for(sm = hd_data->ser_modem; sm; sm = sm->next) {
-    if(sm->do_io) {
-      ADD2LOG("%s@%u: %s\n", sm->dev_name, sm->cur_baud, at);
-      if(raw) {
-        ADD2LOG("  ");
-        hd_log_hex(hd_data, 1, sm->buf_len, sm->buf);
-        ADD2LOG("\n");
-      }
-      else {
-        for(sl = sm->at_resp; sl; sl = sl->next) ADD2LOG("  %s\n", sl->str);
-      }
-    }
-  }
+  at_done(port);
+  ser_probe_done(port);
 }
 
 
-void write_modem(hd_data_t *hd_data, char *msg)
+/*
+ * Send AT command and start response timer.
+ */
+void at_send(ser_probe_t *port, char *at, int raw, int log_it)
 {
-  ser_device_t *sm;
-  int i, len = strlen(msg);
+  modem_port_t *mp = port->data;
 
-  for(sm = hd_data->ser_modem; sm; sm = sm->next) {
-    if(sm->do_io) {
-      i = write(sm->fd, msg, len);
-      if(i != len) {
-        ADD2LOG("%s write oops: %d/%d (\"%s\")\n", sm->dev_name, i, len, msg);
-      }
-    }
-  }
+  free_mem(mp->at);
+  mp->at = new_str(at);
+  mp->raw = raw;
+  mp->log = log_it;
+
+  ser_probe_write(port, at, strlen(at));
+  ser_probe_timer(port, AT_TIMEOUT);
 }
 
-void read_modem(hd_data_t *hd_data)
+
+/*
+ * Check if the response ends with a final result code.
+ *
+ * Numeric codes (ATV0) count only right after the echoed command: with
+ * ATV1 the response starts with an empty line, and info text (e.g. the
+ * product code from ATI) may be just a digit, too.
+ */
+int at_final(ser_probe_t *port)
 {
-  int i, sel, fd_max = -1;
-  fd_set set, set0;
-  struct timeval to;
-  ser_device_t *sm;
+  static char *results[] = { "OK", "ERROR" };
+  static char *codes[] = { "0", "4" };
+  modem_port_t *mp = port->data;
+  ser_device_t *sm = port->sm;
+  char *s, *line, *end;
+  size_t len, echo_len;
+  unsigned u;
+  int first = 1;
+
+  echo_len = mp->at ? strcspn(mp->at, "\r") : 0;
 
-  FD_ZERO(&set0);
+  line = (char *) sm->buf;
+  end = line + sm->buf_len;
 
-  for(i = 0, sm = hd_data->ser_modem; sm; sm = sm->next) {
-    if(sm->do_io) {
-      FD_SET(sm->fd, &set0);
-      if(sm->fd > fd_max) fd_max = sm->fd;
-      i++;
+  for(s = line; s < end; s++) {
+    if(*s != '\r' && *s != '\n') continue;
+    len = s - line;
+    line = s + 1;
+    if(first && echo_len && len == echo_len && !strncmp(s - len, mp->at, len)) continue;
+    for(u = 0; u < sizeof results / sizeof *results; u++) {
+      if(len == strlen(results[u]) && !strncmp(s - len, results[u], len)) return 1;
     }
+    for(u = 0; first && u < sizeof codes / sizeof *codes; u++) {
+      if(len == strlen(codes[u]) && !strncmp(s - len, codes[u], len)) return 1;
+    }
+    first = 0;
   }
 
-  if(!i) return;	/* nothing selected */
-
-  for(;;) {
-    to.tv_sec = 0; to.tv_usec = 1000000;
-    set = set0;
-    if((sel = select(fd_max + 1, &set, NULL, NULL, &to)) > 0) {
-//      fprintf(stderr, "sel: %d\n", sel);
-      for(sm = hd_data->ser_modem; sm; sm = sm->next) {
-        if(FD_ISSET(sm->fd, &set)) {
-          if((i = read(sm->fd, sm->buf + sm->buf_len, sizeof sm->buf - sm->buf_len)) > 0)
-            sm->buf_len += i;
-//          fprintf(stderr, "%s: got %d\n", sm->dev_name, i);
-          if(i <= 0) FD_CLR(sm->fd, &set0);
-        }
-      }
-    }
-    else {
-      break;
+  return 0;
+}
+
+
+/*
+ * Response is complete: split it into lines (unless raw) and log it.
+ */
+void at_done(ser_probe_t *port)
+{
+  hd_data_t *hd_data = port->hd_data;
+  ser_device_t *sm = port->sm;
+  modem_port_t *mp = port->data;
+  char *s, *s0, *buf;
+  str_list_t *sl;
+
+  sm->at_resp = free_str_list(sm->at_resp);
+
+  if(sm->buf_len && !mp->raw) {
+    s0 = buf = new_str((char *) sm->buf);
+    while((s = strsep(&s0, "\r\n"))) {
+      if(*s) add_str_list(&sm->at_resp, s);
     }
+    free_mem(buf);
   }
 
-  /* make the strings \000 terminated */
-  for(sm = hd_data->ser_modem; sm; sm = sm->next) {
-    if(sm->buf_len == sizeof sm->buf) sm->buf_len--;
-    sm->buf[sm->buf_len] = 0;
+  if(!(hd_data->debug & HD_DEB_MODEM) || !mp->log) return;
+
+  ADD2LOG("%s@%u: %s\n", sm->dev_name, sm->cur_baud, mp->at);
+  if(mp->raw) {
+    ADD2LOG("  ");
+    hd_log_hex(hd_data, 1, sm->buf_len, sm->buf);
+    ADD2LOG("\n");
+  }
+  else {
+    for(sl = sm->at_resp; sl; sl = sl->next) ADD2LOG("  %s\n", sl->str);
   }
 }
 
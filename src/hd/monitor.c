@@ -6,6 +6,7 @@
 #include "hd_int.h"
 #include "hddb.h"
 #include "monitor.h"
+#include "klog.h"
 
 /**
  * @defgroup MONITORint Monitor (DDC) information
@@ -36,6 +37,11 @@ static int mi_cmp(monitor_info_t **mi0, monitor_info_t **mi1);
 static void add_edid_info(hd_data_t *hd_data, hd_t *hd, unsigned char *edid);
 static void add_monitor_res(hd_t *hd, unsigned x, unsigned y, unsigned hz, unsigned il);
 static void fix_edid_info(hd_data_t *hd_data, unsigned char *edid);
+static unsigned char *read_drm_edid(hd_data_t *hd_data, char *connector, unsigned *len);
+static int add_drm_monitors(hd_data_t *hd_data);
+
+/* EDID with all 255 extension blocks */
+#define DRM_EDID_MAX	0x8000
 
 void hd_scan_monitor(hd_data_t *hd_data)
 {
@@ -79,6 +85,11 @@ void hd_scan_monitor(hd_data_t *hd_data)
     }
   }
 
+  PROGRESS(1, 1, "drm");
+
+  /* KMS drivers have already read the EDIDs, no need to look further */
+  if(hd_probe_feature(hd_data, pr_monitor_drm) && add_drm_monitors(hd_data)) return;
+
   PROGRESS(2, 0, "bios");
 
   if(
@@ -169,11 +180,129 @@ void hd_scan_monitor(hd_data_t *hd_data)
 }
 
 
+/*
+ * Read EDID of a DRM connector (e.g. "card0-HDMI-A-1").
+ *
+ * Returns NULL if no monitor is connected or the EDID is not usable.
+ */
+unsigned char *read_drm_edid(hd_data_t *hd_data, char *connector, unsigned *len)
+{
+  char *path = NULL, *s;
+  unsigned char *edid = NULL;
+
+  *len = 0;
+
+  /* connectors look like card<n>-<type>-<n> */
+  if(strncmp(connector, "card", sizeof "card" - 1) || !strchr(connector, '-')) return NULL;
+
+  str_printf(&path, 0, SYS_CLASS_DRM "/%s", connector);
+
+  if(
+    (s = get_sysfs_attr_by_path(path, "status")) &&
+    !strncmp(s, "connected", sizeof "connected" - 1)
+  ) {
+    str_printf(&path, -1, "/edid");
+    edid = read_bin_file(path, len, DRM_EDID_MAX);
+    if(edid && (*len < 0x80 || !chk_edid_info(hd_data, edid))) {
+      edid = free_mem(edid);
+      *len = 0;
+    }
+  }
+
+  free_mem(path);
+
+  return edid;
+}
+
+
+/*
+ * Check if there's a KMS driver that has read the monitor EDID for us.
+ */
+int hd_drm_has_edid(hd_data_t *hd_data)
+{
+  str_list_t *sf_dir, *sf_dir_e;
+  unsigned char *edid = NULL;
+  unsigned len;
+
+  sf_dir = read_dir(SYS_CLASS_DRM, 'D');
+
+  for(sf_dir_e = sf_dir; sf_dir_e && !edid; sf_dir_e = sf_dir_e->next) {
+    edid = read_drm_edid(hd_data, sf_dir_e->str, &len);
+  }
+
+  free_str_list(sf_dir);
+
+  if(!edid) return 0;
+
+  free_mem(edid);
+
+  return 1;
+}
+
+
+/*
+ * Add monitors connected to KMS graphics drivers.
+ *
+ * Returns number of monitors found.
+ */
+int add_drm_monitors(hd_data_t *hd_data)
+{
+  hd_t *hd, *hd_card;
+  str_list_t *sf_dir, *sf_dir_e;
+  unsigned char *edid;
+  char *card = NULL, *s;
+  unsigned len;
+  int found = 0;
+
+  sf_dir = read_dir(SYS_CLASS_DRM, 'D');
+
+  for(sf_dir_e = sf_dir; sf_dir_e; sf_dir_e = sf_dir_e->next) {
+    if(!(edid = read_drm_edid(hd_data, sf_dir_e->str, &len))) continue;
+
+    ADD2LOG("  drm %s: edid[%u]\n", sf_dir_e->str, len);
+
+    hd = add_hd_entry(hd_data, __LINE__, 0);
+    hd->base_class.id = bc_monitor;
+    hd->slot = found;
+
+    hd->sysfs_id = new_str(hd_sysfs_id(hd_read_sysfs_link(SYS_CLASS_DRM, sf_dir_e->str)));
+
+    /* .../<graphics card>/drm/card<n>/card<n>-<connector> */
+    if(hd->sysfs_id && (s = strstr(hd->sysfs_id, "/drm/"))) {
+      card = free_mem(card);
+      card = new_str(hd->sysfs_id);
+      card[s - hd->sysfs_id] = 0;
+      for(hd_card = hd_data->hd; hd_card; hd_card = hd_card->next) {
+        if(
+          hd_card->base_class.id == bc_display &&
+          hd_card->sysfs_id &&
+          !strcmp(hd_card->sysfs_id, card)
+        ) {
+          hd->attached_to = hd_card->idx;
+          break;
+        }
+      }
+    }
+
+    add_edid_info(hd_data, hd, edid);
+
+    free_mem(edid);
+
+    found++;
+  }
+
+  free_mem(card);
+  free_str_list(sf_dir);
+
+  return found;
+}
+
+
 #if defined(__PPC__)
 void add_old_mac_monitor(hd_data_t *hd_data)
 {
   hd_t *hd;
-  unsigned u1, u2;
+  unsigned u1, u2, pos;
   str_list_t *sl;
   static struct {
     unsigned width, height, vfreq, interlaced;
@@ -200,7 +329,7 @@ void add_old_mac_monitor(hd_data_t *hd_data)
     { 1280, 1024, 75, 0 }
   };
 
-  for(sl = hd_data->klog; sl; sl = sl->next) {
+  for(pos = 0; (sl = klog_find(hd_data, "Monitor", &pos)); ) {
     if(sscanf(sl->str, "<%*d>Monitor sense value = %i, using video mode %i", &u1, &u2) == 2) {
       u2--;
       hd = add_hd_entry(hd_data, __LINE__, 0);
@@ -1 +1,2 @@
 void hd_scan_monitor(hd_data_t *hd_data);
+int hd_drm_has_edid(hd_data_t *hd_data);
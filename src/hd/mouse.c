@@ -13,6 +13,7 @@
 #include "hd.h"
 #include "hd_int.h"
 #include "mouse.h"
+#include "serprobe.h"
 
 /**
  * @defgroup MOUSEdev Mouse devices
@@ -32,9 +33,9 @@ static void test_ps2_open(void *arg);
 #endif
 
 static void get_serial_mouse(hd_data_t* hd_data);
+static void mouse_step(ser_probe_t *port, ser_probe_event_t event);
 static void add_serial_mouse(hd_data_t* hd_data);
-static int _setspeed(int fd, int old, int new, int needtowrite, unsigned short flags);
-static void setspeed(int fd, int new, int needtowrite, unsigned short flags);
+static int set_tty_speed(int fd, int speed, unsigned short flags);
 static unsigned chk4id(ser_device_t *mi);
 static ser_device_t *add_ser_mouse_entry(ser_device_t **sm, ser_device_t *new_sm);
 static void dump_ser_mouse_data(hd_data_t *hd_data);
@@ -42,6 +43,8 @@ static void dump_ser_mouse_data(hd_data_t *hd_data);
 static void get_sunmouse(hd_data_t *hd_data);
 #endif
 
+static ser_plugin_t mouse_plugin = { "mouse", 0, mouse_step, NULL };
+
 void hd_scan_mouse(hd_data_t *hd_data)
 {
   ser_device_t *sm, *sm_next;
@@ -71,7 +74,7 @@ void hd_scan_mouse(hd_data_t *hd_data)
   }
   else {
     /* take data from shm */
-    hd_data->ser_mouse = ((hd_data_t *) (hd_data->shm.data))->ser_mouse;
+    hd_move_from_shm(hd_data);
     if((hd_data->debug & HD_DEB_MOUSE)) dump_ser_mouse_data(hd_data);
   }
 
@@ -377,15 +380,10 @@ static void get_sunmouse(hd_data_t *hd_data)
 void get_serial_mouse(hd_data_t *hd_data)
 {
   hd_t *hd;
-  int j, fd, fd_max = 0, sel, max_len;
-  unsigned modem_info;
-  fd_set set, set0;
-  struct timeval to;
+  int fd;
   ser_device_t *sm;
   struct termios tio;
 
-  FD_ZERO(&set);
-
   for(hd = hd_data->hd; hd; hd = hd->next) {
     if(
       hd->base_class.id == bc_comm &&
@@ -401,53 +399,14 @@ void get_serial_mouse(hd_data_t *hd_data)
         sm->fd = fd;
         sm->tio = tio;
         sm->hd_idx = hd->idx;
-        if(fd > fd_max) fd_max = fd;
-        FD_SET(fd, &set);
-
-        /*
-         * PnP COM spec black magic...
-         */
-        setspeed(fd, 1200, 1, CS7);
-        modem_info = TIOCM_DTR | TIOCM_RTS;
-        ioctl(fd, TIOCMBIC, &modem_info);
       }
     }
   }
 
   if(!hd_data->ser_mouse) return;
 
-  /*
-   * 200 ms seems to be too fast for some mice...
-   */
-  usleep(300000);		/* PnP protocol */
-
-  for(sm = hd_data->ser_mouse; sm; sm = sm->next) {
-    modem_info = TIOCM_DTR | TIOCM_RTS;
-    ioctl(sm->fd, TIOCMBIS, &modem_info);
-  }
-
-  /* smaller buffer size, otherwise we might wait really long... */
-  max_len = sizeof sm->buf < 128 ? sizeof sm->buf : 128;
-
-  to.tv_sec = 0; to.tv_usec = 300000;
-
-  set0 = set;
-  for(;;) {
-   to.tv_sec = 0; to.tv_usec = 300000;
-    set = set0;
-    if((sel = select(fd_max + 1, &set, NULL, NULL, &to)) > 0) {
-      for(sm = hd_data->ser_mouse; sm; sm = sm->next) {
-        if(FD_ISSET(sm->fd, &set)) {
-          if((j = read(sm->fd, sm->buf + sm->buf_len, max_len - sm->buf_len)) > 0)
-            sm->buf_len += j;
-          if(j <= 0) FD_CLR(sm->fd, &set0);	// #####
-        }
-      }
-    }
-    else {
-      break;
-    }
-  }
+  /* all ports in parallel, see mouse_step() */
+  ser_probe_run(hd_data, hd_data->ser_mouse, &mouse_plugin, NULL);
 
   for(sm = hd_data->ser_mouse; sm; sm = sm->next) {
     chk4id(sm);
@@ -459,6 +418,64 @@ void get_serial_mouse(hd_data_t *hd_data)
 }
 
 
+/*
+ * PnP COM spec black magic, one port.
+ *
+ * Switch to 1200 baud, drop DTR & RTS, raise them again after 300 ms and
+ * read the PnP id until the line stays quiet for 300 ms.
+ */
+void mouse_step(ser_probe_t *port, ser_probe_event_t event)
+{
+  ser_device_t *sm = port->sm;
+  unsigned modem_info;
+
+  switch(port->state) {
+    case 0:
+      /* speed magic taken from gpm: go from every old speed to 1200 */
+      if(event == sp_input) break;
+      if(event == sp_start) {
+        port->count = 9600;
+      }
+      else {
+        set_tty_speed(sm->fd, 1200, CS7);
+        port->count >>= 1;
+      }
+      if(port->count >= 1200) {
+        set_tty_speed(sm->fd, port->count, CS7);
+        write(sm->fd, "*n", 2);
+        ser_probe_timer(port, 100);
+        break;
+      }
+      modem_info = TIOCM_DTR | TIOCM_RTS;
+      ioctl(sm->fd, TIOCMBIC, &modem_info);
+      ser_probe_clear(port);
+      /* smaller buffer size, otherwise we might wait really long... */
+      port->max_len = 128;
+      port->state = 1;
+      /* 200 ms seems to be too fast for some mice... */
+      ser_probe_timer(port, 300);
+      break;
+
+    case 1:
+      if(event != sp_timeout) break;
+      modem_info = TIOCM_DTR | TIOCM_RTS;
+      ioctl(sm->fd, TIOCMBIS, &modem_info);
+      port->state = 2;
+      ser_probe_timer(port, 300);
+      break;
+
+    case 2:
+      if(event == sp_input && (unsigned) sm->buf_len < port->max_len) {
+        ser_probe_timer(port, 300);
+      }
+      else {
+        ser_probe_done(port);
+      }
+      break;
+  }
+}
+
+
 /*
  * Go through serial mouse data and add hd entries.
  */
@@ -518,14 +535,13 @@ void add_serial_mouse(hd_data_t *hd_data)
 
 
 /*
+ * Set port speed.
+ *
  * Baud setting magic taken from gpm.
  */
-
-int _setspeed(int fd, int old, int new, int needtowrite, unsigned short flags)
+int set_tty_speed(int fd, int speed, unsigned short flags)
 {
   struct termios tty;
-  char *c;
-  int err = 0;
 
   flags |= CREAD | CLOCAL | HUPCL;
 
@@ -538,7 +554,7 @@ int _setspeed(int fd, int old, int new, int needtowrite, unsigned short flags)
   tty.c_cc[VTIME] = 0;
   tty.c_cc[VMIN] = 1;
 
-  switch (old)
+  switch(speed)
     {
     case 9600:  tty.c_cflag = flags | B9600; break;
     case 4800:  tty.c_cflag = flags | B4800; break;
@@ -549,40 +565,7 @@ int _setspeed(int fd, int old, int new, int needtowrite, unsigned short flags)
 
   if(tcsetattr(fd, TCSAFLUSH, &tty)) return errno;
 
-  switch (new)
-    {
-    case 9600:  c = "*q";  tty.c_cflag = flags | B9600; break;
-    case 4800:  c = "*p";  tty.c_cflag = flags | B4800; break;
-    case 2400:  c = "*o";  tty.c_cflag = flags | B2400; break;
-    case 1200:
-    default:    c = "*n";  tty.c_cflag = flags | B1200; break;
-    }
-
-  if(needtowrite) {
-    err = 2 - write(fd, c, 2);
-  }
-
-  usleep(100000);
-
-  if(tcsetattr(fd, TCSAFLUSH, &tty)) return errno;
-
-  return err;
-}
-
-
-void setspeed(int fd, int new, int needtowrite, unsigned short flags)
-{
-  int i;
-
-  for(i = 9600; i >= 1200; i >>= 1) {
-    _setspeed(fd, i, new, needtowrite, flags);
-#if 0
-    if(err) {
-      fprintf(stderr, "%d, %d ", i, err);
-      perror("");
-    }
-#endif
-  }
+  return 0;
 }
 
 
@@ -19,10 +19,15 @@
 #include <linux/sockios.h>
 #include <linux/ethtool.h>
 #include <linux/if_arp.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/genetlink.h>
+#include <linux/ethtool_netlink.h>
 
 #include "hd.h"
 #include "hd_int.h"
 #include "net.h"
+#include "index.h"
 
 /**
  * @defgroup NETint Network devices
@@ -34,6 +39,44 @@
  * @{
  */
 
+/* max. size of a netlink reply */
+#define NL_BUF_SIZE	(1 << 16)
+
+/* interface data from netlink dumps */
+typedef struct {
+  char *name;
+  int type;			/* ARPHRD_* */
+  int carrier;			/* -1: unknown */
+  int link;			/* ethtool link state, -1: unknown */
+  char *hw_addr;
+  unsigned priv_flags:1;	/* ethtool private flags are valid */
+  unsigned fcoe_offload:2;	/* tri-state, see hd_t::is */
+  unsigned iscsi_offload:2;
+  unsigned storage_only:2;
+} net_link_t;
+
+typedef struct {
+  hd_data_t *hd_data;
+  unsigned len;
+  net_link_t *list;		/* sorted by name after read_links() */
+  unsigned family;		/* ethtool netlink family */
+  unsigned ethtool_priv:1;	/* ethtool private flags dump worked */
+  unsigned ethtool_link:1;	/* ethtool link state dump worked */
+} net_links_t;
+
+static void read_links(hd_data_t *hd_data, net_links_t *links);
+static net_links_t *free_links(net_links_t *links);
+static net_link_t *find_link(net_links_t *links, char *name);
+static int cmp_link(const void *p0, const void *p1);
+static int nl_request(int fd, void *req, void (*func)(net_links_t *, struct nlmsghdr *), net_links_t *links);
+static void nl_parse(struct nlattr **tb, unsigned max, void *data, int len);
+static void nl_put(struct nlmsghdr *nh, unsigned type, void *data, unsigned len);
+static void add_rtnl_link(net_links_t *links, struct nlmsghdr *nh);
+static void add_genl_family(net_links_t *links, struct nlmsghdr *nh);
+static void add_ethtool_priv(net_links_t *links, struct nlmsghdr *nh);
+static void add_ethtool_link(net_links_t *links, struct nlmsghdr *nh);
+static net_link_t *ethtool_dev(net_links_t *links, struct nlmsghdr *nh, struct nlattr **tb, unsigned max, unsigned hdr);
+
 static void get_ethtool_priv(hd_data_t *hd_data, hd_t *hd);
 static void get_driverinfo(hd_data_t *hd_data, hd_t *hd);
 static void get_linkstate(hd_data_t *hd_data, hd_t *hd);
@@ -57,6 +100,8 @@ void hd_scan_net(hd_data_t *hd_data)
   str_list_t *sf_class, *sf_class_e;
   char *sf_cdev = NULL, *sf_dev = NULL;
   char *sf_drv_name, *sf_drv;
+  net_links_t links = { };
+  net_link_t *link;
 
   if(!hd_probe_feature(hd_data, pr_net)) return;
 
@@ -76,9 +121,15 @@ void hd_scan_net(hd_data_t *hd_data)
     return;
   }
 
+  /* type, carrier, address, link state & private flags of all interfaces at once */
+  read_links(hd_data, &links);
+
   for(sf_class_e = sf_class; sf_class_e; sf_class_e = sf_class_e->next) {
     str_printf(&sf_cdev, 0, "/sys/class/net/%s", sf_class_e->str);
 
+    /* not related to hd_data->only */
+    if(!hd_index_only_sysfs(hd_data, sf_cdev)) continue;
+
     hd_card = NULL;
 
     ADD2LOG(
@@ -88,23 +139,32 @@ void hd_scan_net(hd_data_t *hd_data)
     );
 
     if_type = -1;
-    if(hd_attr_uint(get_sysfs_attr_by_path(sf_cdev, "type"), &ul0, 0)) {
-      if_type = ul0;
-      ADD2LOG("    type = %d\n", if_type);
-    }
-
     if_carrier = -1;
-    if(hd_attr_uint(get_sysfs_attr_by_path(sf_cdev, "carrier"), &ul0, 0)) {
-      if_carrier = ul0;
-      ADD2LOG("    carrier = %d\n", if_carrier);
+    hw_addr = NULL;
+
+    if((link = find_link(&links, sf_class_e->str))) {
+      if_type = link->type;
+      if_carrier = link->carrier;
+      hw_addr = new_str(link->hw_addr);
     }
+    else {
+      if(hd_attr_uint(get_sysfs_attr_by_path(sf_cdev, "type"), &ul0, 0)) {
+        if_type = ul0;
+      }
 
-    hw_addr = NULL;
-    if((s = get_sysfs_attr_by_path(sf_cdev, "address"))) {
-      hw_addr = canon_str(s, strlen(s));
-      ADD2LOG("    hw_addr = %s\n", hw_addr);
+      if(hd_attr_uint(get_sysfs_attr_by_path(sf_cdev, "carrier"), &ul0, 0)) {
+        if_carrier = ul0;
+      }
+
+      if((s = get_sysfs_attr_by_path(sf_cdev, "address"))) {
+        hw_addr = canon_str(s, strlen(s));
+      }
     }
 
+    if(if_type != -1) ADD2LOG("    type = %d\n", if_type);
+    if(if_carrier != -1) ADD2LOG("    carrier = %d\n", if_carrier);
+    if(hw_addr) ADD2LOG("    hw_addr = %s\n", hw_addr);
+
     sf_dev = new_str(hd_read_sysfs_link(sf_cdev, "device"));
     if(sf_dev) {
       ADD2LOG("    net device: path = %s\n", hd_sysfs_id(sf_dev));
@@ -134,6 +194,8 @@ void hd_scan_net(hd_data_t *hd_data)
       add_res_entry(&hd->res, res1);
     }
 
+    if(if_carrier < 0 && link && link->link >= 0) if_carrier = link->link;
+
     if(if_carrier >= 0) {
       res = new_mem(sizeof *res);
       res->link.type = res_link;
@@ -151,7 +213,14 @@ void hd_scan_net(hd_data_t *hd_data)
       get_driverinfo(hd_data, hd);
     }
 
-    get_ethtool_priv(hd_data, hd);
+    if(link && link->priv_flags) {
+      hd->is.fcoe_offload = link->fcoe_offload;
+      hd->is.iscsi_offload = link->iscsi_offload;
+      hd->is.storage_only = link->storage_only;
+    }
+    else if(!links.ethtool_priv) {
+      get_ethtool_priv(hd_data, hd);
+    }
 
     switch(if_type) {
       case ARPHRD_ETHER:	/* eth */
@@ -387,7 +456,15 @@ void hd_scan_net(hd_data_t *hd_data)
         if(res->any.type == res_link) break;
       }
 
-      if(!res) get_linkstate(hd_data, hd);
+      /* ethtool netlink has already been asked */
+      if(!res && !links.ethtool_link) {
+        if(hd_data->flags.lazy) {
+          hd->lazy.link = 1;
+        }
+        else {
+          get_linkstate(hd_data, hd);
+        }
+      }
 
       if(!(hd_card = hd_get_device_by_idx(hd_data, hd->attached_to))) continue;
 
@@ -406,12 +483,359 @@ void hd_scan_net(hd_data_t *hd_data)
           add_res_entry(&hd_card->res, res1);
         }
       }
+      else if(hd->lazy.link) {
+        hd_card->lazy.link = 1;
+      }
 
       hd_card->is.fcoe_offload = hd->is.fcoe_offload;
       hd_card->is.iscsi_offload = hd->is.iscsi_offload;
       hd_card->is.storage_only = hd->is.storage_only;
     }
   }
+
+  free_links(&links);
+}
+
+
+/*
+ * Read interface data via netlink: one RTM_GETLINK dump for type, carrier
+ * and hw address, and ethtool netlink dumps for private flags and link
+ * state. This replaces several sysfs reads and ioctls per interface.
+ *
+ * links->len is 0 if netlink is not available; callers then fall back to
+ * sysfs & ioctl.
+ */
+void read_links(hd_data_t *hd_data, net_links_t *links)
+{
+  int fd;
+  struct {
+    struct nlmsghdr nh;
+    union {
+      struct ifinfomsg ifi;
+      struct genlmsghdr genl;
+    };
+    char buf[64];
+  } req;
+
+  links->hd_data = hd_data;
+
+  fd = socket(PF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+  if(fd == -1) return;
+
+  memset(&req, 0, sizeof req);
+  req.nh.nlmsg_len = NLMSG_LENGTH(sizeof req.ifi);
+  req.nh.nlmsg_type = RTM_GETLINK;
+  req.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+  req.ifi.ifi_family = AF_UNSPEC;
+
+  if(nl_request(fd, &req, add_rtnl_link, links)) {
+    ADD2LOG("  netlink: RTM_GETLINK failed\n");
+    close(fd);
+    free_links(links);
+
+    return;
+  }
+
+  close(fd);
+
+  ADD2LOG("  netlink: %u interfaces\n", links->len);
+
+  if(links->len > 1) qsort(links->list, links->len, sizeof *links->list, cmp_link);
+
+  fd = socket(PF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_GENERIC);
+  if(fd == -1) return;
+
+  /* ethtool family id */
+  memset(&req, 0, sizeof req);
+  req.nh.nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN);
+  req.nh.nlmsg_type = GENL_ID_CTRL;
+  req.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+  req.genl.cmd = CTRL_CMD_GETFAMILY;
+  req.genl.version = 1;
+  nl_put(&req.nh, CTRL_ATTR_FAMILY_NAME, ETHTOOL_GENL_NAME, sizeof ETHTOOL_GENL_NAME);
+
+  if(nl_request(fd, &req, add_genl_family, links) || !links->family) {
+    ADD2LOG("  netlink: no ethtool family\n");
+    close(fd);
+
+    return;
+  }
+
+  memset(&req, 0, sizeof req);
+  req.nh.nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN);
+  req.nh.nlmsg_type = links->family;
+  req.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+  req.genl.cmd = ETHTOOL_MSG_PRIVFLAGS_GET;
+  req.genl.version = ETHTOOL_GENL_VERSION;
+
+  links->ethtool_priv = nl_request(fd, &req, add_ethtool_priv, links) ? 0 : 1;
+
+  req.genl.cmd = ETHTOOL_MSG_LINKSTATE_GET;
+
+  links->ethtool_link = nl_request(fd, &req, add_ethtool_link, links) ? 0 : 1;
+
+  ADD2LOG(
+    "  netlink: ethtool private flags %s, link state %s\n",
+    links->ethtool_priv ? "ok" : "failed",
+    links->ethtool_link ? "ok" : "failed"
+  );
+
+  close(fd);
+}
+
+
+net_links_t *free_links(net_links_t *links)
+{
+  unsigned u;
+
+  for(u = 0; u < links->len; u++) {
+    free_mem(links->list[u].name);
+    free_mem(links->list[u].hw_addr);
+  }
+
+  links->list = free_mem(links->list);
+  links->len = 0;
+
+  return NULL;
+}
+
+
+net_link_t *find_link(net_links_t *links, char *name)
+{
+  net_link_t key = { name: name };
+
+  if(!links->len || !name) return NULL;
+
+  return bsearch(&key, links->list, links->len, sizeof *links->list, cmp_link);
+}
+
+
+int cmp_link(const void *p0, const void *p1)
+{
+  return strcmp(((net_link_t *) p0)->name, ((net_link_t *) p1)->name);
+}
+
+
+/*
+ * Send netlink request and pass all replies to func().
+ *
+ * Returns 0 or a negative errno value.
+ */
+int nl_request(int fd, void *req, void (*func)(net_links_t *, struct nlmsghdr *), net_links_t *links)
+{
+  static unsigned seq;
+  struct nlmsghdr *nh = req;
+  struct nlmsgerr *err;
+  void *buf;
+  int len, ret = -EIO;
+
+  nh->nlmsg_seq = ++seq;
+
+  if(send(fd, nh, nh->nlmsg_len, 0) != (ssize_t) nh->nlmsg_len) return -errno;
+
+  buf = new_mem(NL_BUF_SIZE);
+
+  for(;;) {
+    len = recv(fd, buf, NL_BUF_SIZE, 0);
+    if(len < 0) {
+      if(errno == EINTR) continue;
+      ret = -errno;
+      break;
+    }
+    if(len == 0) break;
+
+    for(nh = buf; NLMSG_OK(nh, (unsigned) len); nh = NLMSG_NEXT(nh, len)) {
+      if(nh->nlmsg_seq != seq) continue;
+      if(nh->nlmsg_type == NLMSG_DONE) {
+        ret = 0;
+        goto done;
+      }
+      if(nh->nlmsg_type == NLMSG_ERROR) {
+        err = NLMSG_DATA(nh);
+        ret = nh->nlmsg_len >= NLMSG_LENGTH(sizeof *err) ? err->error : -EIO;
+        goto done;
+      }
+      func(links, nh);
+    }
+  }
+
+  done:
+
+  free_mem(buf);
+
+  return ret;
+}
+
+
+/*
+ * Index netlink attributes by type.
+ */
+void nl_parse(struct nlattr **tb, unsigned max, void *data, int len)
+{
+  struct nlattr *nla;
+  unsigned type;
+
+  memset(tb, 0, (max + 1) * sizeof *tb);
+
+  for(nla = data; len >= NLA_HDRLEN && nla->nla_len >= NLA_HDRLEN && nla->nla_len <= len; ) {
+    type = nla->nla_type & NLA_TYPE_MASK;
+    if(type <= max) tb[type] = nla;
+    len -= NLA_ALIGN(nla->nla_len);
+    nla = (void *) nla + NLA_ALIGN(nla->nla_len);
+  }
+}
+
+
+/*
+ * Append attribute to request.
+ */
+void nl_put(struct nlmsghdr *nh, unsigned type, void *data, unsigned len)
+{
+  struct nlattr *nla = (void *) nh + NLMSG_ALIGN(nh->nlmsg_len);
+
+  nla->nla_type = type;
+  nla->nla_len = NLA_HDRLEN + len;
+  memcpy((void *) nla + NLA_HDRLEN, data, len);
+
+  nh->nlmsg_len = NLMSG_ALIGN(nh->nlmsg_len) + NLA_ALIGN(nla->nla_len);
+}
+
+
+void add_rtnl_link(net_links_t *links, struct nlmsghdr *nh)
+{
+  struct ifinfomsg *ifi = NLMSG_DATA(nh);
+  struct nlattr *tb[IFLA_MAX + 1];
+  net_link_t *link;
+  unsigned char *addr;
+  unsigned u, len;
+
+  if(nh->nlmsg_type != RTM_NEWLINK || nh->nlmsg_len < NLMSG_LENGTH(sizeof *ifi)) return;
+
+  nl_parse(tb, IFLA_MAX, IFLA_RTA(ifi), IFLA_PAYLOAD(nh));
+
+  if(!tb[IFLA_IFNAME]) return;
+
+  links->list = add_mem(links->list, sizeof *links->list, links->len);
+  link = links->list + links->len++;
+
+  link->name = new_str((void *) tb[IFLA_IFNAME] + NLA_HDRLEN);
+  link->type = ifi->ifi_type;
+  link->link = -1;
+
+  /* sysfs has no carrier for interfaces that are down */
+  link->carrier = -1;
+  if((ifi->ifi_flags & IFF_UP) && tb[IFLA_CARRIER]) {
+    link->carrier = *(uint8_t *) ((void *) tb[IFLA_CARRIER] + NLA_HDRLEN);
+  }
+
+  /* same format as sysfs */
+  if(tb[IFLA_ADDRESS]) {
+    addr = (void *) tb[IFLA_ADDRESS] + NLA_HDRLEN;
+    len = tb[IFLA_ADDRESS]->nla_len - NLA_HDRLEN;
+    for(u = 0; u < len; u++) {
+      str_printf(&link->hw_addr, -1, "%s%02x", u ? ":" : "", addr[u]);
+    }
+  }
+}
+
+
+/*
+ * Remember ethtool family id.
+ */
+void add_genl_family(net_links_t *links, struct nlmsghdr *nh)
+{
+  struct nlattr *tb[CTRL_ATTR_MAX + 1];
+
+  if(nh->nlmsg_type != GENL_ID_CTRL || nh->nlmsg_len < NLMSG_LENGTH(GENL_HDRLEN)) return;
+
+  nl_parse(tb, CTRL_ATTR_MAX, NLMSG_DATA(nh) + GENL_HDRLEN, nh->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN));
+
+  if(tb[CTRL_ATTR_FAMILY_ID]) {
+    links->family = *(uint16_t *) ((void *) tb[CTRL_ATTR_FAMILY_ID] + NLA_HDRLEN);
+  }
+}
+
+
+/*
+ * Parse ethtool reply and find interface.
+ */
+net_link_t *ethtool_dev(net_links_t *links, struct nlmsghdr *nh, struct nlattr **tb, unsigned max, unsigned hdr)
+{
+  struct nlattr *tb_hdr[ETHTOOL_A_HEADER_MAX + 1];
+
+  if(nh->nlmsg_len < NLMSG_LENGTH(GENL_HDRLEN)) return NULL;
+
+  nl_parse(tb, max, NLMSG_DATA(nh) + GENL_HDRLEN, nh->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN));
+
+  if(!tb[hdr]) return NULL;
+
+  nl_parse(tb_hdr, ETHTOOL_A_HEADER_MAX, (void *) tb[hdr] + NLA_HDRLEN, tb[hdr]->nla_len - NLA_HDRLEN);
+
+  if(!tb_hdr[ETHTOOL_A_HEADER_DEV_NAME]) return NULL;
+
+  return find_link(links, (void *) tb_hdr[ETHTOOL_A_HEADER_DEV_NAME] + NLA_HDRLEN);
+}
+
+
+void add_ethtool_priv(net_links_t *links, struct nlmsghdr *nh)
+{
+  hd_data_t *hd_data = links->hd_data;
+  struct nlattr *tb[ETHTOOL_A_PRIVFLAGS_MAX + 1];
+  struct nlattr *tb_set[ETHTOOL_A_BITSET_MAX + 1];
+  struct nlattr *tb_bit[ETHTOOL_A_BITSET_BIT_MAX + 1];
+  struct nlattr *nla;
+  net_link_t *link;
+  char *key;
+  int len;
+  unsigned val;
+
+  link = ethtool_dev(links, nh, tb, ETHTOOL_A_PRIVFLAGS_MAX, ETHTOOL_A_PRIVFLAGS_HEADER);
+
+  if(!link || !tb[ETHTOOL_A_PRIVFLAGS_FLAGS]) return;
+
+  nla = tb[ETHTOOL_A_PRIVFLAGS_FLAGS];
+  nl_parse(tb_set, ETHTOOL_A_BITSET_MAX, (void *) nla + NLA_HDRLEN, nla->nla_len - NLA_HDRLEN);
+
+  if(!tb_set[ETHTOOL_A_BITSET_BITS]) return;
+
+  link->priv_flags = 1;
+
+  ADD2LOG("  %s: ethtool private flags\n", link->name);
+
+  /* list of ETHTOOL_A_BITSET_BITS_BIT entries */
+  len = tb_set[ETHTOOL_A_BITSET_BITS]->nla_len - NLA_HDRLEN;
+  nla = (void *) tb_set[ETHTOOL_A_BITSET_BITS] + NLA_HDRLEN;
+
+  for(; len >= NLA_HDRLEN && nla->nla_len >= NLA_HDRLEN && nla->nla_len <= len; ) {
+    nl_parse(tb_bit, ETHTOOL_A_BITSET_BIT_MAX, (void *) nla + NLA_HDRLEN, nla->nla_len - NLA_HDRLEN);
+
+    if(tb_bit[ETHTOOL_A_BITSET_BIT_NAME]) {
+      key = (void *) tb_bit[ETHTOOL_A_BITSET_BIT_NAME] + NLA_HDRLEN;
+      /* without mask only set bits are listed */
+      val = tb_bit[ETHTOOL_A_BITSET_BIT_VALUE] || tb_set[ETHTOOL_A_BITSET_NOMASK] ? 1 : 0;
+      ADD2LOG("    %s = %u\n", key, val);
+      // add 1 to get tri-state flags: 0 = unset, 1 = false, 2 = true
+      if(!strcmp(key, "FCoE offload support")) link->fcoe_offload = val + 1;
+      if(!strcmp(key, "iSCSI offload support")) link->iscsi_offload = val + 1;
+      if(!strcmp(key, "Storage only interface")) link->storage_only = val + 1;
+    }
+
+    len -= NLA_ALIGN(nla->nla_len);
+    nla = (void *) nla + NLA_ALIGN(nla->nla_len);
+  }
+}
+
+
+void add_ethtool_link(net_links_t *links, struct nlmsghdr *nh)
+{
+  struct nlattr *tb[ETHTOOL_A_LINKSTATE_MAX + 1];
+  net_link_t *link;
+
+  link = ethtool_dev(links, nh, tb, ETHTOOL_A_LINKSTATE_MAX, ETHTOOL_A_LINKSTATE_HEADER);
+
+  if(link && tb[ETHTOOL_A_LINKSTATE_LINK]) {
+    link->link = *(uint8_t *) ((void *) tb[ETHTOOL_A_LINKSTATE_LINK] + NLA_HDRLEN);
+  }
 }
 
 
@@ -561,6 +985,40 @@ void get_linkstate(hd_data_t *hd_data, hd_t *hd)
 }
 
 
+/*
+ * Read link state skipped during a lazy scan. Network cards get the link
+ * state of their interface.
+ */
+void hd_net_link_state(hd_data_t *hd_data, hd_t *hd)
+{
+  hd_t *hd_if;
+  hd_res_t *res, *res1;
+
+  if(hd->base_class.id == bc_network_interface) {
+    get_linkstate(hd_data, hd);
+
+    return;
+  }
+
+  for(hd_if = hd_data->hd; hd_if; hd_if = hd_if->next) {
+    if(hd_if->base_class.id != bc_network_interface || hd_if->attached_to != hd->idx) continue;
+
+    for(res = hd_get_res(hd_data, hd_if); res; res = res->next) {
+      if(res->any.type == res_link) break;
+    }
+
+    if(res) {
+      res1 = new_mem(sizeof *res1);
+      res1->link.type = res_link;
+      res1->link.state = res->link.state;
+      add_res_entry(&hd->res, res1);
+
+      break;
+    }
+  }
+}
+
+
 /*
  * SGI Altix cross partition network.
  */
@@ -1 +1,2 @@
 void hd_scan_net(hd_data_t *hd_data);
+void hd_net_link_state(hd_data_t *hd_data, hd_t *hd);
@@ -13,6 +13,7 @@
 #include "hd_int.h"
 #include "hddb.h"
 #include "pci.h"
+#include "index.h"
 
 /**
  * @defgroup PCIint PCI
@@ -142,6 +143,12 @@ void hd_pci_read_data(hd_data_t *hd_data)
   for(sf_bus_e = sf_bus; sf_bus_e; sf_bus_e = sf_bus_e->next) {
     sf_dev = new_str(hd_read_sysfs_link("/sys/bus/pci/devices", sf_bus_e->str));
 
+    /* not related to hd_data->only */
+    if(!hd_index_only_sysfs(hd_data, sf_dev)) {
+      sf_dev = free_mem(sf_dev);
+      continue;
+    }
+
     ADD2LOG(
       "  pci device: name = %s\n    path = %s\n",
       sf_bus_e->str,
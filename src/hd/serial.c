@@ -84,7 +84,7 @@ void hd_scan_serial(hd_data_t *hd_data)
       str_printf(&hd->unix_dev_name, 0, "/dev/ttyAGS%u", ser->line);
     }
     else {
-      str_printf(&hd->unix_dev_name, 0, "/dev/ttyS%u", ser->line);
+      str_printf(&hd->unix_dev_name, 0, "%s%u", getenv("LIBHD_SERIAL_DEV") ?: "/dev/ttyS", ser->line);
     }
     for(i = 0; i < (int) skip_devs; i++) {
       if(!strcmp(skip_dev[i], hd->unix_dev_name)) {
@@ -166,6 +166,11 @@ void get_serial_info(hd_data_t *hd_data)
   unsigned u0, u1, u2;
 #if !defined(__PPC__)
   unsigned u3;
+  /*
+   * For testing: LIBHD_SERIAL points to a file in PROC_DRIVER_SERIAL format,
+   * LIBHD_SERIAL_DEV replaces the "/dev/ttyS" device name prefix (cf. hwsersim).
+   */
+  char *proc_serial = getenv("LIBHD_SERIAL");
 #endif
   int i;
   str_list_t *sl, *sl0, **sll;
@@ -177,11 +182,11 @@ void get_serial_info(hd_data_t *hd_data)
    * somewhat buggy at the moment (2.2.13), hence the explicit 44 lines
    * limit. That may be dropped later.
    */
-  sl0 = read_file(PROC_DRIVER_SERIAL, 1, 44);
+  sl0 = read_file(proc_serial ?: PROC_DRIVER_SERIAL, 1, 44);
   sll = &sl0;
   while(*sll) sll = &(*sll)->next;
   // append Agere modem devices
-  *sll = read_file("/proc/tty/driver/agrserial", 1, 17);
+  if(!proc_serial) *sll = read_file("/proc/tty/driver/agrserial", 1, 17);
 
 
   // ########## FIX !!!!!!!! ########
@@ -206,11 +211,11 @@ void get_serial_info(hd_data_t *hd_data)
 
     if((hd_data->debug & HD_DEB_SERIAL)) {
       /* log just the first 16 entries */
-      ADD2LOG("----- "PROC_DRIVER_SERIAL" -----\n");
+      ADD2LOG("----- %s -----\n", proc_serial ?: PROC_DRIVER_SERIAL);
       for(sl = sl0, i = 16; sl && i--; sl = sl->next) {
         ADD2LOG("  %s", sl->str);
       }
-      ADD2LOG("----- "PROC_DRIVER_SERIAL" end -----\n");
+      ADD2LOG("----- %s end -----\n", proc_serial ?: PROC_DRIVER_SERIAL);
     }
   }
 #endif	/* !defined(__PPC__) */
@@ -0,0 +1,291 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <time.h>
+#include <termios.h>
+#include <sys/epoll.h>
+
+#include "hd.h"
+#include "hd_int.h"
+#include "serprobe.h"
+
+/**
+ * @defgroup SERPROBEint Serial probe engine
+ * @ingroup  libhdDEVint
+ * @brief Probe several serial ports in parallel
+ *
+ * Every port runs its own state machine (a ser_plugin_t). The plugin's
+ * step() function is called when the port starts, when new input arrived
+ * and when the port's timer expired; it sends data, sets the timer and
+ * finally marks the port as done. All ports share one epoll loop, so the
+ * total time is that of the slowest port, not the sum over all ports.
+ *
+ * @{
+ */
+
+#ifndef LIBHD_TINY
+
+/* epoll events handled per round */
+#define SER_PROBE_EVENTS	16
+
+static uint64_t ser_probe_now(void);
+static void ser_probe_step(ser_probe_t *port, ser_probe_event_t event);
+static void ser_probe_finish(ser_probe_t *port);
+static unsigned ser_probe_limit(ser_probe_t *port);
+static void ser_probe_watch(ser_probe_t *port, int on);
+static void ser_probe_read(ser_probe_t *port);
+
+
+/*
+ * Run plugin on all ports in sm_list.
+ *
+ * The ports must be open; they are not closed here. Returns when all ports
+ * are done.
+ */
+void ser_probe_run(hd_data_t *hd_data, ser_device_t *sm_list, ser_plugin_t *plugin, void *arg)
+{
+  ser_probe_t *ports, *port;
+  ser_device_t *sm;
+  struct epoll_event ev[SER_PROBE_EVENTS];
+  unsigned u, len, active;
+  int i, epfd, events, timeout;
+  uint64_t now, next;
+
+  for(len = 0, sm = sm_list; sm; sm = sm->next) len++;
+
+  if(!len) return;
+
+  epfd = epoll_create1(EPOLL_CLOEXEC);
+  if(epfd == -1) {
+    ADD2LOG("%s: epoll_create1 failed (errno %d)\n", plugin->name, errno);
+    return;
+  }
+
+  ports = new_mem(len * sizeof *ports);
+
+  for(u = 0, sm = sm_list; sm; sm = sm->next, u++) {
+    port = ports + u;
+    port->hd_data = hd_data;
+    port->sm = sm;
+    port->plugin = plugin;
+    port->arg = arg;
+    if(plugin->data_size) port->data = new_mem(plugin->data_size);
+    port->index = u + 1;
+    port->epfd = epfd;
+  }
+
+  for(u = 0; u < len; u++) ser_probe_step(ports + u, sp_start);
+
+  for(;;) {
+    now = ser_probe_now();
+    next = 0;
+
+    for(active = u = 0; u < len; u++) {
+      port = ports + u;
+      if(port->done) continue;
+      /* poll if there's room for more input */
+      if(!port->watch && !port->eof && (unsigned) port->sm->buf_len < ser_probe_limit(port)) {
+        ser_probe_watch(port, 1);
+      }
+      if(!port->timer && !port->watch) {
+        /* nothing would ever happen */
+        ADD2LOG("%s@%s: stalled\n", plugin->name, port->sm->dev_name);
+        ser_probe_finish(port);
+        continue;
+      }
+      active++;
+      if(port->timer && (!next || port->timeout < next)) next = port->timeout;
+    }
+
+    if(!active) break;
+
+    timeout = next ? next > now ? next - now : 0 : -1;
+
+    events = epoll_wait(epfd, ev, SER_PROBE_EVENTS, timeout);
+
+    if(events == -1) {
+      if(errno == EINTR) continue;
+      ADD2LOG("%s: epoll_wait failed (errno %d)\n", plugin->name, errno);
+      break;
+    }
+
+    for(i = 0; i < events; i++) {
+      port = ports + ev[i].data.u32;
+      if(!port->done) ser_probe_read(port);
+    }
+
+    now = ser_probe_now();
+
+    for(u = 0; u < len; u++) {
+      port = ports + u;
+      if(port->done || !port->timer || port->timeout > now) continue;
+      port->timer = 0;
+      ser_probe_step(port, sp_timeout);
+    }
+  }
+
+  for(u = 0; u < len; u++) {
+    ser_probe_finish(ports + u);
+    free_mem(ports[u].data);
+  }
+
+  free_mem(ports);
+  close(epfd);
+}
+
+
+/*
+ * (Re)start port timer.
+ */
+void ser_probe_timer(ser_probe_t *port, unsigned ms)
+{
+  port->timeout = ser_probe_now() + ms;
+  port->timer = 1;
+}
+
+
+/*
+ * Drop input collected so far.
+ */
+void ser_probe_clear(ser_probe_t *port)
+{
+  port->sm->buf_len = 0;
+  *port->sm->buf = 0;
+}
+
+
+/*
+ * Clear input and send data.
+ *
+ * Returns 1 if everything was written.
+ */
+int ser_probe_write(ser_probe_t *port, void *buf, unsigned len)
+{
+  hd_data_t *hd_data = port->hd_data;
+  int i;
+
+  ser_probe_clear(port);
+
+  i = write(port->sm->fd, buf, len);
+
+  if(i != (int) len) {
+    ADD2LOG("%s write oops: %d/%u\n", port->sm->dev_name, i, len);
+    return 0;
+  }
+
+  return 1;
+}
+
+
+/*
+ * Port is done; no more plugin calls.
+ */
+void ser_probe_done(ser_probe_t *port)
+{
+  ser_probe_watch(port, 0);
+  port->timer = 0;
+  port->done = 1;
+}
+
+
+uint64_t ser_probe_now()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec * 1000ull + ts.tv_nsec / 1000000;
+}
+
+
+/*
+ * Pass event to plugin.
+ */
+void ser_probe_step(ser_probe_t *port, ser_probe_event_t event)
+{
+  if(!port->done) port->plugin->step(port, event);
+
+  if(port->done) ser_probe_finish(port);
+}
+
+
+/*
+ * Stop port and call plugin's finish() (just once).
+ */
+void ser_probe_finish(ser_probe_t *port)
+{
+  if(!port->done) ser_probe_done(port);
+
+  if(port->finished) return;
+
+  port->finished = 1;
+  if(port->plugin->finish) port->plugin->finish(port);
+}
+
+
+/*
+ * Input buffer size.
+ */
+unsigned ser_probe_limit(ser_probe_t *port)
+{
+  unsigned limit = sizeof port->sm->buf - 1;
+
+  if(port->max_len && port->max_len < limit) limit = port->max_len;
+
+  return limit;
+}
+
+
+void ser_probe_watch(ser_probe_t *port, int on)
+{
+  struct epoll_event ev = { .events = EPOLLIN };
+
+  if(port->watch == !!on) return;
+
+  ev.data.u32 = port->index - 1;
+
+  if(!epoll_ctl(port->epfd, on ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, port->sm->fd, &ev)) {
+    port->watch = on ? 1 : 0;
+  }
+  else if(on) {
+    /* not pollable */
+    port->eof = 1;
+  }
+}
+
+
+/*
+ * Read available input into sm->buf (\000 terminated) and pass it on.
+ *
+ * Polling stops while the buffer is full (see ser_probe_t::max_len) and at
+ * the first read error.
+ */
+void ser_probe_read(ser_probe_t *port)
+{
+  ser_device_t *sm = port->sm;
+  unsigned limit = ser_probe_limit(port);
+  int i;
+
+  if((unsigned) sm->buf_len < limit) {
+    i = read(sm->fd, sm->buf + sm->buf_len, limit - sm->buf_len);
+
+    if(i > 0) {
+      sm->buf_len += i;
+      sm->buf[sm->buf_len] = 0;
+      ser_probe_step(port, sp_input);
+    }
+    else if(i == 0 || (errno != EAGAIN && errno != EINTR)) {
+      ser_probe_watch(port, 0);
+      port->eof = 1;
+    }
+  }
+
+  if(!port->done && (unsigned) sm->buf_len >= ser_probe_limit(port)) ser_probe_watch(port, 0);
+}
+
+#endif	/* LIBHD_TINY */
+
+/** @} */
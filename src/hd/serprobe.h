@@ -0,0 +1,38 @@
+/* events passed to ser_plugin_t::step() */
+typedef enum { sp_start, sp_input, sp_timeout } ser_probe_event_t;
+
+typedef struct ser_probe_s ser_probe_t;
+
+/* a serial protocol driven by ser_probe_run() */
+typedef struct {
+  char *name;
+  unsigned data_size;		/* size of ser_probe_t::data */
+  void (*step)(ser_probe_t *port, ser_probe_event_t event);
+  void (*finish)(ser_probe_t *port);	/* optional; port is done */
+} ser_plugin_t;
+
+/* per port state */
+struct ser_probe_s {
+  hd_data_t *hd_data;
+  ser_device_t *sm;		/* the port; input is collected in sm->buf */
+  ser_plugin_t *plugin;
+  void *arg;			/* ser_probe_run() argument */
+  void *data;			/* plugin data, zeroed */
+  unsigned index;		/* port number, starting at 1 */
+  unsigned state;		/* plugin state, starts at 0 */
+  unsigned count;		/* plugin counter */
+  unsigned max_len;		/* collect at most that much input (0: sm->buf size) */
+  uint64_t timeout;		/* timer expiry (ms) */
+  unsigned timer:1;		/* timer is running */
+  unsigned watch:1;		/* (internal) fd is polled */
+  unsigned eof:1;		/* reading failed, fd is no longer polled */
+  unsigned done:1;
+  unsigned finished:1;		/* (internal) finish() was called */
+  int epfd;			/* (internal) */
+};
+
+void ser_probe_run(hd_data_t *hd_data, ser_device_t *sm_list, ser_plugin_t *plugin, void *arg);
+void ser_probe_timer(ser_probe_t *port, unsigned ms);
+void ser_probe_clear(ser_probe_t *port);
+int ser_probe_write(ser_probe_t *port, void *buf, unsigned len);
+void ser_probe_done(ser_probe_t *port);
@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "hd.h"
@@ -17,6 +18,19 @@ enum sm_map_type { sm_map_str, sm_map_num2str };
 
 typedef struct { unsigned num; char *str; } sm_num2str_t;
 
+/* SMBIOS types are 0..255 */
+#define SMBIOS_TYPES		0x100
+
+/* sanity limit for the structure table */
+#define SMBIOS_MAX_TABLE	(1 << 24)
+
+/* SMBIOS entries sorted by type */
+typedef struct smbios_index_s {
+  unsigned len;
+  hd_smbios_t **by_type;
+  unsigned type_start[SMBIOS_TYPES + 1];
+} smbios_index_t;
+
 typedef struct {
   enum sm_map_type type;
   unsigned len;
@@ -35,6 +49,8 @@ static void smbios_id_print(FILE *f, hd_id_t *hid, char *label);
 static void smbios_str_print(FILE *f, char *str, char *label);
 static void smbios_id2str(hd_id_t *hid, sm_str_map_t *map, unsigned def);
 static void smbios_bitmap2str(hd_bitmap_t *hbm, sm_str_map_t *map);
+static int smbios_checksum(unsigned char *data, unsigned len);
+static smbios_index_t *smbios_index(hd_data_t *hd_data);
 
 
 /* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - */
@@ -1276,6 +1292,215 @@ hd_smbios_t *smbios_free(hd_smbios_t *sm)
 }
 
 
+/*
+ * Add entries from a raw SMBIOS structure table.
+ *
+ * structs: number of structures, 0 if not known (SMBIOS 3).
+ * Returns number of entries added.
+ */
+unsigned smbios_add_table(hd_data_t *hd_data, unsigned char *data, unsigned len, unsigned structs)
+{
+  unsigned u, u1, ofs, scnt, type, slen;
+  char *s;
+  hd_smbios_t *sm;
+
+  for(type = 0, u = 0, ofs = 0; (!structs || u < structs) && ofs + 3 < len; u++) {
+    type = data[ofs];
+    slen = data[ofs + 1];
+    if(ofs + slen > len || slen < 4) break;
+    sm = smbios_add_entry(&hd_data->smbios, new_mem(sizeof *sm));
+    sm->any.type = type;
+    sm->any.data_len = slen;
+    sm->any.data = new_mem(slen);
+    memcpy(sm->any.data, data + ofs, slen);
+    sm->any.handle = READ_MEM16(data + ofs + 2);
+    ADD2LOG("  type 0x%02x [0x%04x]: ", type, sm->any.handle);
+    hd_log_hex(hd_data, 0, slen, sm->any.data);
+    ADD2LOG("\n");
+    if(type == sm_end) break;
+    ofs += slen;
+    u1 = ofs;
+    scnt = 0;
+    while(ofs + 1 < len) {
+      if(!data[ofs]) {
+        if(ofs > u1) {
+          s = canon_str(data + u1, strlen(data + u1));
+          add_str_list(&sm->any.strings, s);
+          scnt++;
+          if(*s) ADD2LOG("       str%d: \"%s\"\n", scnt, s);
+          free_mem(s);
+          u1 = ofs + 1;
+        }
+        if(!data[ofs + 1]) {
+          ofs += 2;
+          break;
+        }
+      }
+      ofs++;
+    }
+  }
+
+  if(type == sm_end) {
+    ADD2LOG("  smbios: stopped at end tag\n");
+  }
+  else if(structs && u != structs) {
+    ADD2LOG("  smbios oops: only %d of %d structs found\n", u, structs);
+  }
+
+  return u;
+}
+
+
+/*
+ * Read SMBIOS tables the kernel exports in sysfs.
+ *
+ * Works without /dev/mem access and also for SMBIOS 3 (64 bit) entry
+ * points. If ver is set, store the SMBIOS version there.
+ *
+ * Returns 1 if there was a valid table.
+ */
+int smbios_read_sysfs(hd_data_t *hd_data, unsigned *ver)
+{
+  unsigned char *ep, *table;
+  unsigned ep_len, len, hlen, structs, version = 0;
+  int ok = 0;
+
+  ep = read_bin_file(SYS_DMI_TABLES "/smbios_entry_point", &ep_len, 0x100);
+  if(!ep) return 0;
+
+  structs = 0;
+  if(ep_len >= 0x18 && !memcmp(ep, "_SM3_", 5)) {
+    hlen = ep[6];
+    ok = hlen >= 0x18 && hlen <= ep_len && !smbios_checksum(ep, hlen);
+    version = (ep[7] << 8) + ep[8];
+  }
+  else if(ep_len >= 0x1f && !memcmp(ep, "_SM_", 4)) {
+    hlen = ep[5];
+    ok = hlen >= 0x1e && hlen <= ep_len && !smbios_checksum(ep, hlen);
+    structs = READ_MEM16(ep + 0x1c);
+    version = (ep[6] << 8) + ep[7];
+  }
+  else if(ep_len >= 0x0f && !memcmp(ep, "_DMI_", 5)) {
+    hlen = 0x0f;
+    ok = !smbios_checksum(ep, hlen);
+    structs = READ_MEM16(ep + 0x0c);
+    version = ((ep[0x0e] & 0xf0) << 4) + (ep[0x0e] & 0x0f);
+  }
+
+  if(ok) {
+    ADD2LOG("----- %s -----\n  ", SYS_DMI_TABLES "/smbios_entry_point");
+    hd_log_hex(hd_data, 1, hlen, ep);
+    ADD2LOG("\n");
+  }
+
+  ep = free_mem(ep);
+
+  if(!ok) return 0;
+
+  table = read_bin_file(SYS_DMI_TABLES "/DMI", &len, SMBIOS_MAX_TABLE);
+  if(!table) return 0;
+
+  ADD2LOG("  SMBIOS %u.%u, table size 0x%x\n", version >> 8, version & 0xff, len);
+
+  hd_data->smbios = smbios_free(hd_data->smbios);
+  smbios_free_index(hd_data);
+
+  ok = smbios_add_table(hd_data, table, len, structs) ? 1 : 0;
+
+  free_mem(table);
+
+  if(ok) {
+    smbios_parse(hd_data);
+    if(ver) *ver = version;
+  }
+
+  return ok;
+}
+
+
+int smbios_checksum(unsigned char *data, unsigned len)
+{
+  unsigned char sum = 0;
+
+  while(len--) sum += *data++;
+
+  return sum;
+}
+
+
+/*
+ * Index SMBIOS entries by type.
+ *
+ * Done on first lookup; if there's no SMBIOS data yet, try sysfs.
+ */
+smbios_index_t *smbios_index(hd_data_t *hd_data)
+{
+  smbios_index_t *idx;
+  hd_smbios_t *sm;
+  unsigned u, pos[SMBIOS_TYPES];
+
+  if((idx = hd_data->smbios_index)) return idx;
+
+  if(!hd_data->smbios) smbios_read_sysfs(hd_data, NULL);
+
+  idx = hd_data->smbios_index = new_mem(sizeof *idx);
+
+  /* count entries per type */
+  for(sm = hd_data->smbios; sm; sm = sm->next, idx->len++) {
+    idx->type_start[(sm->any.type & 0xff) + 1]++;
+  }
+
+  if(!idx->len) return idx;
+
+  /* type_start[type] .. type_start[type + 1] - 1 are the entries of 'type' */
+  for(u = 0; u < SMBIOS_TYPES; u++) {
+    idx->type_start[u + 1] += idx->type_start[u];
+    pos[u] = idx->type_start[u];
+  }
+
+  idx->by_type = new_mem(idx->len * sizeof *idx->by_type);
+
+  /* by type, in table order */
+  for(sm = hd_data->smbios; sm; sm = sm->next) {
+    idx->by_type[pos[sm->any.type & 0xff]++] = sm;
+  }
+
+  return idx;
+}
+
+
+/*
+ * Get entry number 'nr' of SMBIOS type 'type'.
+ *
+ * Returns NULL if there's no such entry.
+ */
+hd_smbios_t *smbios_get(hd_data_t *hd_data, hd_smbios_type_t type, unsigned nr)
+{
+  smbios_index_t *idx = smbios_index(hd_data);
+
+  if(type >= SMBIOS_TYPES) return NULL;
+
+  nr += idx->type_start[type];
+
+  return nr < idx->type_start[type + 1] ? idx->by_type[nr] : NULL;
+}
+
+
+/*
+ * Drop SMBIOS index; must be called whenever hd_data->smbios changes.
+ */
+void smbios_free_index(hd_data_t *hd_data)
+{
+  smbios_index_t *idx = hd_data->smbios_index;
+
+  if(!idx) return;
+
+  free_mem(idx->by_type);
+
+  hd_data->smbios_index = free_mem(idx);
+}
+
+
 /*
  * print SMBIOS entries
  */
@@ -2,3 +2,7 @@ hd_smbios_t *smbios_free(hd_smbios_t *sm);
 hd_smbios_t *smbios_add_entry(hd_smbios_t **sm, hd_smbios_t *new_sm);
 void smbios_dump(hd_data_t *hd_data, FILE *f);
 void smbios_parse(hd_data_t *hd_data);
+unsigned smbios_add_table(hd_data_t *hd_data, unsigned char *data, unsigned len, unsigned structs);
+int smbios_read_sysfs(hd_data_t *hd_data, unsigned *ver);
+hd_smbios_t *smbios_get(hd_data_t *hd_data, hd_smbios_type_t type, unsigned nr);
+void smbios_free_index(hd_data_t *hd_data);
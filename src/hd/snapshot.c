@@ -0,0 +1,350 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "hd.h"
+#include "hd_int.h"
+
+/**
+ * @defgroup SNAPSHOTint Columnar hardware list
+ * @ingroup  libhdInternals
+ * @brief Compact column view of a hardware list
+ *
+ * Every column is a plain array of unsigned values, one per entry. Strings
+ * are interned; equal strings get the same id. The filter and group
+ * functions are simple loops over these arrays so the compiler can
+ * vectorize them.
+ *
+ * @{
+ */
+
+#ifndef LIBHD_TINY
+
+/* bytes per row in hd_snapshot_t::hw_class_list */
+#define SNAP_CLASS_BYTES	((hw_all + 7) / 8)
+
+/* use a counting table for group ids below this */
+#define SNAP_COUNT_MAX		4096
+
+typedef struct {
+  unsigned size;		/* power of 2 */
+  unsigned *slot;		/* name ids, 0 = free */
+  hd_snapshot_t *snap;
+} snap_names_t;
+
+static unsigned snap_hash_str(char *str);
+static unsigned snap_name_id(snap_names_t *names, char *str);
+static int snap_cmp_uint(const void *p0, const void *p1);
+
+
+/*
+ * Build column view of hd list.
+ *
+ * Strings are copied; but hd_snapshot_t::hd points into the list.
+ */
+hd_snapshot_t *hd_snapshot(hd_data_t *hd_data, hd_t *hd_list)
+{
+  hd_snapshot_t *snap;
+  snap_names_t names = {};
+  hd_t *hd;
+  unsigned u, rows, max_idx, *row_of_idx;
+  hd_col_t col;
+
+  snap = new_mem(sizeof *snap);
+
+  for(rows = max_idx = 0, hd = hd_list; hd; hd = hd->next) {
+    rows++;
+    if(hd->idx > max_idx) max_idx = hd->idx;
+  }
+
+  snap->rows = rows;
+  snap->hd = new_mem((rows + 1) * sizeof *snap->hd);
+  for(col = 0; col < hd_col_max; col++) {
+    snap->col[col] = new_mem((rows + 1) * sizeof *snap->col[col]);
+  }
+  snap->hw_class_list = new_mem((rows + 1) * SNAP_CLASS_BYTES);
+
+  /* name id 0 is 'no string' */
+  snap->names = 1;
+  snap->name = new_mem(sizeof *snap->name);
+
+  for(names.size = 16; names.size < 2 * 3 * rows; names.size <<= 1);
+  names.slot = new_mem(names.size * sizeof *names.slot);
+  names.snap = snap;
+
+  row_of_idx = new_mem((max_idx + 1) * sizeof *row_of_idx);
+
+  for(u = 0, hd = hd_list; hd; hd = hd->next, u++) {
+    snap->hd[u] = hd;
+    if(hd->idx) row_of_idx[hd->idx] = u + 1;
+
+    snap->col[hd_col_hw_class][u] = hd->hw_class;
+    snap->col[hd_col_bus][u] = hd->bus.id;
+    snap->col[hd_col_base_class][u] = hd->base_class.id;
+    snap->col[hd_col_sub_class][u] = hd->sub_class.id;
+    snap->col[hd_col_prog_if][u] = hd->prog_if.id;
+    snap->col[hd_col_vendor][u] = hd->vendor.id;
+    snap->col[hd_col_device][u] = hd->device.id;
+    snap->col[hd_col_sub_vendor][u] = hd->sub_vendor.id;
+    snap->col[hd_col_sub_device][u] = hd->sub_device.id;
+    snap->col[hd_col_model][u] = snap_name_id(&names, hd->model);
+    snap->col[hd_col_driver][u] = snap_name_id(&names, hd->driver);
+    snap->col[hd_col_dev_name][u] = snap_name_id(&names, hd->unix_dev_name);
+
+    memcpy(snap->hw_class_list + u * SNAP_CLASS_BYTES, hd->hw_class_list, SNAP_CLASS_BYTES);
+  }
+
+  /* second pass: parents may come after their children */
+  for(u = 0; u < rows; u++) {
+    hd = snap->hd[u];
+    snap->col[hd_col_parent][u] =
+      hd->attached_to && hd->attached_to <= max_idx && row_of_idx[hd->attached_to] ?
+        row_of_idx[hd->attached_to] - 1 : HD_SNAPSHOT_NONE;
+  }
+
+  ADD2LOG("snapshot: %u rows, %u names\n", rows, snap->names - 1);
+
+  free_mem(row_of_idx);
+  free_mem(names.slot);
+
+  return snap;
+}
+
+
+/*
+ * Free column view.
+ */
+hd_snapshot_t *hd_free_snapshot(hd_snapshot_t *snap)
+{
+  unsigned u;
+  hd_col_t col;
+
+  if(!snap) return NULL;
+
+  for(u = 0; u < snap->names; u++) free_mem(snap->name[u]);
+  free_mem(snap->name);
+  for(col = 0; col < hd_col_max; col++) free_mem(snap->col[col]);
+  free_mem(snap->hw_class_list);
+  free_mem(snap->hd);
+
+  return free_mem(snap);
+}
+
+
+/*
+ * Allocate row mask with all rows selected.
+ */
+unsigned char *hd_snapshot_mask(hd_snapshot_t *snap)
+{
+  unsigned char *mask;
+
+  mask = new_mem(snap->rows + 1);
+  memset(mask, 1, snap->rows);
+
+  return mask;
+}
+
+
+/*
+ * Unselect rows where column col is not val.
+ *
+ * Returns number of rows still selected.
+ */
+unsigned hd_snapshot_filter(hd_snapshot_t *snap, hd_col_t col, unsigned val, unsigned char *mask)
+{
+  unsigned u, cnt = 0, rows = snap->rows, *c;
+
+  if(col >= hd_col_max) {
+    memset(mask, 0, rows);
+    return 0;
+  }
+
+  c = snap->col[col];
+
+  for(u = 0; u < rows; u++) {
+    mask[u] &= c[u] == val;
+    cnt += mask[u];
+  }
+
+  return cnt;
+}
+
+
+/*
+ * Unselect rows that are not of hardware class item.
+ *
+ * Unlike the hd_col_hw_class column this checks all classes of an entry,
+ * like hd_list() does.
+ *
+ * Returns number of rows still selected.
+ */
+unsigned hd_snapshot_filter_class(hd_snapshot_t *snap, hd_hw_item_t item, unsigned char *mask)
+{
+  unsigned u, cnt = 0, rows = snap->rows;
+  unsigned char *cl, bit;
+
+  if(item >= hw_all) {
+    memset(mask, 0, rows);
+    return 0;
+  }
+
+  cl = snap->hw_class_list + (item >> 3);
+  bit = item & 7;
+
+  for(u = 0; u < rows; u++) {
+    mask[u] &= (cl[u * SNAP_CLASS_BYTES] >> bit) & 1;
+    cnt += mask[u];
+  }
+
+  return cnt;
+}
+
+
+/*
+ * Store indices of selected rows in rows (at least hd_snapshot_t::rows entries).
+ *
+ * Returns number of rows stored.
+ */
+unsigned hd_snapshot_rows(hd_snapshot_t *snap, unsigned char *mask, unsigned *rows)
+{
+  unsigned u, cnt = 0;
+
+  /* branch-free compaction */
+  for(u = 0; u < snap->rows; u++) {
+    rows[cnt] = u;
+    cnt += mask ? mask[u] : 1;
+  }
+
+  return cnt;
+}
+
+
+/*
+ * Count selected rows per distinct value of column col.
+ *
+ * Returns number of groups; *keys and *counts are new arrays of that size,
+ * sorted by key. mask may be NULL to use all rows.
+ */
+unsigned hd_snapshot_group(hd_snapshot_t *snap, hd_col_t col, unsigned char *mask, unsigned **keys, unsigned **counts)
+{
+  unsigned u, groups = 0, rows = snap->rows, max = 0, *c, *tmp, *cnt_tab;
+
+  *keys = *counts = NULL;
+
+  if(col >= hd_col_max || !rows) return 0;
+
+  c = snap->col[col];
+
+  for(u = 0; u < rows; u++) if(c[u] > max) max = c[u];
+
+  if(max < SNAP_COUNT_MAX) {
+    /* small ids (classes, name ids): counting table */
+    cnt_tab = new_mem((max + 1) * sizeof *cnt_tab);
+    for(u = 0; u < rows; u++) cnt_tab[c[u]] += mask ? mask[u] : 1;
+
+    for(u = 0; u <= max; u++) groups += cnt_tab[u] != 0;
+    *keys = new_mem((groups + 1) * sizeof **keys);
+    *counts = new_mem((groups + 1) * sizeof **counts);
+
+    for(groups = u = 0; u <= max; u++) {
+      if(!cnt_tab[u]) continue;
+      (*keys)[groups] = u;
+      (*counts)[groups++] = cnt_tab[u];
+    }
+
+    free_mem(cnt_tab);
+  }
+  else {
+    /* large ids (vendor/device): sort & run-length count */
+    tmp = new_mem((rows + 1) * sizeof *tmp);
+    for(groups = u = 0; u < rows; u++) {
+      tmp[groups] = c[u];
+      groups += mask ? mask[u] : 1;
+    }
+    rows = groups;
+
+    qsort(tmp, rows, sizeof *tmp, snap_cmp_uint);
+
+    for(groups = u = 0; u < rows; u++) groups += !u || tmp[u] != tmp[u - 1];
+    *keys = new_mem((groups + 1) * sizeof **keys);
+    *counts = new_mem((groups + 1) * sizeof **counts);
+
+    for(groups = u = 0; u < rows; u++) {
+      if(!u || tmp[u] != tmp[u - 1]) (*keys)[groups++] = tmp[u];
+      (*counts)[groups - 1]++;
+    }
+
+    free_mem(tmp);
+  }
+
+  return groups;
+}
+
+
+/*
+ * Look up interned string; returns 0 if there is none.
+ */
+unsigned hd_snapshot_name_id(hd_snapshot_t *snap, char *str)
+{
+  unsigned u;
+
+  if(!str) return 0;
+
+  for(u = 1; u < snap->names; u++) {
+    if(!strcmp(snap->name[u], str)) return u;
+  }
+
+  return 0;
+}
+
+
+/*
+ * FNV-1a.
+ */
+unsigned snap_hash_str(char *str)
+{
+  unsigned hash = 2166136261u;
+
+  while(*str) {
+    hash ^= (unsigned char) *str++;
+    hash *= 16777619u;
+  }
+
+  return hash;
+}
+
+
+/*
+ * Intern string; returns its id (0 for NULL).
+ */
+unsigned snap_name_id(snap_names_t *names, char *str)
+{
+  hd_snapshot_t *snap = names->snap;
+  unsigned u, id;
+
+  if(!str) return 0;
+
+  for(u = snap_hash_str(str) & (names->size - 1); (id = names->slot[u]); u = (u + 1) & (names->size - 1)) {
+    if(!strcmp(snap->name[id], str)) return id;
+  }
+
+  id = snap->names++;
+  snap->name = resize_mem(snap->name, snap->names * sizeof *snap->name);
+  snap->name[id] = new_str(str);
+  names->slot[u] = id;
+
+  return id;
+}
+
+
+int snap_cmp_uint(const void *p0, const void *p1)
+{
+  unsigned u0 = *(const unsigned *) p0, u1 = *(const unsigned *) p1;
+
+  return u0 < u1 ? -1 : u0 > u1;
+}
+
+#endif	/* LIBHD_TINY */
+
+/** @} */
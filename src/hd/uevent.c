@@ -0,0 +1,194 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+
+#include "hd.h"
+#include "hd_int.h"
+
+/**
+ * @defgroup UEVENTint Kernel device events
+ * @ingroup libhdINFOint
+ * @brief Read device events from the kernel (NETLINK_KOBJECT_UEVENT).
+ *
+ * @{
+ */
+
+/* kernel events are at most a few kB */
+#define UEVENT_BUFFER_SIZE	8192
+
+/* socket buffer to survive event storms */
+#define UEVENT_RCVBUF		(1 << 20)
+
+
+/** \relates hd_uevent_t
+ * Open a non-blocking socket receiving kernel uevents.
+ *
+ * Returns socket fd or -1.
+ */
+int hd_uevent_open()
+{
+  struct sockaddr_nl nl = { };
+  int fd, size = UEVENT_RCVBUF;
+
+  fd = socket(PF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_KOBJECT_UEVENT);
+  if(fd < 0) return -1;
+
+  /* needs CAP_NET_ADMIN; fall back to the normal limit */
+  if(setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof size)) {
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof size);
+  }
+
+  nl.nl_family = AF_NETLINK;
+  nl.nl_groups = 1;		/* kernel events, not the ones from udev */
+
+  if(bind(fd, (struct sockaddr *) &nl, sizeof nl)) {
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+
+/** \relates hd_uevent_t
+ * Read next event from uevent socket.
+ *
+ * Returns NULL if there is no (valid) event pending. Events not sent by the
+ * kernel are ignored.
+ */
+hd_uevent_t *hd_uevent_read(int fd)
+{
+  char buf[UEVENT_BUFFER_SIZE + 1], *s, *end;
+  struct sockaddr_nl nl;
+  socklen_t nl_len;
+  ssize_t len;
+  hd_uevent_t *uevent;
+
+  for(;;) {
+    nl_len = sizeof nl;
+    len = recvfrom(fd, buf, sizeof buf - 1, 0, (struct sockaddr *) &nl, &nl_len);
+    if(len < 0) {
+      if(errno == EINTR) continue;
+      /* ENOBUFS: we lost events; the caller has to rescan anyway */
+      return NULL;
+    }
+
+    /* only trust the kernel, and skip the 'action@devpath' header */
+    if(
+      nl_len == sizeof nl &&
+      nl.nl_pid == 0 &&
+      len > 0 &&
+      (s = memchr(buf, 0, len)) &&
+      strchr(buf, '@')
+    ) break;
+  }
+
+  buf[len] = 0;
+  end = buf + len;
+
+  uevent = new_mem(sizeof *uevent);
+
+  for(s += 1; s < end; s += strlen(s) + 1) {
+    if(!*s) continue;
+
+    add_str_list(&uevent->env, s);
+
+    if(!strncmp(s, "ACTION=", sizeof "ACTION=" - 1)) {
+      uevent->action = new_str(s + sizeof "ACTION=" - 1);
+    }
+    else if(!strncmp(s, "DEVPATH=", sizeof "DEVPATH=" - 1)) {
+      uevent->devpath = new_str(s + sizeof "DEVPATH=" - 1);
+    }
+    else if(!strncmp(s, "SUBSYSTEM=", sizeof "SUBSYSTEM=" - 1)) {
+      uevent->subsystem = new_str(s + sizeof "SUBSYSTEM=" - 1);
+    }
+    else if(!strncmp(s, "DEVTYPE=", sizeof "DEVTYPE=" - 1)) {
+      uevent->devtype = new_str(s + sizeof "DEVTYPE=" - 1);
+    }
+    else if(!strncmp(s, "DEVNAME=", sizeof "DEVNAME=" - 1)) {
+      uevent->devname = new_str(s + sizeof "DEVNAME=" - 1);
+    }
+    else if(!strncmp(s, "DRIVER=", sizeof "DRIVER=" - 1)) {
+      uevent->driver = new_str(s + sizeof "DRIVER=" - 1);
+    }
+    else if(!strncmp(s, "SEQNUM=", sizeof "SEQNUM=" - 1)) {
+      uevent->seqnum = strtoull(s + sizeof "SEQNUM=" - 1, NULL, 10);
+    }
+  }
+
+  if(!uevent->action || !uevent->devpath) uevent = hd_free_uevent(uevent);
+
+  return uevent;
+}
+
+
+/** \relates hd_uevent_t
+ * Free event.
+ *
+ * Returns NULL.
+ */
+hd_uevent_t *hd_free_uevent(hd_uevent_t *uevent)
+{
+  if(!uevent) return NULL;
+
+  free_mem(uevent->action);
+  free_mem(uevent->devpath);
+  free_mem(uevent->subsystem);
+  free_mem(uevent->devtype);
+  free_mem(uevent->devname);
+  free_mem(uevent->driver);
+  free_str_list(uevent->env);
+
+  return free_mem(uevent);
+}
+
+
+/** \relates hd_uevent_t
+ * Hardware items that have to be rescanned because of an event.
+ *
+ * Returns a 0-terminated list; it is empty if the event is not interesting.
+ */
+const hd_hw_item_t *hd_uevent_hw_items(hd_uevent_t *uevent)
+{
+  static const struct {
+    char *subsystem;
+    hd_hw_item_t items[4];
+  } map[] = {
+    { "block",     { hw_block } },
+    { "scsi",      { hw_block } },
+    { "pci",       { hw_pci } },
+    { "usb",       { hw_usb } },
+    { "net",       { hw_network } },
+    { "input",     { hw_mouse, hw_keyboard, hw_joystick } },
+    { "sound",     { hw_sound } },
+    { "drm",       { hw_display } },
+    { "graphics",  { hw_framebuffer } },
+    { "cpu",       { hw_cpu } },
+    { "memory",    { hw_memory } },
+    { "pcmcia",    { hw_pcmcia } },
+    { "bluetooth", { hw_bluetooth } },
+  };
+  static const hd_hw_item_t none[] = { hw_none };
+  unsigned u;
+
+  if(!uevent || !uevent->subsystem || !uevent->action) return none;
+
+  /* driver changes matter only for pci & usb devices */
+  if(!strcmp(uevent->action, "bind") || !strcmp(uevent->action, "unbind")) {
+    if(strcmp(uevent->subsystem, "usb") && strcmp(uevent->subsystem, "pci")) return none;
+  }
+
+  for(u = 0; u < sizeof map / sizeof *map; u++) {
+    if(!strcmp(uevent->subsystem, map[u].subsystem)) return map[u].items;
+  }
+
+  return none;
+}
+
+/** @} */
@@ -12,6 +12,7 @@
 #include "hd_int.h"
 #include "hddb.h"
 #include "usb.h"
+#include "index.h"
 
 /**
  * @defgroup USBint Universal Serial Bus (USB)
@@ -101,6 +102,9 @@ void get_usb_devs(hd_data_t *hd_data)
   for(sf_bus_e = sf_bus; sf_bus_e; sf_bus_e = sf_bus_e->next) {
     sf_dev = hd_read_sysfs_link("/sys/bus/usb/devices", sf_bus_e->str);
 
+    /* not related to hd_data->only */
+    if(!hd_index_only_sysfs(hd_data, sf_dev)) continue;
+
     if(hd_attr_uint(get_sysfs_attr_by_path(sf_dev, "bNumInterfaces"), &ul0, 0)) {
       add_str_list(&usb_devs, sf_dev);
       ADD2LOG("  usb dev: %s\n", hd_sysfs_id(sf_dev));
@@ -110,6 +114,11 @@ void get_usb_devs(hd_data_t *hd_data)
   for(sf_bus_e = sf_bus; sf_bus_e; sf_bus_e = sf_bus_e->next) {
     sf_dev = new_str(hd_read_sysfs_link("/sys/bus/usb/devices", sf_bus_e->str));
 
+    if(!hd_index_only_sysfs(hd_data, sf_dev)) {
+      sf_dev = free_mem(sf_dev);
+      continue;
+    }
+
     ADD2LOG(
       "  usb device: name = %s\n    path = %s\n",
       sf_bus_e->str,
@@ -645,7 +654,7 @@ void get_input_devs(hd_data_t *hd_data)
       sf_dev = new_str(hd_read_sysfs_link("/sys/class/input", sf_dir_e->str));
     }
 
-    add_input_dev(hd_data, sf_dev);
+    if(hd_index_only_sysfs(hd_data, sf_dev)) add_input_dev(hd_data, sf_dev);
 
     sf_dev = free_mem(sf_dev);
   }
@@ -677,6 +686,8 @@ void get_printer_devs(hd_data_t *hd_data)
 
     str_printf(&sf_cdev, 0, "/sys/class/usb/%s", sf_class_e->str);
 
+    if(!hd_index_only_sysfs(hd_data, sf_cdev)) continue;
+
     ADD2LOG(
       "  usb: name = %s, path = %s\n",
       sf_class_e->str,
@@ -843,6 +854,8 @@ void get_serial_devs(hd_data_t *hd_data)
 
     str_printf(&sf_cdev, 0, "/sys/class/tty/%s", sf_class_e->str);
 
+    if(!hd_index_only_sysfs(hd_data, sf_cdev)) continue;
+
     ADD2LOG(
       "  usb: name = %s, path = %s\n",
       sf_class_e->str,
@@ -7,6 +7,7 @@
 #include <unistd.h>
 #include <time.h>
 #include <getopt.h>
+#include <pthread.h>
 
 #include "../hd/hddb_int.h"
 
@@ -110,6 +111,59 @@ typedef struct item_s {
 } item_t;
 
 
+/* a pair of items, see match_pairs() */
+typedef struct {
+  unsigned row0, row1;		/* list positions, row0 < row1 */
+  unsigned swap:1;		/* check_items(): item_a is item1 */
+  int m, mr, m_all, mr_all;	/* check_items(): match results */
+} item_pair_t;
+
+typedef struct {
+  unsigned len, max;
+  item_pair_t *pair;
+} pair_list_t;
+
+typedef struct {
+  unsigned hash, row;
+} row_hash_t;
+
+typedef struct {
+  unsigned row;
+  skey_t *skey;
+} skey_ref_t;
+
+/* skeys of a group, sorted by hash over some entries */
+typedef struct {
+  unsigned hids;		/* hashed entries (bit mask) */
+  row_hash_t *rh;
+} sig_index_t;
+
+/* skeys with the same entries */
+typedef struct {
+  unsigned mask, exact;		/* see skey_mask() */
+  unsigned len, max;
+  skey_ref_t *ref;
+  unsigned indexes;
+  sig_index_t *index;
+} sig_group_t;
+
+typedef struct {
+  item_t **items;
+  item_pair_t *pair;
+  unsigned len;
+  pthread_t thread;
+  unsigned started:1;
+} match_job_t;
+
+/* positions by hash; the positions in a chain are ascending */
+typedef struct {
+  unsigned *head, *tail;	/* position + 1 per bucket, 0: empty */
+  unsigned max;
+  unsigned *next;		/* position + 1 of next entry in chain */
+} pos_index_t;
+
+#define POS_INDEX_BITS	20
+
 typedef struct hddb_list_s {   
   hddb_entry_mask_t key_mask;
   hddb_entry_mask_t value_mask;
@@ -126,6 +180,14 @@ typedef struct {
   char *strings;
 } hddb_data_t;
 
+/* used to find duplicates, see hddb_store_string() & hddb_store_skey() */
+typedef struct {
+  pos_index_t str;		/* string suffixes */
+  pos_index_t id;		/* ids positions, by value */
+  pos_index_t id2;		/* ids positions, by value & next value */
+  unsigned id_len, id2_len;	/* ids positions indexed so far */
+} hddb_index_t;
+
 
 /* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - */
 #ifdef UCLIBC
@@ -139,6 +201,9 @@ void sort_list(list_t *list, int (*cmp_func)(const void *, const void *));
 unsigned eisa_id(char *s);
 char *eisa_str(unsigned id);
 void write_stats(FILE *f);
+void start_pass(char *name, int log_it);
+void end_pass(void);
+unsigned count_items(list_t *hd);
 
 void read_items(char *file);
 line_t *parse_line(char *str);
@@ -186,6 +251,21 @@ item_t *free_item(item_t *item, int follow_next);
 
 unsigned driver_entry_types(hid_t *hid);
 
+item_t **item_array(list_t *hd, unsigned *len);
+void add_pair(pair_list_t *pl, unsigned row0, unsigned row1);
+int cmp_pair_s(const void *p0, const void *p1);
+void sort_pairs(pair_list_t *pl);
+int cmp_row_hash_s(const void *p0, const void *p1);
+unsigned hash_hid(unsigned hash, hid_t *hid);
+unsigned hash_skey(unsigned hash, skey_t *skey, unsigned hids);
+unsigned hash_key(item_t *item);
+unsigned skey_mask(skey_t *skey, int exact);
+void equal_pairs(pair_list_t *pl, item_t **items, unsigned len, int by_value, int leader_only);
+void match_pairs(pair_list_t *pl, item_t **items, unsigned len);
+void match_pair(item_t *item0, item_t *item1, item_pair_t *pair);
+void *match_thread(void *arg);
+void match_all_pairs(pair_list_t *pl, item_t **items);
+
 void remove_items(list_t *hd);
 void remove_nops(list_t *hd);
 void check_items(list_t *hd);
@@ -217,6 +297,8 @@ struct option options[] = {
   { "join-keys-first", 0, NULL, 14},
   { "combine", 0, NULL, 15},
   { "no-range", 0, NULL, 16},
+  { "stats", 0, NULL, 17},
+  { "threads", 1, NULL, 18},
   { }
 };
 
@@ -225,6 +307,8 @@ list_t hd;
 char *item_ind = NULL;
 FILE *logfh = NULL;
 
+hddb_index_t hddb_index;
+
 struct {
   int debug;
   unsigned sort:1;
@@ -238,6 +322,8 @@ struct {
   unsigned join_keys_first:1;
   unsigned combine:1;		/* always combine driver info */
   unsigned no_range:1;		/* don't create entries with ranges */
+  unsigned stats:1;		/* report time per pass */
+  unsigned threads;		/* for check_items(), default: number of cpus */
   char *logfile;
   char *outfile;
   char *cfile;
@@ -251,12 +337,25 @@ struct {
   unsigned diffs, errors, errors_res;
 } stats;
 
+#define MAX_PASSES	16
+
+/* time per pass, for --stats */
+struct {
+  unsigned len;
+  int current;
+  struct timespec start;
+  struct {
+    char *name;
+    double secs;
+    unsigned items;	/* items after pass */
+  } pass[MAX_PASSES];
+} pass_stats = { current: -1 };
+
 
 /* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - */
 int main(int argc, char **argv)
 {
   int i, close_log = 0, close_cfile = 0;
-  item_t *item;
   FILE *cfile;
 
   for(opterr = 0; (i = getopt_long(argc, argv, "", options, NULL)) != -1; ) {
@@ -327,6 +426,15 @@ int main(int argc, char **argv)
         opt.no_range = 1;
         break;
 
+      case 17:
+        opt.stats = 1;
+        break;
+
+      case 18:
+        opt.threads = strtoul(optarg, NULL, 0);
+        if(!opt.threads) opt.threads = 1;
+        break;
+
       default:
         fprintf(stderr,
           "Usage: check_hd [options] files\n"
@@ -341,6 +449,8 @@ int main(int argc, char **argv)
           "  \t\t\tcommon keys first (default is common values first)\n"
           "  --cfile file\t\tcreate C file to be included in libhd\n"
           "  --no-compact\t\tdon't try to make C version as small as possible\n"
+          "  --stats\t\treport time spent in each pass\n"
+          "  --threads n\t\tuse n threads for consistency checks, default: number of cpus\n"
           "  --out file\t\twrite results to file, default is \"hd.ids\"\n"
           "  --log file\t\twrite log info to file, default is \"hd.log\"\n\n"
           "  Note: check_hd works with libhd/hwinfo internal format only;\n"
@@ -362,43 +472,43 @@ int main(int argc, char **argv)
     logfh = stdout;
   }
 
+  if(!opt.threads) {
+    i = sysconf(_SC_NPROCESSORS_ONLN);
+    opt.threads = i > 0 ? i : 1;
+  }
+
+  start_pass("reading data", 0);
+
   for(argv += optind; *argv; argv++) {
     read_items(*argv);
   }
 
-  for(item = hd.first; item; item = item->next) stats.items_in++;
+  stats.items_in = count_items(&hd);
 
-  fprintf(logfh, "- removing useless entries\n");
-  fflush(logfh);
+  start_pass("removing useless entries", 1);
   remove_nops(&hd);
 
   if(opt.mini) {
-    fprintf(logfh, "- building mini version\n");
-    fflush(logfh);
+    start_pass("building mini version", 1);
     remove_unimportant_items(&hd);
   }
 
   if(opt.check || opt.split) {
-    fprintf(logfh, "- splitting entries\n");
-    fflush(logfh);
+    start_pass("splitting entries", 1);
     split_items(&hd);
   }
 
   if(opt.check) {
-    fprintf(logfh, "- combining driver info\n");
-    fflush(logfh);
+    start_pass("combining driver info", 1);
     combine_driver(&hd);
 
-    fprintf(logfh, "- combining requires info\n");
-    fflush(logfh);
+    start_pass("combining requires info", 1);
     combine_requires(&hd);
 
-    fprintf(logfh, "- checking for consistency\n");
-    fflush(logfh);
+    start_pass("checking for consistency", 1);
     check_items(&hd);
 
-    fprintf(logfh, "- join items\n");
-    fflush(logfh);
+    start_pass("join items", 1);
     if(opt.join_keys_first) {
       join_items_by_key(&hd);
       join_items_by_value(&hd);
@@ -412,13 +522,13 @@ int main(int argc, char **argv)
   }
 
   if(opt.sort) {
-    fprintf(logfh, "- sorting\n");
-    fflush(logfh);
+    start_pass("sorting", 1);
     sort_list(&hd, cmp_item_s);
   }
 
-  for(item = hd.first; item; item = item->next) stats.items_out++;
+  stats.items_out = count_items(&hd);
 
+  start_pass("writing data", 0);
   write_items(opt.outfile, &hd);
 
   if(opt.cfile) {
@@ -434,6 +544,8 @@ int main(int argc, char **argv)
       cfile = stdout;
     }
 
+    start_pass("building C version", 0);
+
     split_items(&hd);
 
     write_cfile(cfile, &hd);
@@ -441,6 +553,8 @@ int main(int argc, char **argv)
     if(close_cfile) fclose(cfile);
   }
 
+  end_pass();
+
   fprintf(logfh, "- statistics\n");
   write_stats(logfh);
   if(logfh != stdout) {
@@ -562,12 +676,69 @@ char *eisa_str(unsigned id)
 
 void write_stats(FILE *f)
 {
+  int i;
+
   fprintf(f, "  %u inconsistencies%s\n", stats.diffs, stats.diffs ? " fixed" : "");
   fprintf(f, "  %u errors", stats.errors + stats.errors_res);
   if(stats.errors_res) fprintf(f, ", %u resolved", stats.errors_res);
   fprintf(f, "\n");
   fprintf(f, "  %u items in\n", stats.items_in);
   fprintf(f, "  %u items out\n", stats.items_out);
+
+  if(opt.stats) {
+    for(i = 0; (unsigned) i < pass_stats.len; i++) {
+      fprintf(f, "  %-26s %8.3f s, %6u items\n",
+        pass_stats.pass[i].name, pass_stats.pass[i].secs, pass_stats.pass[i].items
+      );
+    }
+  }
+}
+
+
+/*
+ * Start timing a new pass (and finish the current one).
+ */
+void start_pass(char *name, int log_it)
+{
+  end_pass();
+
+  if(log_it) {
+    fprintf(logfh, "- %s\n", name);
+    fflush(logfh);
+  }
+
+  if(pass_stats.len >= MAX_PASSES) return;
+
+  pass_stats.current = pass_stats.len++;
+  pass_stats.pass[pass_stats.current].name = name;
+  clock_gettime(CLOCK_MONOTONIC, &pass_stats.start);
+}
+
+
+void end_pass()
+{
+  struct timespec ts;
+
+  if(pass_stats.current < 0) return;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  pass_stats.pass[pass_stats.current].secs =
+    (ts.tv_sec - pass_stats.start.tv_sec) + (ts.tv_nsec - pass_stats.start.tv_nsec) / 1e9;
+  pass_stats.pass[pass_stats.current].items = count_items(&hd);
+
+  pass_stats.current = -1;
+}
+
+
+unsigned count_items(list_t *hd)
+{
+  item_t *item;
+  unsigned cnt = 0;
+
+  for(item = hd->first; item; item = item->next) cnt++;
+
+  return cnt;
 }
 
 
@@ -2033,6 +2204,417 @@ unsigned driver_entry_types(hid_t *hid)
 }
 
 
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - */
+/*
+ * Item pairs.
+ *
+ * The passes below look at pairs of items (item0 before item1 in the list).
+ * Instead of trying every pair they get a list of candidate pairs, found
+ * by hashing keys or values; it is sorted by list position so the items
+ * are processed in the same order as before. Pairs not in the list are
+ * known to be left alone by the pass.
+ */
+
+item_t **item_array(list_t *hd, unsigned *len)
+{
+  item_t *item, **items;
+  unsigned u;
+
+  *len = count_items(hd);
+  items = new_mem((*len + 1) * sizeof *items);
+
+  for(u = 0, item = hd->first; item; item = item->next) items[u++] = item;
+
+  return items;
+}
+
+
+void add_pair(pair_list_t *pl, unsigned row0, unsigned row1)
+{
+  item_pair_t *pair;
+
+  if(pl->len == pl->max) {
+    pl->max = pl->max ? 2 * pl->max : 0x1000;
+    pl->pair = realloc(pl->pair, pl->max * sizeof *pl->pair);
+  }
+
+  pair = pl->pair + pl->len++;
+  memset(pair, 0, sizeof *pair);
+  pair->row0 = row0 < row1 ? row0 : row1;
+  pair->row1 = row0 < row1 ? row1 : row0;
+}
+
+
+/* wrapper for qsort */
+int cmp_pair_s(const void *p0, const void *p1)
+{
+  const item_pair_t *pair0 = p0, *pair1 = p1;
+
+  if(pair0->row0 != pair1->row0) return pair0->row0 < pair1->row0 ? -1 : 1;
+
+  return pair0->row1 < pair1->row1 ? -1 : pair0->row1 > pair1->row1;
+}
+
+
+/*
+ * Sort pairs and drop duplicates.
+ */
+void sort_pairs(pair_list_t *pl)
+{
+  unsigned u, len;
+
+  if(!pl->len) return;
+
+  qsort(pl->pair, pl->len, sizeof *pl->pair, cmp_pair_s);
+
+  for(len = 1, u = 1; u < pl->len; u++) {
+    if(cmp_pair_s(pl->pair + u, pl->pair + len - 1)) pl->pair[len++] = pl->pair[u];
+  }
+
+  pl->len = len;
+}
+
+
+/* wrapper for qsort */
+int cmp_row_hash_s(const void *p0, const void *p1)
+{
+  const row_hash_t *rh0 = p0, *rh1 = p1;
+
+  if(rh0->hash != rh1->hash) return rh0->hash < rh1->hash ? -1 : 1;
+
+  return rh0->row < rh1->row ? -1 : rh0->row > rh1->row;
+}
+
+
+/*
+ * FNV-1a over hid; equal hids (cmp_hid() == 0) get equal hashes.
+ */
+unsigned hash_hid(unsigned hash, hid_t *hid)
+{
+  str_t *str;
+  unsigned char *s;
+
+  hash = (hash ^ hid->any.flag) * 16777619u;
+
+  if(hid->any.flag == FLAG_STRING) {
+    for(str = hid->str.list.first; str; str = str->next) {
+      for(s = (unsigned char *) str->str; *s; s++) hash = (hash ^ *s) * 16777619u;
+      hash = (hash ^ 0x100) * 16777619u;
+    }
+  }
+  else if(hid->any.flag == FLAG_ID) {
+    hash = (hash ^ hid->num.tag) * 16777619u;
+    hash = (hash ^ hid->num.id) * 16777619u;
+  }
+
+  return hash;
+}
+
+
+/*
+ * Hash over skey entries in hids (bit mask).
+ */
+unsigned hash_skey(unsigned hash, skey_t *skey, unsigned hids)
+{
+  int i;
+
+  if(!skey) return (hash ^ 0x200) * 16777619u;
+
+  for(i = 0; (unsigned) i < sizeof skey->hid / sizeof *skey->hid; i++) {
+    if(skey->hid[i] && (hids & (1 << i))) {
+      hash = (hash ^ i) * 16777619u;
+      hash = hash_hid(hash, skey->hid[i]);
+    }
+  }
+
+  return hash;
+}
+
+
+unsigned hash_key(item_t *item)
+{
+  unsigned hash = 2166136261u;
+  skey_t *skey;
+
+  for(skey = item->key.first; skey; skey = skey->next) {
+    hash = hash_skey(hash, skey, -1u);
+    hash = (hash ^ 0x300) * 16777619u;
+  }
+
+  return hash;
+}
+
+
+/*
+ * Defined skey entries (exact = 0) or those with a single id or string
+ * (exact = 1) as bit mask.
+ */
+unsigned skey_mask(skey_t *skey, int exact)
+{
+  int i;
+  unsigned mask = 0;
+  hid_t *hid;
+
+  for(i = 0; (unsigned) i < sizeof skey->hid / sizeof *skey->hid; i++) {
+    if(!(hid = skey->hid[i])) continue;
+    if(
+      !exact ||
+      hid->any.flag == FLAG_STRING ||
+      (hid->any.flag == FLAG_ID && !hid->num.has.range && !hid->num.has.mask)
+    ) mask |= 1 << i;
+  }
+
+  return mask;
+}
+
+
+/*
+ * Pairs of items with identical keys (by_value = 0) or values (by_value = 1).
+ *
+ * leader_only: just pairs with the first item of each set of equal items.
+ */
+void equal_pairs(pair_list_t *pl, item_t **items, unsigned len, int by_value, int leader_only)
+{
+  row_hash_t *rh;
+  unsigned u, v, i, j, leaders, *leader = NULL;
+  int eq;
+
+  rh = new_mem((len + 1) * sizeof *rh);
+
+  for(u = 0; u < len; u++) {
+    rh[u].row = u;
+    rh[u].hash = by_value ? hash_skey(2166136261u, items[u]->value, -1u) : hash_key(items[u]);
+  }
+
+  qsort(rh, len, sizeof *rh, cmp_row_hash_s);
+
+  for(u = 0; u < len; u = v) {
+    for(v = u + 1; v < len && rh[v].hash == rh[u].hash; v++);
+    if(v - u < 2) continue;
+
+    if(leader_only) {
+      leader = realloc(leader, (v - u) * sizeof *leader);
+      for(leaders = 0, i = u; i < v; i++) {
+        for(j = 0; j < leaders; j++) {
+          if(!cmp_skey(items[leader[j]]->value, items[rh[i].row]->value)) break;
+        }
+        if(j < leaders) {
+          add_pair(pl, leader[j], rh[i].row);
+        }
+        else {
+          leader[leaders++] = rh[i].row;
+        }
+      }
+    }
+    else {
+      for(i = u; i < v; i++) {
+        for(j = i + 1; j < v; j++) {
+          if(by_value) {
+            eq = !cmp_skey(items[rh[i].row]->value, items[rh[j].row]->value);
+          }
+          else {
+            eq = cmp_item(items[rh[i].row], items[rh[j].row]);
+            eq = eq != 1 && eq != -1;
+          }
+          if(eq) add_pair(pl, rh[i].row, rh[j].row);
+        }
+      }
+    }
+  }
+
+  free_mem(leader);
+  free_mem(rh);
+
+  sort_pairs(pl);
+}
+
+
+/*
+ * Pairs of items that might match (match_item() != 0 in either direction).
+ *
+ * An skey can only match one that has a subset of its entries; where both
+ * have a single id or string, these must be equal. So group all skeys by
+ * their entry masks and look up the matching ones per group, using a hash
+ * over the entries that are exact in both skeys.
+ */
+void match_pairs(pair_list_t *pl, item_t **items, unsigned len)
+{
+  sig_group_t *groups = NULL, *g;
+  sig_index_t *idx;
+  skey_t *skey;
+  unsigned u, v, w, mask, exact, hids, hash, group_cnt = 0, lo, hi;
+
+  /* sort all skeys into groups */
+  for(u = 0; u < len; u++) {
+    for(skey = items[u]->key.first; skey; skey = skey->next) {
+      mask = skey_mask(skey, 0);
+      exact = skey_mask(skey, 1);
+      for(v = 0; v < group_cnt; v++) {
+        if(groups[v].mask == mask && groups[v].exact == exact) break;
+      }
+      if(v == group_cnt) {
+        groups = realloc(groups, ++group_cnt * sizeof *groups);
+        memset(groups + v, 0, sizeof *groups);
+        groups[v].mask = mask;
+        groups[v].exact = exact;
+      }
+      g = groups + v;
+      if(g->len == g->max) {
+        g->max = g->max ? 2 * g->max : 0x100;
+        g->ref = realloc(g->ref, g->max * sizeof *g->ref);
+      }
+      g->ref[g->len].row = u;
+      g->ref[g->len++].skey = skey;
+    }
+  }
+
+  for(u = 0; u < len; u++) {
+    for(skey = items[u]->key.first; skey; skey = skey->next) {
+      mask = skey_mask(skey, 0);
+      exact = skey_mask(skey, 1);
+      for(g = groups; g < groups + group_cnt; g++) {
+        if((g->mask & ~mask)) continue;
+
+        hids = g->exact & exact;
+
+        if(!hids) {
+          for(v = 0; v < g->len; v++) {
+            if(g->ref[v].row != u) add_pair(pl, u, g->ref[v].row);
+          }
+          continue;
+        }
+
+        /* get hash index over hids, build it if necessary */
+        for(v = 0; v < g->indexes; v++) {
+          if(g->index[v].hids == hids) break;
+        }
+        if(v == g->indexes) {
+          g->index = realloc(g->index, ++g->indexes * sizeof *g->index);
+          idx = g->index + v;
+          idx->hids = hids;
+          idx->rh = new_mem((g->len + 1) * sizeof *idx->rh);
+          for(w = 0; w < g->len; w++) {
+            idx->rh[w].row = g->ref[w].row;
+            idx->rh[w].hash = hash_skey(2166136261u, g->ref[w].skey, hids);
+          }
+          qsort(idx->rh, g->len, sizeof *idx->rh, cmp_row_hash_s);
+        }
+        idx = g->index + v;
+
+        hash = hash_skey(2166136261u, skey, hids);
+
+        for(lo = 0, hi = g->len; lo < hi;) {
+          w = (lo + hi) / 2;
+          if(idx->rh[w].hash < hash) lo = w + 1; else hi = w;
+        }
+
+        for(; lo < g->len && idx->rh[lo].hash == hash; lo++) {
+          if(idx->rh[lo].row != u) add_pair(pl, u, idx->rh[lo].row);
+        }
+      }
+    }
+  }
+
+  for(g = groups; g < groups + group_cnt; g++) {
+    for(v = 0; v < g->indexes; v++) free_mem(g->index[v].rh);
+    free_mem(g->index);
+    free_mem(g->ref);
+  }
+  free_mem(groups);
+
+  sort_pairs(pl);
+}
+
+
+/*
+ * Compare the keys of a pair for check_items().
+ *
+ * Depends on the keys only, so it's safe to run in parallel.
+ */
+void match_pair(item_t *item0, item_t *item1, item_pair_t *pair)
+{
+  int i, m, mr, m_all, mr_all, swap = 0;
+
+  m = match_item(item0, item1, match_any);
+  mr = match_item(item1, item0, match_any);
+
+  m_all = mr_all = 0;
+
+  if(m && mr) {
+    m_all = match_item(item0, item1, match_all);
+    mr_all = match_item(item1, item0, match_all);
+    if(mr_all) {
+      swap = 1;
+      i = m_all; m_all = mr_all; mr_all = i;
+      i = m; m = mr; mr = i;
+    }
+  }
+  else if(mr && !m) {
+    swap = 1;
+    m = mr; mr = 0;
+  }
+
+  if(m && !mr) {
+    m_all = match_item(swap ? item1 : item0, swap ? item0 : item1, match_all);
+    mr_all = match_item(swap ? item0 : item1, swap ? item1 : item0, match_all);
+  }
+
+  pair->swap = swap;
+  pair->m = m;
+  pair->mr = mr;
+  pair->m_all = m_all;
+  pair->mr_all = mr_all;
+}
+
+
+void *match_thread(void *arg)
+{
+  match_job_t *job = arg;
+  unsigned u;
+
+  for(u = 0; u < job->len; u++) {
+    match_pair(job->items[job->pair[u].row0], job->items[job->pair[u].row1], job->pair + u);
+  }
+
+  return NULL;
+}
+
+
+/*
+ * Run match_pair() on all pairs, using opt.threads threads.
+ */
+void match_all_pairs(pair_list_t *pl, item_t **items)
+{
+  match_job_t *job;
+  unsigned u, threads, chunk;
+
+  threads = opt.threads;
+  if(threads > pl->len / 256 + 1) threads = pl->len / 256 + 1;
+
+  job = new_mem(threads * sizeof *job);
+
+  chunk = (pl->len + threads - 1) / threads;
+
+  for(u = 0; u < threads; u++) {
+    job[u].items = items;
+    job[u].pair = pl->pair + u * chunk;
+    job[u].len = u * chunk >= pl->len ? 0 : pl->len - u * chunk < chunk ? pl->len - u * chunk : chunk;
+    job[u].started = u && !pthread_create(&job[u].thread, NULL, match_thread, job + u);
+  }
+
+  /* the rest is done right here */
+  for(u = 0; u < threads; u++) {
+    if(!job[u].started) match_thread(job + u);
+  }
+
+  for(u = 0; u < threads; u++) {
+    if(job[u].started) pthread_join(job[u].thread, NULL);
+  }
+
+  free_mem(job);
+}
+
+
 /* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - */
 void remove_items(list_t *hd)
 {
@@ -2114,52 +2696,41 @@ void split_items(list_t *hd)
 
 void check_items(list_t *hd)
 {
-  int i, j, k, m, mr, m_all, mr_all, c_ident, c_diff, c_crit;
+  int i, j, k, c_ident, c_diff, c_crit;
   char *s;
-  item_t *item0, *item1, *item_a, *item_b;
-  unsigned *stat_cnt;
+  item_t **items, *item0, *item1, *item_a, *item_b;
+  unsigned *stat_cnt, u, v, w, len;
+  pair_list_t pl = {};
+  item_pair_t *pair;
 
-  for(item0 = hd->first; item0; item0 = item0->next) {
-    if(item0->remove) continue;
-    for(item1 = item0->next; item1 && !item0->remove; item1 = item1->next) {
-      if(item1->remove) continue;
+  items = item_array(hd, &len);
 
-      item_a = item0; item_b = item1;
+  /* the keys don't change here, so compare them all in advance */
+  match_pairs(&pl, items, len);
+  match_all_pairs(&pl, items);
 
-      m = match_item(item0, item1, match_any);
-      mr = match_item(item1, item0, match_any);
-
-      m_all = mr_all = 0;
-
-      if(m && mr) {
-        m_all = match_item(item0, item1, match_all);
-        mr_all = match_item(item1, item0, match_all);
-        if(mr_all) {
-          item_a = item1; item_b = item0;
-          i = m_all; m_all = mr_all; mr_all = i;
-          i = m; m = mr; mr = i;
-        }
-      }
-      else if(mr && !m) {
-        item_a = item1; item_b = item0;
-        m = mr; mr = 0;
-      }
+  for(u = 0; u < pl.len; u = v) {
+    item0 = items[pl.pair[u].row0];
+    for(v = u + 1; v < pl.len && pl.pair[v].row0 == pl.pair[u].row0; v++);
+    if(item0->remove) continue;
+    for(w = u; w < v && !item0->remove; w++) {
+      pair = pl.pair + w;
+      item1 = items[pair->row1];
+      if(item1->remove) continue;
 
-      if(m && !mr) {
-        m_all = match_item(item_a, item_b, match_all);
-        mr_all = match_item(item_b, item_a, match_all);
-      }
+      item_a = pair->swap ? item1 : item0;
+      item_b = pair->swap ? item0 : item1;
 
-      if(m) {
+      if(pair->m) {
 #if 0
         fprintf(
           logfh, "a = %s, b = %s, m = %d, mr = %d, m_all = %d, mr_all = %d\n",
           item_a->pos, item_b->pos,
-          m, mr, m_all, mr_all
+          pair->m, pair->mr, pair->m_all, pair->mr_all
         );
 #endif
 
-        if(m_all) {
+        if(pair->m_all) {
           /*
            * item_b matches (at least) everything that item_a does
            * (item_a is a special case of item_b)
@@ -2283,6 +2854,9 @@ void check_items(list_t *hd)
     }
   }
 
+  free_mem(pl.pair);
+  free_mem(items);
+
   remove_items(hd);
 }
 
@@ -2290,19 +2864,27 @@ void check_items(list_t *hd)
 void combine_driver(list_t *hd)
 {
   int i;
-  item_t *item0, *item1, *item_a, *item_b;
+  item_t **items, *item0, *item1, *item_a, *item_b;
   hid_t *hid0, *hid1, *new_hid, *hid_a, *hid_b;
   str_t *str0, *str1, *tmp_str, *last_str;
-  unsigned type0, type1;
+  unsigned type0, type1, u, v, w, len;
+  pair_list_t pl = {};
 
-  for(item0 = hd->first; item0; item0 = item0->next) {
+  /* only items with identical keys are combined */
+  items = item_array(hd, &len);
+  equal_pairs(&pl, items, len, 0, 0);
+
+  for(u = 0; u < pl.len; u = v) {
+    item0 = items[pl.pair[u].row0];
+    for(v = u + 1; v < pl.len && pl.pair[v].row0 == pl.pair[u].row0; v++);
     if(
       item0->remove ||
       !item0->value ||
       !(hid0 = item0->value->hid[he_driver]) ||
       hid0->any.flag != FLAG_STRING
     ) continue;
-    for(item1 = item0->next; item1 && !item0->remove; item1 = item1->next) {
+    for(w = u; w < v && !item0->remove; w++) {
+      item1 = items[pl.pair[w].row1];
       hid0 = item0->value->hid[he_driver];
       if(
         item1->remove ||
@@ -2394,6 +2976,9 @@ void combine_driver(list_t *hd)
     }
   }
 
+  free_mem(pl.pair);
+  free_mem(items);
+
   remove_items(hd);
 }
 
@@ -2401,19 +2986,28 @@ void combine_driver(list_t *hd)
 void combine_requires(list_t *hd)
 {
   int i;
-  item_t *item0, *item1;
+  item_t **items, *item0, *item1;
   hid_t *hid0, *hid1;
   list_t slist = {};
   str_t *str, *str0, *str1;
+  unsigned u, v, w, len;
+  pair_list_t pl = {};
 
-  for(item0 = hd->first; item0; item0 = item0->next) {
+  /* only items with identical keys are combined */
+  items = item_array(hd, &len);
+  equal_pairs(&pl, items, len, 0, 0);
+
+  for(u = 0; u < pl.len; u = v) {
+    item0 = items[pl.pair[u].row0];
+    for(v = u + 1; v < pl.len && pl.pair[v].row0 == pl.pair[u].row0; v++);
     if(
       item0->remove ||
       !item0->value ||
       !(hid0 = item0->value->hid[he_requires]) ||
       hid0->any.flag != FLAG_STRING
     ) continue;
-    for(item1 = item0->next; item1; item1 = item1->next) {
+    for(w = u; w < v; w++) {
+      item1 = items[pl.pair[w].row1];
       if(
         item1->remove ||
         !item1->value ||
@@ -2485,19 +3079,31 @@ void combine_requires(list_t *hd)
     }
   }
 
+  free_mem(pl.pair);
+  free_mem(items);
+
   remove_items(hd);
 }
 
 
 void join_items_by_value(list_t *hd)
 {
-  item_t *item0, *item1;
+  item_t **items, *item0, *item1;
   skey_t *skey, *next;
   int i;
+  unsigned u, v, w, len;
+  pair_list_t pl = {};
 
-  for(item0 = hd->first; item0; item0 = item0->next) {
+  /* all items go to the first one with the same value */
+  items = item_array(hd, &len);
+  equal_pairs(&pl, items, len, 1, 1);
+
+  for(u = 0; u < pl.len; u = v) {
+    item0 = items[pl.pair[u].row0];
+    for(v = u + 1; v < pl.len && pl.pair[v].row0 == pl.pair[u].row0; v++);
     if(item0->remove) continue;
-    for(item1 = item0->next; item1; item1 = item1->next) {
+    for(w = u; w < v; w++) {
+      item1 = items[pl.pair[w].row1];
       if(item1->remove) continue;
 
       if(!cmp_skey(item0->value, item1->value)) {
@@ -2512,6 +3118,9 @@ void join_items_by_value(list_t *hd)
     }
   }
 
+  free_mem(pl.pair);
+  free_mem(items);
+
   remove_items(hd);
 
   for(item0 = hd->first; item0; item0 = item0->next) {
@@ -2538,14 +3147,23 @@ void join_items_by_value(list_t *hd)
 
 void join_items_by_key(list_t *hd)
 {
-  item_t *item0, *item1;
+  item_t **items, *item0, *item1;
   skey_t *val0, *val1;
   int i;
+  unsigned u, v, w, len;
+  pair_list_t pl = {};
 
-  for(item0 = hd->first; item0; item0 = item0->next) {
+  /* only items with identical keys are joined */
+  items = item_array(hd, &len);
+  equal_pairs(&pl, items, len, 0, 0);
+
+  for(u = 0; u < pl.len; u = v) {
+    item0 = items[pl.pair[u].row0];
+    for(v = u + 1; v < pl.len && pl.pair[v].row0 == pl.pair[u].row0; v++);
     if(item0->remove) continue;
     val0 = item0->value;
-    for(item1 = item0->next; item1; item1 = item1->next) {
+    for(w = u; w < v; w++) {
+      item1 = items[pl.pair[w].row1];
       if(item1->remove) continue;
 
       i = cmp_item(item0, item1);
@@ -2569,6 +3187,9 @@ void join_items_by_key(list_t *hd)
     }
   }
 
+  free_mem(pl.pair);
+  free_mem(items);
+
   remove_items(hd);
 }
 
@@ -2646,16 +3267,105 @@ void add_value(tmp_entry_t *te, hddb_entry_t idx, unsigned val)
 
 
 
+void pos_index_add(pos_index_t *pi, unsigned hash, unsigned pos)
+{
+  hash = (hash ^ hash >> POS_INDEX_BITS) & ((1 << POS_INDEX_BITS) - 1);
+
+  if(!pi->head) {
+    pi->head = new_mem((1 << POS_INDEX_BITS) * sizeof *pi->head);
+    pi->tail = new_mem((1 << POS_INDEX_BITS) * sizeof *pi->tail);
+  }
+
+  if(pos >= pi->max) {
+    pi->max = pos + 0x10000;
+    pi->next = realloc(pi->next, pi->max * sizeof *pi->next);
+  }
+
+  pi->next[pos] = 0;
+
+  if(pi->tail[hash]) {
+    pi->next[pi->tail[hash] - 1] = pos + 1;
+  }
+  else {
+    pi->head[hash] = pos + 1;
+  }
+  pi->tail[hash] = pos + 1;
+}
+
+
+/*
+ * Iterate over positions with hash (ascending).
+ *
+ * pos is -1 to start; returns next position or -1.
+ */
+unsigned pos_index_next(pos_index_t *pi, unsigned hash, unsigned pos)
+{
+  if(!pi->head) return -1;
+
+  if(pos == -1u) {
+    pos = pi->head[(hash ^ hash >> POS_INDEX_BITS) & ((1 << POS_INDEX_BITS) - 1)];
+  }
+  else {
+    pos = pi->next[pos];
+  }
+
+  return pos - 1;
+}
+
+
+void pos_index_free(pos_index_t *pi)
+{
+  free(pi->head);
+  free(pi->tail);
+  free(pi->next);
+
+  memset(pi, 0, sizeof *pi);
+}
+
+
+/*
+ * Hash over str[0 .. len - 1], starting at the end.
+ *
+ * So we get the hashes of all suffixes of a string in one go.
+ */
+unsigned hash_suffix(unsigned hash, char *str, unsigned len)
+{
+  while(len--) hash = hash * 31 + (unsigned char) str[len];
+
+  return hash;
+}
+
+
+/*
+ * Remember all suffixes of a string we just stored.
+ */
+void hddb_index_string(hddb_data_t *hddb, unsigned ofs, unsigned len)
+{
+  unsigned hash = 0;
+
+  while(len--) {
+    hash = hash * 31 + (unsigned char) hddb->strings[ofs + len];
+    pos_index_add(&hddb_index.str, hash, ofs + len);
+  }
+}
+
+
 unsigned hddb_store_string(hddb_data_t *hddb, char *str)
 {
   unsigned l = strlen(str), u;
-  char *s;
 
   if(!opt.no_compact) {
-    /* maybe we already have it... */
+    /*
+     * Maybe we already have it...
+     *
+     * Note: this finds the same (1st) match as a plain memmem() over
+     * hddb->strings would.
+     */
     if(l && l < hddb->strings_len) {
-      s = memmem(hddb->strings, hddb->strings_len, str, l + 1);
-      if(s) return s - hddb->strings;
+      u = hash_suffix(0, str, l);
+      for(u = pos_index_next(&hddb_index.str, u, -1); u != -1u; u = pos_index_next(&hddb_index.str, 0, u)) {
+        if(!strcmp(hddb->strings + u, str)) return u;
+      }
     }
   }
 
@@ -2675,6 +3385,8 @@ unsigned hddb_store_string(hddb_data_t *hddb, char *str)
   strcpy(hddb->strings + (u = hddb->strings_len), str);
   hddb->strings_len += l + 1;
 
+  if(!opt.no_compact) hddb_index_string(hddb, u, l);
+
   return u;
 }
 
@@ -2732,10 +3444,35 @@ unsigned hddb_store_hid(hddb_data_t *hddb, hid_t *hid, hddb_entry_t entry)
 }
 
 
+/*
+ * Add ids positions up to len to the ids indexes.
+ *
+ * hddb_index.id has all positions, hddb_index.id2 all positions that have
+ * a successor.
+ */
+void hddb_index_ids(hddb_data_t *hddb, unsigned len)
+{
+  unsigned *ids = hddb->ids;
+
+  for(; hddb_index.id_len < len; hddb_index.id_len++) {
+    pos_index_add(&hddb_index.id, ids[hddb_index.id_len] * 16777619u, hddb_index.id_len);
+  }
+
+  for(; hddb_index.id2_len + 1 < len; hddb_index.id2_len++) {
+    pos_index_add(
+      &hddb_index.id2,
+      ids[hddb_index.id2_len] * 16777619u ^ ids[hddb_index.id2_len + 1] * 2654435761u,
+      hddb_index.id2_len
+    );
+  }
+}
+
+
 void hddb_store_skey(hddb_data_t *hddb, skey_t *skey, unsigned *mask, unsigned *idx)
 {
   int i, j, end;
-  unsigned ent;
+  unsigned ent, *new_ids;
+  pos_index_t *pi;
   hddb_data_t save_db = *hddb;
 
   *mask = 0;
@@ -2756,9 +3493,22 @@ void hddb_store_skey(hddb_data_t *hddb, skey_t *skey, unsigned *mask, unsigned *
     if(save_db.ids_len && hddb->ids_len > save_db.ids_len) {
       j = hddb->ids_len - save_db.ids_len;
       end = save_db.ids_len - j;
-      /* this is pretty slow, but avoids memmem() alignment problems */
-      for(i = 0; i < end; i++) {
-        if(!memcmp(hddb->ids + i, hddb->ids + save_db.ids_len, j * sizeof *hddb->ids)) {
+      /*
+       * Look up candidate positions by the 1st (two) value(s) instead of
+       * trying every position - it's the same 1st match as before.
+       */
+      hddb_index_ids(hddb, save_db.ids_len);
+      new_ids = hddb->ids + save_db.ids_len;
+      if(j == 1) {
+        pi = &hddb_index.id;
+        ent = new_ids[0] * 16777619u;
+      }
+      else {
+        pi = &hddb_index.id2;
+        ent = new_ids[0] * 16777619u ^ new_ids[1] * 2654435761u;
+      }
+      for(i = pos_index_next(pi, ent, -1); i != -1 && i < end; i = pos_index_next(pi, 0, i)) {
+        if(!memcmp(hddb->ids + i, new_ids, j * sizeof *hddb->ids)) {
           /* remove new id entries and return existing entry */
           hddb->ids_len = save_db.ids_len;
           *idx = i;
@@ -2847,6 +3597,11 @@ void write_cfile(FILE *f, list_t *hd)
 
   hddb_init(&hddb, hd);
 
+  pos_index_free(&hddb_index.str);
+  pos_index_free(&hddb_index.id);
+  pos_index_free(&hddb_index.id2);
+  hddb_index.id_len = hddb_index.id2_len = 0;
+
   fprintf(logfh, "  db size: %u bytes\n",
     (unsigned) (sizeof hddb +
     hddb.strings_len +
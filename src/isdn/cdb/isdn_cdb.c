@@ -15,7 +15,7 @@ static int WriteVendors(FILE *f) {
 	int i;
 
 	fprintf(f, "/* vendor database */\n");
-	fprintf(f,"static cdb_isdn_vendor cdb_isdnvendor_info_init[] = {\n");
+	fprintf(f,"static const cdb_isdn_vendor cdb_isdnvendor_info_init[] = {\n");
 	for (i=0; i < ivendor_idx; i++) {
 		fprintf(f,"	{");
 		if (vendors[i].name)
@@ -38,7 +38,7 @@ static int WriteCards(FILE *f) {
 	int i;
 
 	fprintf(f, "/* card database */\n");
-	fprintf(f,"static cdb_isdn_card cdb_isdncard_info_init[] = {\n");
+	fprintf(f,"static const cdb_isdn_card cdb_isdncard_info_init[] = {\n");
 	for (i=0; i <= ce_idx; i++) {
 		fprintf(f,"	{");
 		fprintf(f,"%d,",cards[i].handle);
@@ -71,7 +71,7 @@ static int WriteCards(FILE *f) {
 		fprintf(f,"},\n");
 	}
 	fprintf(f,"};\n");
-	fprintf(f,"static int cdb_isdncard_idsorted_init[] = {");
+	fprintf(f,"static const int cdb_isdncard_idsorted_init[] = {");
 	for (i=0; i < ce_idx; i++) {
 		if (!(i%8))
 			fprintf(f,"\n	");
@@ -85,7 +85,7 @@ static int WriteVarios(FILE *f) {
 	int i;
 
 	fprintf(f, "/* driver database */\n");
-	fprintf(f,"static cdb_isdn_vario cdb_isdnvario_info_init[] = {\n");
+	fprintf(f,"static const cdb_isdn_vario cdb_isdnvario_info_init[] = {\n");
 	for (i=0; i <= vario_idx; i++) {
 		fprintf(f,"	{");
 		fprintf(f,"%d,",varios[i].handle);
@@ -220,13 +220,13 @@ char **argv;
 	SortVarios();
 	
 	fprintf(stdout, "/* CDBISDN database */\n");
-	fprintf(stdout,"const int  CDBISDN_DBVERSION = 0x%x;\n", CDB_DATAVERSION);
+	fprintf(stdout,"#define CDBISDN_DBVERSION\t0x%x\n", CDB_DATAVERSION);
 	time(&tim);
 	strcpy(line,ctime(&tim));
 	l = strlen(line);
 	if (l)
 		line[l-1] = 0;
-	fprintf(stdout,"const char CDBISDN_DATE[]  = \"%s\";\n", line); 
+	fprintf(stdout,"#define CDBISDN_DATE\t\t\"%s\"\n", line); 
 	WriteVendors(stdout);
 	WriteCards(stdout);
 	WriteVarios(stdout);
@@ -13,37 +13,74 @@
 #include "cdb/isdn_cdb.h"
 #include "cdb/cdb_hwdb.h"
 
-static int		CDBISDN_vendor_cnt;
-static int		CDBISDN_card_cnt;
-static int		CDBISDN_vario_cnt;
-static int		CDBISDN_name_size;
-static char		*CDBISDN_names;
+/*
+ * The database: either read from CDBISDN_HWDB_FILE or the built-in one.
+ *
+ * It's set up once and never changed afterwards, so lookups need no locking.
+ */
+typedef struct {
+	int			vendor_cnt;
+	int			card_cnt;
+	int			vario_cnt;
+	const cdb_isdn_vendor	*vendor;
+	const cdb_isdn_card	*card;
+	const int		*idsorted;
+	const cdb_isdn_vario	*vario;
+	int			dbversion;
+	char			date[32];
+	char			*names;		/* strings, if read from file */
+} cdb_isdn_db;
 
-static cdb_isdn_vendor	*cdb_isdnvendor_info;
-static cdb_isdn_card	*cdb_isdncard_info;
-static int 		*cdb_isdncard_idsorted;
-static cdb_isdn_vario	*cdb_isdnvario_info;
-static int		cdb_dbversion;
-static char		cdb_date[32];
+static const cdb_isdn_db	cdb_builtin_db = {
+	.vendor_cnt	= sizeof(cdb_isdnvendor_info_init) / sizeof(cdb_isdn_vendor),
+	.card_cnt	= (sizeof(cdb_isdncard_info_init) / sizeof(cdb_isdn_card)) - 1,
+	.vario_cnt	= (sizeof(cdb_isdnvario_info_init) / sizeof(cdb_isdn_vario)) - 1,
+	.vendor		= cdb_isdnvendor_info_init,
+	.card		= cdb_isdncard_info_init,
+	.idsorted	= cdb_isdncard_idsorted_init,
+	.vario		= cdb_isdnvario_info_init,
+	.dbversion	= CDBISDN_DBVERSION,
+	.date		= CDBISDN_DATE,
+};
 
-static char		line[1024];
+static const cdb_isdn_db	*cdb_db;
 
-static int		CDBISDN_readhwdb;
+static void
+free_cdbisdn(cdb_isdn_db *db)
+{
+	free(db->names);
+	free((void *) db->vendor);
+	free((void *) db->card);
+	free((void *) db->idsorted);
+	free((void *) db->vario);
+	free(db);
+}
 
-static int
-init_cdbisdn(void)
+/* returns NULL if there's no (valid) CDBISDN_HWDB_FILE */
+static cdb_isdn_db *
+read_cdbisdn(void)
 {
 	FILE	*cdb;
-	char	*s, *p = NULL;
-	int	rectyp, l, cnt = 0, icnt = 0;
+	char	*s, *p = NULL, line[1024];
+	int	rectyp, l, cnt = 0, icnt = 0, ok = 0;
+	int	CDBISDN_name_size = 0;
+	char	*CDBISDN_names = NULL;
+	cdb_isdn_db	*db;
+	cdb_isdn_vendor	*cdb_isdnvendor_info = NULL;
+	cdb_isdn_card	*cdb_isdncard_info = NULL;
+	int	*cdb_isdncard_idsorted = NULL;
+	cdb_isdn_vario	*cdb_isdnvario_info = NULL;
 
 	cdb = fopen(CDBISDN_HWDB_FILE, "rb");
 	if (!cdb) {
 		debprintf("open failure %s\n", CDBISDN_HWDB_FILE);
-		goto fallback;
+		return(NULL);
 	}
+	db = calloc(1, sizeof(*db));
+	if (!db)
+		goto fallback_close;
 	while (!feof(cdb)) {
-		s = fgets(line, 1024, cdb);
+		s = fgets(line, sizeof(line), cdb);
 		if (!s)
 			break;
 		if (!s[0] || s[0] == '!' || s[0] == '#' || s[0] == '\n') 
@@ -55,7 +92,7 @@ init_cdbisdn(void)
 		sscanf(s, "$%d", &rectyp);
 		switch(rectyp) {
 			case IWHREC_TYPE_VERSION:
-				sscanf(s + 4, "%d", &cdb_dbversion);
+				sscanf(s + 4, "%d", &db->dbversion);
 				break;
 			case IWHREC_TYPE_DATE:
 				l = strlen(s + 4);
@@ -64,11 +101,13 @@ init_cdbisdn(void)
 				l--;
 				if (l > 31)
 					l = 31;
-				strncpy(cdb_date, s + 4, l);
-				cdb_date[l] = 0;
+				strncpy(db->date, s + 4, l);
+				db->date[l] = 0;
 				break;
 			case IWHREC_TYPE_NAME_SIZE:
 				sscanf(s + 4, "%d", &CDBISDN_name_size);
+				if (CDBISDN_names)
+					goto fallback_close;
 				CDBISDN_names = calloc(CDBISDN_name_size + 1, 1);
 				if (!CDBISDN_names) {
 					debprintf("fail to allocate %d bytes for CDBISDN_names\n", CDBISDN_name_size);
@@ -98,17 +137,19 @@ init_cdbisdn(void)
 					goto fallback_close;
 				break;
 			case IWHREC_TYPE_VENDOR_COUNT:
-				sscanf(s + 4, "%d", &CDBISDN_vendor_cnt);
-				cdb_isdnvendor_info = calloc(CDBISDN_vendor_cnt, sizeof(cdb_isdn_vendor));
+				if (cdb_isdnvendor_info)
+					goto fallback_close;
+				sscanf(s + 4, "%d", &db->vendor_cnt);
+				cdb_isdnvendor_info = calloc(db->vendor_cnt, sizeof(cdb_isdn_vendor));
 				if (!cdb_isdnvendor_info) {
-					debprintf("fail to allocate %d vendor structs\n", CDBISDN_vendor_cnt);
+					debprintf("fail to allocate %d vendor structs\n", db->vendor_cnt);
 					goto fallback_close;
 				}
 				cnt = 0;
 				break;
 			case IWHREC_TYPE_VENDOR_RECORD:
-				if (cnt >= CDBISDN_vendor_cnt) {
-					debprintf("vendor overflow %d/%d\n", cnt, CDBISDN_vendor_cnt);
+				if (!cdb_isdnvendor_info || !CDBISDN_names || cnt >= db->vendor_cnt) {
+					debprintf("vendor overflow %d/%d\n", cnt, db->vendor_cnt);
 					goto fallback_close;
 				}
 				l = sscanf(s + 4, "%p %p %d %d",
@@ -125,19 +166,21 @@ init_cdbisdn(void)
 				cnt++;
 				break;
 			case IWHREC_TYPE_CARD_COUNT:
-				sscanf(s + 4, "%d", &CDBISDN_card_cnt);
-				cdb_isdncard_info = calloc(CDBISDN_card_cnt + 1, sizeof(cdb_isdn_card));
-				cdb_isdncard_idsorted = calloc(CDBISDN_card_cnt, sizeof(int));
+				if (cdb_isdncard_info)
+					goto fallback_close;
+				sscanf(s + 4, "%d", &db->card_cnt);
+				cdb_isdncard_info = calloc(db->card_cnt + 1, sizeof(cdb_isdn_card));
+				cdb_isdncard_idsorted = calloc(db->card_cnt, sizeof(int));
 				if (!cdb_isdncard_info || !cdb_isdncard_idsorted) {
-					debprintf("fail to allocate %d vendor structs\n", CDBISDN_card_cnt);
+					debprintf("fail to allocate %d vendor structs\n", db->card_cnt);
 					goto fallback_close;
 				}
 				cnt = 0;
 				icnt = 0;
 				break;
 			case IWHREC_TYPE_CARD_RECORD:
-				if (cnt > CDBISDN_card_cnt) {
-					debprintf("card overflow %d/%d\n", cnt, CDBISDN_card_cnt);
+				if (!cdb_isdncard_info || !CDBISDN_names || cnt > db->card_cnt) {
+					debprintf("card overflow %d/%d\n", cnt, db->card_cnt);
 					goto fallback_close;
 				}
 				l = sscanf(s + 4, "%d %d %p %p %p %p %d %d %d %d %d %d %d %d %d",
@@ -167,25 +210,27 @@ init_cdbisdn(void)
 				cnt++;
 				break;
 			case IWHREC_TYPE_CARD_IDSORTED:
-				if (icnt >= CDBISDN_card_cnt) {
-					debprintf("card overflow %d/%d\n", icnt, CDBISDN_card_cnt);
+				if (!cdb_isdncard_idsorted || icnt >= db->card_cnt) {
+					debprintf("card overflow %d/%d\n", icnt, db->card_cnt);
 					goto fallback_close;
 				}
 				sscanf(s + 4, "%d", &cdb_isdncard_idsorted[icnt]);
 				icnt++;
 				break;
 			case IWHREC_TYPE_VARIO_COUNT:
-				sscanf(s + 4, "%d", &CDBISDN_vario_cnt);
-				cdb_isdnvario_info = calloc(CDBISDN_vario_cnt+1, sizeof(cdb_isdn_vario));
+				if (cdb_isdnvario_info)
+					goto fallback_close;
+				sscanf(s + 4, "%d", &db->vario_cnt);
+				cdb_isdnvario_info = calloc(db->vario_cnt+1, sizeof(cdb_isdn_vario));
 				if (!cdb_isdnvario_info) {
-					debprintf("fail to allocate %d vario structs\n", CDBISDN_vario_cnt);
+					debprintf("fail to allocate %d vario structs\n", db->vario_cnt);
 					goto fallback_close;
 				}
 				cnt = 0;
 				break;
 			case IWHREC_TYPE_VARIO_RECORD:
-				if (cnt > CDBISDN_vario_cnt) {
-					debprintf("vario overflow %d/%d\n", cnt, CDBISDN_vario_cnt);
+				if (!cdb_isdnvario_info || !CDBISDN_names || cnt > db->vario_cnt) {
+					debprintf("vario overflow %d/%d\n", cnt, db->vario_cnt);
 					goto fallback_close;
 				}
 				l = sscanf(s + 4, "%d %d %d %d %d %d %p %p %p %p %p %p %p %p %p %p %p %p %p %p %d %p",
@@ -237,35 +282,61 @@ init_cdbisdn(void)
 				break;
 		}
 	}
-	fclose(cdb);
-	if (CDBISDN_name_size == 0 ||
-		CDBISDN_vendor_cnt == 0 ||
-		CDBISDN_card_cnt == 0 ||
-		CDBISDN_vario_cnt == 0)
-		goto fallback;
-	debprintf("successfull reading %s\n", CDBISDN_HWDB_FILE);
-	CDBISDN_readhwdb = 1;	
-	return(0);
+	ok = 1;
 fallback_close:
 	fclose(cdb);
-fallback:
-	debprintf("error reading %s\n", CDBISDN_HWDB_FILE);
-	CDBISDN_vendor_cnt = (sizeof(cdb_isdnvendor_info_init) / sizeof(cdb_isdn_vendor));
-	CDBISDN_card_cnt = ((sizeof(cdb_isdncard_info_init) / sizeof(cdb_isdn_card)) -1);
-	CDBISDN_vario_cnt = ((sizeof(cdb_isdnvario_info_init) / sizeof(cdb_isdn_vario))-1);
-	cdb_isdnvendor_info = cdb_isdnvendor_info_init;
-	cdb_isdncard_info = cdb_isdncard_info_init;
-	cdb_isdncard_idsorted = cdb_isdncard_idsorted_init;
-	cdb_isdnvario_info = cdb_isdnvario_info_init;
-	cdb_dbversion = CDBISDN_DBVERSION;
-	strncpy(cdb_date, CDBISDN_DATE, 31);
-	CDBISDN_readhwdb = 1;
-	return(1);
+	if (!db)
+		return(NULL);
+	db->names = CDBISDN_names;
+	db->vendor = cdb_isdnvendor_info;
+	db->card = cdb_isdncard_info;
+	db->idsorted = cdb_isdncard_idsorted;
+	db->vario = cdb_isdnvario_info;
+	if (!ok ||
+		CDBISDN_name_size == 0 ||
+		db->vendor_cnt == 0 ||
+		db->card_cnt == 0 ||
+		db->vario_cnt == 0 ||
+		!db->vendor || !db->card || !db->idsorted || !db->vario) {
+		debprintf("error reading %s\n", CDBISDN_HWDB_FILE);
+		free_cdbisdn(db);
+		return(NULL);
+	}
+	debprintf("successfull reading %s\n", CDBISDN_HWDB_FILE);
+	return(db);
+}
+
+/*
+ * Get the database; the first caller sets it up.
+ *
+ * Concurrent first callers might both read the file; only one result is
+ * kept.
+ */
+static const cdb_isdn_db *
+get_cdbisdn(void)
+{
+	const cdb_isdn_db	*db, *expected = NULL;
+	cdb_isdn_db		*new_db;
+
+	db = __atomic_load_n(&cdb_db, __ATOMIC_ACQUIRE);
+	if (db)
+		return(db);
+
+	new_db = read_cdbisdn();
+	db = new_db ? new_db : &cdb_builtin_db;
+
+	if (!__atomic_compare_exchange_n(&cdb_db, &expected, db, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		/* someone else was faster */
+		if (new_db)
+			free_cdbisdn(new_db);
+		db = expected;
+	}
+	return(db);
 }
 
 typedef int (*fcmp) (const void *, const void *);
 
-static int compare_type(cdb_isdn_vario *v1, cdb_isdn_vario *v2) {
+static int compare_type(const cdb_isdn_vario *v1, const cdb_isdn_vario *v2) {
 	int x= v1->typ - v2->typ;
 
 	if (!x)
@@ -273,51 +344,75 @@ static int compare_type(cdb_isdn_vario *v1, cdb_isdn_vario *v2) {
 	return(x);
 }
 
-static int compare_id(const int *c1, const int *c2) {
-	int x= cdb_isdncard_info[*c1].vendor - cdb_isdncard_info[*c2].vendor;
+static int compare_id(const cdb_isdn_card *c1, const cdb_isdn_card *c2) {
+	int x= c1->vendor - c2->vendor;
 
 	if (!x)
-		x=cdb_isdncard_info[*c1].device - cdb_isdncard_info[*c2].device;
+		x=c1->device - c2->device;
 	if (!x)
-		x=cdb_isdncard_info[*c1].subvendor - cdb_isdncard_info[*c2].subvendor;
+		x=c1->subvendor - c2->subvendor;
 	if (!x)
-		x=cdb_isdncard_info[*c1].subdevice - cdb_isdncard_info[*c2].subdevice;
+		x=c1->subdevice - c2->subdevice;
 	return(x);
 }
 
+/*
+ * Search db->idsorted for a card matching key (same as bsearch(), but
+ * the compared items are the cards the entries point to).
+ */
+static const cdb_isdn_card *find_card(const cdb_isdn_db *db, const cdb_isdn_card *key) {
+	size_t	l = 0, u = db->card_cnt, idx;
+	int	x;
+
+	while (l < u) {
+		idx = (l + u) / 2;
+		x = compare_id(key, &db->card[db->idsorted[idx]]);
+		if (x < 0)
+			u = idx;
+		else if (x > 0)
+			l = idx + 1;
+		else {
+			debprintf("ret idx %d\n", db->idsorted[idx]);
+			if (db->idsorted[idx] <= 0 || db->idsorted[idx] > db->card_cnt)
+				return(NULL);
+			return(&db->card[db->idsorted[idx]]);
+		}
+	}
+	return(NULL);
+}
+
 /* interface */
 
 cdb_isdn_vendor	*hd_cdbisdn_get_vendor(int handle)
 {
-	if (!CDBISDN_readhwdb)
-		init_cdbisdn();
+	const cdb_isdn_db *db = get_cdbisdn();
+
 	if (handle<0)
 		return(NULL);
-	if ((unsigned)handle >= CDBISDN_vendor_cnt)
+	if (handle >= db->vendor_cnt)
 		return(NULL);
-	return(&cdb_isdnvendor_info[handle]);
+	return((cdb_isdn_vendor *) &db->vendor[handle]);
 }
 
 cdb_isdn_card	*hd_cdbisdn_get_card(int handle)
 {
-	if (!CDBISDN_readhwdb)
-		init_cdbisdn();
+	const cdb_isdn_db *db = get_cdbisdn();
+
 	if (handle<=0)
 		return(NULL);
-	if ((unsigned) handle>CDBISDN_card_cnt)
+	if (handle>db->card_cnt)
 		return(NULL);
-	return(&cdb_isdncard_info[handle]);
+	return((cdb_isdn_card *) &db->card[handle]);
 }
 
 cdb_isdn_vario	*hd_cdbisdn_get_vario_from_type(int typ, int subtyp)
 {
+	const cdb_isdn_db *db = get_cdbisdn();
 	cdb_isdn_vario key, *ret;
-	
-	if (!CDBISDN_readhwdb)
-		CDBISDN_readhwdb = init_cdbisdn();
+
 	key.typ = typ;
 	key.subtyp = subtyp;
-	if (!(ret=bsearch(&key, &cdb_isdnvario_info[1], CDBISDN_vario_cnt, sizeof(cdb_isdn_vario), (fcmp)compare_type))) {
+	if (!(ret=bsearch(&key, &db->vario[1], db->vario_cnt, sizeof(cdb_isdn_vario), (fcmp)compare_type))) {
 		debprintf("ret NULL\n");
 		return(NULL);
 	}
@@ -326,75 +421,61 @@ cdb_isdn_vario	*hd_cdbisdn_get_vario_from_type(int typ, int subtyp)
 
 cdb_isdn_card	*hd_cdbisdn_get_card_from_type(int typ, int subtyp)
 {
+	const cdb_isdn_db *db = get_cdbisdn();
 	cdb_isdn_vario	*civ;
-	
-	if (!CDBISDN_readhwdb)
-		init_cdbisdn();
+
 	civ = hd_cdbisdn_get_vario_from_type(typ, subtyp);
 	if (civ) {
-		if (civ->card_ref > 0)
-			return(&cdb_isdncard_info[civ->card_ref]);
+		if (civ->card_ref > 0 && civ->card_ref <= db->card_cnt)
+			return((cdb_isdn_card *) &db->card[civ->card_ref]);
 	}
 	return(NULL);
 }
 
 cdb_isdn_card	*hd_cdbisdn_get_card_from_id(int vendor, int device, int subvendor, int subdevice)
 {
-	int key, *ret;	
-
-	if (!CDBISDN_readhwdb)
-		init_cdbisdn();
-	key = 0;
-	cdb_isdncard_info[key].vendor = vendor;
-	cdb_isdncard_info[key].device = device;
-	cdb_isdncard_info[key].subvendor = subvendor;
-	cdb_isdncard_info[key].subdevice = subdevice;
-	if (!(ret=bsearch(&key, cdb_isdncard_idsorted, CDBISDN_card_cnt, sizeof(int), (fcmp)compare_id))) {
+	const cdb_isdn_db *db = get_cdbisdn();
+	const cdb_isdn_card *ret;
+	cdb_isdn_card key;
+
+	key.vendor = vendor;
+	key.device = device;
+	key.subvendor = subvendor;
+	key.subdevice = subdevice;
+	if (!(ret = find_card(db, &key))) {
 		debprintf("bs1 ret NULL\n");
-		key = 0;
-		cdb_isdncard_info[key].subvendor = PCI_ANY_ID;
-		cdb_isdncard_info[key].subdevice = PCI_ANY_ID;
-		if (!(ret=bsearch(&key, cdb_isdncard_idsorted, CDBISDN_card_cnt, sizeof(int), (fcmp)compare_id))) {
+		key.subvendor = PCI_ANY_ID;
+		key.subdevice = PCI_ANY_ID;
+		if (!(ret = find_card(db, &key))) {
 			debprintf("bs2 ret NULL\n");
 			return(NULL);
 		}
 	}
-	debprintf("ret idx %d\n", *ret);
-	if (*ret <= 0)
-		return(NULL);
-	if ((unsigned) *ret > CDBISDN_card_cnt)
-		return(NULL);
-	return(&cdb_isdncard_info[*ret]);
+	return((cdb_isdn_card *) ret);
 }
 
 cdb_isdn_vario *hd_cdbisdn_get_vario(int handle)
 {
-	if (!CDBISDN_readhwdb)
-		init_cdbisdn();
+	const cdb_isdn_db *db = get_cdbisdn();
+
 	if (handle<=0)
 		return(NULL);
-	if ((unsigned) handle > CDBISDN_vario_cnt)
+	if (handle > db->vario_cnt)
 		return(NULL);
-	return(&cdb_isdnvario_info[handle]);
+	return((cdb_isdn_vario *) &db->vario[handle]);
 }
 
 int	hd_cdbisdn_get_version(void)
 {
-	if (!CDBISDN_readhwdb)
-		init_cdbisdn();
 	return(CDBISDN_VERSION);
 }
 
 int	hd_cdbisdn_get_db_version(void)
 {
-	if (!CDBISDN_readhwdb)
-		init_cdbisdn();
-	return(cdb_dbversion);
+	return(get_cdbisdn()->dbversion);
 }
 
 char	*hd_cdbisdn_get_db_date(void)
 {
-	if (!CDBISDN_readhwdb)
-		init_cdbisdn();
-	return(cdb_date);
+	return((char *) get_cdbisdn()->date);
 }